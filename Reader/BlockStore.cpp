@@ -0,0 +1,462 @@
+#include "BlockStore.h"
+#include "TextDecode.h"
+#include "zlib.h"
+#include <algorithm>
+#include <unordered_set>
+#ifndef _WIN32
+#include <sys/mman.h>
+#endif
+
+#define DISCARD_PAGE_SIZE       4096
+
+struct stored_block_t
+{
+    u32 crc;
+    u32 size;
+    char *data;
+};
+
+BlockStore::BlockStore()
+    : m_Inflated(0)
+    , m_Clock(0)
+    , m_Length(0)
+{
+    InitializeCriticalSection(&m_Lock);
+}
+
+BlockStore::~BlockStore()
+{
+    Clear();
+    DeleteCriticalSection(&m_Lock);
+}
+
+BOOL BlockStore::Load(const char *data, int size, TCHAR **text, int *length)
+{
+    const ol_text_t *head = (const ol_text_t *)data;
+    const ol_block_t *blocks;
+    const ol_block_t *b;
+    std::unordered_map<u64, stored_block_t*>::iterator it;
+    stored_block_t *sb;
+    loaded_block_t lb;
+    TCHAR *buf = NULL;
+    u32 cursor = 0;
+    u32 i;
+    u64 key;
+
+    Clear();
+    if (size < (int)sizeof(ol_text_t) || head->magic != OL_TEXT_MAGIC || head->length > (u32)TEXT_MAX_LENGTH)
+        return FALSE;
+    if (head->block_count > (size - sizeof(ol_text_t)) / sizeof(ol_block_t))
+        return FALSE;
+    blocks = (const ol_block_t *)(head + 1);
+
+    // left as it is, the pages of a block are not touched before it is read
+    buf = (TCHAR *)malloc(((size_t)head->length + 1) * sizeof(TCHAR));
+    if (!buf)
+        return FALSE;
+
+    EnterCriticalSection(&m_Lock);
+    for (i = 0; i < head->block_count; i++)
+    {
+        b = &blocks[i];
+        if (b->offset != cursor || b->length > head->length - cursor
+            || b->data_offset > (u32)size || b->data_size > (u32)size - b->data_offset)
+            goto fail;
+        cursor += b->length;
+
+        // the same data is the same text, another one of the same crc takes the next key
+        key = ((u64)b->crc << 32) | b->length;
+        while ((it = m_Blocks.find(key)) != m_Blocks.end()
+            && (it->second->size != b->data_size || memcmp(it->second->data, data + b->data_offset, b->data_size)))
+            key++;
+        lb.offset = b->offset;
+        lb.length = b->length;
+        lb.key = key;
+        lb.used = 0;
+        m_Loaded.push_back(lb);
+
+        // inflated from here, and written again as is by the next save
+        if (it != m_Blocks.end())
+            continue;
+        sb = new stored_block_t;
+        sb->crc = b->crc;
+        sb->size = b->data_size;
+        sb->data = (char *)malloc(b->data_size);
+        if (!sb->data)
+        {
+            delete sb;
+            goto fail;
+        }
+        memcpy(sb->data, data + b->data_offset, b->data_size);
+        m_Blocks[key] = sb;
+    }
+    if (cursor != head->length)
+        goto fail;
+    LeaveCriticalSection(&m_Lock);
+
+    buf[head->length] = 0;
+    *text = buf;
+    *length = (int)head->length;
+    return TRUE;
+
+fail:
+    LeaveCriticalSection(&m_Lock);
+    free(buf);
+    Clear();
+    return FALSE;
+}
+
+BOOL BlockStore::Read(TCHAR *text, int start, int length, BOOL evict)
+{
+    std::vector<loaded_block_t>::iterator it;
+    loaded_block_t *lb;
+    u32 first;
+    size_t i;
+    BOOL ret = TRUE;
+
+    if (!text || length <= 0)
+        return TRUE;
+    if (start < 0)
+    {
+        length += start;
+        start = 0;
+    }
+
+    EnterCriticalSection(&m_Lock);
+    first = m_Clock + 1;
+
+    // from the block holding start on
+    it = std::upper_bound(m_Loaded.begin(), m_Loaded.end(), (u32)start,
+        [](u32 offset, const loaded_block_t &b) { return offset < b.offset; });
+    i = it == m_Loaded.begin() ? 0 : (it - m_Loaded.begin()) - 1;
+    for (; i < m_Loaded.size() && (int)m_Loaded[i].offset < start + length; i++)
+    {
+        lb = &m_Loaded[i];
+        if (lb->offset + lb->length <= (u32)start)
+            continue;
+        if (lb->used == 0)
+        {
+            if (!Inflate(lb->key, text + lb->offset, lb->length))
+                ret = FALSE;
+            m_Inflated++;
+        }
+        lb->used = ++m_Clock;
+    }
+
+    // the text being drawn is not locked, so only its own thread gives pages back
+    if (evict)
+        Evict(text, first);
+    LeaveCriticalSection(&m_Lock);
+    return ret;
+}
+
+void BlockStore::Insert(TCHAR *text, int offset, int length)
+{
+    size_t i;
+
+    EnterCriticalSection(&m_Lock);
+    for (i = 0; i < m_Loaded.size(); i++)
+    {
+        if (m_Loaded[i].offset >= (u32)offset)
+            m_Loaded[i].offset += length;
+        // moved pages of a block not inflated are of no use either
+        if (m_Loaded[i].used == 0)
+            Discard(text + m_Loaded[i].offset, m_Loaded[i].length * sizeof(TCHAR));
+    }
+    LeaveCriticalSection(&m_Lock);
+}
+
+void BlockStore::GetDeflated(std::vector<loaded_block_t> &blocks)
+{
+    size_t i;
+
+    blocks.clear();
+    EnterCriticalSection(&m_Lock);
+    for (i = 0; i < m_Loaded.size(); i++)
+    {
+        if (m_Loaded[i].used == 0)
+            blocks.push_back(m_Loaded[i]);
+    }
+    LeaveCriticalSection(&m_Lock);
+}
+
+BOOL BlockStore::Pack(TCHAR *text, int length, std::vector<int> &cuts, std::vector<loaded_block_t> &deflated)
+{
+    std::unordered_set<u64> used;
+    std::unordered_map<u64, stored_block_t*>::iterator it;
+    stored_block_t *sb, *other;
+    ol_block_t block;
+    uLongf bound;
+    u64 key;
+    size_t i, j = 0, k;
+    int deflated_count = 0;
+    BOOL ret = TRUE;
+
+    m_Index.clear();
+    m_Order.clear();
+    m_Length = 0;
+
+    // a block from each cut to the next one
+    cuts.push_back(0);
+    cuts.push_back(length);
+    std::sort(cuts.begin(), cuts.end());
+    cuts.erase(std::unique(cuts.begin(), cuts.end()), cuts.end());
+
+    for (i = 0; i + 1 < cuts.size(); i++)
+    {
+        if (cuts[i] < 0 || cuts[i + 1] > length)
+            continue;
+        memset(&block, 0, sizeof(ol_block_t));
+        block.offset = cuts[i];
+        block.length = cuts[i + 1] - cuts[i];
+
+        // a block not inflated when the text was copied is taken as it is, one
+        // that is not a whole chapter any more is inflated into the copy first
+        sb = NULL;
+        while (j < deflated.size() && deflated[j].offset + deflated[j].length <= block.offset)
+            j++;
+        EnterCriticalSection(&m_Lock);
+        if (j < deflated.size() && deflated[j].offset == block.offset && deflated[j].length == block.length)
+        {
+            key = deflated[j].key;
+            if ((it = m_Blocks.find(key)) != m_Blocks.end())
+                sb = it->second;
+            LeaveCriticalSection(&m_Lock);
+            // the store was cleared since the copy, there is nothing to take it from
+            if (!sb)
+            {
+                ret = FALSE;
+                break;
+            }
+        }
+        else
+        {
+            for (k = j; k < deflated.size() && deflated[k].offset < block.offset + block.length; k++)
+            {
+                if (deflated[k].offset + deflated[k].length <= (u32)length)
+                    Inflate(deflated[k].key, text + deflated[k].offset, deflated[k].length);
+            }
+            key = Find(Key(text + block.offset, block.length), text + block.offset, block.length, &sb);
+            LeaveCriticalSection(&m_Lock);
+        }
+
+        if (!sb)
+        {
+            bound = compressBound(block.length * sizeof(TCHAR));
+            sb = new stored_block_t;
+            sb->crc = (u32)(key >> 32);
+            sb->data = (char *)malloc(bound);
+            if (!sb->data || Z_OK != compress2((Bytef *)sb->data, &bound, (const Bytef *)(text + block.offset), block.length * sizeof(TCHAR), Z_DEFAULT_COMPRESSION))
+            {
+                if (sb->data)
+                    free(sb->data);
+                delete sb;
+                ret = FALSE;
+                break;
+            }
+            sb->size = (u32)bound;
+            sb->data = (char *)realloc(sb->data, bound);
+            deflated_count++;
+
+            // the key is looked for again, a load may have taken it meanwhile
+            EnterCriticalSection(&m_Lock);
+            key = Find(Key(text + block.offset, block.length), text + block.offset, block.length, &other);
+            if (other)
+            {
+                free(sb->data);
+                delete sb;
+                sb = other;
+            }
+            else
+            {
+                m_Blocks[key] = sb;
+            }
+            LeaveCriticalSection(&m_Lock);
+        }
+        block.crc = sb->crc;
+        used.insert(key);
+        m_Index.push_back(block);
+        m_Order.push_back(sb);
+    }
+
+    EnterCriticalSection(&m_Lock);
+    // still read from here, while not inflated
+    for (i = 0; i < m_Loaded.size(); i++)
+        used.insert(m_Loaded[i].key);
+    // chapters gone from the text
+    for (it = m_Blocks.begin(); it != m_Blocks.end(); )
+    {
+        if (used.find(it->first) == used.end())
+        {
+            free(it->second->data);
+            delete it->second;
+            it = m_Blocks.erase(it);
+        }
+        else
+        {
+            it++;
+        }
+    }
+    LeaveCriticalSection(&m_Lock);
+    if (!ret)
+    {
+        m_Index.clear();
+        m_Order.clear();
+        return FALSE;
+    }
+    m_Length = length;
+
+    logger_printk("text=%d bytes, blocks=%d, deflated=%d", (int)(length * sizeof(TCHAR)), (int)m_Index.size(), deflated_count);
+    return TRUE;
+}
+
+BOOL BlockStore::Write(FILE *fp)
+{
+    ol_text_t head;
+    u32 data_offset;
+    size_t i;
+
+    head.magic = OL_TEXT_MAGIC;
+    head.block_count = (u32)m_Index.size();
+    head.length = m_Length;
+    head.reserve = 0;
+    data_offset = sizeof(ol_text_t) + (u32)(sizeof(ol_block_t) * m_Index.size());
+    for (i = 0; i < m_Index.size(); i++)
+    {
+        m_Index[i].data_offset = data_offset;
+        m_Index[i].data_size = m_Order[i]->size;
+        data_offset += m_Order[i]->size;
+    }
+
+    if (1 != fwrite(&head, sizeof(ol_text_t), 1, fp))
+        return FALSE;
+    if (!m_Index.empty() && m_Index.size() != fwrite(&m_Index[0], sizeof(ol_block_t), m_Index.size(), fp))
+        return FALSE;
+    for (i = 0; i < m_Order.size(); i++)
+    {
+        if (1 != fwrite(m_Order[i]->data, m_Order[i]->size, 1, fp))
+            return FALSE;
+    }
+
+    logger_printk("text=%d bytes, stored=%u bytes", (int)(m_Length * sizeof(TCHAR)), data_offset);
+    return TRUE;
+}
+
+void BlockStore::Clear(void)
+{
+    EnterCriticalSection(&m_Lock);
+    ReleaseBlocks();
+    m_Loaded.clear();
+    m_Inflated = 0;
+    m_Clock = 0;
+    LeaveCriticalSection(&m_Lock);
+    m_Index.clear();
+    m_Order.clear();
+    m_Length = 0;
+}
+
+int BlockStore::GetInflatedCount(void)
+{
+    return m_Inflated;
+}
+
+BOOL BlockStore::Inflate(u64 key, TCHAR *text, u32 length)
+{
+    std::unordered_map<u64, stored_block_t*>::iterator it;
+    uLongf out = length * sizeof(TCHAR);
+    u32 i;
+
+    it = m_Blocks.find(key);
+    if (it != m_Blocks.end()
+        && Z_OK == uncompress((Bytef *)text, &out, (const Bytef *)it->second->data, it->second->size)
+        && out == length * sizeof(TCHAR))
+        return TRUE;
+
+    // a damaged block reads as blanks, the rest of the book is still fine
+    logger_printk("block %llx: inflate failed", key);
+    for (i = 0; i < length; i++)
+        text[i] = L' ';
+    return FALSE;
+}
+
+// the block holding the same text, or the first free key from the crc and
+// length on; a crc match alone is not the same text
+u64 BlockStore::Find(u64 key, const TCHAR *text, u32 length, stored_block_t **block)
+{
+    std::unordered_map<u64, stored_block_t*>::iterator it;
+    uLongf out;
+    TCHAR *buf;
+
+    *block = NULL;
+    buf = (TCHAR *)malloc(length * sizeof(TCHAR) + 1);
+    for (; (it = m_Blocks.find(key)) != m_Blocks.end(); key++)
+    {
+        out = length * sizeof(TCHAR);
+        if (buf && Z_OK == uncompress((Bytef *)buf, &out, (const Bytef *)it->second->data, it->second->size)
+            && out == length * sizeof(TCHAR) && 0 == memcmp(buf, text, out))
+        {
+            *block = it->second;
+            break;
+        }
+    }
+    free(buf);
+    return key;
+}
+
+void BlockStore::Evict(TCHAR *text, u32 first)
+{
+    loaded_block_t *oldest;
+    size_t i;
+
+    // the blocks of the read that asked stay, even if there are more of them
+    while (m_Inflated > BLOCK_CACHE_COUNT)
+    {
+        oldest = NULL;
+        for (i = 0; i < m_Loaded.size(); i++)
+        {
+            if (m_Loaded[i].used != 0 && (!oldest || m_Loaded[i].used < oldest->used))
+                oldest = &m_Loaded[i];
+        }
+        if (!oldest || oldest->used >= first)
+            break;
+        Discard(text + oldest->offset, oldest->length * sizeof(TCHAR));
+        oldest->used = 0;
+        m_Inflated--;
+    }
+}
+
+void BlockStore::ReleaseBlocks(void)
+{
+    std::unordered_map<u64, stored_block_t*>::iterator it;
+
+    for (it = m_Blocks.begin(); it != m_Blocks.end(); it++)
+    {
+        free(it->second->data);
+        delete it->second;
+    }
+    m_Blocks.clear();
+}
+
+void BlockStore::Discard(void *data, size_t size)
+{
+    uintptr_t begin = ((uintptr_t)data + DISCARD_PAGE_SIZE - 1) & ~(uintptr_t)(DISCARD_PAGE_SIZE - 1);
+    uintptr_t end = ((uintptr_t)data + size) & ~(uintptr_t)(DISCARD_PAGE_SIZE - 1);
+
+    // only whole pages inside the block, the heap keeps nothing of its own
+    // there; the memory stays committed, reads as zeros or garbage until the
+    // next inflate writes it again
+    if (end <= begin)
+        return;
+#ifdef _WIN32
+    VirtualAlloc((LPVOID)begin, end - begin, MEM_RESET, PAGE_READWRITE);
+#else
+    madvise((void *)begin, end - begin, MADV_DONTNEED);
+#endif
+}
+
+u64 BlockStore::Key(const TCHAR *text, int length)
+{
+    u32 crc = (u32)crc32(0, (const Bytef *)text, length * sizeof(TCHAR));
+
+    return ((u64)crc << 32) | (u32)length;
+}
@@ -0,0 +1,85 @@
+#ifndef __BLOCK_STORE_H__
+#define __BLOCK_STORE_H__
+
+#include "types.h"
+#include <stdio.h>
+#include <vector>
+#include <unordered_map>
+
+#define OL_TEXT_MAGIC           0x4B4C424C  // "LBLK", ol_header_t.text_format of block text
+#define BLOCK_CACHE_COUNT       16          // blocks kept inflated, besides the ones of the last read
+
+// text of an .ol file after its header, offsets are from the start of it
+typedef struct ol_text_t
+{
+    u32 magic;          // OL_TEXT_MAGIC
+    u32 block_count;
+    u32 length;         // characters of the whole text
+    u32 reserve;
+} ol_text_t;
+
+typedef struct ol_block_t
+{
+    u32 offset;         // first character
+    u32 length;         // characters
+    u32 data_offset;
+    u32 data_size;      // deflated bytes
+    u32 crc;            // of the characters
+} ol_block_t;
+
+// a block of the loaded file, in the text until it is inflated on its first read
+typedef struct loaded_block_t
+{
+    u32 offset;         // first character, moved by Insert()
+    u32 length;
+    u64 key;            // of its stored_block_t in m_Blocks
+    u32 used;           // clock of the last read, 0 while it is not inflated
+} loaded_block_t;
+
+struct stored_block_t;
+
+// Text of an online book stored as deflated blocks, one per downloaded chapter.
+// Blocks are independent, each one is inflated straight to its place in the
+// text when it is read first; only the last used ones stay inflated, the pages
+// of the others are given back. The deflated data is kept by crc and length,
+// so a save only deflates the chapters that came in since the last one; two
+// texts of the same crc and length are told apart by their data, the second
+// one takes the next free key.
+// Outside the ranges read the text holds nothing, every reader of it goes
+// through Read() first; an evicting read drops all but its own blocks.
+class BlockStore
+{
+public:
+    BlockStore();
+    ~BlockStore();
+
+public:
+    BOOL Load(const char *data, int size, TCHAR **text, int *length);  // text is filled by Read()
+    BOOL Read(TCHAR *text, int start, int length, BOOL evict);          // evict: on the thread that draws the text
+    void Insert(TCHAR *text, int offset, int length);                   // at a block start, text may have moved
+    void GetDeflated(std::vector<loaded_block_t> &blocks);              // ranges of the text not inflated now
+    BOOL Pack(TCHAR *text, int length, std::vector<int> &cuts, std::vector<loaded_block_t> &deflated); // cuts: chapter starts
+    BOOL Write(FILE *fp);                                               // the text packed last
+    void Clear(void);
+    int  GetInflatedCount(void);
+
+private:
+    BOOL Inflate(u64 key, TCHAR *text, u32 length);
+    void Evict(TCHAR *text, u32 first);
+    u64  Find(u64 key, const TCHAR *text, u32 length, stored_block_t **block);
+    void ReleaseBlocks(void);
+    static void Discard(void *data, size_t size);
+    static u64 Key(const TCHAR *text, int length);
+
+private:
+    CRITICAL_SECTION m_Lock;                            // m_Blocks and m_Loaded, Pack runs on the scheduler
+    std::unordered_map<u64, stored_block_t*> m_Blocks;  // by crc and length, see Find()
+    std::vector<loaded_block_t> m_Loaded;               // in text order
+    int m_Inflated;                                     // of m_Loaded
+    u32 m_Clock;
+    std::vector<ol_block_t> m_Index;
+    std::vector<stored_block_t*> m_Order;               // data of m_Index
+    u32 m_Length;
+};
+
+#endif
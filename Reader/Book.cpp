@@ -1,20 +1,28 @@
 #include "Book.h"
 #include "types.h"
 #include "Utils.h"
-#include <process.h>
+#include "TaskScheduler.h"
+#include "CoverImage.h"
 #ifdef _DEBUG
 #include <assert.h>
 #endif
 
 #define MAX_BLANK_LINE      2
+#define TASK_CANCEL_WAIT    500     // ms the UI waits for a task to stop, then detaches it
+#define FIND_SLICE          65536   // chars searched per text lock
+
+static volatile LONG s_FindSeq = 0;
 
 Book::Book()
     : m_Data(NULL)
     , m_Size(0)
-    , m_hThread(NULL)
-    , m_bForceKill(FALSE)
+    , m_hTask(NULL)
     , m_Rule(NULL)
+    , m_Ref(1)
+    , m_FindSeq(0)
 {
+    InterlockedExchange(&m_Token.cancel, FALSE);
+    InterlockedExchange(&m_FindToken.cancel, FALSE);
     memset(m_fileName, 0, sizeof(m_fileName));
     m_Chapters.clear();
 }
@@ -25,44 +33,72 @@ Book::~Book()
     CloseBook();
 }
 
+void Book::Destroy(Book *book)
+{
+    if (!book)
+        return;
+    book->m_FindSeq = 0;
+    InterlockedExchange(&book->m_FindToken.cancel, TRUE);
+    InterlockedExchange(&book->m_Token.cancel, TRUE);
+    book->ForceKill();
+    Unref(book);
+}
+
+void Book::AddRef(Book *book)
+{
+    InterlockedIncrement(&book->m_Ref);
+}
+
+void Book::Unref(Book *book)
+{
+    if (InterlockedDecrement(&book->m_Ref) == 0)
+        delete book;
+}
+
 BOOL Book::OpenBook(HWND hWnd)
 {
-    unsigned threadID;
     ob_thread_param_t *param;
 
-    ForceKill();
+    // a parser that ignores the cancel still owns the book state
+    if (!ForceKill())
+        return FALSE;
     param = (ob_thread_param_t *)malloc(sizeof(ob_thread_param_t));
     param->_this = this;
     param->hWnd = hWnd;
-    m_hThread = (HANDLE)_beginthreadex(NULL, 0, OpenBookThread, param, 0, &threadID);
+    InterlockedExchange(&m_Token.cancel, FALSE);
+    AddRef(this);
+    m_hTask = TaskScheduler::Instance()->Submit(OpenBookTask, param, task_normal, &m_Token, "OpenBook");
+    if (!m_hTask)
+    {
+        free(param);
+        Unref(this);
+        return FALSE;
+    }
     return TRUE;
 }
 
 BOOL Book::OpenBook(char *data, int size, HWND hWnd)
 {
-    unsigned threadID;
-    ob_thread_param_t *param;
-
     m_Data = data;
     m_Size = size;
 
-    ForceKill();
-    param = (ob_thread_param_t *)malloc(sizeof(ob_thread_param_t));
-    param->_this = this;
-    param->hWnd = hWnd;
-    m_hThread = (HANDLE)_beginthreadex(NULL, 0, OpenBookThread, param, 0, &threadID);
-    return TRUE;
+    return OpenBook(hWnd);
 }
 
 BOOL Book::CloseBook(void)
 {
+    // a search still running stops at its next slice
+    m_FindSeq = 0;
+    EnterCriticalSection(&m_TextLock);
     if (m_Text)
     {
         free(m_Text);
         m_Text = NULL;
     }
     m_Length = 0;
+    LeaveCriticalSection(&m_TextLock);
     m_Chapters.clear();
+    m_Images.clear();
     memset(m_fileName, 0, sizeof(m_fileName));
     if (m_Data)
     {
@@ -75,7 +111,7 @@ BOOL Book::CloseBook(void)
 
 BOOL Book::IsLoading(void)
 {
-    return m_hThread != NULL;
+    return m_hTask != NULL && !TaskScheduler::Instance()->IsDone(m_hTask);
 }
 
 wchar_t * Book::GetText(void)
@@ -188,43 +224,45 @@ BOOL Book::GetChapterTitle(TCHAR* title, int size)
         index = GetCurChapterIndex();
         if (index >= 0 && index < (int)m_Chapters.size())
         {
-            _tcsncpy(title, m_Chapters[index].title.c_str(), size-1);
+            _tcsncpy(title, m_Chapters.title(index), size-1);
             return TRUE;
         }
     }
     return FALSE;
 }
 
-BOOL Book::DecodeText(const char *src, int srcsize, wchar_t **dst, int *dstsize)
+BOOL Book::DecodeText(const char *src, size_t srcsize, wchar_t **dst, int *dstsize)
 {
     type_t bom = Unknown;
+    size_t i, len;
 
+    *dst = NULL;
     if (Unknown != (bom = check_bom(src, srcsize)))
     {
         if (utf8 == bom)
         {
             src += 3;
             srcsize -= 3;
-            *dst = utf8_to_utf16(src, srcsize, dstsize);
-        }
-        else if (utf16_le == bom)
-        {
-            src += 2;
-            srcsize -= 2;
-            *dstsize = srcsize / 2;
-            *dst = (wchar_t *)malloc(sizeof(wchar_t) * ((*dstsize) + 1));
-            memcpy(*dst, src, srcsize);
-            (*dst)[*dstsize] = 0;
+            *dst = utf8_to_utf16_ex(src, srcsize, dstsize);
         }
-        else if (utf16_be == bom)
+        else if (utf16_le == bom || utf16_be == bom)
         {
             src += 2;
             srcsize -= 2;
-            *dstsize = srcsize / 2;
-            *dst = (wchar_t *)malloc(sizeof(wchar_t) * ((*dstsize) + 1));
-            memcpy(*dst, src, srcsize);
-            (*dst)[*dstsize] = 0;
-            *dst = (wchar_t *)be_to_le((char *)(*dst), srcsize);
+            len = srcsize / 2;
+            if (len > (size_t)TEXT_MAX_LENGTH)
+                return FALSE;
+            *dst = (wchar_t *)malloc(sizeof(wchar_t) * (len + 1));
+            if (!(*dst))
+                return FALSE;
+            memcpy(*dst, src, sizeof(wchar_t) * len);
+            (*dst)[len] = 0;
+            *dstsize = (int)len;
+            if (utf16_be == bom)
+            {
+                for (i = 0; i < len; i++)
+                    (*dst)[i] = (wchar_t)(((*dst)[i] >> 8) | ((*dst)[i] << 8));
+            }
         }
         else if (utf32_le == bom || utf32_be == bom)
         {
@@ -234,13 +272,17 @@ BOOL Book::DecodeText(const char *src, int srcsize, wchar_t **dst, int *dstsize)
     }
     else if (is_utf8(src, srcsize > 4096 ? 4096 : srcsize))
     {
-        *dst = utf8_to_utf16(src, srcsize, dstsize);
+        *dst = utf8_to_utf16_ex(src, srcsize, dstsize);
     }
     else
     {
-        *dst = ansi_to_utf16(src, srcsize, dstsize);
+        *dst = ansi_to_utf16_ex(src, srcsize, dstsize);
     }
 
+    // longer than the text model holds, or out of memory
+    if (!(*dst))
+        return FALSE;
+
     FormatText(*dst, dstsize);
 
     return TRUE;
@@ -319,6 +361,52 @@ BOOL Book::GetChapterInfo(int type, int *start, int *length)
     return TRUE;
 }
 
+BOOL Book::GetImageSize(int id, int *width, int *height)
+{
+    inline_image_t *image;
+    Gdiplus::Bitmap *bitmap;
+    std::string data;
+
+    if (id < 0 || id >= (int)m_Images.size())
+        return FALSE;
+    image = &m_Images[id];
+
+    // the header is enough for most, the first layout reads a few KB and not the image
+    if (image->width == 0)
+    {
+        image->width = -1;
+        if (ReadImage(id, data, INLINE_IMAGE_PROBE_BYTES)
+            && !image_probe_size(data.c_str(), data.size(), &image->width, &image->height))
+        {
+            // a header past the probe, or a format without one we know
+            if (data.size() >= INLINE_IMAGE_PROBE_BYTES && !ReadImage(id, data, 0))
+                data.clear();
+            if (!image_probe_size(data.c_str(), data.size(), &image->width, &image->height))
+            {
+                bitmap = CoverImage::Decode(data.c_str(), data.size());
+                if (bitmap)
+                {
+                    image->width = bitmap->GetWidth();
+                    image->height = bitmap->GetHeight();
+                    delete bitmap;
+                }
+            }
+        }
+        if (image->width <= 0 || image->height <= 0)
+            image->width = -1;
+    }
+    if (image->width < 0)
+        return FALSE;
+    *width = image->width;
+    *height = image->height;
+    return TRUE;
+}
+
+BOOL Book::HasInlineImages(void)
+{
+    return !m_Images.empty();
+}
+
 BOOL Book::IsValid(void)
 {
     return Page::IsValid() && !IsLoading();
@@ -467,36 +555,144 @@ BOOL Book::GetLine(wchar_t* text, int len, int *line_len, int *lf_len, int *is_b
     return TRUE;
 }
 
-void Book::ForceKill(void)
+BOOL Book::ForceKill(void)
 {
-    if (m_hThread)
+    BOOL stopped = TRUE;
+
+    if (m_hTask)
     {
-        m_bForceKill = TRUE;
-        if (WAIT_TIMEOUT == WaitForSingleObject(m_hThread, 5000))
+        InterlockedExchange(&m_Token.cancel, TRUE);
+        if (!TaskScheduler::Instance()->Wait(m_hTask, TASK_CANCEL_WAIT))
         {
-            ASSERT(FALSE);
-            TerminateThread(m_hThread, 0);
+            // cooperative only, the parser polls m_Token at every step; the
+            // task holds its own reference, so it is left to finish alone
+            logger_printk("open book task is not responding to cancel, detach it");
+            stopped = FALSE;
         }
-        CloseHandle(m_hThread);
-        m_hThread = NULL;
+        TaskScheduler::Instance()->Release(m_hTask);
+        m_hTask = NULL;
     }
+    return stopped;
 }
 
-unsigned __stdcall Book::OpenBookThread(void* pArguments)
+unsigned Book::OpenBookTask(void* arg, task_token_t* token)
 {
-    ob_thread_param_t *param = (ob_thread_param_t *)pArguments;
+    ob_thread_param_t *param = (ob_thread_param_t *)arg;
     Book *_this = param->_this;
     BOOL result = FALSE;
 
-    _this->m_bForceKill = FALSE;
-    result = _this->ParserBook(param->hWnd);
-    if (param->hWnd && !_this->m_bForceKill)
+    if (!ReadAcquire(&token->cancel))
+        result = _this->ParserBook(param->hWnd);
+    if (param->hWnd && !ReadAcquire(&token->cancel))
     {
-        PostMessage(param->hWnd, WM_OPEN_BOOK, result ? 1 : 0, NULL);
+        // tagged with the book, the window may have moved on to another one
+        PostMessage(param->hWnd, WM_OPEN_BOOK, result ? 1 : 0, (LPARAM)_this);
     }
     free(param);
-    CloseHandle(_this->m_hThread);
-    _this->m_hThread = NULL;
-    _endthreadex(0);
-    return 0;
+    Unref(_this);
+    return result ? 1 : 0;
+}
+
+BOOL Book::Find(HWND hWnd, const wchar_t *text, int from, BOOL down)
+{
+    find_param_t *param;
+    task_t *task;
+    int len;
+
+    len = text ? (int)wcslen(text) : 0;
+    if (len == 0 || Book::IsLoading())
+        return FALSE;
+
+    param = (find_param_t *)malloc(sizeof(find_param_t));
+    param->text = (wchar_t *)malloc((len + 1) * sizeof(wchar_t));
+    wcscpy(param->text, text);
+    param->_this = this;
+    param->hWnd = hWnd;
+    param->len = len;
+    param->from = from;
+    param->down = down;
+    param->seq = InterlockedIncrement(&s_FindSeq);
+
+    // a newer search supersedes the running one
+    m_FindSeq = param->seq;
+    InterlockedExchange(&m_FindToken.cancel, FALSE);
+    AddRef(this);
+    task = TaskScheduler::Instance()->Submit(FindTask, param, task_high, &m_FindToken, "Find");
+    if (!task)
+    {
+        m_FindSeq = 0;
+        free(param->text);
+        free(param);
+        Unref(this);
+        return FALSE;
+    }
+    TaskScheduler::Instance()->Release(task);
+    return TRUE;
+}
+
+BOOL Book::IsFindResult(WPARAM seq)
+{
+    if (seq == 0 || (LONG)seq != m_FindSeq)
+        return FALSE;
+    m_FindSeq = 0;
+    return TRUE;
+}
+
+unsigned Book::FindTask(void* arg, task_token_t* token)
+{
+    find_param_t *param = (find_param_t *)arg;
+    Book *_this = param->_this;
+    int found = -1;
+    BOOL done = FALSE;
+    int i, end, last;
+
+    // slice by slice, so that the text may grow between two of them
+    i = param->down ? param->from + 1 : param->from - 1;
+    while (found < 0 && !done && !ReadAcquire(&token->cancel) && _this->m_FindSeq == param->seq)
+    {
+        EnterCriticalSection(&_this->m_TextLock);
+        last = _this->m_Length - param->len;
+        if (param->down)
+        {
+            end = last + 1;
+            if (end > i + FIND_SLICE)
+                end = i + FIND_SLICE;
+            _this->LoadText(i, end - i + param->len, FALSE);
+            for (; i < end; i++)
+            {
+                if (0 == memcmp(param->text, _this->m_Text + i, param->len * sizeof(wchar_t)))
+                {
+                    found = i;
+                    break;
+                }
+            }
+            done = i > last;
+        }
+        else
+        {
+            if (i > last)
+                i = last;
+            end = i - FIND_SLICE;
+            if (end < -1)
+                end = -1;
+            _this->LoadText(end + 1, i - end + param->len, FALSE);
+            for (; i > end; i--)
+            {
+                if (0 == memcmp(param->text, _this->m_Text + i, param->len * sizeof(wchar_t)))
+                {
+                    found = i;
+                    break;
+                }
+            }
+            done = i < 0;
+        }
+        LeaveCriticalSection(&_this->m_TextLock);
+    }
+
+    if (found >= 0 && !ReadAcquire(&token->cancel) && _this->m_FindSeq == param->seq)
+        PostMessage(param->hWnd, WM_FIND_RESULT, (WPARAM)param->seq, (LPARAM)found);
+    free(param->text);
+    free(param);
+    Unref(_this);
+    return found >= 0 ? 1 : 0;
 }
\ No newline at end of file
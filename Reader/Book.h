@@ -4,18 +4,12 @@
 #include <map>
 #include "types.h"
 #include "Page.h"
+#include "TaskScheduler.h"
+#include "ChapterTable.h"
 #include <string>
 
 
-typedef struct chapter_item_t
-{
-    int index;
-    std::wstring title;
-    std::string url; // for online book
-    int size; // current chapter total len, for online book
-    int title_len;
-} chapter_item_t;
-typedef std::vector<chapter_item_t> chapters_t;
+typedef ChapterTable chapters_t;
 
 typedef enum book_type_t
 {
@@ -75,6 +69,12 @@ public:
     virtual ~Book();
 
 public:
+    // cancels the running tasks and drops the owner's reference, a task that
+    // does not stop in time keeps the book alive and deletes it when it ends
+    static void Destroy(Book *book);
+    // one more reference for whoever keeps the book past the owner's Destroy
+    static void AddRef(Book *book);
+    static void Unref(Book *book);
     virtual book_type_t GetBookType(void) = 0;
     virtual BOOL SaveBook(HWND hWnd) = 0;
     virtual BOOL UpdateChapters(int offset) = 0;
@@ -95,30 +95,40 @@ public:
     virtual LRESULT OnBookEvent(HWND hWnd, UINT message, WPARAM wParam, LPARAM lParam);
     BOOL GetChapterTitle(TCHAR *title, int size);
     BOOL FormatText(wchar_t *p_data, int *p_len);
+    // searches in the background, the hit comes back as WM_FIND_RESULT
+    BOOL Find(HWND hWnd, const wchar_t *text, int from, BOOL down);
+    BOOL IsFindResult(WPARAM seq);
 
 protected:
     virtual BOOL ParserBook(HWND hWnd) = 0;
     // srcsize and dstsize not include \0
-    virtual BOOL DecodeText(const char *src, int srcsize, wchar_t **dst, int *dstsize);
+    virtual BOOL DecodeText(const char *src, size_t srcsize, wchar_t **dst, int *dstsize);
     virtual BOOL IsChapterIndex(int index);
     virtual BOOL IsChapter(int index);
     virtual BOOL GetChapterInfo(int type, int *start, int *length);
+    virtual BOOL GetImageSize(int id, int *width, int *height);
+    virtual BOOL HasInlineImages(void);
     virtual BOOL IsValid(void);
     
     BOOL GetLine(wchar_t* text, int len, int *line_len, int *lf_len, int *is_blank_line, int *prefix_blank_len, int *suffix_blank_len);
-    void ForceKill(void);
+    BOOL ForceKill(void);
 
 protected:
-    static unsigned __stdcall OpenBookThread(void* pArguments);
+    static unsigned OpenBookTask(void* arg, task_token_t* token);
+    static unsigned FindTask(void* arg, task_token_t* token);
 
 protected:
     wchar_t m_fileName[MAX_PATH];
     chapters_t m_Chapters;
     char *m_Data;
     int m_Size;
-    HANDLE m_hThread;
-    BOOL m_bForceKill;
+    task_t *m_hTask;
+    task_token_t m_Token;
     chapter_rule_t *m_Rule;
+    std::vector<inline_image_t> m_Images;  // by id, read back from the book when drawn
+    volatile LONG m_Ref;                // owner and running tasks
+    task_token_t m_FindToken;
+    volatile LONG m_FindSeq;            // search in progress, 0 for none
 };
 
 typedef struct ob_thread_param_t
@@ -127,4 +137,15 @@ typedef struct ob_thread_param_t
     HWND hWnd;
 } ob_thread_param_t;
 
+typedef struct find_param_t
+{
+    Book *_this;
+    HWND hWnd;
+    wchar_t *text;
+    int len;
+    int from;
+    BOOL down;
+    LONG seq;
+} find_param_t;
+
 #endif
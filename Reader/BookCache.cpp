@@ -0,0 +1,99 @@
+#include "BookCache.h"
+
+BookCache::BookCache(size_t books, size_t chars)
+    : m_Chars(0)
+    , m_MaxBooks(books)
+    , m_MaxChars(chars)
+{
+    InitializeCriticalSection(&m_Lock);
+}
+
+BookCache::~BookCache()
+{
+    Clear();
+    DeleteCriticalSection(&m_Lock);
+}
+
+BOOL BookCache::Get(const wchar_t *file_name, u64 file_size, u64 write_time, book_cache_item_t *copy)
+{
+    std::list<book_cache_item_t*>::iterator it;
+    book_cache_item_t *item;
+    BOOL ret = FALSE;
+
+    EnterCriticalSection(&m_Lock);
+    for (it = m_Items.begin(); it != m_Items.end(); it++)
+    {
+        item = *it;
+        if (item->file_name != file_name || item->file_size != file_size || item->write_time != write_time)
+            continue;
+
+        *copy = *item;
+        copy->text = (wchar_t *)malloc(sizeof(wchar_t) * (item->length + 1));
+        if (!copy->text)
+            break;
+        memcpy(copy->text, item->text, sizeof(wchar_t) * (item->length + 1));
+        if (it != m_Items.begin())
+            m_Items.splice(m_Items.begin(), m_Items, it);
+        ret = TRUE;
+        break;
+    }
+    LeaveCriticalSection(&m_Lock);
+    return ret;
+}
+
+void BookCache::Put(book_cache_item_t *item)
+{
+    std::list<book_cache_item_t*>::iterator it;
+
+    EnterCriticalSection(&m_Lock);
+    for (it = m_Items.begin(); it != m_Items.end(); it++)
+    {
+        if ((*it)->file_name == item->file_name)
+        {
+            Drop(it);
+            break;
+        }
+    }
+    m_Items.push_front(item);
+    m_Chars += item->length;
+
+    while (m_Items.size() > 1 && (m_Items.size() > m_MaxBooks || m_Chars > m_MaxChars))
+        Drop(--m_Items.end());
+    LeaveCriticalSection(&m_Lock);
+}
+
+void BookCache::Clear(void)
+{
+    EnterCriticalSection(&m_Lock);
+    while (!m_Items.empty())
+        Drop(m_Items.begin());
+    LeaveCriticalSection(&m_Lock);
+}
+
+size_t BookCache::GetBooks(void)
+{
+    size_t books;
+
+    EnterCriticalSection(&m_Lock);
+    books = m_Items.size();
+    LeaveCriticalSection(&m_Lock);
+    return books;
+}
+
+size_t BookCache::GetChars(void)
+{
+    size_t chars;
+
+    EnterCriticalSection(&m_Lock);
+    chars = m_Chars;
+    LeaveCriticalSection(&m_Lock);
+    return chars;
+}
+
+void BookCache::Drop(std::list<book_cache_item_t*>::iterator it)
+{
+    m_Chars -= (*it)->length;
+    free((*it)->text);
+    delete *it;
+    m_Items.erase(it);
+}
@@ -0,0 +1,48 @@
+#ifndef __BOOK_CACHE_H__
+#define __BOOK_CACHE_H__
+
+#include "InlineImage.h"
+#include <string>
+#include <vector>
+#include <list>
+
+typedef struct book_cache_item_t
+{
+    std::wstring file_name;
+    u64 file_size;
+    u64 write_time;
+    wchar_t *text;      // malloc'd, with its terminating 0
+    int length;
+    std::vector<int> chapter_index;
+    std::vector<std::wstring> chapter_title;
+    std::string cover;
+    std::vector<inline_image_t> images;
+} book_cache_item_t;
+
+// Decoded books kept for the next open, found by the name, size and write
+// time of the file. The least recently opened go first once there are more
+// books or characters than allowed, the last one put stays.
+class BookCache
+{
+public:
+    BookCache(size_t books, size_t chars);
+    ~BookCache();
+
+    BOOL Get(const wchar_t *file_name, u64 file_size, u64 write_time, book_cache_item_t *copy);   // the caller frees copy->text
+    void Put(book_cache_item_t *item);      // the cache owns it, and replaces a book of the same name
+    void Clear(void);
+    size_t GetBooks(void);
+    size_t GetChars(void);
+
+private:
+    void Drop(std::list<book_cache_item_t*>::iterator it);
+
+private:
+    CRITICAL_SECTION m_Lock;
+    std::list<book_cache_item_t*> m_Items;  // most recently opened first
+    size_t m_Chars;
+    size_t m_MaxBooks;
+    size_t m_MaxChars;
+};
+
+#endif
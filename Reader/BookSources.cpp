@@ -0,0 +1,376 @@
+#include "BookSources.h"
+
+typedef enum bs_field_type_t
+{
+    bft_int,
+    bft_str,
+    bft_wstr
+} bs_field_type_t;
+
+typedef struct bs_field_t
+{
+    u32 offset;
+    u32 size;
+    int type;
+} bs_field_t;
+
+#define BS_FIELD(f, t)          { (u32)offsetof(book_source_t, f), (u32)sizeof(((book_source_t *)0)->f), t }
+
+// packed layout, each string is a byte length and its bytes padded to 4
+static const bs_field_t g_Fields[] =
+{
+    BS_FIELD(title, bft_wstr),
+    BS_FIELD(host, bft_str),
+    BS_FIELD(query_url, bft_str),
+    BS_FIELD(query_method, bft_int),
+    BS_FIELD(query_params, bft_str),
+    BS_FIELD(query_charset, bft_int),
+    BS_FIELD(book_name_xpath, bft_str),
+    BS_FIELD(book_mainpage_xpath, bft_str),
+    BS_FIELD(book_author_xpath, bft_str),
+    BS_FIELD(enable_chapter_page, bft_int),
+    BS_FIELD(chapter_page_xpath, bft_str),
+    BS_FIELD(chapter_title_xpath, bft_str),
+    BS_FIELD(chapter_url_xpath, bft_str),
+    BS_FIELD(enable_chapter_next, bft_int),
+    BS_FIELD(chapter_next_url_xpath, bft_str),
+    BS_FIELD(chapter_next_keyword_xpath, bft_str),
+    BS_FIELD(chapter_next_keyword, bft_str),
+    BS_FIELD(content_xpath, bft_str),
+    BS_FIELD(enable_content_next, bft_int),
+    BS_FIELD(content_next_url_xpath, bft_str),
+    BS_FIELD(content_next_keyword_xpath, bft_str),
+    BS_FIELD(content_next_keyword, bft_str),
+    BS_FIELD(content_filter_type, bft_int),
+    BS_FIELD(content_filter_keyword, bft_wstr),
+};
+
+#define BS_FIELD_COUNT          (sizeof(g_Fields) / sizeof(g_Fields[0]))
+#define BS_ALIGN(n)             (((n) + 3) & ~3)
+
+BookSources::BookSources()
+{
+    m_Items = NULL;
+    m_Count = 0;
+    m_Cap = 0;
+    m_Slots = NULL;
+    m_SlotCount = 0;
+    m_Retired = NULL;
+    m_RetiredCount = 0;
+    m_RetiredCap = 0;
+}
+
+BookSources::~BookSources()
+{
+    int i;
+
+    for (i = 0; i < m_Count; i++)
+        free(m_Items[i]);
+    for (i = 0; i < m_RetiredCount; i++)
+        free(m_Retired[i]);
+    if (m_Items)
+        free(m_Items);
+    if (m_Slots)
+        free(m_Slots);
+    if (m_Retired)
+        free(m_Retired);
+}
+
+int BookSources::Count(void)
+{
+    return m_Count;
+}
+
+book_source_t* BookSources::Get(int i)
+{
+    if (i < 0 || i >= m_Count)
+        return NULL;
+    return m_Items[i];
+}
+
+book_source_t* BookSources::Find(const char *host)
+{
+    return Get(IndexOf(host));
+}
+
+int BookSources::IndexOf(const char *host)
+{
+    int slot;
+
+    if (!host || !m_Slots)
+        return -1;
+    return Lookup(host, Hash(host), &slot);
+}
+
+book_source_t* BookSources::Add(const book_source_t *bs)
+{
+    book_source_t **items;
+    book_source_t *item;
+    int cap, slot;
+
+    if (m_Count >= m_Cap)
+    {
+        cap = m_Cap ? m_Cap * 2 : 16;
+        items = (book_source_t **)realloc(m_Items, cap * sizeof(book_source_t *));
+        if (!items)
+            return NULL;
+        m_Items = items;
+        m_Cap = cap;
+    }
+    if ((m_Count + 1) * 2 > m_SlotCount)
+    {
+        if (!Rehash(m_SlotCount ? m_SlotCount * 2 : BOOKSRC_SLOT_MIN))
+            return NULL;
+    }
+
+    item = (book_source_t *)malloc(sizeof(book_source_t));
+    if (!item)
+        return NULL;
+    memcpy(item, bs, sizeof(book_source_t));
+    m_Items[m_Count] = item;
+
+    // a host seen before keeps its first source
+    if (Lookup(item->host, Hash(item->host), &slot) == -1)
+        m_Slots[slot] = m_Count;
+    m_Count++;
+    return item;
+}
+
+BOOL BookSources::Set(int i, const book_source_t *bs)
+{
+    BOOL rehash;
+
+    if (i < 0 || i >= m_Count)
+        return FALSE;
+    rehash = strcmp(m_Items[i]->host, bs->host) != 0;
+    memcpy(m_Items[i], bs, sizeof(book_source_t));
+    if (rehash)
+        return Rehash(m_SlotCount);
+    return TRUE;
+}
+
+BOOL BookSources::Remove(int i)
+{
+    if (i < 0 || i >= m_Count)
+        return FALSE;
+    if (!Retire(m_Items[i]))
+        return FALSE;
+    memmove(m_Items + i, m_Items + i + 1, (m_Count - i - 1) * sizeof(book_source_t *));
+    m_Count--;
+    return Rehash(m_SlotCount);
+}
+
+BOOL BookSources::Swap(int i, int j)
+{
+    book_source_t *item;
+
+    if (i < 0 || i >= m_Count || j < 0 || j >= m_Count)
+        return FALSE;
+    item = m_Items[i];
+    m_Items[i] = m_Items[j];
+    m_Items[j] = item;
+    return Rehash(m_SlotCount);
+}
+
+void BookSources::Clear(void)
+{
+    while (m_Count > 0)
+    {
+        if (!Retire(m_Items[m_Count - 1]))
+            free(m_Items[m_Count - 1]);
+        m_Count--;
+    }
+    Rehash(m_SlotCount);
+}
+
+void BookSources::Assign(BookSources *other)
+{
+    book_source_t **items;
+    int *slots;
+    int count, cap, slot_count;
+
+    Clear();
+
+    // swap the tables, the retired entries of other stay with it
+    items = m_Items;
+    cap = m_Cap;
+    slots = m_Slots;
+    slot_count = m_SlotCount;
+    m_Items = other->m_Items;
+    m_Count = other->m_Count;
+    m_Cap = other->m_Cap;
+    m_Slots = other->m_Slots;
+    m_SlotCount = other->m_SlotCount;
+    count = 0;
+    other->m_Items = items;
+    other->m_Count = count;
+    other->m_Cap = cap;
+    other->m_Slots = slots;
+    other->m_SlotCount = slot_count;
+}
+
+u32 BookSources::Pack(BYTE *data)
+{
+    const BYTE *src;
+    u32 size = 0, len;
+    int i;
+    size_t j;
+
+    for (i = 0; i < m_Count; i++)
+    {
+        for (j = 0; j < BS_FIELD_COUNT; j++)
+        {
+            src = (const BYTE *)m_Items[i] + g_Fields[j].offset;
+            if (g_Fields[j].type == bft_int)
+            {
+                if (data)
+                    memcpy(data + size, src, sizeof(int));
+                size += sizeof(int);
+                continue;
+            }
+            if (g_Fields[j].type == bft_str)
+                len = (u32)strnlen((const char *)src, g_Fields[j].size);
+            else
+                len = (u32)wcsnlen((const wchar_t *)src, g_Fields[j].size / sizeof(wchar_t)) * sizeof(wchar_t);
+            if (data)
+            {
+                memcpy(data + size, &len, sizeof(u32));
+                memcpy(data + size + sizeof(u32), src, len);
+            }
+            size += sizeof(u32) + BS_ALIGN(len);
+        }
+    }
+    return size;
+}
+
+BOOL BookSources::Unpack(const BYTE *data, u32 size, int count)
+{
+    book_source_t *bs;
+    BYTE *dst;
+    u32 pos = 0, len, term;
+    int i;
+    size_t j;
+
+    bs = (book_source_t *)malloc(sizeof(book_source_t));
+    if (!bs)
+        return FALSE;
+
+    Clear();
+    for (i = 0; i < count; i++)
+    {
+        memset(bs, 0, sizeof(book_source_t));
+        for (j = 0; j < BS_FIELD_COUNT; j++)
+        {
+            dst = (BYTE *)bs + g_Fields[j].offset;
+            if (g_Fields[j].type == bft_int)
+            {
+                if (size - pos < sizeof(int))
+                    goto _fail;
+                memcpy(dst, data + pos, sizeof(int));
+                pos += sizeof(int);
+                continue;
+            }
+            if (size - pos < sizeof(u32))
+                goto _fail;
+            memcpy(&len, data + pos, sizeof(u32));
+            pos += sizeof(u32);
+            term = g_Fields[j].type == bft_str ? sizeof(char) : sizeof(wchar_t);
+            if (len > g_Fields[j].size - term || size - pos < BS_ALIGN(len))
+                goto _fail;
+            memcpy(dst, data + pos, len);
+            pos += BS_ALIGN(len);
+        }
+        if (!Add(bs))
+            goto _fail;
+    }
+    free(bs);
+    return TRUE;
+
+_fail:
+    free(bs);
+    Clear();
+    return FALSE;
+}
+
+BOOL BookSources::AddCallback(const book_source_t *bs, void *arg)
+{
+    return ((BookSources *)arg)->Add(bs) != NULL;
+}
+
+u32 BookSources::Hash(const char *host)
+{
+    u32 hash = 2166136261u;
+
+    // FNV-1a
+    while (*host)
+    {
+        hash ^= (BYTE)*host++;
+        hash *= 16777619u;
+    }
+    return hash;
+}
+
+int BookSources::Lookup(const char *host, u32 hash, int *slot)
+{
+    u32 mask = m_SlotCount - 1;
+    u32 i;
+
+    // linear probing, the table is never full
+    for (i = hash & mask; m_Slots[i] != -1; i = (i + 1) & mask)
+    {
+        if (strcmp(m_Items[m_Slots[i]]->host, host) == 0)
+        {
+            *slot = (int)i;
+            return m_Slots[i];
+        }
+    }
+    *slot = (int)i;
+    return -1;
+}
+
+BOOL BookSources::Rehash(int slot_count)
+{
+    int *slots;
+    int i, slot;
+
+    if (slot_count < BOOKSRC_SLOT_MIN)
+        slot_count = BOOKSRC_SLOT_MIN;
+    while (m_Count * 2 > slot_count)
+        slot_count *= 2;
+
+    if (slot_count != m_SlotCount)
+    {
+        slots = (int *)realloc(m_Slots, slot_count * sizeof(int));
+        if (!slots)
+            return FALSE;
+        m_Slots = slots;
+        m_SlotCount = slot_count;
+    }
+    memset(m_Slots, 0xFF, m_SlotCount * sizeof(int));
+
+    // in order, so the first source of a host wins
+    for (i = 0; i < m_Count; i++)
+    {
+        if (Lookup(m_Items[i]->host, Hash(m_Items[i]->host), &slot) == -1)
+            m_Slots[slot] = i;
+    }
+    return TRUE;
+}
+
+BOOL BookSources::Retire(book_source_t *bs)
+{
+    book_source_t **retired;
+    int cap;
+
+    if (m_RetiredCount >= m_RetiredCap)
+    {
+        cap = m_RetiredCap ? m_RetiredCap * 2 : 16;
+        retired = (book_source_t **)realloc(m_Retired, cap * sizeof(book_source_t *));
+        if (!retired)
+            return FALSE;
+        m_Retired = retired;
+        m_RetiredCap = cap;
+    }
+    m_Retired[m_RetiredCount++] = bs;
+    return TRUE;
+}
@@ -0,0 +1,49 @@
+#ifndef __BOOK_SOURCES_H__
+#define __BOOK_SOURCES_H__
+
+#include "types.h"
+
+#define BOOKSRC_SLOT_MIN        64
+
+// Book sources, one heap entry per source and an open addressing index on host.
+// Pointers from Get and Find stay valid until the table is destroyed: removed
+// and replaced entries are retired, an open OnlineBook may still use them.
+class BookSources
+{
+public:
+    BookSources();
+    ~BookSources();
+
+public:
+    int  Count(void);
+    book_source_t* Get(int i);
+    book_source_t* Find(const char *host);      // first source of host
+    int  IndexOf(const char *host);
+    book_source_t* Add(const book_source_t *bs);
+    BOOL Set(int i, const book_source_t *bs);
+    BOOL Remove(int i);
+    BOOL Swap(int i, int j);
+    void Clear(void);
+    void Assign(BookSources *other);            // takes the entries of other
+    u32  Pack(BYTE *data);                      // returns the size, data may be NULL
+    BOOL Unpack(const BYTE *data, u32 size, int count);
+    static BOOL AddCallback(const book_source_t *bs, void *arg); // for import_book_source
+
+private:
+    static u32 Hash(const char *host);
+    int  Lookup(const char *host, u32 hash, int *slot);
+    BOOL Rehash(int slot_count);
+    BOOL Retire(book_source_t *bs);
+
+private:
+    book_source_t **m_Items;
+    int m_Count;
+    int m_Cap;
+    int *m_Slots;           // index of m_Items, -1 empty, kept under half full
+    int m_SlotCount;        // power of two
+    book_source_t **m_Retired;
+    int m_RetiredCount;
+    int m_RetiredCap;
+};
+
+#endif
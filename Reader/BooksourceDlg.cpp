@@ -6,12 +6,13 @@
 #include "Utils.h"
 #include "https.h"
 #include "Jsondata.h"
+#include "BookSources.h"
+#include "ContentFilter.h"
 #include <shellapi.h>
 #include <commdlg.h>
 #include <stdio.h>
-#include <regex>
 
-extern header_t *_header;
+extern BookSources *_BookSources;
 extern HWND _hWnd;
 extern HINSTANCE hInst;
 extern void Save(HWND);
@@ -208,7 +209,7 @@ static void _get_data_from_ui(HWND hDlg, book_source_t *data)
     data->content_filter_type = (int)SendMessage(GetDlgItem(hDlg, IDC_COMBO_FILTER), CB_GETCURSEL, 0, NULL);
     // <!-- format filter keyword, \r\n -> \n
     GetDlgItemText(hDlg, IDC_EDIT_FILTER, buf, 1023);
-    if (data->content_filter_type == 1)
+    if (data->content_filter_type == 1 || data->content_filter_type == 3)
     {
         
         len = _tcslen(buf);
@@ -257,21 +258,21 @@ static void _load_ui(HWND hDlg, int idx, BOOL initList)
         lvc.cx = 146;
         SendMessage(hList, LVM_INSERTCOLUMN, 0, (LPARAM)&lvc);
 
-        for (i = 0; i < _header->book_source_count; i++)
+        for (i = 0; i < _BookSources->Count(); i++)
         {
             memset(&lvitem, 0, sizeof(LVITEM));
             lvitem.mask = LVIF_TEXT;
             lvitem.cchTextMax = MAX_PATH;
             lvitem.iItem = i;
             lvitem.iSubItem = 0;
-            lvitem.pszText = _header->book_sources[i].title;
+            lvitem.pszText = _BookSources->Get(i)->title;
             ::SendMessage(hList, LVM_INSERTITEM, lvitem.iItem, (LPARAM)&lvitem);
             ::SendMessage(hList, LVM_SETITEMTEXT, lvitem.iItem, (LPARAM)&lvitem);
         }
     }
-    if (idx >= 0 && idx < _header->book_source_count)
+    if (idx >= 0 && idx < _BookSources->Count())
     {
-        _set_data_to_ui(hDlg, &_header->book_sources[idx]);
+        _set_data_to_ui(hDlg, _BookSources->Get(idx));
         ListView_SetItemState(hList, idx, LVIS_FOCUSED | LVIS_SELECTED, 0x000F);
     }
     else
@@ -352,7 +353,6 @@ _yes:
 static BOOL _check_is_valid(HWND hDlg, book_source_t* data)
 {
     book_source_t* p_temp = NULL;
-    std::wregex* e = NULL;
 
     if (!data)
     {
@@ -362,23 +362,12 @@ static BOOL _check_is_valid(HWND hDlg, book_source_t* data)
         data = p_temp;
     }
 
-    if (data->content_filter_type == 2)
+    if (!ContentFilter::IsValid(data->content_filter_type, data->content_filter_keyword))
     {
-        try
-        {
-            e = new std::wregex(data->content_filter_keyword);
-        }
-        catch (...)
-        {
-            if (e)
-            {
-                delete e;
-            }
-            if (p_temp)
-                free(p_temp);
-            MessageBox_(hDlg, IDS_INVALID_REGEX, IDS_ERROR, MB_ICONERROR | MB_OK);
-            return FALSE;
-        }
+        if (p_temp)
+            free(p_temp);
+        MessageBox_(hDlg, IDS_INVALID_REGEX, IDS_ERROR, MB_ICONERROR | MB_OK);
+        return FALSE;
     }
     if (p_temp)
         free(p_temp);
@@ -397,16 +386,14 @@ static BOOL _check_is_exist(HWND hDlg, int except, book_source_t *data)
         data = p_temp;
     }
 
-    for (i = 0; i < _header->book_source_count; i++)
+    for (i = 0; i < _BookSources->Count(); i++)
     {
-        if (i != except && 0 == _tcscmp(data->title, _header->book_sources[i].title))
-            goto _yes;
-    }
-    for (i = 0; i < _header->book_source_count; i++)
-    {
-        if (i != except && 0 == strcmp(data->host, _header->book_sources[i].host))
+        if (i != except && 0 == _tcscmp(data->title, _BookSources->Get(i)->title))
             goto _yes;
     }
+    i = _BookSources->IndexOf(data->host);
+    if (i != -1 && i != except)
+        goto _yes;
     if (p_temp)
         free(p_temp);
     return FALSE;
@@ -430,7 +417,7 @@ static BOOL _check_is_modify(HWND hDlg, int idx, book_source_t *data)
         data = p_temp;
     }
 
-    is_modify = 0 != memcmp(data, &_header->book_sources[idx], sizeof(book_source_t));
+    is_modify = 0 != memcmp(data, _BookSources->Get(idx), sizeof(book_source_t));
     if (p_temp)
         free(p_temp);
     return is_modify;
@@ -444,10 +431,10 @@ static void _backup_curn_bsconfig(void)
     const TCHAR *bak_name = _T(".bs_bak.json");
     size_t i;
 
-    if (_header->book_source_count == 0)
+    if (_BookSources->Count() == 0)
         return;
 
-    if (export_book_source(_header->book_sources, _header->book_source_count, &json))
+    if (export_book_source(_BookSources, &json))
     {
         GetModuleFileName(NULL, file_name, sizeof(TCHAR) * (MAX_PATH - 1));
         for (i = _tcslen(file_name) - 1; i >= 0; i--)
@@ -471,74 +458,48 @@ static void _backup_curn_bsconfig(void)
     export_book_source_free(json);
 }
 
-static BOOL _merge_bsconfig(HWND hDlg, const char *json)
+// called for each imported source, sources are matched by host
+static BOOL _merge_book_source(const book_source_t *bs, void *arg)
 {
-    int book_source_count;
-    book_source_t *book_sources = NULL;
-    int i, j, ret;
-    int found;
-
-    book_sources = (book_source_t*)malloc(sizeof(book_source_t) * MAX_BOOKSRC_COUNT);
-    memset(book_sources, 0, sizeof(book_source_t) * MAX_BOOKSRC_COUNT);
-    book_source_count = 0;
-    if (!import_book_source(json, book_sources, &book_source_count))
+    HWND hDlg = (HWND)arg;
+    book_source_t *item;
+    int idx, ret;
+
+    idx = _BookSources->IndexOf(bs->host);
+    if (idx == -1)
     {
-        free(book_sources);
-        return FALSE;
+        // add new one
+        _BookSources->Add(bs);
+        return TRUE;
     }
-    // no changed
-    if (book_source_count == _header->book_source_count && 0 == memcmp(book_sources, _header->book_sources, sizeof(book_sources)))
-    {
-        free(book_sources);
+
+    item = _BookSources->Get(idx);
+    if (0 == memcmp(bs, item, sizeof(book_source_t)))
         return TRUE;
+
+    ret = MessageBoxFmt_(hDlg, IDS_WARN, MB_ICONINFORMATION | MB_YESNO, IDS_BS_EXIST_TIP, item->title);
+    if (IDYES == ret)
+    {
+        // replace
+        _BookSources->Set(idx, bs);
     }
-    // do check
-    for (i = 0; i < book_source_count; i++)
+    else if (IDNO == ret)
     {
-        found = 0;
-        for (j = 0; j < _header->book_source_count; j++)
-        {
-            if (0 == memcmp(&book_sources[i], &_header->book_sources[j], sizeof(book_source_t)))
-            {
-                found = 1;
-                break;
-            }
-            if (0 == strcmp(book_sources[i].host, _header->book_sources[j].host))
-            {
-                found = 1;
-                ret = MessageBoxFmt_(hDlg, IDS_WARN, MB_ICONINFORMATION | MB_YESNO, IDS_BS_EXIST_TIP, _header->book_sources[j].title);
-                if (IDYES == ret)
-                {
-                    // replace
-                    memcpy(&_header->book_sources[j], &book_sources[i], sizeof(book_source_t));
-                }
-                else if (IDNO == ret)
-                {
-                    // ignore, keep old config
-                }
-                else
-                {
-                    // exit
-                    free(book_sources);
-                    return TRUE;
-                }
-                break;
-            }
-        }
-        if (found == 0)
-        {
-            // add new one
-            if (_header->book_source_count < MAX_BOOKSRC_COUNT)
-            {
-                memcpy(&_header->book_sources[_header->book_source_count], &book_sources[i], sizeof(book_source_t));
-                _header->book_source_count++;
-            }
-        }
+        // ignore, keep old config
+    }
+    else
+    {
+        // exit
+        return FALSE;
     }
-    free(book_sources);
     return TRUE;
 }
 
+static BOOL _merge_bsconfig(HWND hDlg, const char *json)
+{
+    return import_book_source(json, _merge_book_source, hDlg);
+}
+
 static void EnableDialog_Sync(HWND hDlg, BOOL enable)
 {
     TCHAR szSync[256] = { 0 };
@@ -607,6 +568,7 @@ static unsigned int DownloadBooksrcCompleter(request_result_t* result)
     char* html = NULL;
     int htmllen = 0;
     int needfree = 0;
+    BookSources sources;
 
     g_hRequestSync = NULL;
 
@@ -656,7 +618,7 @@ static unsigned int DownloadBooksrcCompleter(request_result_t* result)
     _backup_curn_bsconfig();
 
     // import book src
-    if (!import_book_source(html, _header->book_sources, &_header->book_source_count))
+    if (!import_book_source(html, BookSources::AddCallback, &sources))
     {
         EnableDialog_Sync(hDlg, TRUE);
         MessageBox_(hDlg, IDS_IMPORT_FAILED, IDS_ERROR, MB_ICONERROR | MB_OK);
@@ -664,6 +626,7 @@ static unsigned int DownloadBooksrcCompleter(request_result_t* result)
             free(html);
         return 1;
     }
+    _BookSources->Assign(&sources);
 
     // update ui
     ListView_DeleteAllItems(GetDlgItem(hDlg, IDC_LIST_BOOKSRC));
@@ -690,7 +653,7 @@ static int DownloadBooksrc(HWND hDlg)
         return 0;
     }
 
-    if (_header->book_source_count > 0)
+    if (_BookSources->Count() > 0)
     {
         if (IDYES != MessageBox_(hDlg, IDS_LOST_WARN, IDS_WARN, MB_ICONWARNING | MB_YESNO))
             return 0;
@@ -733,6 +696,8 @@ static INT_PTR CALLBACK BS_DlgProc(HWND hDlg, UINT message, WPARAM wParam, LPARA
         SendMessage(GetDlgItem(hDlg, IDC_COMBO_FILTER), CB_ADDSTRING, 0, (LPARAM)buf);
         LoadString(hInst, IDS_REGEX, buf, 256);
         SendMessage(GetDlgItem(hDlg, IDC_COMBO_FILTER), CB_ADDSTRING, 0, (LPARAM)buf);
+        LoadString(hInst, IDS_RULES, buf, 256);
+        SendMessage(GetDlgItem(hDlg, IDC_COMBO_FILTER), CB_ADDSTRING, 0, (LPARAM)buf);
         SendMessage(GetDlgItem(hDlg, IDC_COMBO_METHOD), CB_ADDSTRING, 0, (LPARAM)_T("GET"));
         SendMessage(GetDlgItem(hDlg, IDC_COMBO_METHOD), CB_ADDSTRING, 0, (LPARAM)_T("POST"));
         SendMessage(GetDlgItem(hDlg, IDC_COMBO_CHARSET), CB_ADDSTRING, 0, (LPARAM)_T("AUTO"));
@@ -745,7 +710,7 @@ static INT_PTR CALLBACK BS_DlgProc(HWND hDlg, UINT message, WPARAM wParam, LPARA
         SendMessage(GetDlgItem(hDlg, IDC_COMBO_CTX_NEXT), CB_ADDSTRING, 0, (LPARAM)_T("Disable"));
         SendMessage(GetDlgItem(hDlg, IDC_COMBO_CTX_NEXT), CB_ADDSTRING, 0, (LPARAM)_T("Enable"));
         iPos = (int)SendMessage(GetDlgItem(GetParent(hDlg), IDC_COMBO_BS_LIST), CB_GETCURSEL, 0, NULL);
-        if (iPos < 0 || iPos >= _header->book_source_count)
+        if (iPos < 0 || iPos >= _BookSources->Count())
             iPos = 0;
         _load_ui(hDlg, iPos, TRUE);
         return (INT_PTR)TRUE;
@@ -756,13 +721,6 @@ static INT_PTR CALLBACK BS_DlgProc(HWND hDlg, UINT message, WPARAM wParam, LPARA
             // add item
             hList = GetDlgItem(hDlg, IDC_LIST_BOOKSRC);
 
-            // check is full
-            if (_header->book_source_count >= MAX_BOOKSRC_COUNT)
-            {
-                MessageBoxFmt_(hDlg, IDS_ERROR, MB_ICONERROR | MB_OK, IDS_BOOKSOURCE_FULL, MAX_BOOKSRC_COUNT);
-                return (INT_PTR)FALSE;
-            }
-
             if (!p_temp)
                 p_temp = (book_source_t*)malloc(sizeof(book_source_t));
             memset(p_temp, 0, sizeof(book_source_t));
@@ -790,9 +748,12 @@ static INT_PTR CALLBACK BS_DlgProc(HWND hDlg, UINT message, WPARAM wParam, LPARA
             }
 
             // insert data
-            iPos = _header->book_source_count;
-            memcpy(&_header->book_sources[iPos], p_temp, sizeof(book_source_t));
-            _header->book_source_count++;
+            if (!_BookSources->Add(p_temp))
+            {
+                free(p_temp);
+                return (INT_PTR)FALSE;
+            }
+            iPos = _BookSources->Count() - 1;
 
             free(p_temp);
             p_temp = NULL;
@@ -803,7 +764,7 @@ static INT_PTR CALLBACK BS_DlgProc(HWND hDlg, UINT message, WPARAM wParam, LPARA
             lvitem.cchTextMax = MAX_PATH;
             lvitem.iItem = iPos;
             lvitem.iSubItem = 0;
-            lvitem.pszText = _header->book_sources[iPos].title;
+            lvitem.pszText = _BookSources->Get(iPos)->title;
             ::SendMessage(hList, LVM_INSERTITEM, lvitem.iItem, (LPARAM)&lvitem);
             ::SendMessage(hList, LVM_SETITEMTEXT, lvitem.iItem, (LPARAM)&lvitem);
             ListView_SetItemState(hList, iPos, LVIS_FOCUSED | LVIS_SELECTED, 0x000F);
@@ -877,10 +838,10 @@ static INT_PTR CALLBACK BS_DlgProc(HWND hDlg, UINT message, WPARAM wParam, LPARA
             }
 
             // check if want to add new
-            if (0 != _tcscmp(_header->book_sources[iPos].title, p_temp->title)
-                && 0 != strcmp(_header->book_sources[iPos].host, p_temp->host))
+            if (0 != _tcscmp(_BookSources->Get(iPos)->title, p_temp->title)
+                && 0 != strcmp(_BookSources->Get(iPos)->host, p_temp->host))
             {
-                if (IDYES != MessageBoxFmt_(hDlg, IDS_WARN, MB_ICONINFORMATION | MB_YESNO, IDS_BS_SAVE_TIP, _header->book_sources[iPos].title))
+                if (IDYES != MessageBoxFmt_(hDlg, IDS_WARN, MB_ICONINFORMATION | MB_YESNO, IDS_BS_SAVE_TIP, _BookSources->Get(iPos)->title))
                 {
                     free(p_temp);
                     return (INT_PTR)FALSE;
@@ -888,7 +849,7 @@ static INT_PTR CALLBACK BS_DlgProc(HWND hDlg, UINT message, WPARAM wParam, LPARA
             }
 
             // save
-            memcpy(&_header->book_sources[iPos], p_temp, sizeof(book_source_t));
+            _BookSources->Set(iPos, p_temp);
 
             free(p_temp);
             p_temp = NULL;
@@ -899,7 +860,7 @@ static INT_PTR CALLBACK BS_DlgProc(HWND hDlg, UINT message, WPARAM wParam, LPARA
             lvitem.cchTextMax = MAX_PATH;
             lvitem.iItem = iPos;
             lvitem.iSubItem = 0;
-            lvitem.pszText = _header->book_sources[iPos].title;
+            lvitem.pszText = _BookSources->Get(iPos)->title;
             ::SendMessage(hList, LVM_SETITEMTEXT, lvitem.iItem, (LPARAM)&lvitem);
 
             // save cache
@@ -968,7 +929,7 @@ static INT_PTR CALLBACK BS_DlgProc(HWND hDlg, UINT message, WPARAM wParam, LPARA
 #if 1
             if (!_merge_bsconfig(hDlg, json))
 #else
-            if (!import_book_source(json, _header->book_sources, &_header->book_source_count))
+            if (!import_book_source(json, BookSources::AddCallback, _BookSources))
 #endif
             {
                 MessageBox_(hDlg, IDS_IMPORT_FAILED, IDS_ERROR, MB_ICONERROR | MB_OK);
@@ -1009,7 +970,7 @@ static INT_PTR CALLBACK BS_DlgProc(HWND hDlg, UINT message, WPARAM wParam, LPARA
                 break;
             }
 
-            if (!export_book_source(_header->book_sources, _header->book_source_count, &json))
+            if (!export_book_source(_BookSources, &json))
             {
                 MessageBox_(hDlg, IDS_EXPORT_FAILED, IDS_ERROR, MB_ICONERROR | MB_OK);
                 break;
@@ -1071,7 +1032,7 @@ static INT_PTR CALLBACK BS_DlgProc(HWND hDlg, UINT message, WPARAM wParam, LPARA
             pt.x = LOWORD(lParam);
             pt.y = HIWORD(lParam);
             iPos = ListView_GetNextItem(GetDlgItem(hDlg, IDC_LIST_BOOKSRC), -1, LVNI_SELECTED);
-            if (iPos >= 0 && iPos < _header->book_source_count)
+            if (iPos >= 0 && iPos < _BookSources->Count())
             {
                 s_iLastPos = iPos;
                 HMENU hMenu = CreatePopupMenu();
@@ -1085,7 +1046,7 @@ static INT_PTR CALLBACK BS_DlgProc(HWND hDlg, UINT message, WPARAM wParam, LPARA
                         LoadString(hInst, IDS_MOVE_UP, str, 256);
                         InsertMenu(hMenu, (UINT)-1, MF_BYPOSITION, IDM_BS_MOVE_UP, str);
                     }
-                    if (iPos < _header->book_source_count-1)
+                    if (iPos < _BookSources->Count()-1)
                     {
                         LoadString(hInst, IDS_MOVE_DOWN, str, 256);
                         InsertMenu(hMenu, (UINT)-1, MF_BYPOSITION, IDM_BS_MOVE_DOWN, str);
@@ -1099,13 +1060,7 @@ static INT_PTR CALLBACK BS_DlgProc(HWND hDlg, UINT message, WPARAM wParam, LPARA
                         if (IDYES == MessageBox_(hDlg, IDS_DELETE_BS_CFM, IDS_WARN, MB_ICONINFORMATION | MB_YESNO))
                         {
                             // delete from data
-                            for (int i = iPos + 1; i < _header->book_source_count; i++)
-                            {
-                                book_source_t* item_1 = &_header->book_sources[i];
-                                book_source_t* item_2 = &_header->book_sources[i - 1];
-                                memcpy(item_2, item_1, sizeof(book_source_t));
-                            }
-                            _header->book_source_count--;
+                            _BookSources->Remove(iPos);
 
                             // delete from list view
                             ListView_DeleteItem(hList, iPos);
@@ -1115,13 +1070,7 @@ static INT_PTR CALLBACK BS_DlgProc(HWND hDlg, UINT message, WPARAM wParam, LPARA
                     else if (IDM_BS_MOVE_UP == ret)
                     {
                         // move up
-                        book_source_t* item = (book_source_t*)malloc(sizeof(book_source_t));
-                        book_source_t* item_1 = &_header->book_sources[iPos];
-                        book_source_t* item_2 = &_header->book_sources[iPos - 1];
-                        memcpy(item, item_1, sizeof(book_source_t));
-                        memcpy(item_1, item_2, sizeof(book_source_t));
-                        memcpy(item_2, item, sizeof(book_source_t));
-                        free(item);
+                        _BookSources->Swap(iPos, iPos - 1);
 
                         // update ui
                         ListView_DeleteAllItems(GetDlgItem(hDlg, IDC_LIST_BOOKSRC));
@@ -1130,13 +1079,7 @@ static INT_PTR CALLBACK BS_DlgProc(HWND hDlg, UINT message, WPARAM wParam, LPARA
                     else if (IDM_BS_MOVE_DOWN == ret)
                     {
                         // move down
-                        book_source_t* item = (book_source_t*)malloc(sizeof(book_source_t));
-                        book_source_t* item_1 = &_header->book_sources[iPos];
-                        book_source_t* item_2 = &_header->book_sources[iPos + 1];
-                        memcpy(item, item_1, sizeof(book_source_t));
-                        memcpy(item_1, item_2, sizeof(book_source_t));
-                        memcpy(item_2, item, sizeof(book_source_t));
-                        free(item);
+                        _BookSources->Swap(iPos, iPos + 1);
 
                         // update ui
                         ListView_DeleteAllItems(GetDlgItem(hDlg, IDC_LIST_BOOKSRC));
@@ -1146,8 +1089,7 @@ static INT_PTR CALLBACK BS_DlgProc(HWND hDlg, UINT message, WPARAM wParam, LPARA
                     {
                         if (IDYES == MessageBox_(hDlg, IDS_CLEAR_BS_CFM, IDS_WARN, MB_ICONINFORMATION | MB_YESNO))
                         {
-                            _header->book_source_count = 0;
-                            memset(_header->book_sources, 0, sizeof(_header->book_sources));
+                            _BookSources->Clear();
                             
                             // update ui
                             ListView_DeleteAllItems(GetDlgItem(hDlg, IDC_LIST_BOOKSRC));
@@ -4,6 +4,7 @@
 #include "Upgrade.h"
 #include "jsondata.h"
 #include "DPIAwareness.h"
+#include "CoverImage.h"
 #include <stdio.h>
 #include <string.h>
 #include <shlwapi.h>
@@ -11,9 +12,41 @@
 
 extern VOID GetCacheVersion(TCHAR *);
 
+static u32 cache_hash(const void *data, int size)
+{
+    const BYTE *p = (const BYTE *)data;
+    u32 hash = 2166136261u;
+    int i;
+
+    // FNV-1a
+    for (i = 0; i < size; i++)
+    {
+        hash ^= p[i];
+        hash *= 16777619u;
+    }
+    return hash;
+}
+
 Cache::Cache(const TCHAR* file)
-    : m_jsonbak(NULL)
-    , m_jsonlen(0)
+    : m_jsonlen(0)
+    , m_jsonhash(0)
+    , m_hBinFile(NULL)
+    , m_hBinMap(NULL)
+    , m_bin_view(NULL)
+    , m_bin_items(NULL)
+    , m_bin_items_size(0)
+    , m_bin_copy(NULL)
+    , m_binlen(0)
+    , m_binhash(0)
+    , m_pool(NULL)
+    , m_free(NULL)
+    , m_head(NULL)
+    , m_tail(NULL)
+    , m_hash(NULL)
+    , m_hash_size(0)
+    , m_order(NULL)
+    , m_order_size(0)
+    , m_order_dirty(TRUE)
 {
     size_t i;
     GetModuleFileName(NULL, m_file_name, sizeof(TCHAR)*(MAX_PATH-1));
@@ -27,6 +60,15 @@ Cache::Cache(const TCHAR* file)
     }
     m_buffer = NULL;
     m_size = 0;
+
+    _tcscpy(m_bin_name, m_file_name);
+    PathRenameExtension(m_bin_name, _T(".bin"));
+    _tcscpy(m_mark_dir, m_file_name);
+    PathRemoveFileSpec(m_mark_dir);
+    PathAppend(m_mark_dir, _T("marks"));
+    _tcscpy(m_thumb_dir, m_file_name);
+    PathRemoveFileSpec(m_thumb_dir);
+    PathAppend(m_thumb_dir, _T("thumbs"));
 }
 
 
@@ -38,6 +80,8 @@ Cache::~Cache(void)
         m_buffer = NULL;
     }
     m_size = 0;
+    close_bin();
+    release_items();
 }
 
 BOOL Cache::init()
@@ -45,6 +89,13 @@ BOOL Cache::init()
     void* json = NULL;
     int size = 0;
     header_t *header = NULL;
+    item_t *items = NULL;
+    item_t *item = NULL;
+    int i, count;
+
+    // the binary copy needs no parsing, items are decoded on first use
+    if (load_bin())
+        return TRUE;
 
     if (!PathFileExists(m_file_name)) // not exist
     {
@@ -53,17 +104,11 @@ BOOL Cache::init()
     }
     else
     {
-        if (read(&json, &size))
+        if (read(m_file_name, &json, &size))
         {
-            // backup file data
-            if (m_jsonbak)
-            {
-                free(m_jsonbak);
-                m_jsonbak = NULL;
-            }
+            // checksum of file data
             m_jsonlen = size;
-            m_jsonbak = malloc(m_jsonlen);
-            memcpy(m_jsonbak, json, m_jsonlen);
+            m_jsonhash = cache_hash(json, size);
 
             header = (header_t*)malloc(sizeof(header_t));
             // parser json string
@@ -80,9 +125,34 @@ BOOL Cache::init()
                 }
                 ((char*)json)[size] = 0;
             }
-            parser_json((const char *)json, header, &m_buffer, &m_size);
+            parser_json((const char *)json, header, &m_buffer, &m_size, &items, &m_sources);
             free(json);
             free(header);
+
+            // adopt the parsed items into records, keeping the saved order
+            header = get_header();
+            count = header->item_count;
+            header->item_count = 0;
+            for (i = 0; i < count; i++)
+            {
+                if (!items[i].file_name || find_item(items[i].file_name) || !(item = alloc_item()))
+                {
+                    free(items[i].file_name);
+                    free(items[i].mark);
+                    continue;
+                }
+                item->index = items[i].index;
+                item->file_name = items[i].file_name;
+                item->mark_size = items[i].mark_size;
+                item->mark_cap = items[i].mark_cap;
+                item->mark = items[i].mark;
+                item->is_new = items[i].is_new;
+                hash_insert(item);
+                link_item(item, FALSE);
+                header->item_count++;
+            }
+            if (items)
+                free(items);
             return TRUE;
         }
         return FALSE;
@@ -97,59 +167,65 @@ BOOL Cache::exit()
 
     if (m_buffer)
     {
-        result = save();
+        result = save_json();
 
         // free
         free(m_buffer);
         m_buffer = NULL;
         m_size = 0;
     }
-
-    if (m_jsonbak)
-    {
-        free(m_jsonbak);
-        m_jsonbak = NULL;
-        m_jsonlen = 0;
-    }
+    close_bin();
+    release_items();
+    m_marks.Close();
+    m_jsonlen = 0;
+    m_jsonhash = 0;
 
     return result;
 }
 
 BOOL Cache::save()
+{
+    // only the binary copy while running, it is stamped with the json file
+    // and there is none yet on the first run
+    if (!PathFileExists(m_file_name))
+        return save_json();
+    return save_bin();
+}
+
+BOOL Cache::save_json(void)
 {
     BOOL result = FALSE;
     char* json = NULL;
     int size = 0;
+    u32 hash;
 
-    json = create_json(get_header());
+    load_items();
+    update_order();
+    json = create_json(get_header(), m_order, &m_sources);
     if (json)
     {
         size = (int)strlen(json);
         encode(json, size);
+        hash = cache_hash(json, size);
 
         // check if data is changed
-        if (size != m_jsonlen
-            || 0 != memcmp(m_jsonbak, json, m_jsonlen))
+        if (size != m_jsonlen || hash != m_jsonhash)
         {
-            result = write(json, size);
-
-            // backup
-            if (size != m_jsonlen)
+            result = write(m_file_name, json, size);
+            if (result)
             {
                 m_jsonlen = size;
-                m_jsonbak = realloc(m_jsonbak, m_jsonlen);
-                if (!m_jsonbak)
-                {
-                    m_jsonlen = 0;
-                }
+                m_jsonhash = hash;
             }
-            if (m_jsonbak)
-                memcpy(m_jsonbak, json, m_jsonlen);
         }
         else
         {
             result = TRUE; // no change, don't need write file
         }
+
+        // stamped with the json file written, or brought up to date
+        if (result)
+            save_bin();
     }
     create_json_free(json);
     return result;
@@ -163,36 +239,40 @@ header_t* Cache::get_header()
 item_t* Cache::get_item(int item_id)
 {
     header_t* header = get_header();
-    int offset = sizeof(header_t) + item_id*sizeof(item_t);
-    if (item_id >= header->item_count)
+    load_items();
+    if (item_id < 0 || item_id >= header->item_count)
         return NULL;
-    return (item_t*)((char*)m_buffer + offset);
+    if (!update_order())
+        return NULL;
+    return m_order[item_id];
 }
 
 item_t* Cache::open_item(int item_id)
+{
+    return open_item(get_item(item_id));
+}
+
+item_t* Cache::open_item(item_t* item)
 {
     header_t* header = get_header();
-    item_t* item = get_item(item_id);
 
-    // move to index 0
-    move_item(item->id, 0);
-    item = get_item(0);
+    if (!item)
+        return NULL;
 
-    if (header && item)
+    // move to index 0
+    if (item != m_head)
     {
-        header->item_id = item_id;
+        unlink_item(item);
+        link_item(item, TRUE);
     }
-
+    header->item_id = 0;
     return item;
 }
 
 item_t* Cache::new_item(TCHAR* file_name)
 {
-    header_t* header = NULL;
+    header_t* header = get_header();
     item_t* item = find_item(file_name);
-    
-    int item_id = -1;
-    void *oldAddr = NULL;
 
     // already exist
     if (item)
@@ -202,41 +282,36 @@ item_t* Cache::new_item(TCHAR* file_name)
     }
 
     // new item
-    oldAddr = m_buffer;
-    m_buffer = realloc(m_buffer, m_size+sizeof(item_t));
-    if (!m_buffer)
+    item = alloc_item();
+    if (!item)
         return NULL;
-    if (oldAddr != m_buffer)
-        update_addr();
-    m_size += sizeof(item_t);
-    header = get_header();
-    item_id = header->item_count++;
-
-    // init item
-    item = get_item(item_id);
-    memset(item, 0, sizeof(item_t));
-    item->id = item_id;
-    memcpy(item->file_name, file_name, sizeof(TCHAR) * (_tcslen(file_name) + 1));
+    item->file_name = _tcsdup(file_name);
+    if (!item->file_name)
+    {
+        free_item(item);
+        return NULL;
+    }
+    hash_insert(item);
 
     // move to index 0
-    move_item(item->id, 0);
-    item = get_item(0);
-
+    link_item(item, TRUE);
+    header->item_count++;
     return item;
 }
 
 item_t* Cache::find_item(TCHAR* file_name)
 {
-    header_t* header = get_header();
     item_t* item = NULL;
+    u32 hash;
 
-    if (header->item_count <= 0)
+    load_items();
+    if (!m_hash)
         return NULL;
 
-    for (int i=0; i<header->item_count; i++)
+    hash = hash_path(file_name);
+    for (item = m_hash[hash & (m_hash_size - 1)]; item; item = item->hash_next)
     {
-        item = get_item(i);
-        if (0 == _tcscmp(item->file_name, file_name))
+        if (item->hash == hash && 0 == _tcscmp(item->file_name, file_name))
         {
             return item;
         }
@@ -251,22 +326,33 @@ BOOL Cache::delete_item(int item_id)
     if (!item)
         return FALSE;
 
-    for (int i=item_id+1; i<header->item_count; i++)
-    {
-        item_t* item_1 = get_item(i);
-        item_t* item_2 = get_item(i-1);
-        item_1->id--;
-        memcpy(item_2, item_1, sizeof(item_t));
-    }
+    // bookmarks go with the item
+    if (m_marks.IsOpen(item->file_name))
+        m_marks.Close();
+    MarkStore::Delete(m_mark_dir, item->file_name, item->hash);
+    CoverImage::DeleteThumb(m_thumb_dir, item->file_name, item->hash);
+
+    hash_remove(item);
+    unlink_item(item);
+    free_item(item);
     header->item_count--;
-    m_size -= sizeof(item_t);
     return TRUE;
 }
 
 BOOL Cache::delete_all_item(void)
 {
     header_t* header = get_header();
+    item_t* item;
+
+    load_items();
+    m_marks.Close();
+    for (item = m_head; item; item = item->next)
+    {
+        MarkStore::Delete(m_mark_dir, item->file_name, item->hash);
+        CoverImage::DeleteThumb(m_thumb_dir, item->file_name, item->hash);
+    }
 
+    release_items();
     header->item_count = 0;
     header->item_id = -1;
     m_size = sizeof(header_t);
@@ -296,6 +382,11 @@ header_t* Cache::default_header()
     return header;
 }
 
+BookSources* Cache::get_book_sources()
+{
+    return &m_sources;
+}
+
 void Cache::default_header(header_t* header)
 {
     // default font
@@ -422,88 +513,609 @@ void Cache::default_header(header_t* header)
 #endif
 }
 
-BOOL Cache::add_mark(item_t *item, int value)
+MarkStore* Cache::open_marks(item_t* item)
 {
     int i;
 
     if (!item)
-        return FALSE;
-    if (item->mark_size >= MAX_MARK_COUNT)
-        return FALSE;
-    for (i=0; i<item->mark_size; i++)
+        return NULL;
+    if (m_marks.IsOpen(item->file_name))
+        return &m_marks;
+    if (!m_marks.Open(m_mark_dir, item->file_name, item->hash))
+        return NULL;
+
+    // older versions saved the marks in the cache file, move them out
+    if (item->mark_size > 0)
     {
-        if (value == item->mark[i])
-            return FALSE;
+        for (i = 0; i < item->mark_size; i++)
+            m_marks.Add(item->mark[i]);
+        free(item->mark);
+        item->mark = NULL;
+        item->mark_size = 0;
+        item->mark_cap = 0;
     }
-    item->mark[item->mark_size] = value;
-    item->mark_size++;
-    return TRUE;
+    return &m_marks;
+}
+
+BOOL Cache::add_mark(item_t *item, int value)
+{
+    MarkStore* marks = open_marks(item);
+
+    if (!marks)
+        return FALSE;
+    return marks->Add(value);
 }
 
 BOOL Cache::del_mark(item_t *item, int index)
 {
-    if (!item)
+    MarkStore* marks = open_marks(item);
+
+    if (!marks)
         return FALSE;
-    if (item->mark_size <= 0)
+    return marks->Remove(index);
+}
+
+int Cache::get_mark_count(item_t *item)
+{
+    MarkStore* marks = open_marks(item);
+
+    if (!marks)
+        return 0;
+    return marks->Count();
+}
+
+int Cache::get_mark(item_t *item, int index)
+{
+    MarkStore* marks = open_marks(item);
+
+    if (!marks)
+        return 0;
+    return marks->Get(index);
+}
+
+void Cache::shift_mark(item_t *item, int index, int size)
+{
+    MarkStore* marks = open_marks(item);
+
+    if (marks)
+        marks->Shift(index, size);
+}
+
+BOOL Cache::save_thumb(item_t *item, Gdiplus::Bitmap *cover)
+{
+    if (!item || !cover)
         return FALSE;
-    if (index >= item->mark_size)
+    return CoverImage::SaveThumb(m_thumb_dir, item->file_name, item->hash, cover);
+}
+
+HBITMAP Cache::load_thumb(item_t *item)
+{
+    if (!item)
+        return NULL;
+    return CoverImage::LoadThumb(m_thumb_dir, item->file_name, item->hash);
+}
+
+item_t* Cache::alloc_item(void)
+{
+    item_pool_t* pool = NULL;
+    item_t* item = NULL;
+    int i;
+
+    if (!m_free)
+    {
+        pool = (item_pool_t*)calloc(1, sizeof(item_pool_t));
+        if (!pool)
+            return NULL;
+        pool->next = m_pool;
+        m_pool = pool;
+        for (i = ITEM_POOL_SIZE - 1; i >= 0; i--)
+        {
+            pool->items[i].next = m_free;
+            m_free = &pool->items[i];
+        }
+    }
+
+    item = m_free;
+    m_free = item->next;
+
+    // the strings of a deleted record are kept until it is reused
+    if (item->file_name)
+        free(item->file_name);
+    if (item->mark)
+        free(item->mark);
+    memset(item, 0, sizeof(item_t));
+    return item;
+}
+
+void Cache::free_item(item_t* item)
+{
+    item->prev = NULL;
+    item->hash_next = NULL;
+    item->next = m_free;
+    m_free = item;
+}
+
+void Cache::release_items(void)
+{
+    item_pool_t* pool = NULL;
+    int i;
+
+    while (m_pool)
+    {
+        pool = m_pool;
+        m_pool = pool->next;
+        for (i = 0; i < ITEM_POOL_SIZE; i++)
+        {
+            if (pool->items[i].file_name)
+                free(pool->items[i].file_name);
+            if (pool->items[i].mark)
+                free(pool->items[i].mark);
+        }
+        free(pool);
+    }
+    if (m_hash)
+        free(m_hash);
+    if (m_order)
+        free(m_order);
+    m_free = NULL;
+    m_head = NULL;
+    m_tail = NULL;
+    m_hash = NULL;
+    m_hash_size = 0;
+    m_order = NULL;
+    m_order_size = 0;
+    m_order_dirty = TRUE;
+}
+
+void Cache::link_item(item_t* item, BOOL front)
+{
+    if (front)
+    {
+        item->prev = NULL;
+        item->next = m_head;
+        if (m_head)
+            m_head->prev = item;
+        else
+            m_tail = item;
+        m_head = item;
+    }
+    else
+    {
+        item->next = NULL;
+        item->prev = m_tail;
+        if (m_tail)
+            m_tail->next = item;
+        else
+            m_head = item;
+        m_tail = item;
+    }
+    m_order_dirty = TRUE;
+}
+
+void Cache::unlink_item(item_t* item)
+{
+    if (item->prev)
+        item->prev->next = item->next;
+    else
+        m_head = item->next;
+    if (item->next)
+        item->next->prev = item->prev;
+    else
+        m_tail = item->prev;
+    item->prev = NULL;
+    item->next = NULL;
+    m_order_dirty = TRUE;
+}
+
+u32 Cache::hash_path(const TCHAR* file_name)
+{
+    u32 hash = 2166136261u;
+
+    // FNV-1a
+    while (*file_name)
+    {
+        hash ^= (u32)*file_name++;
+        hash *= 16777619u;
+    }
+    return hash;
+}
+
+void Cache::hash_insert(item_t* item)
+{
+    item_t** bucket;
+
+    if (get_header()->item_count >= m_hash_size)
+        hash_grow();
+    if (!m_hash)
+        return;
+
+    item->hash = hash_path(item->file_name);
+    bucket = &m_hash[item->hash & (m_hash_size - 1)];
+    item->hash_next = *bucket;
+    *bucket = item;
+}
+
+void Cache::hash_remove(item_t* item)
+{
+    item_t** pp;
+
+    if (!m_hash)
+        return;
+
+    for (pp = &m_hash[item->hash & (m_hash_size - 1)]; *pp; pp = &(*pp)->hash_next)
+    {
+        if (*pp == item)
+        {
+            *pp = item->hash_next;
+            item->hash_next = NULL;
+            break;
+        }
+    }
+}
+
+BOOL Cache::hash_grow(void)
+{
+    item_t** table;
+    item_t* item;
+    int size;
+
+    size = m_hash_size ? m_hash_size * 2 : ITEM_HASH_SIZE;
+    table = (item_t**)calloc(size, sizeof(item_t*));
+    if (!table)
         return FALSE;
 
-    // delete
-    if (item->mark_size - index - 1 > 0)
+    // rehash every linked record, hash values are kept in the records
+    for (item = m_head; item; item = item->next)
     {
-        memcpy(item->mark+index, item->mark+index+1, (item->mark_size-index-1)*sizeof(int));
+        item->hash_next = table[item->hash & (size - 1)];
+        table[item->hash & (size - 1)] = item;
     }
-    item->mark_size--;
-    item->mark[item->mark_size] = 0;
+    if (m_hash)
+        free(m_hash);
+    m_hash = table;
+    m_hash_size = size;
     return TRUE;
 }
 
-BOOL Cache::move_item(int from, int to)
+BOOL Cache::update_order(void)
 {
-    // from and to is exist
-    item_t temp = {0};
-    item_t* from_item = get_item(from);
-    item_t* to_item = get_item(to);
-    if (!from_item || !to_item)
+    header_t* header = get_header();
+    item_t** order;
+    item_t* item;
+    int i;
+
+    if (!m_order_dirty)
+        return TRUE;
+
+    if (header->item_count > m_order_size)
     {
-        return FALSE;
+        order = (item_t**)realloc(m_order, header->item_count * sizeof(item_t*));
+        if (!order)
+            return FALSE;
+        m_order = order;
+        m_order_size = header->item_count;
     }
 
-    if (from == to)
+    for (i = 0, item = m_head; item && i < header->item_count; i++, item = item->next)
     {
-        return TRUE;
+        item->id = i;
+        m_order[i] = item;
     }
-    else if (from > to)
+    m_order_dirty = FALSE;
+    return TRUE;
+}
+
+void Cache::load_items(void)
+{
+    header_t* header = get_header();
+    const BYTE* p = m_bin_items;
+    const BYTE* end = m_bin_items + m_bin_items_size;
+    cache_bin_item_t bi;
+    item_t* item;
+    u32 name_size, mark_size;
+    int i, count;
+
+    if (!m_bin_items)
+        return;
+    m_bin_items = NULL;
+
+    count = header->item_count;
+    header->item_count = 0;
+    for (i = 0; i < count; i++)
     {
-        memcpy(&temp, from_item, sizeof(item_t));
-        for (int i=from-1; i>=to; i--)
+        if ((u32)(end - p) < sizeof(cache_bin_item_t))
+            break;
+        memcpy(&bi, p, sizeof(cache_bin_item_t));
+        decode(&bi, sizeof(cache_bin_item_t));
+        p += sizeof(cache_bin_item_t);
+
+        if (bi.name_len == 0 || bi.name_len >= MAX_PATH || bi.mark_size > MAX_MARK_COUNT)
+            break;
+        name_size = bi.name_len * sizeof(TCHAR);
+        mark_size = bi.mark_size * sizeof(int);
+        if ((u32)(end - p) < CACHE_BIN_ALIGN(name_size) + mark_size)
+            break;
+
+        item = alloc_item();
+        if (!item)
+            break;
+        item->file_name = (TCHAR*)malloc(name_size + sizeof(TCHAR));
+        if (!item->file_name)
         {
-            item_t* item_1 = get_item(i);
-            item_t* item_2 = get_item(i+1);
-            item_1->id++;
-            memcpy(item_2, item_1, sizeof(item_t));
+            free_item(item);
+            break;
         }
-        temp.id = to;
-        memcpy(to_item, &temp, sizeof(item_t));
+        memcpy(item->file_name, p, name_size);
+        decode(item->file_name, name_size);
+        item->file_name[bi.name_len] = 0;
+        p += CACHE_BIN_ALIGN(name_size);
+
+        if (bi.mark_size)
+        {
+            item->mark = (int*)malloc(mark_size);
+            if (item->mark)
+            {
+                memcpy(item->mark, p, mark_size);
+                decode(item->mark, mark_size);
+                item->mark_size = bi.mark_size;
+                item->mark_cap = bi.mark_size;
+            }
+        }
+        p += mark_size;
+
+        item->index = bi.index;
+        item->is_new = bi.is_new;
+        hash_insert(item);
+        link_item(item, FALSE);
+        header->item_count++;
     }
-    else
+    close_bin();
+}
+
+BOOL Cache::load_bin(void)
+{
+    WIN32_FILE_ATTRIBUTE_DATA attr;
+    TCHAR version[16] = { 0 };
+    cache_bin_header_t* bh;
+    cache_bin_section_t* sec;
+    header_t* header;
+    BYTE* sources;
+    BOOL valid;
+    DWORD size;
+    int i;
+
+    if (!GetFileAttributesEx(m_file_name, GetFileExInfoStandard, &attr))
+        return FALSE;
+
+    m_hBinFile = CreateFile(m_bin_name, GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_ATTRIBUTE_HIDDEN, NULL);
+    if (m_hBinFile == INVALID_HANDLE_VALUE)
+    {
+        m_hBinFile = NULL;
+        return FALSE;
+    }
+    size = GetFileSize(m_hBinFile, NULL);
+    if (size == INVALID_FILE_SIZE || size < sizeof(cache_bin_header_t) + cs_count * sizeof(cache_bin_section_t))
+        goto _fail;
+    m_hBinMap = CreateFileMapping(m_hBinFile, NULL, PAGE_READONLY, 0, 0, NULL);
+    if (!m_hBinMap)
+        goto _fail;
+    m_bin_view = (BYTE*)MapViewOfFile(m_hBinMap, FILE_MAP_READ, 0, 0, 0);
+    if (!m_bin_view)
+        goto _fail;
+
+    // written by this build for the current json file
+    bh = (cache_bin_header_t*)m_bin_view;
+    GetCacheVersion(version);
+    if (bh->magic != CACHE_BIN_MAGIC
+        || bh->version != CACHE_BIN_VERSION
+        || memcmp(bh->app_version, version, sizeof(version)) != 0
+        || bh->settings_size != CACHE_SETTINGS_SIZE
+        || bh->source_size != sizeof(book_source_t)
+        || bh->section_count != cs_count
+        || bh->json_size != attr.nFileSizeLow || attr.nFileSizeHigh
+        || CompareFileTime(&bh->json_time, &attr.ftLastWriteTime) != 0)
+        goto _fail;
+
+    sec = (cache_bin_section_t*)(bh + 1);
+    for (i = 0; i < cs_count; i++)
+    {
+        if (sec[i].id != (u32)i || sec[i].offset > size || sec[i].size > size - sec[i].offset)
+            goto _fail;
+    }
+    if (sec[cs_settings].size != CACHE_SETTINGS_SIZE
+        || sec[cs_items].count > IDM_OPEN_END - IDM_OPEN_BEGIN + 1)
+        goto _fail;
+
+    // sources are checked field by field while unpacking
+    sources = (BYTE*)malloc(sec[cs_sources].size + 1);
+    if (!sources)
+        goto _fail;
+    memcpy(sources, m_bin_view + sec[cs_sources].offset, sec[cs_sources].size);
+    decode(sources, sec[cs_sources].size);
+    valid = m_sources.Unpack(sources, sec[cs_sources].size, sec[cs_sources].count);
+    free(sources);
+    if (!valid)
+        goto _fail;
+
+    m_buffer = calloc(1, sizeof(header_t));
+    if (!m_buffer)
+        goto _fail;
+    m_size = sizeof(header_t);
+    header = get_header();
+    memcpy(header, m_bin_view + sec[cs_settings].offset, sec[cs_settings].size);
+    decode(header, sec[cs_settings].size);
+    header->item_count = sec[cs_items].count;
+
+    m_jsonlen = bh->json_size;
+    m_jsonhash = bh->json_hash;
+    m_binlen = size;
+    m_binhash = cache_hash(m_bin_view, size);
+
+    // keep the view until the items are needed
+    m_bin_items = m_bin_view + sec[cs_items].offset;
+    m_bin_items_size = sec[cs_items].size;
+    if (header->item_count == 0)
+        load_items();
+    return TRUE;
+
+_fail:
+    close_bin();
+    m_sources.Clear();
+    return FALSE;
+}
+
+BOOL Cache::save_bin(void)
+{
+    WIN32_FILE_ATTRIBUTE_DATA attr;
+    header_t* header = get_header();
+    cache_bin_header_t* bh;
+    cache_bin_section_t* sec;
+    cache_bin_item_t* bi;
+    item_t* item;
+    BYTE* data;
+    BYTE* p;
+    u32 size, name_size, source_size, hash;
+    BOOL result = TRUE;
+
+    if (!GetFileAttributesEx(m_file_name, GetFileExInfoStandard, &attr))
+        return FALSE;
+    // items not decoded yet are written back as they were read
+    if (!detach_bin())
+        return FALSE;
+
+    source_size = m_sources.Pack(NULL);
+    size = sizeof(cache_bin_header_t) + cs_count * sizeof(cache_bin_section_t)
+        + CACHE_SETTINGS_SIZE + source_size;
+    if (m_bin_items)
+        size += m_bin_items_size;
+    for (item = m_head; item; item = item->next)
+    {
+        size += sizeof(cache_bin_item_t) + CACHE_BIN_ALIGN((u32)_tcslen(item->file_name) * sizeof(TCHAR))
+            + item->mark_size * sizeof(int);
+    }
+    data = (BYTE*)calloc(1, size);
+    if (!data)
+        return FALSE;
+
+    bh = (cache_bin_header_t*)data;
+    bh->magic = CACHE_BIN_MAGIC;
+    bh->version = CACHE_BIN_VERSION;
+    GetCacheVersion(bh->app_version);
+    bh->settings_size = CACHE_SETTINGS_SIZE;
+    bh->source_size = sizeof(book_source_t);
+    bh->json_size = attr.nFileSizeLow;
+    bh->json_hash = m_jsonhash;
+    bh->json_time = attr.ftLastWriteTime;
+    bh->section_count = cs_count;
+    sec = (cache_bin_section_t*)(bh + 1);
+    p = (BYTE*)(sec + cs_count);
+
+    sec[cs_settings].id = cs_settings;
+    sec[cs_settings].offset = (u32)(p - data);
+    sec[cs_settings].size = CACHE_SETTINGS_SIZE;
+    sec[cs_settings].count = 1;
+    memcpy(p, header, CACHE_SETTINGS_SIZE);
+    p += CACHE_SETTINGS_SIZE;
+
+    sec[cs_sources].id = cs_sources;
+    sec[cs_sources].offset = (u32)(p - data);
+    sec[cs_sources].size = m_sources.Pack(p);
+    sec[cs_sources].count = m_sources.Count();
+    p += source_size;
+
+    sec[cs_items].id = cs_items;
+    sec[cs_items].offset = (u32)(p - data);
+    sec[cs_items].count = header->item_count;
+    if (m_bin_items)
     {
-        memcpy(&temp, from_item, sizeof(item_t));
-        for (int i=from+1; i<to; i++)
+        memcpy(p, m_bin_items, m_bin_items_size);
+        p += m_bin_items_size;
+    }
+    for (item = m_head; item; item = item->next)
+    {
+        bi = (cache_bin_item_t*)p;
+        bi->index = item->index;
+        bi->is_new = item->is_new;
+        bi->name_len = (u32)_tcslen(item->file_name);
+        bi->mark_size = item->mark_size;
+        p += sizeof(cache_bin_item_t);
+        name_size = bi->name_len * sizeof(TCHAR);
+        memcpy(p, item->file_name, name_size);
+        p += CACHE_BIN_ALIGN(name_size);
+        memcpy(p, item->mark, item->mark_size * sizeof(int));
+        p += item->mark_size * sizeof(int);
+    }
+    sec[cs_items].size = (u32)(p - data) - sec[cs_items].offset;
+
+    // the items copied back are encoded already
+    encode(data + sec[cs_settings].offset, sec[cs_items].offset - sec[cs_settings].offset);
+    if (!m_bin_items)
+        encode(data + sec[cs_items].offset, sec[cs_items].size);
+
+    // nothing changed since it was read or last written
+    hash = cache_hash(data, size);
+    if (size != m_binlen || hash != m_binhash)
+    {
+        result = write(m_bin_name, data, size);
+        if (result)
         {
-            item_t* item_1 = get_item(i);
-            item_t* item_2 = get_item(i-1);
-            item_1->id--;
-            memcpy(item_2, item_1, sizeof(item_t));
+            m_binlen = size;
+            m_binhash = hash;
         }
-        temp.id = to;
-        memcpy(to_item, &temp, sizeof(item_t));
     }
+    free(data);
+    return result;
+}
+
+BOOL Cache::detach_bin(void)
+{
+    BYTE* items = NULL;
+    u32 size = m_bin_items_size;
+
+    // the view keeps the file from being rewritten
+    if (!m_bin_view)
+        return TRUE;
+    if (m_bin_items)
+    {
+        items = (BYTE*)malloc(size + 1);
+        if (!items)
+            return FALSE;
+        memcpy(items, m_bin_items, size);
+    }
+    close_bin();
+    m_bin_copy = items;
+    m_bin_items = items;
+    m_bin_items_size = size;
     return TRUE;
 }
 
-BOOL Cache::read(void** data, int* size)
+void Cache::close_bin(void)
+{
+    m_bin_items = NULL;
+    m_bin_items_size = 0;
+    if (m_bin_copy)
+    {
+        free(m_bin_copy);
+        m_bin_copy = NULL;
+    }
+    if (m_bin_view)
+    {
+        UnmapViewOfFile(m_bin_view);
+        m_bin_view = NULL;
+    }
+    if (m_hBinMap)
+    {
+        CloseHandle(m_hBinMap);
+        m_hBinMap = NULL;
+    }
+    if (m_hBinFile)
+    {
+        CloseHandle(m_hBinFile);
+        m_hBinFile = NULL;
+    }
+}
+
+BOOL Cache::read(const TCHAR* file, void** data, int* size)
 {
     HANDLE hFile = NULL;
     BOOL bErrorFlag = FALSE;
@@ -512,7 +1124,7 @@ BOOL Cache::read(void** data, int* size)
 
     *data = NULL;
     *size = 0;
-    hFile = CreateFile(m_file_name,                // file to open
+    hFile = CreateFile(file,                // file to open
         GENERIC_READ,          // open for reading
         FILE_SHARE_READ,       // share for reading
         NULL,                  // default security
@@ -568,13 +1180,13 @@ BOOL Cache::read(void** data, int* size)
     return TRUE;
 }
 
-BOOL Cache::write(void* data, int size)
+BOOL Cache::write(const TCHAR* file, void* data, int size)
 {
     HANDLE hFile = NULL;
     BOOL bErrorFlag = FALSE;
     DWORD dwBytesWritten = 0;
 
-    hFile = CreateFile(m_file_name,                // name of the write
+    hFile = CreateFile(file,                // name of the write
         GENERIC_WRITE,          // open for writing
         0,                      // do not share
         NULL,                   // default security
@@ -611,15 +1223,6 @@ BOOL Cache::write(void* data, int size)
     return TRUE;
 }
 
-void Cache::update_addr(void)
-{
-    header_t* header = NULL;
-
-    header = (header_t*)m_buffer;
-
-    KS_UpdateKeyset(header->keyset);
-}
-
 void Cache::encode(void* data, int size)
 {
 //#ifndef _DEBUG
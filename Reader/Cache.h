@@ -2,6 +2,64 @@
 #define __CACHE_H__
 
 #include "types.h"
+#include "MarkStore.h"
+#include "BookSources.h"
+
+#define ITEM_POOL_SIZE      64
+#define ITEM_HASH_SIZE      64
+
+#define CACHE_BIN_MAGIC     0x42434452  // "RDCB"
+#define CACHE_BIN_VERSION   2
+#define CACHE_SETTINGS_SIZE ((u32)sizeof(header_t))
+#define CACHE_BIN_ALIGN(n)  (((n) + 3) & ~3)
+
+typedef enum cache_section_id_t
+{
+    cs_settings = 0,    // header_t
+    cs_sources,         // BookSources::Pack, count entries
+    cs_items,           // cache_bin_item_t records, most recently opened first
+    cs_count
+} cache_section_id_t;
+
+// Binary copy of the json cache file, written on every save that changes it,
+// while the json file is written on exit. Sections are raw structs, so the file
+// is only used by the build that wrote it and while the json file is unchanged,
+// otherwise the json is imported.
+typedef struct cache_bin_header_t
+{
+    u32 magic;
+    u32 version;
+    TCHAR app_version[16];
+    u32 settings_size;
+    u32 source_size;
+    u32 json_size;
+    u32 json_hash;
+    FILETIME json_time;
+    u32 section_count;
+} cache_bin_header_t;
+
+typedef struct cache_bin_section_t
+{
+    u32 id;
+    u32 offset;
+    u32 size;
+    u32 count;
+} cache_bin_section_t;
+
+typedef struct cache_bin_item_t
+{
+    int index;
+    int is_new;
+    u32 name_len;       // characters, not terminated, padded to 4 bytes
+    u32 mark_size;      // marks follow the name
+} cache_bin_item_t;
+
+// records are never moved, item_t pointers stay valid until the record is deleted
+typedef struct item_pool_t
+{
+    struct item_pool_t *next;
+    item_t items[ITEM_POOL_SIZE];
+} item_pool_t;
 
 class Cache
 {
@@ -15,20 +73,42 @@ public:
     header_t* get_header();
     item_t* get_item(int item_id);
     item_t* open_item(int item_id);
+    item_t* open_item(item_t* item);
     item_t* new_item(TCHAR* file_name);
     item_t* find_item(TCHAR* file_name);
     BOOL delete_item(int item_id);
     BOOL delete_all_item(void);
     header_t* default_header();
+    BookSources* get_book_sources();
     BOOL add_mark(item_t *item, int value);
     BOOL del_mark(item_t *item, int index);
+    int  get_mark_count(item_t *item);
+    int  get_mark(item_t *item, int index);
+    void shift_mark(item_t *item, int index, int size);
+    BOOL save_thumb(item_t *item, Gdiplus::Bitmap *cover);
+    HBITMAP load_thumb(item_t *item);
 
 private:
     void default_header(header_t* header);
-    BOOL move_item(int from, int to);
-    BOOL read(void **data, int *size);
-    BOOL write(void *data, int size);
-    void update_addr(void);
+    item_t* alloc_item(void);
+    void free_item(item_t* item);
+    void release_items(void);
+    MarkStore* open_marks(item_t* item);
+    void load_items(void);
+    BOOL load_bin(void);
+    BOOL save_bin(void);
+    BOOL save_json(void);
+    BOOL detach_bin(void);
+    void close_bin(void);
+    void link_item(item_t* item, BOOL front);
+    void unlink_item(item_t* item);
+    u32  hash_path(const TCHAR* file_name);
+    void hash_insert(item_t* item);
+    void hash_remove(item_t* item);
+    BOOL hash_grow(void);
+    BOOL update_order(void);
+    BOOL read(const TCHAR* file, void **data, int *size);
+    BOOL write(const TCHAR* file, void *data, int size);
     void encode(void *data, int size);
     void decode(void* data, int size);
 
@@ -36,8 +116,30 @@ private:
     TCHAR m_file_name[MAX_PATH];
     void* m_buffer;
     int   m_size;
-    void* m_jsonbak;
     int   m_jsonlen;
+    u32   m_jsonhash;       // of the encoded json last read or written
+    TCHAR m_bin_name[MAX_PATH];
+    HANDLE m_hBinFile;
+    HANDLE m_hBinMap;
+    BYTE* m_bin_view;
+    const BYTE* m_bin_items;    // items section not decoded yet
+    u32   m_bin_items_size;
+    BYTE* m_bin_copy;       // m_bin_items copied out of the view, the file can be rewritten
+    u32   m_binlen;         // of the binary file last read or written
+    u32   m_binhash;
+    item_pool_t* m_pool;
+    item_t* m_free;         // deleted records, linked by next
+    item_t* m_head;         // recent list, most recently opened first
+    item_t* m_tail;
+    item_t** m_hash;        // path index, chained by hash_next
+    int   m_hash_size;
+    item_t** m_order;       // position table of get_item, rebuilt when the list changes
+    int   m_order_size;
+    BOOL  m_order_dirty;
+    TCHAR m_mark_dir[MAX_PATH];
+    TCHAR m_thumb_dir[MAX_PATH];    // recent list cover thumbnails
+    MarkStore m_marks;      // bookmarks of the last item asked for
+    BookSources m_sources;
 };
 
 #endif
\ No newline at end of file
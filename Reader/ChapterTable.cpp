@@ -0,0 +1,295 @@
+#include "ChapterTable.h"
+
+#define CHAPTER_URL_RESTART     16
+#define MAX_URL_PREFIX          0xFFFF
+
+// url node: u32 prev node | u16 prefix length | u16 suffix length | suffix '\0'
+#define URL_NODE_HEAD           (sizeof(u32) + sizeof(unsigned short) * 2)
+
+ChapterTable::ChapterTable()
+    : m_LastNode(CHAPTER_NO_URL)
+    , m_Run(0)
+{
+}
+
+ChapterTable::~ChapterTable()
+{
+}
+
+ChapterTable::ChapterTable(ChapterTable &&other)
+    : m_Items(std::move(other.m_Items))
+    , m_Titles(std::move(other.m_Titles))
+    , m_Urls(std::move(other.m_Urls))
+    , m_LastUrl(std::move(other.m_LastUrl))
+    , m_LastNode(other.m_LastNode)
+    , m_Run(other.m_Run)
+{
+    other.clear();
+}
+
+ChapterTable& ChapterTable::operator=(ChapterTable &&other)
+{
+    if (this != &other)
+    {
+        m_Items = std::move(other.m_Items);
+        m_Titles = std::move(other.m_Titles);
+        m_Urls = std::move(other.m_Urls);
+        m_LastUrl = std::move(other.m_LastUrl);
+        m_LastNode = other.m_LastNode;
+        m_Run = other.m_Run;
+        other.clear();
+    }
+    return *this;
+}
+
+void ChapterTable::clear(void)
+{
+    m_Items.clear();
+    m_Titles.clear();
+    m_Urls.clear();
+    m_LastUrl.clear();
+    m_LastNode = CHAPTER_NO_URL;
+    m_Run = 0;
+}
+
+void ChapterTable::reserve(size_t count, size_t title_chars)
+{
+    m_Items.reserve(count);
+    m_Titles.reserve(title_chars + count);
+}
+
+void ChapterTable::push_back(int index, const wchar_t *title, int title_len, const char *url, int size)
+{
+    chapter_item_t item;
+
+    item.index = index;
+    item.size = size;
+    item.title_len = title_len;
+    item.title = add_title(title, title_len);
+    item.url = add_url(url, FALSE);
+    m_Items.push_back(item);
+}
+
+void ChapterTable::append(const ChapterTable &src, int i)
+{
+    const chapter_item_t &item = src.m_Items[i];
+    std::string url;
+
+    if (item.url != CHAPTER_NO_URL)
+        url = src.url(i);
+    push_back(item.index, src.title(i), item.title_len, item.url != CHAPTER_NO_URL ? url.c_str() : NULL, item.size);
+}
+
+void ChapterTable::set(int i, const wchar_t *title, int title_len, const char *url)
+{
+    // old data stay in the pools, nodes are never rewritten
+    m_Items[i].title = add_title(title, title_len);
+    m_Items[i].title_len = title_len;
+    m_Items[i].url = add_url(url, TRUE);
+}
+
+const wchar_t* ChapterTable::title(int i) const
+{
+    return title(m_Items[i]);
+}
+
+const wchar_t* ChapterTable::title(const chapter_item_t &item) const
+{
+    return &m_Titles[item.title];
+}
+
+std::string ChapterTable::url(int i) const
+{
+    u32 chain[CHAPTER_URL_RESTART];
+    u32 node = m_Items[i].url;
+    u32 prev;
+    int prefix, suffix_len;
+    const char *suffix;
+    int n = 0;
+    std::string result;
+
+    if (node == CHAPTER_NO_URL)
+        return result;
+
+    while (n < CHAPTER_URL_RESTART)
+    {
+        chain[n++] = node;
+        read_node(node, &prev, &prefix, &suffix_len, &suffix);
+        if (prefix == 0)
+            break;
+        node = prev;
+    }
+    ASSERT(prefix == 0);
+
+    while (n > 0)
+    {
+        read_node(chain[--n], &prev, &prefix, &suffix_len, &suffix);
+        result.resize(prefix);
+        result.append(suffix, suffix_len);
+    }
+    return result;
+}
+
+BOOL ChapterTable::same(int i, const ChapterTable &other, int j) const
+{
+    if (m_Items[i].title_len != other.m_Items[j].title_len)
+        return FALSE;
+    if (wcscmp(title(i), other.title(j)) != 0)
+        return FALSE;
+    return url(i) == other.url(j);
+}
+
+int ChapterTable::title_pool_size(void) const
+{
+    return (int)(m_Titles.size() * sizeof(wchar_t));
+}
+
+const wchar_t* ChapterTable::title_pool(void) const
+{
+    return m_Titles.empty() ? NULL : &m_Titles[0];
+}
+
+int ChapterTable::url_export_size(void) const
+{
+    u32 prev;
+    int prefix, suffix_len;
+    const char *suffix;
+    int size = 0;
+    size_t i;
+
+    for (i = 0; i < m_Items.size(); i++)
+    {
+        if (m_Items[i].url == CHAPTER_NO_URL)
+        {
+            size += 1;
+            continue;
+        }
+        read_node(m_Items[i].url, &prev, &prefix, &suffix_len, &suffix);
+        size += prefix + suffix_len + 1;
+    }
+    return size;
+}
+
+void ChapterTable::export_urls(char *buf, u32 *offsets) const
+{
+    std::string cur;
+    u32 cur_node = CHAPTER_NO_URL;
+    u32 prev;
+    int prefix, suffix_len;
+    const char *suffix;
+    u32 offset = 0;
+    size_t i;
+
+    for (i = 0; i < m_Items.size(); i++)
+    {
+        offsets[i] = offset;
+        if (m_Items[i].url == CHAPTER_NO_URL)
+        {
+            buf[offset++] = 0;
+            continue;
+        }
+
+        // sequential walk only needs one step per url
+        read_node(m_Items[i].url, &prev, &prefix, &suffix_len, &suffix);
+        if (prefix == 0 || (prev == cur_node && cur_node != CHAPTER_NO_URL))
+        {
+            cur.resize(prefix);
+            cur.append(suffix, suffix_len);
+        }
+        else
+        {
+            cur = url((int)i);
+        }
+        cur_node = m_Items[i].url;
+
+        memcpy(buf + offset, cur.c_str(), cur.size() + 1);
+        offset += (u32)cur.size() + 1;
+    }
+}
+
+size_t ChapterTable::memory_usage(void) const
+{
+    return m_Items.capacity() * sizeof(chapter_item_t)
+        + m_Titles.capacity() * sizeof(wchar_t)
+        + m_Urls.capacity();
+}
+
+u32 ChapterTable::add_title(const wchar_t *title, int title_len)
+{
+    u32 offset = (u32)m_Titles.size();
+    size_t from;
+
+    // a title of this table is copied by position, growing the pool moves it
+    if (title && title_len > 0 && !m_Titles.empty()
+        && title >= &m_Titles[0] && title < &m_Titles[0] + m_Titles.size())
+    {
+        from = title - &m_Titles[0];
+        m_Titles.resize(offset + title_len + 1);
+        memmove(&m_Titles[offset], &m_Titles[from], title_len * sizeof(wchar_t));
+        m_Titles[offset + title_len] = 0;
+        return offset;
+    }
+
+    if (title && title_len > 0)
+        m_Titles.insert(m_Titles.end(), title, title + title_len);
+    m_Titles.push_back(0);
+    return offset;
+}
+
+u32 ChapterTable::add_url(const char *url, BOOL detached)
+{
+    u32 offset;
+    u32 prev = m_LastNode;
+    int len, prefix = 0, suffix_len;
+    unsigned short val;
+
+    if (!url)
+        return CHAPTER_NO_URL;
+
+    len = (int)strlen(url);
+    if (!detached && prev != CHAPTER_NO_URL && m_Run < CHAPTER_URL_RESTART - 1)
+    {
+        while (prefix < len && prefix < (int)m_LastUrl.size() && prefix < MAX_URL_PREFIX
+            && url[prefix] == m_LastUrl[prefix])
+        {
+            prefix++;
+        }
+    }
+    suffix_len = len - prefix;
+    if (suffix_len > MAX_URL_PREFIX)
+    {
+        // too long to code, truncate like the fixed 1024 buffers do
+        suffix_len = MAX_URL_PREFIX;
+    }
+
+    offset = (u32)m_Urls.size();
+    m_Urls.resize(offset + URL_NODE_HEAD + suffix_len + 1);
+    memcpy(&m_Urls[offset], &prev, sizeof(u32));
+    val = (unsigned short)prefix;
+    memcpy(&m_Urls[offset + sizeof(u32)], &val, sizeof(val));
+    val = (unsigned short)suffix_len;
+    memcpy(&m_Urls[offset + sizeof(u32) + sizeof(unsigned short)], &val, sizeof(val));
+    memcpy(&m_Urls[offset + URL_NODE_HEAD], url + prefix, suffix_len);
+    m_Urls[offset + URL_NODE_HEAD + suffix_len] = 0;
+
+    // a replaced url is a standalone node, the append chain is untouched
+    if (!detached)
+    {
+        m_Run = prefix == 0 ? 0 : m_Run + 1;
+        m_LastUrl.assign(url, prefix + suffix_len);
+        m_LastNode = offset;
+    }
+    return offset;
+}
+
+void ChapterTable::read_node(u32 offset, u32 *prev, int *prefix, int *suffix_len, const char **suffix) const
+{
+    unsigned short val;
+
+    memcpy(prev, &m_Urls[offset], sizeof(u32));
+    memcpy(&val, &m_Urls[offset + sizeof(u32)], sizeof(val));
+    *prefix = val;
+    memcpy(&val, &m_Urls[offset + sizeof(u32) + sizeof(unsigned short)], sizeof(val));
+    *suffix_len = val;
+    *suffix = &m_Urls[offset + URL_NODE_HEAD];
+}
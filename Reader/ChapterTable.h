@@ -0,0 +1,80 @@
+#ifndef __CHAPTER_TABLE_H__
+#define __CHAPTER_TABLE_H__
+
+#include "types.h"
+#include <vector>
+#include <string>
+
+#define CHAPTER_NO_URL          ((u32)-1)
+
+typedef struct chapter_item_t
+{
+    int index;
+    int size; // current chapter total len, for online book
+    int title_len;
+    u32 title; // offset in title pool
+    u32 url; // offset in url pool, for online book
+} chapter_item_t;
+
+// Chapter list with all titles and urls kept in two pools.
+// Urls are front coded against the previous url, with a full url every
+// CHAPTER_URL_RESTART entries, so decoding one url never walks far.
+// The table is move-only, hand it over with std::move.
+class ChapterTable
+{
+public:
+    typedef std::vector<chapter_item_t>::iterator iterator;
+    typedef std::vector<chapter_item_t>::reverse_iterator reverse_iterator;
+
+    ChapterTable();
+    ~ChapterTable();
+    ChapterTable(ChapterTable &&other);
+    ChapterTable& operator=(ChapterTable &&other);
+    ChapterTable(const ChapterTable &) = delete;
+    ChapterTable& operator=(const ChapterTable &) = delete;
+
+public:
+    size_t size(void) const { return m_Items.size(); }
+    bool empty(void) const { return m_Items.empty(); }
+    chapter_item_t& operator[](size_t i) { return m_Items[i]; }
+    const chapter_item_t& operator[](size_t i) const { return m_Items[i]; }
+    iterator begin(void) { return m_Items.begin(); }
+    iterator end(void) { return m_Items.end(); }
+    reverse_iterator rbegin(void) { return m_Items.rbegin(); }
+    reverse_iterator rend(void) { return m_Items.rend(); }
+
+    void clear(void);
+    void reserve(size_t count, size_t title_chars);
+    void push_back(int index, const wchar_t *title, int title_len, const char *url = NULL, int size = 0);
+    void append(const ChapterTable &src, int i);
+    void set(int i, const wchar_t *title, int title_len, const char *url);
+
+    // points into the title pool: valid until the next push_back, append, set,
+    // clear or move of this table, copy it to keep it longer
+    const wchar_t* title(int i) const;
+    const wchar_t* title(const chapter_item_t &item) const;
+    std::string url(int i) const;
+    BOOL same(int i, const ChapterTable &other, int j) const;
+
+    // for .ol header
+    int title_pool_size(void) const; // bytes
+    const wchar_t* title_pool(void) const;
+    int url_export_size(void) const; // bytes, full urls with '\0'
+    void export_urls(char *buf, u32 *offsets) const; // offsets relative to buf
+    size_t memory_usage(void) const;
+
+private:
+    u32 add_title(const wchar_t *title, int title_len);
+    u32 add_url(const char *url, BOOL detached);
+    void read_node(u32 offset, u32 *prev, int *prefix, int *suffix_len, const char **suffix) const;
+
+private:
+    std::vector<chapter_item_t> m_Items;
+    std::vector<wchar_t> m_Titles;
+    std::vector<char> m_Urls;
+    std::string m_LastUrl;
+    u32 m_LastNode;
+    int m_Run;
+};
+
+#endif
@@ -0,0 +1,202 @@
+#include "Composite.h"
+
+#if defined(_M_IX86) || defined(_M_X64)
+#include <intrin.h>
+#include <emmintrin.h>
+#include <immintrin.h>
+#define ENABLE_SIMD_COMPOSITE       1
+#define TARGET_SSE2
+#define TARGET_AVX2
+#elif defined(__i386__) || defined(__x86_64__)
+#include <cpuid.h>
+#include <immintrin.h>
+#define ENABLE_SIMD_COMPOSITE       1
+#define TARGET_SSE2                 __attribute__((target("sse2")))
+#define TARGET_AVX2                 __attribute__((target("avx2")))
+#else
+#define ENABLE_SIMD_COMPOSITE       0
+#endif
+
+BOOL alpha_composite_text_c(BYTE *bits, int count, COLORREF color, BYTE alpha)
+{
+    BYTE FillR = GetRValue(color);
+    BYTE FillG = GetGValue(color);
+    BYTE FillB = GetBValue(color);
+    UINT found = 0;
+    UINT ThisA;
+    int i;
+
+    for (i = 0; i < count; i++, bits += 4)
+    {
+        found |= *((UINT*)bits);
+        ThisA = bits[0];
+        bits[0] = (BYTE)((FillB * ThisA * alpha) >> 16);
+        bits[1] = (BYTE)((FillG * ThisA * alpha) >> 16);
+        bits[2] = (BYTE)((FillR * ThisA * alpha) >> 16);
+        bits[3] = (BYTE)((ThisA * alpha) >> 8);
+    }
+    return (found & 0x00FFFFFF) != 0;
+}
+
+#if ENABLE_SIMD_COMPOSITE
+// cov * alpha <= 65025 fits in 16 bits, so (fill * cov * alpha) >> 16 is
+// exactly mulhi_epu16(cov * alpha, fill), no 32-bit multiply needed.
+TARGET_SSE2 static BOOL alpha_composite_text_sse2(BYTE *bits, int count, COLORREF color, BYTE alpha)
+{
+    const __m128i mask = _mm_set1_epi32(0xFF);
+    const __m128i va = _mm_set1_epi16(alpha);
+    const __m128i vb = _mm_set1_epi16(GetBValue(color));
+    const __m128i vg = _mm_set1_epi16(GetGValue(color));
+    const __m128i vr = _mm_set1_epi16(GetRValue(color));
+    __m128i found = _mm_setzero_si128();
+    __m128i p0, p1, t, bg, ra;
+    int i, n = count & ~7;
+    BOOL ret;
+
+    for (i = 0; i < n; i += 8, bits += 32)
+    {
+        p0 = _mm_loadu_si128((__m128i *)bits);
+        p1 = _mm_loadu_si128((__m128i *)(bits + 16));
+        found = _mm_or_si128(found, _mm_or_si128(p0, p1));
+
+        t = _mm_packs_epi32(_mm_and_si128(p0, mask), _mm_and_si128(p1, mask));
+        t = _mm_mullo_epi16(t, va);
+        bg = _mm_or_si128(_mm_mulhi_epu16(t, vb), _mm_slli_epi16(_mm_mulhi_epu16(t, vg), 8));
+        ra = _mm_or_si128(_mm_mulhi_epu16(t, vr), _mm_slli_epi16(_mm_srli_epi16(t, 8), 8));
+
+        _mm_storeu_si128((__m128i *)bits, _mm_unpacklo_epi16(bg, ra));
+        _mm_storeu_si128((__m128i *)(bits + 16), _mm_unpackhi_epi16(bg, ra));
+    }
+
+    found = _mm_or_si128(found, _mm_srli_si128(found, 8));
+    found = _mm_or_si128(found, _mm_srli_si128(found, 4));
+    ret = (_mm_cvtsi128_si32(found) & 0x00FFFFFF) != 0;
+
+    if (alpha_composite_text_c(bits, count - n, color, alpha))
+        ret = TRUE;
+    return ret;
+}
+
+TARGET_AVX2 static BOOL alpha_composite_text_avx2(BYTE *bits, int count, COLORREF color, BYTE alpha)
+{
+    const __m256i mask = _mm256_set1_epi32(0xFF);
+    const __m256i va = _mm256_set1_epi16(alpha);
+    const __m256i vb = _mm256_set1_epi16(GetBValue(color));
+    const __m256i vg = _mm256_set1_epi16(GetGValue(color));
+    const __m256i vr = _mm256_set1_epi16(GetRValue(color));
+    __m256i found = _mm256_setzero_si256();
+    __m256i p0, p1, t, bg, ra;
+    __m128i f;
+    int i, n = count & ~15;
+    BOOL ret;
+
+    // pack and unpack both work per 128-bit lane, so the pixel order is kept
+    for (i = 0; i < n; i += 16, bits += 64)
+    {
+        p0 = _mm256_loadu_si256((__m256i *)bits);
+        p1 = _mm256_loadu_si256((__m256i *)(bits + 32));
+        found = _mm256_or_si256(found, _mm256_or_si256(p0, p1));
+
+        t = _mm256_packs_epi32(_mm256_and_si256(p0, mask), _mm256_and_si256(p1, mask));
+        t = _mm256_mullo_epi16(t, va);
+        bg = _mm256_or_si256(_mm256_mulhi_epu16(t, vb), _mm256_slli_epi16(_mm256_mulhi_epu16(t, vg), 8));
+        ra = _mm256_or_si256(_mm256_mulhi_epu16(t, vr), _mm256_slli_epi16(_mm256_srli_epi16(t, 8), 8));
+
+        _mm256_storeu_si256((__m256i *)bits, _mm256_unpacklo_epi16(bg, ra));
+        _mm256_storeu_si256((__m256i *)(bits + 32), _mm256_unpackhi_epi16(bg, ra));
+    }
+
+    f = _mm_or_si128(_mm256_castsi256_si128(found), _mm256_extracti128_si256(found, 1));
+    f = _mm_or_si128(f, _mm_srli_si128(f, 8));
+    f = _mm_or_si128(f, _mm_srli_si128(f, 4));
+    ret = (_mm_cvtsi128_si32(f) & 0x00FFFFFF) != 0;
+    _mm256_zeroupper();
+
+    if (alpha_composite_text_sse2(bits, count - n, color, alpha))
+        ret = TRUE;
+    return ret;
+}
+
+static void cpu_id(int info[4], int leaf, int sub)
+{
+#if defined(_MSC_VER)
+    __cpuidex(info, leaf, sub);
+#else
+    __cpuid_count(leaf, sub, info[0], info[1], info[2], info[3]);
+#endif
+}
+
+static unsigned long long xgetbv0(void)
+{
+#if defined(_MSC_VER)
+    return _xgetbv(0);
+#else
+    unsigned int lo, hi;
+    __asm__ volatile ("xgetbv" : "=a"(lo), "=d"(hi) : "c"(0));
+    return ((unsigned long long)hi << 32) | lo;
+#endif
+}
+
+static composite_isa_t detect_composite_isa(void)
+{
+    int info[4];
+    BOOL sse2, avx2 = FALSE;
+
+    cpu_id(info, 0, 0);
+    if (info[0] < 1)
+        return composite_c;
+
+    cpu_id(info, 1, 0);
+    sse2 = (info[3] & (1 << 26)) != 0;
+
+    // AVX2 also needs the OS to save the ymm registers
+    if ((info[2] & (1 << 27)) && (info[2] & (1 << 28)) && (xgetbv0() & 0x6) == 0x6)
+    {
+        cpu_id(info, 0, 0);
+        if (info[0] >= 7)
+        {
+            cpu_id(info, 7, 0);
+            avx2 = (info[1] & (1 << 5)) != 0;
+        }
+    }
+
+    if (avx2)
+        return composite_avx2;
+    if (sse2)
+        return composite_sse2;
+    return composite_c;
+}
+#endif
+
+composite_func_t get_composite_func(composite_isa_t isa)
+{
+#if ENABLE_SIMD_COMPOSITE
+    static int s_isa = -1;
+    if (s_isa < 0)
+        s_isa = detect_composite_isa();
+    if (isa > s_isa)
+        return NULL;
+    if (isa == composite_avx2)
+        return alpha_composite_text_avx2;
+    if (isa == composite_sse2)
+        return alpha_composite_text_sse2;
+#else
+    if (isa != composite_c)
+        return NULL;
+#endif
+    return alpha_composite_text_c;
+}
+
+BOOL alpha_composite_text(BYTE *bits, int count, COLORREF color, BYTE alpha)
+{
+    static composite_func_t s_func = NULL;
+    if (!s_func)
+    {
+        s_func = get_composite_func(composite_avx2);
+        if (!s_func)
+            s_func = get_composite_func(composite_sse2);
+        if (!s_func)
+            s_func = alpha_composite_text_c;
+    }
+    return s_func(bits, count, color, alpha);
+}
@@ -0,0 +1,26 @@
+#ifndef __COMPOSITE_H__
+#define __COMPOSITE_H__
+
+#include "types.h"
+
+// Convert white-on-black text pixels (BGRA, coverage in B) to premultiplied
+// text color: B,G,R = fill * cov * alpha >> 16, A = cov * alpha >> 8.
+// Returns TRUE if any pixel had a non zero color before the conversion.
+BOOL alpha_composite_text(BYTE *bits, int count, COLORREF color, BYTE alpha);
+
+// same as above, plain C, kept for the fallback and for checking
+BOOL alpha_composite_text_c(BYTE *bits, int count, COLORREF color, BYTE alpha);
+
+typedef BOOL (*composite_func_t)(BYTE *bits, int count, COLORREF color, BYTE alpha);
+
+typedef enum composite_isa_t
+{
+    composite_c,
+    composite_sse2,
+    composite_avx2
+} composite_isa_t;
+
+// the kernel for one instruction set, NULL when the cpu does not have it
+composite_func_t get_composite_func(composite_isa_t isa);
+
+#endif
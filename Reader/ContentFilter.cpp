@@ -0,0 +1,257 @@
+#include "ContentFilter.h"
+#include <map>
+
+struct filter_cache_t
+{
+    CRITICAL_SECTION lock;
+    std::map<std::wstring, ContentFilter*> filters;
+
+    filter_cache_t()
+    {
+        InitializeCriticalSection(&lock);
+    }
+
+    ~filter_cache_t()
+    {
+        std::map<std::wstring, ContentFilter*>::iterator it;
+
+        for (it = filters.begin(); it != filters.end(); it++)
+            delete it->second;
+        DeleteCriticalSection(&lock);
+    }
+};
+
+ContentFilter* ContentFilter::Get(int type, const wchar_t *keyword)
+{
+    static filter_cache_t cache;
+    std::map<std::wstring, ContentFilter*>::iterator it;
+    ContentFilter *filter;
+    std::wstring key;
+
+    if (type < 1 || type > 3 || !keyword || !keyword[0])
+        return NULL;
+
+    // sources edited while the app runs keep their old filters, they are few
+    key = (wchar_t)(L'0' + type);
+    key += keyword;
+    EnterCriticalSection(&cache.lock);
+    it = cache.filters.find(key);
+    if (it == cache.filters.end())
+    {
+        filter = new ContentFilter;
+        filter->Compile(type, keyword);
+        cache.filters[key] = filter;
+    }
+    else
+    {
+        filter = it->second;
+    }
+    LeaveCriticalSection(&cache.lock);
+    return filter->m_Stages.empty() ? NULL : filter;
+}
+
+BOOL ContentFilter::IsValid(int type, const wchar_t *keyword)
+{
+    ContentFilter filter;
+
+    if (!keyword)
+        return TRUE;
+    return filter.Compile(type, keyword);
+}
+
+ContentFilter::ContentFilter()
+{
+}
+
+ContentFilter::~ContentFilter()
+{
+    size_t i;
+
+    for (i = 0; i < m_Stages.size(); i++)
+    {
+        if (m_Stages[i]->regex)
+            delete m_Stages[i]->regex;
+        delete m_Stages[i];
+    }
+    m_Stages.clear();
+}
+
+int ContentFilter::Apply(wchar_t *text, int *len)
+{
+    size_t i;
+    int found = 0;
+    int n = *len;
+
+    for (i = 0; i < m_Stages.size() && n > 0; i++)
+    {
+        if (m_Stages[i]->regex)
+            n = RemoveRegex(m_Stages[i], text, n, &found);
+        else
+            n = RemoveLiterals(m_Stages[i], text, n, &found);
+    }
+    if (!found)
+        return 0;
+
+    if (n == 0)
+    {
+        text[0] = L'\n';
+        n = 1;
+    }
+    text[n] = 0;
+    *len = n;
+    return 1;
+}
+
+BOOL ContentFilter::Compile(int type, const wchar_t *keyword)
+{
+    const wchar_t *line;
+    const wchar_t *end;
+    int len;
+    BOOL ret = TRUE;
+
+    if (type == 1) // one keyword, it may span lines
+    {
+        AddLiteral(keyword, (int)wcslen(keyword));
+    }
+    else if (type == 2) // one regex
+    {
+        ret = AddRegex(keyword);
+    }
+    else if (type == 3) // rules, one per line
+    {
+        for (line = keyword; *line; line = *end ? end + 1 : end)
+        {
+            end = wcschr(line, L'\n');
+            if (!end)
+                end = line + wcslen(line);
+            len = (int)(end - line);
+            if (len > 0 && line[len - 1] == L'\r')
+                len--;
+            if (len == 0)
+                continue;
+
+            if (len > (int)wcslen(FILTER_REGEX_PREFIX) && wcsncmp(line, FILTER_REGEX_PREFIX, wcslen(FILTER_REGEX_PREFIX)) == 0)
+            {
+                std::wstring regex(line + wcslen(FILTER_REGEX_PREFIX), len - wcslen(FILTER_REGEX_PREFIX));
+                if (!AddRegex(regex.c_str()))
+                    ret = FALSE;
+            }
+            else
+            {
+                AddLiteral(line, len);
+            }
+        }
+    }
+
+    return ret;
+}
+
+void ContentFilter::AddLiteral(const wchar_t *literal, int len)
+{
+    filter_stage_t *stage;
+
+    if (len <= 0)
+        return;
+
+    // joins the literals right before it
+    if (m_Stages.empty() || m_Stages.back()->regex)
+    {
+        stage = new filter_stage_t;
+        stage->regex = NULL;
+        m_Stages.push_back(stage);
+    }
+    m_Stages.back()->literals.push_back(std::wstring(literal, len));
+}
+
+BOOL ContentFilter::AddRegex(const wchar_t *regex)
+{
+    filter_stage_t *stage;
+    std::wregex *e = NULL;
+
+    try
+    {
+        e = new std::wregex(regex);
+    }
+    catch (...)
+    {
+        logger_printk("invalid regex rule");
+        return FALSE;
+    }
+    stage = new filter_stage_t;
+    stage->regex = e;
+    m_Stages.push_back(stage);
+    return TRUE;
+}
+
+int ContentFilter::RemoveLiterals(const filter_stage_t *stage, wchar_t *text, int len, int *found)
+{
+    size_t i;
+
+    for (i = 0; i < stage->literals.size() && len > 0; i++)
+        len = RemoveLiteral(stage->literals[i], text, len, found);
+    return len;
+}
+
+int ContentFilter::RemoveLiteral(const std::wstring &literal, wchar_t *text, int len, int *found)
+{
+    const wchar_t *p = literal.c_str();
+    const wchar_t *hit;
+    int n = (int)literal.size();
+    int dst = 0;
+    int i = 0;
+    int keep;
+    BOOL match;
+
+    // the output never gets ahead of the input
+    while (n <= len - i && (hit = wmemchr(text + i, p[0], len - i - n + 1)) != NULL)
+    {
+        match = wmemcmp(hit, p, n) == 0;
+        keep = (int)(hit - text) - i + (match ? 0 : 1);
+        if (dst != i)
+            wmemmove(text + dst, text + i, keep);
+        dst += keep;
+        i += keep;
+        if (match)
+        {
+            i += n;
+            *found = 1;
+        }
+    }
+    if (dst != i)
+        wmemmove(text + dst, text + i, len - i);
+    return dst + len - i;
+}
+
+int ContentFilter::RemoveRegex(const filter_stage_t *stage, wchar_t *text, int len, int *found)
+{
+    std::wcmatch cm;
+    int offset = 0;
+    int dst = 0;
+    int pos;
+
+    while (offset < len && std::regex_search((const wchar_t *)text + offset, (const wchar_t *)text + len, cm, *stage->regex))
+    {
+        pos = (int)cm.position();
+        if (cm.length() == 0)
+        {
+            // keeps one character, an empty match would not move on
+            if (pos >= len - offset)
+                break;
+            pos++;
+            memmove(text + dst, text + offset, sizeof(wchar_t) * pos);
+            dst += pos;
+            offset += pos;
+            continue;
+        }
+        memmove(text + dst, text + offset, sizeof(wchar_t) * pos);
+        dst += pos;
+        offset += pos + (int)cm.length();
+        *found = 1;
+    }
+    if (offset < len)
+    {
+        memmove(text + dst, text + offset, sizeof(wchar_t) * (len - offset));
+        dst += len - offset;
+    }
+    return dst;
+}
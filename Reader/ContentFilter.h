@@ -0,0 +1,48 @@
+#ifndef __CONTENT_FILTER_H__
+#define __CONTENT_FILTER_H__
+
+#include "types.h"
+#include <vector>
+#include <string>
+#include <regex>
+
+#define FILTER_REGEX_PREFIX     L"re:"      // a rule line that is a regex, content_filter_type 3
+
+typedef struct filter_stage_t
+{
+    std::vector<std::wstring> literals; // next to each other in the rules, in rule order
+    std::wregex *regex;                 // or one regex
+} filter_stage_t;
+
+// Content filter of a book source, compiled once per type and keyword and
+// shared by every chapter and thread. Rules apply in order, each one removes
+// its matches left to right from what the ones before it left, so a removal
+// that joins text up can make a match for a later rule but never for an
+// earlier one. A literal is one wmemchr driven scan, a regex one search
+// pass, all in place.
+class ContentFilter
+{
+public:
+    static ContentFilter* Get(int type, const wchar_t *keyword);   // NULL when there is nothing to filter
+    static BOOL IsValid(int type, const wchar_t *keyword);          // FALSE when a regex does not compile
+
+public:
+    int Apply(wchar_t *text, int *len);     // 1 when something was removed
+
+private:
+    ContentFilter();
+    ~ContentFilter();
+    BOOL Compile(int type, const wchar_t *keyword);
+    void AddLiteral(const wchar_t *literal, int len);
+    BOOL AddRegex(const wchar_t *regex);
+    int  RemoveLiterals(const filter_stage_t *stage, wchar_t *text, int len, int *found);
+    int  RemoveLiteral(const std::wstring &literal, wchar_t *text, int len, int *found);
+    int  RemoveRegex(const filter_stage_t *stage, wchar_t *text, int len, int *found);
+
+private:
+    std::vector<filter_stage_t*> m_Stages;
+
+    friend struct filter_cache_t;
+};
+
+#endif
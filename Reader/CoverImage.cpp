@@ -0,0 +1,343 @@
+#include "CoverImage.h"
+#include <wincodec.h>
+#include <shlwapi.h>
+
+#pragma comment(lib, "windowscodecs.lib")
+
+Gdiplus::Bitmap* CoverImage::Decode(const void *data, size_t size)
+{
+    int max_width, max_height;
+
+    // the window never gets larger than the desktop, the page scales it down from there
+    max_width = GetSystemMetrics(SM_CXVIRTUALSCREEN);
+    max_height = GetSystemMetrics(SM_CYVIRTUALSCREEN);
+    if (max_width <= 0 || max_height <= 0)
+    {
+        max_width = GetSystemMetrics(SM_CXSCREEN);
+        max_height = GetSystemMetrics(SM_CYSCREEN);
+    }
+    return Decode(data, size, max_width, max_height);
+}
+
+Gdiplus::Bitmap* CoverImage::Decode(const void *data, size_t size, int max_width, int max_height)
+{
+    IStream *stream;
+    Gdiplus::Bitmap *image;
+    Gdiplus::Bitmap *scaled;
+    int width, height;
+
+    if (!data || size == 0 || max_width <= 0 || max_height <= 0)
+        return NULL;
+
+    image = DecodeWic(data, size, max_width, max_height);
+    if (image)
+        return image;
+
+    // no WIC codec for it, GDI+ reads it whole and it is scaled afterwards
+    stream = SHCreateMemStream((const BYTE *)data, (UINT)size);
+    if (!stream)
+        return NULL;
+    image = new Gdiplus::Bitmap(stream);
+    stream->Release();
+    if (Gdiplus::Ok != image->GetLastStatus())
+    {
+        delete image;
+        return NULL;
+    }
+    if ((int)image->GetWidth() <= max_width && (int)image->GetHeight() <= max_height)
+        return image;
+
+    Fit(max_width, max_height, image->GetWidth(), image->GetHeight(), &width, &height);
+    scaled = Scale(image, width, height);
+    if (!scaled)
+        return image;
+    delete image;
+    return scaled;
+}
+
+Gdiplus::Bitmap* CoverImage::Scale(Gdiplus::Bitmap *image, int width, int height)
+{
+    Gdiplus::Bitmap *scaled;
+    Gdiplus::Graphics *g;
+    Gdiplus::ImageAttributes attr;
+    Gdiplus::Rect dst(0, 0, width, height);
+
+    if (!image || width <= 0 || height <= 0)
+        return NULL;
+
+    scaled = new Gdiplus::Bitmap(width, height, PixelFormat32bppPARGB);
+    if (Gdiplus::Ok != scaled->GetLastStatus())
+    {
+        delete scaled;
+        return NULL;
+    }
+
+    // edge pixels are repeated, otherwise the border blends with transparent black
+    attr.SetWrapMode(Gdiplus::WrapModeTileFlipXY);
+    g = new Gdiplus::Graphics(scaled);
+    g->SetInterpolationMode(Gdiplus::InterpolationModeHighQualityBicubic);
+    g->SetPixelOffsetMode(Gdiplus::PixelOffsetModeHighQuality);
+    g->DrawImage(image, dst, 0, 0, image->GetWidth(), image->GetHeight(), Gdiplus::UnitPixel, &attr);
+    delete g;
+    return scaled;
+}
+
+void CoverImage::Fit(int width, int height, int image_width, int image_height, int *fit_width, int *fit_height)
+{
+    double d = ((double)width) / height;
+    double bd = ((double)image_width) / image_height;
+
+    if (bd > d)
+    {
+        // image is too wide
+        *fit_width = width;
+        *fit_height = (int)(width / bd);
+    }
+    else
+    {
+        // image is too high
+        *fit_height = height;
+        *fit_width = (int)(bd * height);
+    }
+    if (*fit_width < 1)
+        *fit_width = 1;
+    if (*fit_height < 1)
+        *fit_height = 1;
+}
+
+Gdiplus::Bitmap* CoverImage::DecodeWic(const void *data, size_t size, int max_width, int max_height)
+{
+    IWICImagingFactory *factory = NULL;
+    IWICBitmapDecoder *decoder = NULL;
+    IWICBitmapFrameDecode *frame = NULL;
+    IWICFormatConverter *converter = NULL;
+    IWICBitmapScaler *scaler = NULL;
+    IWICBitmapSource *source = NULL;
+    IStream *stream;
+    Gdiplus::Bitmap *image = NULL;
+    Gdiplus::BitmapData bits;
+    UINT width = 0, height = 0;
+    int fit_width, fit_height;
+    HRESULT com;
+    HRESULT hr;
+
+    stream = SHCreateMemStream((const BYTE *)data, (UINT)size);
+    if (!stream)
+        return NULL;
+
+    // books are opened on the task workers, they have no apartment of their own;
+    // the UI thread already has one and keeps it
+    com = CoInitializeEx(NULL, COINIT_MULTITHREADED);
+    hr = CoCreateInstance(CLSID_WICImagingFactory, NULL, CLSCTX_INPROC_SERVER, IID_PPV_ARGS(&factory));
+    if (SUCCEEDED(hr))
+        hr = factory->CreateDecoderFromStream(stream, NULL, WICDecodeMetadataCacheOnDemand, &decoder);
+    if (SUCCEEDED(hr))
+        hr = decoder->GetFrame(0, &frame);
+    if (SUCCEEDED(hr))
+        hr = frame->GetSize(&width, &height);
+    if (SUCCEEDED(hr) && (width == 0 || height == 0))
+        hr = E_FAIL;
+    source = frame;
+
+    // the chain is pulled a band of rows at a time, a large image is scaled
+    // while it is decoded and never exists at full size; straight on the frame
+    // the JPEG codec is asked for a smaller size first and scales in the DCT
+    if (SUCCEEDED(hr) && ((int)width > max_width || (int)height > max_height))
+    {
+        Fit(max_width, max_height, width, height, &fit_width, &fit_height);
+        hr = factory->CreateBitmapScaler(&scaler);
+        if (SUCCEEDED(hr))
+            hr = scaler->Initialize(frame, fit_width, fit_height, WICBitmapInterpolationModeFant);
+        source = scaler;
+        width = fit_width;
+        height = fit_height;
+    }
+    if (SUCCEEDED(hr))
+        hr = factory->CreateFormatConverter(&converter);
+    if (SUCCEEDED(hr))
+        hr = converter->Initialize(source, GUID_WICPixelFormat32bppPBGRA, WICBitmapDitherTypeNone, NULL, 0.0, WICBitmapPaletteTypeCustom);
+
+    if (SUCCEEDED(hr))
+    {
+        image = new Gdiplus::Bitmap(width, height, PixelFormat32bppPARGB);
+        Gdiplus::Rect rect(0, 0, width, height);
+        if (Gdiplus::Ok == image->GetLastStatus()
+            && Gdiplus::Ok == image->LockBits(&rect, Gdiplus::ImageLockModeWrite, PixelFormat32bppPARGB, &bits))
+        {
+            hr = converter->CopyPixels(NULL, bits.Stride, bits.Stride * height, (BYTE *)bits.Scan0);
+            image->UnlockBits(&bits);
+        }
+        else
+        {
+            hr = E_FAIL;
+        }
+        if (FAILED(hr))
+        {
+            delete image;
+            image = NULL;
+        }
+    }
+
+    if (converter)
+        converter->Release();
+    if (scaler)
+        scaler->Release();
+    if (frame)
+        frame->Release();
+    if (decoder)
+        decoder->Release();
+    if (factory)
+        factory->Release();
+    if (SUCCEEDED(com))
+        CoUninitialize();
+    stream->Release();
+    return image;
+}
+
+BOOL CoverImage::SaveThumb(const TCHAR *dir, const TCHAR *book, u32 hash, Gdiplus::Bitmap *cover)
+{
+    cover_thumb_header_t header;
+    Gdiplus::Bitmap *thumb;
+    Gdiplus::BitmapData bits;
+    TCHAR file_name[MAX_PATH];
+    FILE *fp;
+    int width, height;
+    int y;
+    BOOL ret = FALSE;
+
+    if (!cover || !book)
+        return FALSE;
+
+    Fit(COVER_THUMB_WIDTH, COVER_THUMB_HEIGHT, cover->GetWidth(), cover->GetHeight(), &width, &height);
+    thumb = Scale(cover, width, height);
+    if (!thumb)
+        return FALSE;
+    Gdiplus::Rect rect(0, 0, width, height);
+    if (Gdiplus::Ok != thumb->LockBits(&rect, Gdiplus::ImageLockModeRead, PixelFormat32bppPARGB, &bits))
+    {
+        delete thumb;
+        return FALSE;
+    }
+
+    // one book per hash, a collision just takes the file over
+    GetThumbFile(dir, hash, file_name);
+    fp = _tfopen(file_name, _T("wb"));
+    if (!fp)
+    {
+        CreateDirectory(dir, NULL);
+        fp = _tfopen(file_name, _T("wb"));
+    }
+    if (fp)
+    {
+        header.magic = COVER_THUMB_MAGIC;
+        header.version = COVER_THUMB_VERSION;
+        header.name_len = (u32)_tcslen(book);
+        header.width = width;
+        header.height = height;
+        ret = fwrite(&header, sizeof(header), 1, fp) == 1
+            && fwrite(book, sizeof(TCHAR), header.name_len, fp) == header.name_len;
+        for (y = 0; ret && y < height; y++)
+            ret = fwrite((BYTE *)bits.Scan0 + y * bits.Stride, 4, width, fp) == (size_t)width;
+        fclose(fp);
+        if (!ret)
+            DeleteFile(file_name);
+    }
+
+    thumb->UnlockBits(&bits);
+    delete thumb;
+    return ret;
+}
+
+HBITMAP CoverImage::LoadThumb(const TCHAR *dir, const TCHAR *book, u32 hash)
+{
+    cover_thumb_header_t header;
+    BITMAPINFO bmi;
+    HBITMAP hBitmap;
+    void *pixels = NULL;
+    FILE *fp;
+    size_t size;
+
+    fp = OpenThumb(dir, book, hash, &header);
+    if (!fp)
+        return NULL;
+
+    // premultiplied 32 bit top down, the menu draws it with its alpha
+    memset(&bmi, 0, sizeof(bmi));
+    bmi.bmiHeader.biSize = sizeof(BITMAPINFOHEADER);
+    bmi.bmiHeader.biWidth = header.width;
+    bmi.bmiHeader.biHeight = -(int)header.height;
+    bmi.bmiHeader.biPlanes = 1;
+    bmi.bmiHeader.biBitCount = 32;
+    bmi.bmiHeader.biCompression = BI_RGB;
+    hBitmap = CreateDIBSection(NULL, &bmi, DIB_RGB_COLORS, &pixels, NULL, 0);
+    if (hBitmap)
+    {
+        size = (size_t)header.width * header.height;
+        if (fread(pixels, 4, size, fp) != size)
+        {
+            DeleteObject(hBitmap);
+            hBitmap = NULL;
+        }
+    }
+    fclose(fp);
+    return hBitmap;
+}
+
+void CoverImage::DeleteThumb(const TCHAR *dir, const TCHAR *book, u32 hash)
+{
+    cover_thumb_header_t header;
+    TCHAR file_name[MAX_PATH];
+    FILE *fp;
+
+    // left alone when it belongs to another book of the same hash
+    fp = OpenThumb(dir, book, hash, &header);
+    if (!fp)
+        return;
+    fclose(fp);
+    GetThumbFile(dir, hash, file_name);
+    DeleteFile(file_name);
+}
+
+void CoverImage::GetThumbFile(const TCHAR *dir, u32 hash, TCHAR *file_name)
+{
+    TCHAR name[32];
+
+    _stprintf(name, _T("%08X.th"), hash);
+    _tcscpy(file_name, dir);
+    PathAppend(file_name, name);
+}
+
+FILE* CoverImage::OpenThumb(const TCHAR *dir, const TCHAR *book, u32 hash, cover_thumb_header_t *header)
+{
+    TCHAR file_name[MAX_PATH];
+    TCHAR *path;
+    FILE *fp;
+    size_t len = _tcslen(book);
+    BOOL match = FALSE;
+
+    GetThumbFile(dir, hash, file_name);
+    fp = _tfopen(file_name, _T("rb"));
+    if (!fp)
+        return NULL;
+
+    if (fread(header, sizeof(cover_thumb_header_t), 1, fp) == 1
+        && header->magic == COVER_THUMB_MAGIC
+        && header->version == COVER_THUMB_VERSION
+        && header->name_len == len
+        && header->width > 0 && header->width <= COVER_THUMB_WIDTH
+        && header->height > 0 && header->height <= COVER_THUMB_HEIGHT)
+    {
+        path = (TCHAR *)malloc(sizeof(TCHAR) * (len + 1));
+        if (path)
+        {
+            match = fread(path, sizeof(TCHAR), len, fp) == len && 0 == _tcsncmp(path, book, len);
+            free(path);
+        }
+    }
+    if (!match)
+    {
+        fclose(fp);
+        return NULL;
+    }
+    return fp;
+}
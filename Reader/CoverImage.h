@@ -0,0 +1,44 @@
+#ifndef __COVER_IMAGE_H__
+#define __COVER_IMAGE_H__
+
+#include "types.h"
+#include <stdio.h>
+
+#define COVER_THUMB_MAGIC       0x48544452  // "RDTH"
+#define COVER_THUMB_VERSION     1
+#define COVER_THUMB_WIDTH       24
+#define COVER_THUMB_HEIGHT      32
+#define COVER_THUMB_MENU_ITEMS  16          // recent list entries shown with their cover
+
+typedef struct cover_thumb_header_t
+{
+    u32 magic;
+    u32 version;
+    u32 name_len;   // book path follows, characters, not terminated
+    u32 width;
+    u32 height;     // then width * height premultiplied BGRA pixels, top down
+} cover_thumb_header_t;
+
+// Book covers. They are decoded no larger than the screen, a camera sized
+// JPEG is scaled down while it is read instead of kept at full resolution.
+// Thumbnails for the recent list are kept in a sidecar file per book, found
+// by the path hash of the cache item like the bookmark journals.
+class CoverImage
+{
+public:
+    static Gdiplus::Bitmap* Decode(const void *data, size_t size);
+    static Gdiplus::Bitmap* Decode(const void *data, size_t size, int max_width, int max_height);
+    static Gdiplus::Bitmap* Scale(Gdiplus::Bitmap *image, int width, int height);
+    static void Fit(int width, int height, int image_width, int image_height, int *fit_width, int *fit_height);
+
+    static BOOL SaveThumb(const TCHAR *dir, const TCHAR *book, u32 hash, Gdiplus::Bitmap *cover);
+    static HBITMAP LoadThumb(const TCHAR *dir, const TCHAR *book, u32 hash);
+    static void DeleteThumb(const TCHAR *dir, const TCHAR *book, u32 hash);
+
+private:
+    static Gdiplus::Bitmap* DecodeWic(const void *data, size_t size, int max_width, int max_height);
+    static void GetThumbFile(const TCHAR *dir, u32 hash, TCHAR *file_name);
+    static FILE* OpenThumb(const TCHAR *dir, const TCHAR *book, u32 hash, cover_thumb_header_t *header);
+};
+
+#endif
@@ -1,5 +1,7 @@
 #include "EpubBook.h"
 #include "Utils.h"
+#include "XhtmlText.h"
+#include "CoverImage.h"
 #ifdef ZLIB_ENABLE
 #include "unzip.h"
 #include "iowin32.h"
@@ -54,7 +56,7 @@ std::wstring FirstVisibleLine(const wchar_t *text, int len)
     while (i < len)
     {
         wchar_t ch = text[i];
-        if (ch == 0x0A || ch == 0x0D || IsBlankChar(ch))
+        if (ch == 0x0A || ch == 0x0D || IsBlankChar(ch) || is_inline_image(ch))
         {
             i++;
             continue;
@@ -67,6 +69,49 @@ std::wstring FirstVisibleLine(const wchar_t *text, int len)
     std::wstring line(text + start, i - start);
     return TrimTitle(line);
 }
+
+// pictures are read from the zip when they are drawn, not unpacked with the text
+bool IsImageEntry(const char *name)
+{
+    static const char *exts[] = { ".jpg", ".jpeg", ".png", ".gif", ".bmp", ".webp", ".tif", ".tiff" };
+    size_t len = strlen(name);
+    size_t n;
+    int i;
+
+    for (i = 0; i < (int)(sizeof(exts) / sizeof(exts[0])); i++)
+    {
+        n = strlen(exts[i]);
+        if (len > n && 0 == strcasecmp(name + len - n, exts[i]))
+            return true;
+    }
+    return false;
+}
+
+struct image_arg_t
+{
+    EpubBook *_this;
+    std::string dir;        // of the page, the src is relative to it
+    const std::string *cover;
+};
+
+#ifndef ZLIB_ENABLE
+struct entry_read_t
+{
+    std::string *data;
+    size_t max_size;
+};
+
+size_t ReadEntryCallback(void *opaque, mz_uint64 file_ofs, const void *buf, size_t n)
+{
+    entry_read_t *read = (entry_read_t *)opaque;
+
+    // a short count stops the inflate once the probe has its bytes
+    if (read->max_size && read->data->size() + n > read->max_size)
+        n = read->max_size - read->data->size();
+    read->data->append((const char *)buf, n);
+    return n;
+}
+#endif
 } // namespace
 
 
@@ -170,6 +215,13 @@ int EpubBook::GetTextBeginIndex(void)
     return m_Cover ? 1 : 0;
 }
 
+BOOL EpubBook::ReadImage(int id, std::string &data, size_t max_size)
+{
+    if (id < 0 || id >= (int)m_Images.size())
+        return FALSE;
+    return ReadEntry(m_Images[id].name, data, max_size);
+}
+
 void EpubBook::FreeFilelist(void)
 {
     filelist_t::iterator itor;
@@ -178,6 +230,7 @@ void EpubBook::FreeFilelist(void)
         free(itor->second.data);
     }
     m_flist.clear();
+    m_ImageFiles.clear();
 }
 
 #ifdef ZLIB_ENABLE
@@ -192,6 +245,7 @@ BOOL EpubBook::UnzipBook(void)
     char filename_inzip[MAX_PATH] = {0};
     char *buf = NULL;
     file_data_t fdata;
+    inline_image_t image = { "", 0, 0, 0, 0, -1 };
 
     fill_win32_filefunc64W(&ffunc);
     uf = unzOpen2_64(m_fileName, &ffunc);
@@ -216,6 +270,12 @@ BOOL EpubBook::UnzipBook(void)
             {
                 // is directory
             }
+            else if (IsImageEntry(filename_inzip))
+            {
+                image.name = filename_inzip;
+                image.size = (u32)file_info.uncompressed_size;
+                m_ImageFiles.insert(std::make_pair(image.name, image));
+            }
             else
             {
                 // check password
@@ -251,7 +311,7 @@ BOOL EpubBook::UnzipBook(void)
                 goto end;
         }
 
-        if (m_bForceKill)
+        if (ReadAcquire(&m_Token.cancel))
         {
             err = UNZ_ERRNO;
             goto end;
@@ -271,6 +331,38 @@ end:
         FreeFilelist();
     return err == UNZ_OK;
 }
+
+BOOL EpubBook::ReadEntry(const std::string &name, std::string &data, size_t max_size)
+{
+    unzFile uf = NULL;
+    zlib_filefunc64_def ffunc = {0};
+    unz_file_info64 file_info = {0};
+    size_t size;
+    BOOL ret = FALSE;
+
+    data.clear();
+    fill_win32_filefunc64W(&ffunc);
+    uf = unzOpen2_64(m_fileName, &ffunc);
+    if (!uf)
+        return FALSE;
+
+    if (unzLocateFile(uf, name.c_str(), 1) == UNZ_OK
+        && unzGetCurrentFileInfo64(uf, &file_info, NULL, 0, NULL, 0, NULL, 0) == UNZ_OK
+        && unzOpenCurrentFilePassword(uf, NULL) == UNZ_OK)
+    {
+        // a probe inflates only the head of the entry
+        size = (size_t)file_info.uncompressed_size;
+        if (max_size && size > max_size)
+            size = max_size;
+        data.resize(size);
+        ret = size == 0 || unzReadCurrentFile(uf, &data[0], (unsigned int)size) == (int)size;
+        unzCloseCurrentFile(uf);
+    }
+    unzClose(uf);
+    if (!ret)
+        data.clear();
+    return ret;
+}
 #else
 BOOL EpubBook::UnzipBook(void)
 {
@@ -283,6 +375,7 @@ BOOL EpubBook::UnzipBook(void)
 #endif
     char *buf = NULL;
     file_data_t fdata;
+    inline_image_t image = { "", 0, 0, 0, 0, -1 };
 
 #if 0
     filename = Utf16ToAnsi(m_fileName);
@@ -314,6 +407,13 @@ BOOL EpubBook::UnzipBook(void)
             continue;
         if (mz_zip_reader_is_file_a_directory(&zip_archive, i))
             continue; // skip directories for now
+        if (IsImageEntry(file_stat.m_filename))
+        {
+            image.name = file_stat.m_filename;
+            image.size = (u32)file_stat.m_uncomp_size;
+            m_ImageFiles.insert(std::make_pair(image.name, image));
+            continue;
+        }
 
         // create memory to save this file
         buf = (char *)malloc((size_t)file_stat.m_uncomp_size);
@@ -343,6 +443,33 @@ BOOL EpubBook::UnzipBook(void)
     mz_zip_reader_end(&zip_archive);
     return TRUE;
 }
+
+BOOL EpubBook::ReadEntry(const std::string &name, std::string &data, size_t max_size)
+{
+    mz_zip_archive zip_archive;
+    entry_read_t read;
+    int index;
+    BOOL ret = FALSE;
+
+    data.clear();
+    memset(&zip_archive, 0, sizeof(zip_archive));
+    if (!mz_zip_reader_init_file(&zip_archive, (const char*)m_fileName, 0))
+        return FALSE;
+
+    read.data = &data;
+    read.max_size = max_size;
+    index = mz_zip_reader_locate_file(&zip_archive, name.c_str(), NULL, 0);
+    if (index >= 0)
+    {
+        ret = mz_zip_reader_extract_to_callback(&zip_archive, (mz_uint)index, ReadEntryCallback, &read, 0);
+        if (!ret && max_size && data.size() == max_size)
+            ret = TRUE; // stopped at the probe size
+    }
+    mz_zip_reader_end(&zip_archive);
+    if (!ret)
+        data.clear();
+    return ret;
+}
 #endif
 
 BOOL EpubBook::ParserOcf(epub_t &epub)
@@ -365,14 +492,14 @@ BOOL EpubBook::ParserOcf(epub_t &epub)
     if (!doc)
         goto end;
 
-    if (m_bForceKill)
+    if (ReadAcquire(&m_Token.cancel))
         goto end;
 
     xpathctx = xmlXPathNewContext(doc);
     if (!xpathctx)
         goto end;
 
-    if (m_bForceKill)
+    if (ReadAcquire(&m_Token.cancel))
         goto end;
 
     xpath = BAD_CAST("//*[local-name()='rootfile']/@full-path");
@@ -437,14 +564,14 @@ BOOL EpubBook::ParserOpf(epub_t &epub)
     if (!doc)
         goto end;
 
-    if (m_bForceKill)
+    if (ReadAcquire(&m_Token.cancel))
         goto end;
 
     xpathctx = xmlXPathNewContext(doc);
     if (!xpathctx)
         goto end;
 
-    if (m_bForceKill)
+    if (ReadAcquire(&m_Token.cancel))
         goto end;
 
     // parser manifest
@@ -484,7 +611,7 @@ BOOL EpubBook::ParserOpf(epub_t &epub)
                 }
                 if (keyword)
                     xmlFree(keyword);
-                if (m_bForceKill)
+                if (ReadAcquire(&m_Token.cancel))
                 {
                     delete item;
                     goto end;
@@ -508,7 +635,7 @@ BOOL EpubBook::ParserOpf(epub_t &epub)
             xmlXPathFreeObject(xpathobj);
     }
     
-    if (m_bForceKill)
+    if (ReadAcquire(&m_Token.cancel))
         goto end;
 
     // parser spine
@@ -536,7 +663,7 @@ BOOL EpubBook::ParserOpf(epub_t &epub)
             }
             if (keyword)
                 xmlFree(keyword);
-            if (m_bForceKill)
+            if (ReadAcquire(&m_Token.cancel))
                 goto end;
         }
 
@@ -549,7 +676,7 @@ BOOL EpubBook::ParserOpf(epub_t &epub)
 
     ret = TRUE;
 
-    if (m_bForceKill)
+    if (ReadAcquire(&m_Token.cancel))
     {
         ret = FALSE;
         goto end;
@@ -625,14 +752,14 @@ BOOL EpubBook::ParserNcx(epub_t &epub)
     if (!doc)
         goto end;
 
-    if (m_bForceKill)
+    if (ReadAcquire(&m_Token.cancel))
         goto end;
 
     xpathctx = xmlXPathNewContext(doc);
     if (!xpathctx)
         goto end;
 
-    if (m_bForceKill)
+    if (ReadAcquire(&m_Token.cancel))
         goto end;
 
     xpath = BAD_CAST("//*[local-name()='navPoint']");
@@ -709,7 +836,7 @@ BOOL EpubBook::ParserNcx(epub_t &epub)
             xmlFree(text);
         if (src)
             xmlFree(src);
-        if (m_bForceKill)
+        if (ReadAcquire(&m_Token.cancel))
             goto end;
     }
 
@@ -728,128 +855,44 @@ end:
     return ret;
 }
 
-BOOL EpubBook::ParserOps(file_data_t *fdata, wchar_t **text, int *len, wchar_t **title, int *tlen, BOOL parsertitle)
+BOOL EpubBook::ParserOps(epub_t &epub, const std::string &filename, file_data_t *fdata, wchar_t **text, int *len, wchar_t **title, int *tlen, BOOL parsertitle)
 {
-    filelist_t::iterator itor;
-    xmlDocPtr doc = NULL;
-    xmlChar *value;
-    const xmlChar *xpath = NULL;
-    xmlXPathContextPtr xpathctx = NULL;
-    xmlXPathObjectPtr xpathobj = NULL;
-    xmlNodeSetPtr nodeset;
-    int i;
-    BOOL ret = FALSE;
-    int keep_blanks_default = xmlKeepBlanksDefault(0);
-    doc = htmlReadMemory((const char *)fdata->data, fdata->size, NULL, NULL, XML_PARSE_RECOVER | XML_PARSE_NOBLANKS);
-    if (!doc)
-        goto end;
-
-    if (m_bForceKill)
-        goto end;
-
-    xpathctx = xmlXPathNewContext(doc);
-    if (!xpathctx)
-        goto end;
+    XhtmlText xhtml;
+    std::wstring name;
+    image_arg_t arg;
+    size_t pos;
+
+    pos = filename.find_last_of('/');
+    arg._this = this;
+    arg.dir = pos == std::string::npos ? "" : filename.substr(0, pos + 1);
+    arg.cover = &epub.cover;
+    xhtml.SetImageCallback(OnImage, &arg);
+    if (!xhtml.Parse((const char *)fdata->data, fdata->size, &m_Token.cancel))
+        return FALSE;
 
-    if (m_bForceKill)
-        goto end;
+    *text = xhtml.Detach(len);
+    if (!(*text))
+        return FALSE;
 
     if (parsertitle)
     {
-        bool title_set = false;
-        auto decode_node_text = [this](xmlNodePtr node, wchar_t **out, int *out_len) -> bool
-        {
-            if (!node)
-                return false;
-            xmlChar *value = xmlNodeGetContent(node);
-            if (!value)
-                return false;
-            BOOL ok = DecodeText((const char *)value, (int)strlen((const char *)value), out, out_len);
-            xmlFree(value);
-            return ok == TRUE;
-        };
-
-        xpath = BAD_CAST("//*[local-name()='h1' or local-name()='h2' or local-name()='h3']");
-        xpathobj = xmlXPathEvalExpression(xpath, xpathctx);
-        if (xpathobj && !xmlXPathNodeSetIsEmpty(xpathobj->nodesetval))
-        {
-            nodeset = xpathobj->nodesetval;
-            if (decode_node_text(nodeset->nodeTab[0], title, tlen))
-                title_set = (*tlen > 0);
-        }
-        if (xpathobj)
-            xmlXPathFreeObject(xpathobj);
-        xpathobj = NULL;
-
-        if (!title_set)
-        {
-            // parser title
-            xpath = BAD_CAST("//*[local-name()='title']");
-            xpathobj = xmlXPathEvalExpression(xpath, xpathctx);
-            if (xpathobj && !xmlXPathNodeSetIsEmpty(xpathobj->nodesetval))
-            {
-                nodeset = xpathobj->nodesetval;
-                if (decode_node_text(nodeset->nodeTab[0], title, tlen))
-                    title_set = (*tlen > 0);
-            }
-            if (xpathobj)
-                xmlXPathFreeObject(xpathobj);
-            xpathobj = NULL;
-        }
-    }
-
-    if (m_bForceKill)
-        goto end;
-
-body:
-    {
-        // parser body
-        xpath = BAD_CAST("//*[local-name()='body']");
-        xpathobj = xmlXPathEvalExpression(xpath, xpathctx);
-        if (!xpathobj)
-            goto end;
-
-        if (xmlXPathNodeSetIsEmpty(xpathobj->nodesetval))
-            goto end;
-
-        nodeset = xpathobj->nodesetval;
-        for (i = 0; i < nodeset->nodeNr; i++)
-        {
-            value = xmlNodeGetContent(nodeset->nodeTab[i]);
-
-            if (!DecodeText((const char *)value, (int)strlen((const char *)value), text, len))
-                ret = FALSE;
-            else
-                ret = TRUE;
-
-            xmlFree(value);
-            break;
-        }
-    }
-
-    if (parsertitle && (!(*title) || *tlen <= 0) && (*text) && *len > 0)
-    {
-        std::wstring fallback = FirstVisibleLine(*text, *len);
-        if (!fallback.empty())
+        // the first heading, the <title>, then the first line of the text
+        name = xhtml.GetHeading();
+        if (name.empty())
+            name = xhtml.GetTitle();
+        if (name.empty())
+            name = FirstVisibleLine(*text, *len);
+        if (!name.empty())
         {
             if (*title)
                 free(*title);
-            *tlen = (int)fallback.size();
+            *tlen = (int)name.size();
             *title = (wchar_t *)malloc(sizeof(wchar_t) * (*tlen + 1));
-            memcpy(*title, fallback.c_str(), sizeof(wchar_t) * (*tlen));
+            memcpy(*title, name.c_str(), sizeof(wchar_t) * (*tlen));
             (*title)[*tlen] = 0;
         }
     }
-
-end:
-    xmlKeepBlanksDefault(keep_blanks_default);
-    if (xpathobj)
-        xmlXPathFreeObject(xpathobj);
-    if (xpathctx)
-        xmlXPathFreeContext(xpathctx);
-    if (doc)
-        xmlFreeDoc(doc);
-    return ret;
+    return TRUE;
 }
 
 BOOL EpubBook::ParserChapters(epub_t &epub)
@@ -865,7 +908,8 @@ BOOL EpubBook::ParserChapters(epub_t &epub)
     manifests_t::iterator itmfest;
     navpoints_t::iterator itnav;
     file_data_t *fdata;
-    chapter_item_t chapter;
+    int chapter_index = 0;
+    std::wstring chapter_title;
     std::string filename;
     wchar_t *text = NULL;
     wchar_t *title = NULL;
@@ -877,7 +921,7 @@ BOOL EpubBook::ParserChapters(epub_t &epub)
     buffer = (buffer_t *)malloc(epub.spines.size() * sizeof(buffer_t));
     for (itspine = epub.spines.begin(); itspine != epub.spines.end(); itspine++)
     {
-        if (m_bForceKill)
+        if (ReadAcquire(&m_Token.cancel))
             goto end;
         itmfest = epub.manifests.find(*itspine);
         if (itmfest != epub.manifests.end())
@@ -888,13 +932,13 @@ BOOL EpubBook::ParserChapters(epub_t &epub)
             if (itflist != m_flist.end() /*&& itnav != epub.navmap.end()*/)
             {
                 fdata = &(itflist->second);
-                if (ParserOps(fdata, &text, &len, &title, &tlen, TRUE))
+                if (ParserOps(epub, filename, fdata, &text, &len, &title, &tlen, TRUE))
                 {
                     if (len > 0)
                     {
                         buffer[index].text = text;
                         buffer[index].len = len;
-                        chapter.index = m_Length;
+                        chapter_index = m_Length;
                         m_Length += len;
                         if (itnav != epub.navpoints.end())
                         {
@@ -907,19 +951,19 @@ BOOL EpubBook::ParserChapters(epub_t &epub)
                                 free(nav_title);
                             if (IsGenericTocTitle(nav))
                             {
-                                chapter.title = fallback;
+                                chapter_title = fallback;
                                 tlen = (int)fallback.size();
                             }
                             else
                             {
-                                chapter.title = nav;
+                                chapter_title = nav;
                                 tlen = (int)nav.size();
                             }
                         }
                         else
                         {
-                            chapter.title = title ? title : L"";
-                            tlen = (int)chapter.title.size();
+                            chapter_title = title ? title : L"";
+                            tlen = (int)chapter_title.size();
                         }
                         if (title)
                         {
@@ -927,15 +971,14 @@ BOOL EpubBook::ParserChapters(epub_t &epub)
                             title = NULL;
                             tlen = 0;
                         }
-                        if (chapter.title.empty())
+                        if (chapter_title.empty())
                         {
                             std::wstring fallback = Utf8ToUtf16(itmfest->second->href.c_str());
-                            chapter.title = fallback;
+                            chapter_title = fallback;
                             tlen = (int)fallback.size();
                         }
-                        chapter.title_len = tlen;
-                        if (!chapter.title.empty())
-                            m_Chapters.push_back(chapter);
+                        if (!chapter_title.empty())
+                            m_Chapters.push_back(chapter_index, chapter_title.c_str(), (int)chapter_title.size());
                         index++;
                     }
                 }
@@ -953,7 +996,7 @@ BOOL EpubBook::ParserChapters(epub_t &epub)
     }
 
 end:
-    if (m_bForceKill)
+    if (ReadAcquire(&m_Token.cancel))
     {
         for (i = 0; i < index; i++)
         {
@@ -995,9 +1038,9 @@ BOOL EpubBook::ParserCover(epub_t &epub)
     navpoints_t::iterator itnav;
     navpoint_t *p_navpoint;
     file_data_t *fdata;
-    IStream *pStream = NULL;
     const char *cover_fname = NULL;
     char image_fname[1024] = {0};
+    std::string data;
 
     if (m_Cover)
     {
@@ -1135,19 +1178,83 @@ _complete:
         if (itflist != m_flist.end())
         {
             fdata = &(itflist->second);
-            pStream = SHCreateMemStream((const BYTE *)fdata->data, fdata->size);
-            m_Cover = new Gdiplus::Bitmap(pStream);
-            if (m_Cover)
-            {
-                if (Gdiplus::Ok != m_Cover->GetLastStatus())
-                {
-                    delete m_Cover;
-                    m_Cover = NULL;
-                }
-            }
-            pStream->Release();
+            m_Cover = CoverImage::Decode(fdata->data, fdata->size);
+        }
+        else if (ReadEntry(epub.path + image_fname, data, 0))
+        {
+            // left in the zip with the other pictures
+            m_Cover = CoverImage::Decode(data.c_str(), data.size());
         }
+        if (m_Cover)
+            epub.cover = epub.path + image_fname;
     }
 
     return m_Cover != NULL;
 }
+
+int EpubBook::FindImage(const std::string &dir, const char *src, const std::string &cover)
+{
+    std::map<std::string, inline_image_t>::iterator itor;
+    std::vector<char> buf(strlen(src) + 1);
+    std::vector<std::string> parts;
+    std::string path, part;
+    size_t pos, next;
+
+    if (strstr(src, "://") || 0 == strncmp(src, "data:", 5))
+        return -1;
+    url_decode(src, &buf[0]);
+    path = &buf[0];
+    pos = path.find('#');
+    if (pos != std::string::npos)
+        path = path.substr(0, pos);
+    if (path.empty())
+        return -1;
+    path = path[0] == '/' ? path.substr(1) : dir + path;
+
+    // to the entry name, without . and ..
+    for (pos = 0; pos <= path.size(); pos = next + 1)
+    {
+        next = path.find('/', pos);
+        if (next == std::string::npos)
+            next = path.size();
+        part = path.substr(pos, next - pos);
+        if (part == "..")
+        {
+            if (!parts.empty())
+                parts.pop_back();
+        }
+        else if (!part.empty() && part != ".")
+        {
+            parts.push_back(part);
+        }
+    }
+    path.clear();
+    for (pos = 0; pos < parts.size(); pos++)
+    {
+        if (pos > 0)
+            path += '/';
+        path += parts[pos];
+    }
+
+    itor = m_ImageFiles.find(path);
+    if (itor == m_ImageFiles.end())
+        return -1;
+    if (GetCover() && path == cover)
+        return -1;  // it is the cover page already
+
+    // one id for all the pages that show it
+    if (itor->second.id < 0)
+    {
+        if ((int)m_Images.size() >= INLINE_IMAGE_MAX)
+            return -1;
+        itor->second.id = (int)m_Images.size();
+        m_Images.push_back(itor->second);
+    }
+    return itor->second.id;
+}
+
+int EpubBook::OnImage(void *arg, const char *src)
+{
+    image_arg_t *image_arg = (image_arg_t *)arg;
+    return image_arg->_this->FindImage(image_arg->dir, src, *image_arg->cover);
+}
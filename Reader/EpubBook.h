@@ -15,6 +15,7 @@ typedef struct epub_t
     manifests_t manifests;
     spines_t spines;
     navpoints_t navpoints;
+    std::string cover;      // entry of the cover image, not shown again in the text
 } epub_t;
 
 
@@ -33,18 +34,23 @@ protected:
     virtual BOOL ParserBook(HWND hWnd);
     virtual Gdiplus::Bitmap* GetCover(void);
     virtual int GetTextBeginIndex(void);
+    virtual BOOL ReadImage(int id, std::string &data, size_t max_size);
     void FreeFilelist(void);
     BOOL UnzipBook(void);
+    BOOL ReadEntry(const std::string &name, std::string &data, size_t max_size);
     BOOL ParserOcf(epub_t &epub);
     BOOL ParserOpf(epub_t &epub);
     BOOL ParserNcx(epub_t &epub);
-    BOOL ParserOps(file_data_t *fdata, wchar_t **text, int *len, wchar_t **title, int *tlen, BOOL parsertitle);
+    BOOL ParserOps(epub_t &epub, const std::string &filename, file_data_t *fdata, wchar_t **text, int *len, wchar_t **title, int *tlen, BOOL parsertitle);
     BOOL ParserChapters(epub_t &epub);
     BOOL ParserCover(epub_t &epub);
+    int  FindImage(const std::string &dir, const char *src, const std::string &cover);
+    static int OnImage(void *arg, const char *src);
 
 protected:
     Gdiplus::Bitmap *m_Cover;
     filelist_t m_flist;
+    std::map<std::string, inline_image_t> m_ImageFiles;    // pictures left compressed in the zip, by entry
 };
 
 #endif
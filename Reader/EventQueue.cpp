@@ -0,0 +1,75 @@
+#include "EventQueue.h"
+
+#define EVENT_QUEUE_MASK        (EVENT_QUEUE_SIZE - 1)
+#define SEQ_DIFF(a, b)          ((LONG)((ULONG)(a) - (ULONG)(b)))
+
+EventQueue::EventQueue()
+{
+    int i;
+
+    for (i = 0; i < EVENT_QUEUE_SIZE; i++)
+    {
+        m_Slots[i].seq = i;
+        m_Slots[i].type = 0;
+        m_Slots[i].data = NULL;
+    }
+    m_Head = 0;
+    m_Tail = 0;
+}
+
+EventQueue::~EventQueue()
+{
+}
+
+BOOL EventQueue::Push(int type, void *data)
+{
+    event_slot_t *slot;
+    LONG pos, diff;
+
+    // the acquire orders the writes below after the pop that freed the slot,
+    // volatile alone only does that with the msvc memory model
+    pos = ReadNoFence(&m_Head);
+    for (;;)
+    {
+        slot = &m_Slots[pos & EVENT_QUEUE_MASK];
+        diff = SEQ_DIFF(ReadAcquire(&slot->seq), pos);
+        if (diff == 0)
+        {
+            // claim the position, another producer may win it first
+            if (InterlockedCompareExchange(&m_Head, pos + 1, pos) == pos)
+                break;
+            pos = ReadNoFence(&m_Head);
+        }
+        else if (diff < 0)
+        {
+            return FALSE; // not popped yet, full
+        }
+        else
+        {
+            pos = ReadNoFence(&m_Head);
+        }
+    }
+
+    slot->type = type;
+    slot->data = data;
+    // publish, the full barrier orders the writes above
+    InterlockedExchange(&slot->seq, pos + 1);
+    return TRUE;
+}
+
+BOOL EventQueue::Pop(int *type, void **data)
+{
+    event_slot_t *slot;
+
+    slot = &m_Slots[m_Tail & EVENT_QUEUE_MASK];
+    if (SEQ_DIFF(ReadAcquire(&slot->seq), m_Tail + 1) < 0)
+        return FALSE;
+
+    *type = slot->type;
+    *data = slot->data;
+    slot->data = NULL;
+    // hand the slot to the push one lap later
+    InterlockedExchange(&slot->seq, m_Tail + EVENT_QUEUE_SIZE);
+    m_Tail++;
+    return TRUE;
+}
@@ -0,0 +1,34 @@
+#ifndef __EVENT_QUEUE_H__
+#define __EVENT_QUEUE_H__
+
+#include "types.h"
+
+#define EVENT_QUEUE_SIZE        64          // power of two
+
+typedef struct event_slot_t
+{
+    volatile LONG seq;      // turn of the slot, see EventQueue::Push
+    int type;
+    void *data;
+} event_slot_t;
+
+// Bounded lock free queue, any thread may push, only the owner thread pops.
+// A slot is free for the push of position pos when its seq equals pos, and
+// holds an event for the pop of position pos when its seq equals pos + 1.
+class EventQueue
+{
+public:
+    EventQueue();
+    ~EventQueue();
+
+public:
+    BOOL Push(int type, void *data);            // FALSE when full
+    BOOL Pop(int *type, void **data);           // FALSE when empty
+
+private:
+    event_slot_t m_Slots[EVENT_QUEUE_SIZE];
+    volatile LONG m_Head;   // next push, claimed by compare exchange
+    LONG m_Tail;            // next pop, owner thread only
+};
+
+#endif
@@ -1,5 +1,6 @@
 #include "framework.h"
 #include "HtmlParser.h"
+#include "XpathStream.h"
 #include "libxml/HTMLparser.h"
 #include "libxml/xpath.h"
 #include "libxml/HTMLtree.h"
@@ -69,9 +70,9 @@ void HtmlParser::ReleaseContent(char *content)
         free(content);
 }
 
-#define GOTO_STOP(s) if (*(s)) goto _stop
+#define GOTO_STOP(s) if (ReadAcquire(s)) goto _stop
 
-int HtmlParser::HtmlParseByXpath(const char* html, int len, const std::string& xpath, std::vector<std::string>& value, BOOL* stop, BOOL clear)
+int HtmlParser::HtmlParseByXpath(const char* html, int len, const std::string& xpath, std::vector<std::string>& value, volatile LONG* stop, BOOL clear)
 {
     int i;
     xmlDocPtr doc = NULL;
@@ -114,6 +115,7 @@ int HtmlParser::HtmlParseByXpath(const char* html, int len, const std::string& x
     if (xmlXPathNodeSetIsEmpty(xpathObj->nodesetval))
     {
         xmlXPathFreeObject(xpathObj);
+        xmlFreeDoc(doc);
         // No result
         return 0;
     }
@@ -156,7 +158,7 @@ _stop:
     return 1;
 }
 
-int HtmlParser::HtmlParseBegin(const char *html, int len, void** pdoc, void** pctx, BOOL* stop)
+int HtmlParser::HtmlParseBegin(const char *html, int len, void** pdoc, void** pctx, volatile LONG* stop)
 {
     xmlDocPtr doc = NULL;
     xmlXPathContextPtr xpathCtx = NULL;
@@ -191,7 +193,7 @@ _stop:
     return 1;
 }
 
-int HtmlParser::HtmlParseByXpath(void* doc_, void* ctx_, const std::string& xpath, std::vector<std::string>& value, BOOL* stop, BOOL clear)
+int HtmlParser::HtmlParseByXpath(void* doc_, void* ctx_, const std::string& xpath, std::vector<std::string>& value, volatile LONG* stop, BOOL clear)
 {
     int i;
     xmlDocPtr doc = (xmlDocPtr)doc_;
@@ -262,6 +264,52 @@ int HtmlParser::HtmlParseEnd(void* doc_, void* ctx_)
     return 0;
 }
 
+int HtmlParser::HtmlParseByXpaths(const char *html, int len, html_query_t *queries, int count, volatile LONG *stop)
+{
+    XpathStream stream;
+    std::vector<size_t> start;
+    void *doc = NULL;
+    void *ctx = NULL;
+    char *content;
+    size_t j;
+    int i;
+    int ret;
+
+    for (i = 0; i < count; i++)
+    {
+        start.push_back(queries[i].value->size());
+        if (!stream.Add(queries[i].xpath, queries[i].value))
+            break;
+    }
+
+    if (i < count)
+    {
+        // one xpath out of the subset, the tree is built once for all of them
+        ret = HtmlParseBegin(html, len, &doc, &ctx, stop);
+        for (i = 0; i < count; i++)
+            ret |= HtmlParseByXpath(doc, ctx, queries[i].xpath, *queries[i].value, stop, queries[i].clear);
+        HtmlParseEnd(doc, ctx);
+        return ret;
+    }
+
+    ret = stream.Run(html, len, stop);
+    for (i = 0; i < count; i++)
+    {
+        if (!queries[i].clear)
+            continue;
+        for (j = start[i]; j < queries[i].value->size(); j++)
+        {
+            content = CreateContent((*queries[i].value)[j].c_str());
+            if (content)
+            {
+                (*queries[i].value)[j] = content;
+                ReleaseContent(content);
+            }
+        }
+    }
+    return ret;
+}
+
 int HtmlParser::FormatHtml(char *html, int len, char **htmlfmt, int *fmtlen)
 {
     xmlDocPtr doc = NULL;
@@ -295,3 +343,92 @@ void HtmlParser::FreeFormat(char *htmlfmt)
 {
     xmlFree(htmlfmt);
 }
+
+#define HTML_SCAN_CHUNK     4096    // parsed at a time, the xpaths run each time the parsed part doubled
+
+int HtmlParser::HtmlScanByXpath(const char *html, int len, const std::string &xpath1, const std::string &xpath2, std::string &value1, std::string &value2, volatile LONG *stop)
+{
+    htmlParserCtxtPtr ctxt = NULL;
+    std::string url, keyword;
+    BOOL matched = FALSE;
+    int offset = 0;
+    int check = HTML_SCAN_CHUNK;
+    int size;
+    int ret = 1;
+
+    if (!html || len <= 0)
+        return 1;
+
+    ctxt = htmlCreatePushParserCtxt(NULL, NULL, NULL, 0, NULL, XML_CHAR_ENCODING_UTF8);
+    if (!ctxt)
+        return 1;
+    htmlCtxtUseOptions(ctxt, HTML_PARSE_RECOVER | HTML_PARSE_NOERROR | HTML_PARSE_NOWARNING);
+
+    while (offset < len)
+    {
+        GOTO_STOP(stop);
+        size = len - offset < HTML_SCAN_CHUNK ? len - offset : HTML_SCAN_CHUNK;
+        offset += size;
+        htmlParseChunk(ctxt, html + offset - size, size, offset >= len);
+        // an xpath runs over the whole tree, so evaluated at every chunk the scan
+        // grows with the square of the page; at doubled sizes it stays linear
+        if (offset < check && offset < len)
+            continue;
+        check = offset < INT_MAX / 2 ? offset * 2 : INT_MAX;
+        if (!ctxt->myDoc || !FirstByXpath(ctxt->myDoc, xpath1, url) || !FirstByXpath(ctxt->myDoc, xpath2, keyword))
+            continue;
+
+        // a node at the end of the parsed part may still grow, take it once the next check left it as is
+        if (matched && url == value1 && keyword == value2)
+        {
+            ret = 0;
+            break;
+        }
+        value1 = url;
+        value2 = keyword;
+        matched = TRUE;
+        if (offset >= len)
+            ret = 0;
+    }
+
+_stop:
+    if (ctxt->myDoc)
+        xmlFreeDoc(ctxt->myDoc);
+    htmlFreeParserCtxt(ctxt);
+    return ret;
+}
+
+BOOL HtmlParser::FirstByXpath(void *doc, const std::string &xpath, std::string &value)
+{
+    xmlXPathContextPtr xpathCtx = NULL;
+    xmlXPathObjectPtr xpathObj = NULL;
+    xmlChar* keyword = NULL;
+    char* content = NULL;
+    BOOL ret = FALSE;
+
+    xpathCtx = xmlXPathNewContext((xmlDocPtr)doc);
+    if (!xpathCtx)
+        return FALSE;
+    xpathObj = xmlXPathEvalExpression(BAD_CAST xpath.c_str(), xpathCtx);
+    xmlXPathFreeContext(xpathCtx);
+    if (!xpathObj)
+        return FALSE;
+
+    if (!xmlXPathNodeSetIsEmpty(xpathObj->nodesetval))
+    {
+        keyword = xmlNodeGetContent(xpathObj->nodesetval->nodeTab[0]);
+        if (keyword)
+        {
+            content = CreateContent((const char*)keyword);
+            if (content)
+            {
+                value = content;
+                ReleaseContent(content);
+                ret = TRUE;
+            }
+            xmlFree(keyword);
+        }
+    }
+    xmlXPathFreeObject(xpathObj);
+    return ret;
+}
@@ -4,6 +4,13 @@
 #include <string>
 #include <vector>
 
+typedef struct html_query_t
+{
+    const char *xpath;
+    std::vector<std::string> *value;
+    BOOL clear;
+} html_query_t;
+
 class HtmlParser
 {
 private:
@@ -14,17 +21,24 @@ public:
     static HtmlParser* Instance();
     static void ReleaseInstance();
 
-    int HtmlParseByXpath(const char *html, int len, const std::string &xpath, std::vector<std::string> &value, BOOL *stop, BOOL clear = FALSE);
+    int HtmlParseByXpath(const char *html, int len, const std::string &xpath, std::vector<std::string> &value, volatile LONG *stop, BOOL clear = FALSE);
 
     // for multi parser
-    int HtmlParseBegin(const char *html, int len, void **doc, void **ctx, BOOL* stop);
-    int HtmlParseByXpath(void *doc, void *ctx, const std::string &xpath, std::vector<std::string> &value, BOOL* stop, BOOL clear = FALSE);
+    int HtmlParseBegin(const char *html, int len, void **doc, void **ctx, volatile LONG* stop);
+    int HtmlParseByXpath(void *doc, void *ctx, const std::string &xpath, std::vector<std::string> &value, volatile LONG* stop, BOOL clear = FALSE);
     int HtmlParseEnd(void *doc, void *ctx);
 
+    // every query over one parse, streamed without a tree when all of the xpaths are simple paths
+    int HtmlParseByXpaths(const char *html, int len, html_query_t *queries, int count, volatile LONG *stop);
+
     int FormatHtml(char *html, int len, char **htmlfmt, int *fmtlen);
     void FreeFormat(char *htmlfmt);
 
+    // push parser, stops at the first check after which both xpaths have the same match as before
+    int HtmlScanByXpath(const char *html, int len, const std::string &xpath1, const std::string &xpath2, std::string &value1, std::string &value2, volatile LONG *stop);
+
 private:
+    BOOL FirstByXpath(void *doc, const std::string &xpath, std::string &value);
     char * CreateContent(const char* xml);
     void ReleaseContent(char *content);
 };
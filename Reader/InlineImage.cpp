@@ -0,0 +1,167 @@
+#include "InlineImage.h"
+
+#define BE16(p)     (((u32)(p)[0] << 8) | (p)[1])
+#define BE32(p)     (((u32)(p)[0] << 24) | ((u32)(p)[1] << 16) | ((u32)(p)[2] << 8) | (p)[3])
+#define LE16(p)     ((u32)(p)[0] | ((u32)(p)[1] << 8))
+#define LE24(p)     ((u32)(p)[0] | ((u32)(p)[1] << 8) | ((u32)(p)[2] << 16))
+#define LE32(p)     ((u32)(p)[0] | ((u32)(p)[1] << 8) | ((u32)(p)[2] << 16) | ((u32)(p)[3] << 24))
+
+static BOOL jpeg_probe_size(const BYTE *p, size_t size, int *width, int *height)
+{
+    size_t i = 2;
+    u32 len;
+    BYTE marker;
+
+    // segments up to the first start of frame, SOF0 to SOF15 without DHT, JPG and DAC
+    while (i + 4 <= size)
+    {
+        if (p[i] != 0xFF)
+            return FALSE;
+        marker = p[i + 1];
+        if (marker == 0xFF)
+        {
+            i++;
+            continue;
+        }
+        if (marker == 0xD8 || marker == 0x01 || (marker >= 0xD0 && marker <= 0xD7))
+        {
+            i += 2;
+            continue;
+        }
+        if (marker == 0xD9 || marker == 0xDA)
+            return FALSE;
+        len = BE16(p + i + 2);
+        if (len < 2)
+            return FALSE;
+        if (marker >= 0xC0 && marker <= 0xCF && marker != 0xC4 && marker != 0xC8 && marker != 0xCC)
+        {
+            if (i + 9 > size)
+                return FALSE;
+            *height = (int)BE16(p + i + 5);
+            *width = (int)BE16(p + i + 7);
+            return TRUE;
+        }
+        i += 2 + len;
+    }
+    return FALSE;
+}
+
+BOOL image_probe_size(const void *data, size_t size, int *width, int *height)
+{
+    const BYTE *p = (const BYTE *)data;
+    int w = 0, h = 0;
+
+    if (!p || size < 10)
+        return FALSE;
+
+    if (p[0] == 0xFF && p[1] == 0xD8)
+    {
+        if (!jpeg_probe_size(p, size, &w, &h))
+            return FALSE;
+    }
+    else if (size >= 24 && memcmp(p, "\x89PNG\r\n\x1a\n", 8) == 0 && memcmp(p + 12, "IHDR", 4) == 0)
+    {
+        w = (int)BE32(p + 16);
+        h = (int)BE32(p + 20);
+    }
+    else if (memcmp(p, "GIF8", 4) == 0)
+    {
+        w = (int)LE16(p + 6);
+        h = (int)LE16(p + 8);
+    }
+    else if (size >= 26 && p[0] == 'B' && p[1] == 'M')
+    {
+        if (LE32(p + 14) == 12)
+        {
+            w = (int)LE16(p + 18);
+            h = (int)LE16(p + 20);
+        }
+        else
+        {
+            w = (int)LE32(p + 18);
+            h = (int)LE32(p + 22);
+            if (h < 0)
+                h = -h; // top down
+        }
+    }
+    else if (size >= 30 && memcmp(p, "RIFF", 4) == 0 && memcmp(p + 8, "WEBP", 4) == 0)
+    {
+        if (memcmp(p + 12, "VP8 ", 4) == 0)
+        {
+            w = (int)(LE16(p + 26) & 0x3FFF);
+            h = (int)(LE16(p + 28) & 0x3FFF);
+        }
+        else if (memcmp(p + 12, "VP8L", 4) == 0 && p[20] == 0x2F)
+        {
+            w = (int)(LE32(p + 21) & 0x3FFF) + 1;
+            h = (int)((LE32(p + 21) >> 14) & 0x3FFF) + 1;
+        }
+        else if (memcmp(p + 12, "VP8X", 4) == 0)
+        {
+            w = (int)LE24(p + 24) + 1;
+            h = (int)LE24(p + 27) + 1;
+        }
+    }
+
+    if (w <= 0 || h <= 0)
+        return FALSE;
+    *width = w;
+    *height = h;
+    return TRUE;
+}
+
+ImageCache::ImageCache(size_t budget)
+    : m_Bytes(0)
+    , m_Budget(budget)
+{
+}
+
+ImageCache::~ImageCache()
+{
+    Clear();
+}
+
+Gdiplus::Bitmap* ImageCache::Get(int id, int box_width, int box_height)
+{
+    std::list<image_cache_item_t>::iterator it;
+
+    for (it = m_Items.begin(); it != m_Items.end(); it++)
+    {
+        if (it->id != id || it->box_width != box_width || it->box_height != box_height)
+            continue;
+        if (it != m_Items.begin())
+            m_Items.splice(m_Items.begin(), m_Items, it);
+        return m_Items.front().image;
+    }
+    return NULL;
+}
+
+void ImageCache::Put(int id, int box_width, int box_height, Gdiplus::Bitmap *image)
+{
+    image_cache_item_t item;
+
+    item.id = id;
+    item.box_width = box_width;
+    item.box_height = box_height;
+    item.image = image;
+    item.bytes = (size_t)image->GetWidth() * image->GetHeight() * 4;
+    m_Items.push_front(item);
+    m_Bytes += item.bytes;
+
+    while (m_Bytes > m_Budget && m_Items.size() > 1)
+    {
+        m_Bytes -= m_Items.back().bytes;
+        delete m_Items.back().image;
+        m_Items.pop_back();
+    }
+}
+
+void ImageCache::Clear(void)
+{
+    std::list<image_cache_item_t>::iterator it;
+
+    for (it = m_Items.begin(); it != m_Items.end(); it++)
+        delete it->image;
+    m_Items.clear();
+    m_Bytes = 0;
+}
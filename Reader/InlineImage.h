@@ -0,0 +1,55 @@
+#ifndef __INLINE_IMAGE_H__
+#define __INLINE_IMAGE_H__
+
+#include "types.h"
+#include <string>
+#include <list>
+
+#define INLINE_IMAGE_BASE           0xE000          // image n is the character INLINE_IMAGE_BASE + n, on a line of its own
+#define INLINE_IMAGE_MAX            0x1900          // the private use area, U+E000 to U+F8FF
+#define INLINE_IMAGE_PROBE_BYTES    (64 << 10)      // read for the size of an image
+#define INLINE_IMAGE_CACHE_BYTES    (32 << 20)      // decoded pixels kept per book
+
+#define is_inline_image(c)          ((c) >= INLINE_IMAGE_BASE && (c) < INLINE_IMAGE_BASE + INLINE_IMAGE_MAX)
+
+typedef struct inline_image_t
+{
+    std::string name;   // entry of the zip, or resource of the mobi
+    u32 offset;         // of the record in a mobi file
+    u32 size;           // bytes of the entry or the record
+    int width;          // 0 until read, -1 when it can not be read
+    int height;
+    int id;             // -1 until the text shows it
+} inline_image_t;
+
+typedef struct image_cache_item_t
+{
+    int id;
+    int box_width;      // the box it was decoded for
+    int box_height;
+    Gdiplus::Bitmap *image;
+    size_t bytes;
+} image_cache_item_t;
+
+// Size of a JPEG, PNG, GIF, BMP or WebP from its header, without decoding it.
+BOOL image_probe_size(const void *data, size_t size, int *width, int *height);
+
+// Images of a book decoded at the size of the box they are drawn in. The least
+// recently drawn go first once the pixels are over budget, the last one stays.
+class ImageCache
+{
+public:
+    ImageCache(size_t budget);
+    ~ImageCache();
+
+    Gdiplus::Bitmap* Get(int id, int box_width, int box_height);
+    void Put(int id, int box_width, int box_height, Gdiplus::Bitmap *image);   // the cache owns it
+    void Clear(void);
+
+private:
+    std::list<image_cache_item_t> m_Items;  // most recently drawn first
+    size_t m_Bytes;
+    size_t m_Budget;
+};
+
+#endif
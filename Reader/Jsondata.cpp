@@ -619,8 +619,6 @@ class json_header_t
     cJSON* tag_count;
     json_tagitem_t* tags[MAX_TAG_COUNT];
 #endif
-    cJSON* book_source_count;
-    json_book_source_t* book_sources[MAX_BOOKSRC_COUNT];
 public:
     json_header_t(cJSON* parent, header_t* data)
     {
@@ -727,15 +725,6 @@ public:
             cJSON_AddItemToArray(array, item);
         }
 #endif
-        memset(book_sources, 0, sizeof(json_book_source_t*) * MAX_BOOKSRC_COUNT);
-        book_source_count = cJSON_AddNumberToObject(parent, "book_source_count", data->book_source_count);
-        array = cJSON_AddArrayToObject(parent, "book_sources");
-        for (i = 0; i < data->book_source_count; i++)
-        {
-            item = cJSON_CreateObject();
-            book_sources[i] = new json_book_source_t(item, &(data->book_sources[i]));
-            cJSON_AddItemToArray(array, item);
-        }
     }
     json_header_t(cJSON* parent) // for json parser
         : placement(NULL)
@@ -852,19 +841,6 @@ public:
             }
         }
 #endif
-        book_source_count = cJSON_GetObjectItem(parent, "book_source_count");
-        memset(book_sources, 0, sizeof(json_book_source_t*) * MAX_BOOKSRC_COUNT);
-        array = cJSON_GetObjectItem(parent, "book_sources");
-        if (array)
-        {
-            size = cJSON_GetArraySize(array);
-            for (i = 0; i < size; i++)
-            {
-                item = cJSON_GetArrayItem(array, i);
-                if (item)
-                    book_sources[i] = new json_book_source_t(item);
-            }
-        }
     }
     ~json_header_t()
     {
@@ -900,11 +876,6 @@ public:
                 delete tags[i];
         }
 #endif
-        for (i = 0; i < MAX_BOOKSRC_COUNT; i++)
-        {
-            if (book_sources[i])
-                delete book_sources[i];
-        }
     }
     void GetData(header_t* data)
     {
@@ -1026,13 +997,6 @@ public:
                 tags[i]->GetData(&(data->tags[i]));
         }
 #endif
-        if (book_source_count)
-            data->book_source_count = book_source_count->valueint;
-        for (i = 0; i < data->book_source_count; i++)
-        {
-            if (book_sources[i])
-                book_sources[i]->GetData(&(data->book_sources[i]));
-        }
     }
 };
 
@@ -1081,34 +1045,91 @@ public:
             data->id = id->valueint;
         if (index)
             data->index = index->valueint;
-        if (file_name)
-            wcscpy(data->file_name, Utf8ToUtf16(file_name->valuestring));
+        if (file_name && file_name->valuestring)
+            data->file_name = _wcsdup(Utf8ToUtf16(file_name->valuestring));
         if (mark_size)
             data->mark_size = mark_size->valueint;
-        if (mark)
+        size = mark ? cJSON_GetArraySize(mark) : 0;
+        if (size > MAX_MARK_COUNT)
+            size = MAX_MARK_COUNT;
+        if (data->mark_size > size)
+            data->mark_size = size;
+        if (data->mark_size > 0)
         {
-            size = cJSON_GetArraySize(mark);
-            if (size > MAX_MARK_COUNT)
-                size = MAX_MARK_COUNT;
-            for (i = 0; i < size; i++)
+            data->mark = (int *)calloc(size, sizeof(int));
+            if (data->mark)
             {
-                item = cJSON_GetArrayItem(mark, i);
-                if (item)
-                    data->mark[i] = item->valueint;
+                data->mark_cap = size;
+                for (i = 0; i < size; i++)
+                {
+                    item = cJSON_GetArrayItem(mark, i);
+                    if (item)
+                        data->mark[i] = item->valueint;
+                }
+            }
+            else
+            {
+                data->mark_size = 0;
             }
         }
+        else
+        {
+            data->mark_size = 0;
+        }
         if (is_new)
             data->is_new = is_new->valueint;
     }
 };
 
-char* create_json(header_t *data)
+static void add_book_sources(cJSON* parent, BookSources* sources)
+{
+    cJSON* array, * item;
+    json_book_source_t* json_bs;
+    int i;
+
+    cJSON_AddNumberToObject(parent, "book_source_count", sources->Count());
+    array = cJSON_AddArrayToObject(parent, "book_sources");
+    for (i = 0; i < sources->Count(); i++)
+    {
+        item = cJSON_CreateObject();
+        json_bs = new json_book_source_t(item, sources->Get(i));
+        cJSON_AddItemToArray(array, item);
+        delete json_bs;
+    }
+}
+
+// walks the array once, one book_source_t is reused for every entry
+static BOOL get_book_sources(cJSON* array, book_source_cb_t cb, void* arg)
+{
+    book_source_t* bs;
+    json_book_source_t* json_bs;
+    cJSON* item;
+
+    if (!array || !cJSON_IsArray(array))
+        return FALSE;
+
+    bs = (book_source_t*)malloc(sizeof(book_source_t));
+    if (!bs)
+        return FALSE;
+    for (item = array->child; item; item = item->next)
+    {
+        memset(bs, 0, sizeof(book_source_t));
+        json_bs = new json_book_source_t(item);
+        json_bs->GetData(bs);
+        delete json_bs;
+        if (!cb(bs, arg))
+            break;
+    }
+    free(bs);
+    return TRUE;
+}
+
+char* create_json(header_t *data, item_t **itemdata, BookSources *sources)
 {
     cJSON* root, * header, * items, * item;
     json_header_t* headerobj;
     json_item_t* itemobj;
-    item_t* itemdata;
-    int i, offset;
+    int i;
     char* json = NULL;
 
     root = cJSON_CreateObject();
@@ -1116,16 +1137,14 @@ char* create_json(header_t *data)
     cJSON_AddItemToObject(root, "header", header);
 
     headerobj = new json_header_t(header, data);
+    add_book_sources(header, sources);
     if (data->item_count > 0)
     {
         items = cJSON_AddArrayToObject(root, "items");
         for (i = 0; i < data->item_count; i++)
         {
-            offset = sizeof(header_t) + i * sizeof(item_t);
-            itemdata = (item_t*)((char*)data + offset);
-
             item = cJSON_CreateObject();
-            itemobj = new json_item_t(item, itemdata);
+            itemobj = new json_item_t(item, itemdata[i]);
             cJSON_AddItemToArray(items, item);
             delete itemobj;
         }
@@ -1143,19 +1162,20 @@ void create_json_free(char* json)
         free(json);
 }
 
-BOOL parser_json(const char* json, header_t* defhdr, void** data, int* size)
+BOOL parser_json(const char* json, header_t* defhdr, void** data, int* size, item_t** itemdata, BookSources* sources)
 {
     cJSON* root, *header, *items, *item;
     json_header_t* headerobj;
     json_item_t* itemobj;
-    item_t* itemdata;
-    int i, offset;
+    int i;
 
     *data = NULL;
     *size = 0;
+    *itemdata = NULL;
     root = cJSON_Parse(json);
     if (!root)
     {
+        defhdr->item_count = 0;
         *size = sizeof(header_t);
         *data = (header_t*)malloc(*size);
         memcpy(*data, defhdr, *size);
@@ -1166,6 +1186,7 @@ BOOL parser_json(const char* json, header_t* defhdr, void** data, int* size)
     header = cJSON_GetObjectItem(root, "header");
     if (!header)
     {
+        defhdr->item_count = 0;
         *size = sizeof(header_t);
         *data = (header_t*)malloc(*size);
         memcpy(*data, defhdr, *size);
@@ -1176,10 +1197,16 @@ BOOL parser_json(const char* json, header_t* defhdr, void** data, int* size)
     headerobj = new json_header_t(header);
     headerobj->GetData(defhdr);
     delete headerobj;
+    sources->Clear();
+    get_book_sources(cJSON_GetObjectItem(header, "book_sources"), BookSources::AddCallback, sources);
 
     // parser items
     items = cJSON_GetObjectItem(root, "items");
-    if (!items || cJSON_GetArraySize(items) <= 0 || cJSON_GetArraySize(items) != defhdr->item_count)
+    if (items && cJSON_GetArraySize(items) > 0 && cJSON_GetArraySize(items) == defhdr->item_count)
+    {
+        *itemdata = (item_t*)calloc(defhdr->item_count, sizeof(item_t));
+    }
+    if (!*itemdata)
     {
         defhdr->item_count = 0;
         *size = sizeof(header_t);
@@ -1189,18 +1216,16 @@ BOOL parser_json(const char* json, header_t* defhdr, void** data, int* size)
         return TRUE;
     }
 
-    *size = sizeof(header_t) + (sizeof(item_t) * (defhdr->item_count));
+    // items are returned apart from the header, strings and marks owned by the caller
+    *size = sizeof(header_t);
     *data = (header_t*)malloc(*size);
-    memset(*data, 0, *size);
     memcpy(*data, defhdr, sizeof(header_t));
 
     for (i = 0; i < defhdr->item_count; i++)
     {
-        offset = sizeof(header_t) + i * sizeof(item_t);
-        itemdata = (item_t*)((char*)(*data) + offset);
         item = cJSON_GetArrayItem(items, i);
         itemobj = new json_item_t(item);
-        itemobj->GetData(itemdata);
+        itemobj->GetData(&(*itemdata)[i]);
         delete itemobj;
     }
     
@@ -1208,11 +1233,10 @@ BOOL parser_json(const char* json, header_t* defhdr, void** data, int* size)
     return TRUE;
 }
 
-BOOL import_book_source(const char* json, book_source_t *bs, int* count)
+BOOL import_book_source(const char* json, book_source_cb_t cb, void* arg)
 {
-    cJSON* root, * book_sources, * item;
-    json_book_source_t* json_bs;
-    int i;
+    cJSON* root, * book_sources;
+    BOOL ret;
 
     root = cJSON_Parse(json);
     if (!root)
@@ -1221,36 +1245,25 @@ BOOL import_book_source(const char* json, book_source_t *bs, int* count)
     }
 
     book_sources = cJSON_GetObjectItem(root, "book_sources");
-    if (!book_sources || cJSON_GetArraySize(book_sources) <= 0 || cJSON_GetArraySize(book_sources) > MAX_BOOKSRC_COUNT)
+    if (!book_sources || !book_sources->child)
     {
         cJSON_Delete(root);
         return FALSE;
     }
 
-    *count = 0;
-    for (i = 0; i < cJSON_GetArraySize(book_sources); i++)
-    {
-        item = cJSON_GetArrayItem(book_sources, i);
-        if (item)
-        {
-            json_bs = new json_book_source_t(item);
-            json_bs->GetData(&(bs[i]));
-            (*count)++;
-            delete json_bs;
-        }   
-    }
+    ret = get_book_sources(book_sources, cb, arg);
     cJSON_Delete(root);
-    return TRUE;
+    return ret;
 }
 
-BOOL export_book_source(const book_source_t* bs, int count, char** json)
+BOOL export_book_source(BookSources* sources, char** json)
 {
     cJSON* root, * book_sources, * item;
     json_book_source_t* json_bs;
     int i;
 
     *json = NULL;
-    if (!bs || count < 0 || count > MAX_BOOKSRC_COUNT)
+    if (!sources)
     {
         return FALSE;
     }
@@ -1258,10 +1271,10 @@ BOOL export_book_source(const book_source_t* bs, int count, char** json)
     root = cJSON_CreateObject();
     book_sources = cJSON_AddArrayToObject(root, "book_sources");
 
-    for (i = 0; i < count; i++)
+    for (i = 0; i < sources->Count(); i++)
     {
         item = cJSON_CreateObject();
-        json_bs = new json_book_source_t(item, &(bs[i]));
+        json_bs = new json_book_source_t(item, sources->Get(i));
         cJSON_AddItemToArray(book_sources, item);
         delete json_bs;
     }
@@ -2,13 +2,16 @@
 #define __JSON_DATA_H__
 
 #include "types.h"
+#include "BookSources.h"
 
-char* create_json(header_t* data);
+typedef BOOL (*book_source_cb_t)(const book_source_t *bs, void *arg); // return FALSE to stop
+
+char* create_json(header_t* data, item_t** items, BookSources* sources);
 void create_json_free(char* json);
-BOOL parser_json(const char* json, header_t* defhdr, void **data, int *size);
+BOOL parser_json(const char* json, header_t* defhdr, void **data, int *size, item_t **items, BookSources* sources);
 
-BOOL import_book_source(const char *json, book_source_t *bs, int *count);
-BOOL export_book_source(const book_source_t *bs, int count, char **json);
+BOOL import_book_source(const char *json, book_source_cb_t cb, void *arg);
+BOOL export_book_source(BookSources *sources, char **json);
 void export_book_source_free(char* json);
 
 #endif
\ No newline at end of file
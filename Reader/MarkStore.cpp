@@ -0,0 +1,400 @@
+#include "MarkStore.h"
+#include <shlwapi.h>
+
+MarkStore::MarkStore()
+{
+    m_FileName[0] = 0;
+    m_Book = NULL;
+    m_Marks = NULL;
+    m_Tree = NULL;
+    m_Size = 0;
+    m_Cap = 0;
+    m_Delta = FALSE;
+    m_Records = 0;
+}
+
+MarkStore::~MarkStore()
+{
+    Close();
+}
+
+BOOL MarkStore::Open(const TCHAR *dir, const TCHAR *book, u32 hash)
+{
+    BOOL exist = FALSE;
+
+    Close();
+    if (!FindFile(dir, book, hash, m_FileName, &exist))
+        return FALSE;
+    m_Book = _tcsdup(book);
+    if (!m_Book)
+        return FALSE;
+
+    if (exist && !Load())
+    {
+        // unreadable journal, start over
+        m_Size = 0;
+        m_Delta = FALSE;
+        DeleteFile(m_FileName);
+    }
+    if (m_Records > m_Size * 2 + 64)
+        Compact();
+    return TRUE;
+}
+
+void MarkStore::Close(void)
+{
+    if (m_Book)
+        free(m_Book);
+    if (m_Marks)
+        free(m_Marks);
+    if (m_Tree)
+        free(m_Tree);
+    m_FileName[0] = 0;
+    m_Book = NULL;
+    m_Marks = NULL;
+    m_Tree = NULL;
+    m_Size = 0;
+    m_Cap = 0;
+    m_Delta = FALSE;
+    m_Records = 0;
+}
+
+BOOL MarkStore::IsOpen(const TCHAR *book)
+{
+    return m_Book && _tcscmp(m_Book, book) == 0;
+}
+
+int MarkStore::Count(void)
+{
+    return m_Size;
+}
+
+int MarkStore::Get(int i)
+{
+    if (i < 0 || i >= m_Size)
+        return 0;
+    return m_Marks[i] + (m_Delta ? TreeSum(i) : 0);
+}
+
+BOOL MarkStore::Add(int value)
+{
+    if (!Insert(value))
+        return FALSE;
+    Append(mo_add, value, 0);
+    return TRUE;
+}
+
+BOOL MarkStore::Remove(int i)
+{
+    int value = Get(i);
+
+    if (!Erase(i))
+        return FALSE;
+    Append(mo_del, value, 0);
+    return TRUE;
+}
+
+void MarkStore::Shift(int index, int size)
+{
+    if (m_Size == 0 || size == 0)
+        return;
+    Move(index, size);
+    Append(mo_shift, index, size);
+}
+
+void MarkStore::Delete(const TCHAR *dir, const TCHAR *book, u32 hash)
+{
+    TCHAR file_name[MAX_PATH];
+    BOOL exist = FALSE;
+
+    if (FindFile(dir, book, hash, file_name, &exist) && exist)
+        DeleteFile(file_name);
+}
+
+BOOL MarkStore::FindFile(const TCHAR *dir, const TCHAR *book, u32 hash, TCHAR *file_name, BOOL *exist)
+{
+    mark_file_header_t header;
+    TCHAR name[32];
+    TCHAR *path;
+    FILE *fp;
+    size_t len = _tcslen(book);
+    int i;
+    BOOL match;
+
+    // hash collisions probe the next name, the journal keeps the book path
+    for (i = 0; i < MARK_PROBE_COUNT; i++)
+    {
+        if (i == 0)
+            _stprintf(name, _T("%08X.mk"), hash);
+        else
+            _stprintf(name, _T("%08X-%d.mk"), hash, i);
+        _tcscpy(file_name, dir);
+        PathAppend(file_name, name);
+
+        fp = _tfopen(file_name, _T("rb"));
+        if (!fp)
+        {
+            *exist = FALSE;
+            return TRUE;
+        }
+        match = FALSE;
+        if (fread(&header, sizeof(header), 1, fp) == 1
+            && header.magic == MARK_FILE_MAGIC
+            && header.name_len == len)
+        {
+            path = (TCHAR *)malloc(len * sizeof(TCHAR));
+            if (path)
+            {
+                match = fread(path, sizeof(TCHAR), len, fp) == len
+                    && memcmp(path, book, len * sizeof(TCHAR)) == 0;
+                free(path);
+            }
+        }
+        fclose(fp);
+        if (match)
+        {
+            *exist = TRUE;
+            return TRUE;
+        }
+    }
+    return FALSE;
+}
+
+BOOL MarkStore::Load(void)
+{
+    mark_file_header_t header;
+    mark_record_t record;
+    FILE *fp;
+    int i;
+
+    fp = _tfopen(m_FileName, _T("rb"));
+    if (!fp)
+        return FALSE;
+    if (fread(&header, sizeof(header), 1, fp) != 1
+        || header.magic != MARK_FILE_MAGIC
+        || header.version != MARK_FILE_VERSION
+        || fseek(fp, header.name_len * sizeof(TCHAR), SEEK_CUR) != 0)
+    {
+        fclose(fp);
+        return FALSE;
+    }
+
+    // replay, a torn record at the end is ignored
+    while (fread(&record, sizeof(record), 1, fp) == 1)
+    {
+        switch (record.op)
+        {
+        case mo_add:
+            Insert(record.a);
+            break;
+        case mo_del:
+            i = LowerBound(record.a);
+            if (i < m_Size && Get(i) == record.a)
+                Erase(i);
+            break;
+        case mo_shift:
+            Move(record.a, record.b);
+            break;
+        default:
+            break;
+        }
+        m_Records++;
+    }
+    fclose(fp);
+    return TRUE;
+}
+
+BOOL MarkStore::Insert(int value)
+{
+    int i;
+    int cap;
+    int *marks;
+    int *tree;
+
+    i = LowerBound(value);
+    if (i < m_Size && Get(i) == value)
+        return FALSE;
+
+    Flatten();
+    if (m_Size >= m_Cap)
+    {
+        cap = m_Cap ? m_Cap * 2 : 16;
+        marks = (int *)realloc(m_Marks, cap * sizeof(int));
+        if (!marks)
+            return FALSE;
+        m_Marks = marks;
+        tree = (int *)realloc(m_Tree, (cap + 1) * sizeof(int));
+        if (!tree)
+            return FALSE;
+        m_Tree = tree;
+        memset(m_Tree, 0, (cap + 1) * sizeof(int));
+        m_Cap = cap;
+    }
+    memmove(m_Marks + i + 1, m_Marks + i, (m_Size - i) * sizeof(int));
+    m_Marks[i] = value;
+    m_Size++;
+    return TRUE;
+}
+
+BOOL MarkStore::Erase(int i)
+{
+    if (i < 0 || i >= m_Size)
+        return FALSE;
+
+    Flatten();
+    memmove(m_Marks + i, m_Marks + i + 1, (m_Size - i - 1) * sizeof(int));
+    m_Size--;
+    return TRUE;
+}
+
+void MarkStore::Move(int index, int size)
+{
+    int i = LowerBound(index);
+
+    if (i >= m_Size)
+        return;
+    // every mark from i on moves, the order is kept
+    TreeAdd(i, size);
+    m_Delta = TRUE;
+}
+
+int MarkStore::LowerBound(int value)
+{
+    int lo = 0, hi = m_Size, mid;
+
+    while (lo < hi)
+    {
+        mid = (lo + hi) / 2;
+        if (Get(mid) < value)
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+    return lo;
+}
+
+void MarkStore::Flatten(void)
+{
+    int i;
+
+    if (!m_Delta)
+        return;
+    for (i = 0; i < m_Size; i++)
+        m_Marks[i] += TreeSum(i);
+    memset(m_Tree, 0, (m_Cap + 1) * sizeof(int));
+    m_Delta = FALSE;
+}
+
+int MarkStore::TreeSum(int i)
+{
+    int sum = 0;
+
+    for (i++; i > 0; i -= i & (-i))
+        sum += m_Tree[i];
+    return sum;
+}
+
+void MarkStore::TreeAdd(int i, int value)
+{
+    for (i++; i <= m_Cap; i += i & (-i))
+        m_Tree[i] += value;
+}
+
+FILE* MarkStore::OpenJournal(const TCHAR *mode)
+{
+    mark_file_header_t header;
+    TCHAR dir[MAX_PATH];
+    FILE *fp;
+
+    fp = _tfopen(m_FileName, mode);
+    if (!fp)
+    {
+        _tcscpy(dir, m_FileName);
+        PathRemoveFileSpec(dir);
+        CreateDirectory(dir, NULL);
+        fp = _tfopen(m_FileName, mode);
+        if (!fp)
+            return NULL;
+    }
+    fseek(fp, 0, SEEK_END);
+    if (ftell(fp) == 0)
+    {
+        header.magic = MARK_FILE_MAGIC;
+        header.version = MARK_FILE_VERSION;
+        header.name_len = (u32)_tcslen(m_Book);
+        fwrite(&header, sizeof(header), 1, fp);
+        fwrite(m_Book, sizeof(TCHAR), header.name_len, fp);
+    }
+    return fp;
+}
+
+BOOL MarkStore::Append(int op, int a, int b)
+{
+    mark_record_t record;
+    FILE *fp;
+
+    if (!m_Book)
+        return FALSE;
+
+    fp = OpenJournal(_T("ab"));
+    if (!fp)
+        return FALSE;
+    record.op = op;
+    record.a = a;
+    record.b = b;
+    fwrite(&record, sizeof(record), 1, fp);
+    fclose(fp);
+
+    m_Records++;
+    if (m_Records > m_Size * 2 + 64)
+        return Compact();
+    return TRUE;
+}
+
+BOOL MarkStore::Compact(void)
+{
+    mark_file_header_t header;
+    mark_record_t record;
+    TCHAR tmp_name[MAX_PATH];
+    FILE *fp;
+    BOOL ok;
+    int i;
+
+    if (m_Size == 0)
+    {
+        DeleteFile(m_FileName);
+        m_Records = 0;
+        return TRUE;
+    }
+
+    // rewrite as one add per mark into a side file, the journal is only
+    // replaced once that is complete, a failed write leaves it as it was
+    if (_tcslen(m_FileName) + 5 > MAX_PATH)
+        return FALSE;
+    _stprintf(tmp_name, _T("%s.tmp"), m_FileName);
+    Flatten();
+    fp = _tfopen(tmp_name, _T("wb"));
+    if (!fp)
+        return FALSE;
+    header.magic = MARK_FILE_MAGIC;
+    header.version = MARK_FILE_VERSION;
+    header.name_len = (u32)_tcslen(m_Book);
+    ok = fwrite(&header, sizeof(header), 1, fp) == 1
+        && fwrite(m_Book, sizeof(TCHAR), header.name_len, fp) == header.name_len;
+    for (i = 0; ok && i < m_Size; i++)
+    {
+        record.op = mo_add;
+        record.a = m_Marks[i];
+        record.b = 0;
+        ok = fwrite(&record, sizeof(record), 1, fp) == 1;
+    }
+    if (fclose(fp) != 0)
+        ok = FALSE;
+    if (!ok || !MoveFileEx(tmp_name, m_FileName, MOVEFILE_REPLACE_EXISTING))
+    {
+        DeleteFile(tmp_name);
+        return FALSE;
+    }
+    m_Records = m_Size;
+    return TRUE;
+}
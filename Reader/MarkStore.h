@@ -0,0 +1,77 @@
+#ifndef __MARK_STORE_H__
+#define __MARK_STORE_H__
+
+#include "types.h"
+#include <stdio.h>
+
+#define MARK_FILE_MAGIC         0x4B4D4452  // "RDMK"
+#define MARK_FILE_VERSION       1
+#define MARK_PROBE_COUNT        16          // file names tried per path hash
+
+typedef enum mark_op_t
+{
+    mo_add = 1,     // a: offset
+    mo_del,         // a: offset
+    mo_shift        // a: text index, b: inserted length
+} mark_op_t;
+
+typedef struct mark_file_header_t
+{
+    u32 magic;
+    u32 version;
+    u32 name_len;   // book path follows, characters, not terminated
+} mark_file_header_t;
+
+typedef struct mark_record_t
+{
+    int op;
+    int a;
+    int b;
+} mark_record_t;
+
+// Bookmarks of one book, kept in a sidecar journal next to the cache file.
+// Offsets are sorted, a shift of the text moves a suffix of them through a
+// Fenwick tree of deltas, and every change is appended to the journal.
+class MarkStore
+{
+public:
+    MarkStore();
+    ~MarkStore();
+
+public:
+    BOOL Open(const TCHAR *dir, const TCHAR *book, u32 hash);
+    void Close(void);
+    BOOL IsOpen(const TCHAR *book);
+    int  Count(void);
+    int  Get(int i);
+    BOOL Add(int value);
+    BOOL Remove(int i);
+    void Shift(int index, int size);
+    static void Delete(const TCHAR *dir, const TCHAR *book, u32 hash);
+
+private:
+    static BOOL FindFile(const TCHAR *dir, const TCHAR *book, u32 hash, TCHAR *file_name, BOOL *exist);
+    BOOL Load(void);
+    BOOL Insert(int value);
+    BOOL Erase(int i);
+    void Move(int index, int size);
+    int  LowerBound(int value);
+    void Flatten(void);
+    int  TreeSum(int i);
+    void TreeAdd(int i, int value);
+    FILE* OpenJournal(const TCHAR *mode);
+    BOOL Append(int op, int a, int b);
+    BOOL Compact(void);
+
+private:
+    TCHAR m_FileName[MAX_PATH];
+    TCHAR *m_Book;
+    int *m_Marks;           // sorted, without the pending deltas
+    int *m_Tree;            // 1-based Fenwick tree of deltas by position
+    int m_Size;
+    int m_Cap;
+    BOOL m_Delta;           // m_Tree has non zero values
+    int m_Records;          // records in the journal
+};
+
+#endif
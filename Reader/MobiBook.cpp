@@ -1,5 +1,8 @@
 ﻿#include "MobiBook.h"
 #include "Utils.h"
+#include "XhtmlText.h"
+#include "CoverImage.h"
+#include "BookCache.h"
 #include "types.h"
 #include <regex>
 
@@ -51,6 +54,29 @@ const char * libmobi_msg(const MOBI_RET ret) {
     return "Unknown error";
 }
 
+static BookCache& mobi_cache(void)
+{
+    static BookCache cache(MOBI_CACHE_BOOKS, MOBI_CACHE_CHARS);
+    return cache;
+}
+
+typedef struct mobi_image_arg_t
+{
+    MobiBook *_this;
+    u32 cover_offset;
+} mobi_image_arg_t;
+
+static BOOL mobi_file_stamp(const wchar_t *file_name, u64 *size, u64 *write_time)
+{
+    WIN32_FILE_ATTRIBUTE_DATA attr;
+
+    if (!GetFileAttributesEx(file_name, GetFileExInfoStandard, &attr))
+        return FALSE;
+    *size = ((u64)attr.nFileSizeHigh << 32) | attr.nFileSizeLow;
+    *write_time = ((u64)attr.ftLastWriteTime.dwHighDateTime << 32) | attr.ftLastWriteTime.dwLowDateTime;
+    return TRUE;
+}
+
 MobiBook::MobiBook()
     : m_Cover(NULL)
 {
@@ -94,6 +120,15 @@ BOOL MobiBook::ParserBook(HWND hWnd)
     manifests_t::iterator itor;
     navpoints_t::iterator it;
 
+    // opened a short while ago, nothing to decode. Otherwise libmobi decodes
+    // every text record at once, it has no way to decode one of them alone
+    if (LoadFromCache())
+    {
+        if (m)
+            mobi_free(m);
+        return TRUE;
+    }
+
     if (m == NULL) {
         printf("Memory allocation failed\n");
         return FALSE;
@@ -113,7 +148,8 @@ BOOL MobiBook::ParserBook(HWND hWnd)
     }    
 
     /* Parse rawml text and other data held in MOBIData structure into MOBIRawml structure */
-    mobi_ret = mobi_parse_rawml(rawml, m);
+    /* the orth and infl indexes of dictionaries are never read */
+    mobi_ret = mobi_parse_rawml_opt(rawml, m, true, false, true);
     if (mobi_ret != MOBI_SUCCESS) {
         printf("Parsing rawml failed (%s)\n", libmobi_msg(mobi_ret));
         return FALSE;
@@ -122,6 +158,7 @@ BOOL MobiBook::ParserBook(HWND hWnd)
 
 
     // unzip mobi file
+    mobi.cover_offset = 0;
     if (!UnzipBook(rawml, m, mobi))
         goto end;
 
@@ -142,7 +179,7 @@ BOOL MobiBook::ParserBook(HWND hWnd)
     if (!ParserChapters(mobi))
         goto end;
 
-
+    SaveToCache();
     ret = TRUE;
 
 end:
@@ -193,9 +230,37 @@ int MobiBook::GetTextBeginIndex(void)
     return m_Cover ? 1 : 0;
 }
 
+BOOL MobiBook::ReadImage(int id, std::string &data, size_t max_size)
+{
+    HANDLE hFile;
+    LARGE_INTEGER pos;
+    DWORD size, read = 0;
+    BOOL ret;
+
+    if (id < 0 || id >= (int)m_Images.size())
+        return FALSE;
+
+    // a record is stored as it is, no need to decode the book again
+    size = m_Images[id].size;
+    if (max_size && size > max_size)
+        size = (DWORD)max_size;
+    hFile = CreateFileW(m_fileName, GENERIC_READ, FILE_SHARE_READ | FILE_SHARE_WRITE, NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+    if (hFile == INVALID_HANDLE_VALUE)
+        return FALSE;
+    pos.QuadPart = m_Images[id].offset;
+    data.resize(size);
+    ret = size > 0 && SetFilePointerEx(hFile, pos, NULL, FILE_BEGIN)
+        && ReadFile(hFile, &data[0], size, &read, NULL) && read == size;
+    CloseHandle(hFile);
+    if (!ret)
+        data.clear();
+    return ret;
+}
+
 void MobiBook::FreeFilelist(void)
 {
     m_flist.clear();
+    m_ImageFiles.clear();
 }
 
 BOOL MobiBook::UnzipBook(MOBIRawml *rawml, MOBIData *m, mobi_t &mobi)
@@ -203,6 +268,9 @@ BOOL MobiBook::UnzipBook(MOBIRawml *rawml, MOBIData *m, mobi_t &mobi)
     char partname[FILENAME_MAX];
 
     file_data_t fdata;
+    inline_image_t image = { "", 0, 0, 0, 0, -1 };
+    MOBIPdbRecord *record;
+    size_t first_resource = mobi_get_first_resource_record(m);
 
     FreeFilelist();
 
@@ -213,7 +281,6 @@ BOOL MobiBook::UnzipBook(MOBIRawml *rawml, MOBIData *m, mobi_t &mobi)
         while (curr != NULL) {
             MOBIFileMeta file_meta = mobi_get_filemeta_by_type(curr->type);
             snprintf(partname, sizeof(partname), "part%05zu.%s", curr->uid, file_meta.extension);
-            printf("%s\n", partname);
             
             // save to file map
             fdata.data = curr->data;
@@ -231,7 +298,6 @@ BOOL MobiBook::UnzipBook(MOBIRawml *rawml, MOBIData *m, mobi_t &mobi)
         while (curr != NULL) {
             MOBIFileMeta file_meta = mobi_get_filemeta_by_type(curr->type);
             snprintf(partname, sizeof(partname), "flow%05zu.%s", curr->uid, file_meta.extension);
-            printf("%s\n", partname);
             
             // save to file map
             fdata.data = curr->data;
@@ -247,7 +313,8 @@ BOOL MobiBook::UnzipBook(MOBIRawml *rawml, MOBIData *m, mobi_t &mobi)
         /* jpg, gif, png, bmp, font, audio, video also opf, ncx */
         while (curr != NULL) {
             MOBIFileMeta file_meta = mobi_get_filemeta_by_type(curr->type);
-            if (curr->size > 0) {
+            /* only the text is shown, images and fonts are left as they are; the cover is read from its record */
+            if (curr->size > 0 && (file_meta.type == T_OPF || file_meta.type == T_NCX)) {
                 int n = snprintf(partname, sizeof(partname), "resource%05zu.%s", curr->uid, file_meta.extension);
                 if (n < 0) {
                     printf("Creating file name failed\n");
@@ -257,8 +324,6 @@ BOOL MobiBook::UnzipBook(MOBIRawml *rawml, MOBIData *m, mobi_t &mobi)
                     printf("File name too long: %s\n", partname);
                     return FALSE;
                 }
-                
-                printf("%s\n", partname);
  
                 // save to file map
                 fdata.data = curr->data;
@@ -276,6 +341,17 @@ BOOL MobiBook::UnzipBook(MOBIRawml *rawml, MOBIData *m, mobi_t &mobi)
                 }
 
             }
+            else if (curr->size > 0 && (file_meta.type == T_JPG || file_meta.type == T_GIF || file_meta.type == T_PNG || file_meta.type == T_BMP)) {
+                /* the part points into its record, only where it is in the file is kept */
+                record = mobi_get_record_by_seqnumber(m, first_resource + curr->uid);
+                if (record && record->data == curr->data) {
+                    snprintf(partname, sizeof(partname), "resource%05zu.%s", curr->uid, file_meta.extension);
+                    image.name = partname;
+                    image.offset = record->offset;
+                    image.size = (u32)record->size;
+                    m_ImageFiles.insert(std::make_pair(image.name, image));
+                }
+            }
             curr = curr->next;
         }
     }
@@ -305,14 +381,14 @@ BOOL MobiBook::ParserOpf(mobi_t &mobi)
     if (!doc)
         goto end;
 
-    if (m_bForceKill)
+    if (ReadAcquire(&m_Token.cancel))
         goto end;
 
     xpathctx = xmlXPathNewContext(doc);
     if (!xpathctx)
         goto end;
 
-    if (m_bForceKill)
+    if (ReadAcquire(&m_Token.cancel))
         goto end;
 
     // parser manifest
@@ -352,7 +428,7 @@ BOOL MobiBook::ParserOpf(mobi_t &mobi)
                 }
                 if (keyword)
                     xmlFree(keyword);
-                if (m_bForceKill)
+                if (ReadAcquire(&m_Token.cancel))
                 {
                     delete item;
                     goto end;
@@ -376,7 +452,7 @@ BOOL MobiBook::ParserOpf(mobi_t &mobi)
             xmlXPathFreeObject(xpathobj);
     }
     
-    if (m_bForceKill)
+    if (ReadAcquire(&m_Token.cancel))
         goto end;
 
     // parser spine
@@ -404,7 +480,7 @@ BOOL MobiBook::ParserOpf(mobi_t &mobi)
             }
             if (keyword)
                 xmlFree(keyword);
-            if (m_bForceKill)
+            if (ReadAcquire(&m_Token.cancel))
                 goto end;
         }
 
@@ -417,7 +493,7 @@ BOOL MobiBook::ParserOpf(mobi_t &mobi)
 
     ret = TRUE;
 
-    if (m_bForceKill)
+    if (ReadAcquire(&m_Token.cancel))
     {
         ret = FALSE;
         goto end;
@@ -494,14 +570,14 @@ BOOL MobiBook::ParserNcx(mobi_t &mobi)
     if (!doc)
         goto end;
 
-    if (m_bForceKill)
+    if (ReadAcquire(&m_Token.cancel))
         goto end;
 
     xpathctx = xmlXPathNewContext(doc);
     if (!xpathctx)
         goto end;
 
-    if (m_bForceKill)
+    if (ReadAcquire(&m_Token.cancel))
         goto end;
 
     xpath = BAD_CAST("//*[local-name()='navPoint']");
@@ -579,7 +655,7 @@ BOOL MobiBook::ParserNcx(mobi_t &mobi)
             xmlFree(text);
         if (src)
             xmlFree(src);
-        if (m_bForceKill)
+        if (ReadAcquire(&m_Token.cancel))
             goto end;
     }
 
@@ -603,119 +679,29 @@ end:
     return ret;
 }
 
-BOOL MobiBook::ParserOps(file_data_t *fdata, wchar_t **text, int *len, wchar_t **title, int *tlen, BOOL parsertitle)
+BOOL MobiBook::ParserOps(mobi_t &mobi, file_data_t *fdata, wchar_t **text, int *len, wchar_t **title, int *tlen, BOOL parsertitle)
 {
-    filelist_t::iterator itor;
-    xmlDocPtr doc = NULL;
-    xmlChar *value;
-    const xmlChar *xpath = NULL;
-    xmlXPathContextPtr xpathctx = NULL;
-    xmlXPathObjectPtr xpathobj = NULL;
-    xmlNodeSetPtr nodeset;
-    int i;
-    BOOL ret = FALSE;
-    xmlChar *format_str = NULL;
-    int size;
-
-    xmlKeepBlanksDefault(0);
-    doc = htmlReadMemory((const char *)fdata->data, fdata->size, NULL, NULL, XML_PARSE_RECOVER | XML_PARSE_NOBLANKS);
-    if (!doc)
-        goto end;
+    XhtmlText xhtml;
+    mobi_image_arg_t arg;
 
-    if (m_bForceKill)
-        goto end;
-
-#if 1
-    
-    htmlDocDumpMemoryFormat(doc, &format_str, &size, 1);
-    xmlFreeDoc(doc);
-    if (!format_str || size <= 0)
-    {
-        if (format_str)
-            xmlFree(format_str);
-        goto end;
-    }
-    
-    xmlKeepBlanksDefault(1);
-    doc = xmlReadMemory((const char *)format_str, size, NULL, NULL, XML_PARSE_RECOVER | XML_PARSE_HUGE /*| XML_PARSE_NOBLANKS */ ); //XML_PARSE_HUGE 大文件支持
-    xmlFree(format_str);
-    if (!doc)
-        goto end;
-    xmlDocDumpFormatMemory(doc, &format_str, &size, 1);
-#endif
-    
-    xpathctx = xmlXPathNewContext(doc);
-    if (!xpathctx)
-        goto end;
-
-    if (m_bForceKill)
-        goto end;
-
-    if (parsertitle)
-    {
-        // parser title
-        xpath = BAD_CAST("//*[local-name()='title']");
-        xpathobj = xmlXPathEvalExpression(xpath, xpathctx);
-        if (!xpathobj)
-            goto body;
-
-        if (xmlXPathNodeSetIsEmpty(xpathobj->nodesetval))
-            goto body;
-
-        nodeset = xpathobj->nodesetval;
-        for (i = 0; i < nodeset->nodeNr; i++)
-        {
-            value = xmlNodeGetContent(nodeset->nodeTab[i]);
-
-            if (!DecodeText((const char *)value, (int)strlen((const char *)value), title, tlen))
-            {
-                xmlFree(value);
-                break;
-            }
-            xmlFree(value);
-            break;
-        }
-    }
+    arg._this = this;
+    arg.cover_offset = GetCover() ? mobi.cover_offset : 0;
+    xhtml.SetImageCallback(OnImage, &arg);
+    if (!xhtml.Parse((const char *)fdata->data, fdata->size, &m_Token.cancel))
+        return FALSE;
 
-    if (m_bForceKill)
-        goto end;
+    *text = xhtml.Detach(len);
+    if (!(*text))
+        return FALSE;
 
-body:
-    if (xpathobj)
-        xmlXPathFreeObject(xpathobj);
+    if (parsertitle && !xhtml.GetTitle().empty())
     {
-        // parser body
-        xpath = BAD_CAST("//*[local-name()='body']");
-        xpathobj = xmlXPathEvalExpression(xpath, xpathctx);
-        if (!xpathobj)
-            goto end;
-
-        if (xmlXPathNodeSetIsEmpty(xpathobj->nodesetval))
-            goto end;
-
-        nodeset = xpathobj->nodesetval;
-        for (i = 0; i < nodeset->nodeNr; i++)
-        {
-            value = xmlNodeGetContent(nodeset->nodeTab[i]);
-
-            if (!DecodeText((const char *)value, (int)strlen((const char *)value), text, len))
-                ret = FALSE;
-            else
-                ret = TRUE;
-
-            xmlFree(value);
-            break;
-        }
+        *tlen = (int)xhtml.GetTitle().size();
+        *title = (wchar_t *)malloc(sizeof(wchar_t) * (*tlen + 1));
+        memcpy(*title, xhtml.GetTitle().c_str(), sizeof(wchar_t) * (*tlen));
+        (*title)[*tlen] = 0;
     }
-
-end:
-    if (xpathobj)
-        xmlXPathFreeObject(xpathobj);
-    if (xpathctx)
-        xmlXPathFreeContext(xpathctx);
-    if (doc)
-        xmlFreeDoc(doc);
-    return ret;
+    return TRUE;
 }
 
 BOOL MobiBook::ParserChapters(mobi_t &mobi)
@@ -731,7 +717,7 @@ BOOL MobiBook::ParserChapters(mobi_t &mobi)
     manifests_t::iterator itmfest;
     navpoints_t::iterator itnav;
     file_data_t *fdata;
-    chapter_item_t chapter;
+    int chapter_index = 0;
     std::string filename;
     wchar_t *text = NULL;
     wchar_t *title = NULL;
@@ -751,7 +737,7 @@ BOOL MobiBook::ParserChapters(mobi_t &mobi)
     {
         len = 0;
         tlen = 0;
-        if (m_bForceKill)
+        if (ReadAcquire(&m_Token.cancel))
             goto end;
         itmfest = mobi.manifests.find(*itspine);    //只有在spines里面的才是有文字的，manifests里面还有图片，暂时不支持
         if (itmfest != mobi.manifests.end())
@@ -763,13 +749,13 @@ BOOL MobiBook::ParserChapters(mobi_t &mobi)
             {
                 fdata = &(itflist->second);
                 tlen = 0;
-                if (ParserOps(fdata, &text, &len, &title, &tlen, itnav == mobi.navpoints.end())) //当nav找不到对应文件时，从文件中获取章节名
+                if (ParserOps(mobi, fdata, &text, &len, &title, &tlen, itnav == mobi.navpoints.end())) //当nav找不到对应文件时，从文件中获取章节名
                 {
                     if (len > 0)
                     {
                         buffer[index].text = text;
                         buffer[index].len = len;
-                        chapter.index = m_Length;
+                        chapter_index = m_Length;
                         m_Length += len;
 
                         if (itnav != mobi.navpoints.end())  //当nav有对应文件时，从nav中获取章节名；之前ParserNCX处理了nav不可靠的情况
@@ -779,9 +765,7 @@ BOOL MobiBook::ParserChapters(mobi_t &mobi)
                         
                         if (tlen > 0)
                         {
-                            chapter.title = title;
-                            chapter.title_len = tlen;
-                            m_Chapters.push_back(chapter);
+                            m_Chapters.push_back(chapter_index, title, tlen);
                             
                             free(title);
                         }                        
@@ -794,7 +778,7 @@ BOOL MobiBook::ParserChapters(mobi_t &mobi)
     }
 
 end:
-    if (m_bForceKill)
+    if (ReadAcquire(&m_Token.cancel))
     {
         for (i = 0; i < index; i++)
         {
@@ -860,23 +844,21 @@ end:
                     {
                         if (refidx > navidx[1])
                         {
-                            chapter.index = navidx.at(((navidx[1] - navidx[0]) > (navidx[2] - navidx[1])
+                            chapter_index = navidx.at(((navidx[1] - navidx[0]) > (navidx[2] - navidx[1])
                                                 || (navidx[2] > refidx)) ? 1 : 2);
                         }
                         else
                         {
-                            chapter.index = refidx;
+                            chapter_index = refidx;
                         }
                     }
                     else
                     {
-                        chapter.index = navidx.at((navidx.size() > 2) ? 1 : 0);     //三次取中间，两次一次取第一个
+                        chapter_index = navidx.at((navidx.size() > 2) ? 1 : 0);     //三次取中间，两次一次取第一个
                     }
                         
 
-                    chapter.title_len = tlen;
-                    chapter.title = title;                    
-                    m_Chapters.push_back(chapter);
+                    m_Chapters.push_back(chapter_index, title, tlen);
                     navidx.clear();
                 }
             }
@@ -897,7 +879,6 @@ BOOL MobiBook::ParserCover(mobi_t &mobi, MOBIData *m)
     manifests_t::iterator itmfest;
     navpoints_t::iterator itnav;
 
-    IStream *pStream = NULL;
     const char *cover_fname = NULL;
     char image_fname[1024] = {0};
 
@@ -906,6 +887,7 @@ BOOL MobiBook::ParserCover(mobi_t &mobi, MOBIData *m)
         delete m_Cover;
         m_Cover = NULL;
     }
+    m_CoverData.clear();
 
     if (exth) {
         uint32_t offset = mobi_decode_exthvalue((unsigned char*)exth->data, exth->size);
@@ -938,18 +920,111 @@ BOOL MobiBook::ParserCover(mobi_t &mobi, MOBIData *m)
         }
     }
     
-    pStream = SHCreateMemStream((const BYTE *)record->data, record->size);
-    m_Cover = new Gdiplus::Bitmap(pStream);
-    if (m_Cover)
+    if (!CreateCover(record->data, record->size))
+        return FALSE;
+    m_CoverData.assign((const char *)record->data, record->size);
+    mobi.cover_offset = record->offset;
+    return TRUE;
+}
+
+BOOL MobiBook::CreateCover(const unsigned char *data, size_t size)
+{
+    m_Cover = CoverImage::Decode(data, size);
+    return m_Cover != NULL;
+}
+
+int MobiBook::FindImage(const char *src, u32 cover_offset)
+{
+    std::map<std::string, inline_image_t>::iterator itor;
+    std::string name;
+    const char *p;
+    size_t pos;
+
+    // the links are rebuilt as resourceNNNNN.ext, with or without a folder
+    p = strrchr(src, '/');
+    name = p ? p + 1 : src;
+    pos = name.find('#');
+    if (pos != std::string::npos)
+        name = name.substr(0, pos);
+
+    itor = m_ImageFiles.find(name);
+    if (itor == m_ImageFiles.end())
+        return -1;
+    if (cover_offset && itor->second.offset == cover_offset)
+        return -1;  // it is the cover page already
+
+    // one id for all the pages that show it
+    if (itor->second.id < 0)
     {
-        if (Gdiplus::Ok != m_Cover->GetLastStatus())
-        {
-            delete m_Cover;
-            m_Cover = NULL;
-        }
+        if ((int)m_Images.size() >= INLINE_IMAGE_MAX)
+            return -1;
+        itor->second.id = (int)m_Images.size();
+        m_Images.push_back(itor->second);
     }
-    pStream->Release();
-    return m_Cover != NULL;
+    return itor->second.id;
+}
+
+int MobiBook::OnImage(void *arg, const char *src)
+{
+    mobi_image_arg_t *image_arg = (mobi_image_arg_t *)arg;
+    return image_arg->_this->FindImage(src, image_arg->cover_offset);
+}
+
+BOOL MobiBook::LoadFromCache(void)
+{
+    book_cache_item_t item;
+    u64 size, write_time;
+    size_t i;
+
+    if (!mobi_file_stamp(m_fileName, &size, &write_time))
+        return FALSE;
+    if (!mobi_cache().Get(m_fileName, size, write_time, &item))
+        return FALSE;
+
+    m_Text = item.text;
+    m_Length = item.length;
+    m_Chapters.clear();
+    for (i = 0; i < item.chapter_index.size(); i++)
+        m_Chapters.push_back(item.chapter_index[i], item.chapter_title[i].c_str(), (int)item.chapter_title[i].size());
+    m_CoverData.swap(item.cover);
+    m_Images.swap(item.images);
+
+    if (!m_CoverData.empty())
+        CreateCover((const unsigned char *)m_CoverData.data(), m_CoverData.size());
+    return TRUE;
+}
+
+void MobiBook::SaveToCache(void)
+{
+    book_cache_item_t *item;
+    u64 size, write_time;
+    size_t i;
+
+    if (!m_Text || m_Length <= 0 || m_Length > MOBI_CACHE_CHARS)
+        return;
+    if (!mobi_file_stamp(m_fileName, &size, &write_time))
+        return;
+
+    item = new book_cache_item_t;
+    item->text = (wchar_t *)malloc(sizeof(wchar_t) * (m_Length + 1));
+    if (!item->text)
+    {
+        delete item;
+        return;
+    }
+    memcpy(item->text, m_Text, sizeof(wchar_t) * (m_Length + 1));
+    item->length = m_Length;
+    item->file_name = m_fileName;
+    item->file_size = size;
+    item->write_time = write_time;
+    for (i = 0; i < m_Chapters.size(); i++)
+    {
+        item->chapter_index.push_back(m_Chapters[i].index);
+        item->chapter_title.push_back(std::wstring(m_Chapters.title((int)i), m_Chapters[i].title_len));
+    }
+    item->cover = m_CoverData;
+    item->images = m_Images;
+    mobi_cache().Put(item);
 }
 
 
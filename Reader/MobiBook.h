@@ -9,6 +9,9 @@
 /* include libmobi header */
 #include <mobi.h>
 
+#define MOBI_CACHE_BOOKS        3               // decoded books kept for the next open
+#define MOBI_CACHE_CHARS        (32 << 20)      // characters of text they hold together
+
 typedef struct mobi_t
 {
     std::string path;           //mobi文件解开后的虚拟路径，这里没用上，直接置""
@@ -21,6 +24,7 @@ typedef struct mobi_t
                                 //spine定义的是要看的电子书每个文件的阅读顺序；而ncx是目录结构，一个文件可能有子目录
                                 //因此，ncx包含的navPoint节点与spine的itemref节点相比，可能多或相等
     navpoints_t navpoints;      //ncx包含的navPoint节点
+    u32 cover_offset;           // record of the cover image, not shown again in the text
 } mobi_t;
 
 
@@ -39,18 +43,26 @@ protected:
     virtual BOOL ParserBook(HWND hWnd);
     virtual Gdiplus::Bitmap* GetCover(void);
     virtual int GetTextBeginIndex(void);
+    virtual BOOL ReadImage(int id, std::string &data, size_t max_size);
     void FreeFilelist(void);
     BOOL UnzipBook(MOBIRawml *rawml, MOBIData *m, mobi_t &mobi);
     BOOL ParserOcf(mobi_t &mobi);
     BOOL ParserOpf(mobi_t &mobi);
     BOOL ParserNcx(mobi_t &mobi);
-    BOOL ParserOps(file_data_t *fdata, wchar_t **text, int *len, wchar_t **title, int *tlen, BOOL parsertitle);
+    BOOL ParserOps(mobi_t &mobi, file_data_t *fdata, wchar_t **text, int *len, wchar_t **title, int *tlen, BOOL parsertitle);
     BOOL ParserChapters(mobi_t &mobi);
     BOOL ParserCover(mobi_t &mobi, MOBIData *m);
+    BOOL CreateCover(const unsigned char *data, size_t size);
+    int  FindImage(const char *src, u32 cover_offset);
+    static int OnImage(void *arg, const char *src);
+    BOOL LoadFromCache(void);
+    void SaveToCache(void);
     
 protected:
     Gdiplus::Bitmap *m_Cover;
+    std::string m_CoverData;    // the cover record, kept with the decoded text
     filelist_t m_flist;
+    std::map<std::string, inline_image_t> m_ImageFiles;    // image records, read from the file when drawn
 };
 
 #endif
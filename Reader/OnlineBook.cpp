@@ -1,9 +1,10 @@
 #ifdef ENABLE_NETWORK
 #include "OnlineBook.h"
+#include "ContentFilter.h"
+#include "TocPage.h"
 #include "Utils.h"
 #include "resource.h"
 #include <time.h>
-#include <regex>
 #include <shellapi.h>
 
 extern BOOL PlayLoadingImage(HWND);
@@ -134,9 +135,11 @@ void combine_url(const char* path, const char* url, char* dsturl)
         htmllen = utf8len;          \
         needfree = 1;               \
     }                               \
-    if (_this->m_bForceKill)        \
+    if (ReadAcquire(&_this->m_Token.cancel))        \
         goto end;
 
+struct toc_fetch_t;
+
 typedef struct req_chapter_param_t
 {
     HWND hWnd;
@@ -144,8 +147,52 @@ typedef struct req_chapter_param_t
     OnlineBook* _this;
     std::vector<std::string> *title_list;
     std::vector<std::string> *title_url;
+    char extraheader[256];  // conditional request of an update check
+    toc_fetch_t *fetch;     // parallel fetch of the page, NULL for the serial chain
+    int page;               // page of the chapter list
 } req_chapter_param_t;
 
+#define TOC_FETCH_LIMIT             4       // chapter list pages requested at once
+#define TOC_FETCH_MAX               1000
+
+typedef enum toc_page_state_t
+{
+    tps_pending,
+    tps_done,
+    tps_failed
+} toc_page_state_t;
+
+struct toc_page_t
+{
+    int state;
+    std::vector<std::string> titles;
+    std::vector<std::string> urls;      // absolute
+    std::string next;                   // empty on the last page
+
+    toc_page_t()
+    {
+        state = tps_pending;
+    }
+};
+
+struct toc_fetch_t
+{
+    CRITICAL_SECTION lock;
+    HWND hWnd;
+    int index;
+    toc_pattern_t pattern;
+    std::vector<toc_page_t> pages;
+    int stop;                           // last page that may be requested
+    int running;
+    BOOL finished;                      // the list went on, only running requests hold it
+};
+
+// ms of a chapter request by host, shared by the books of one site
+static std::map<std::string, u32> s_HostLatency;
+
+// param2 of a next page requested before the page linking to it was parsed
+#define CONTENT_AHEAD               ((void *)1)
+
 typedef struct req_content_param_t
 {
     HWND hWnd;
@@ -154,8 +201,35 @@ typedef struct req_content_param_t
     OnlineBook* _this;
     TCHAR *text;
     int textlen;
+    volatile LONG refs;         // the page being parsed and the one requested ahead
+    HANDLE hTurn;               // set once the page being parsed is done with param
+    req_handler_t ahead;        // ahead and adopted under m_RequestLock
+    char ahead_url[1024];
+    BOOL adopted;               // the page ahead goes on with the chapter
 } req_content_param_t;
 
+// a completed request handed to the scheduler, with copies of what libhttps frees on return
+typedef struct deferred_result_t
+{
+    OnlineBook* _this;
+    complete_cb completer;
+    request_result_t result;
+    request_t req;
+} deferred_result_t;
+
+// what a save writes, taken on the ui thread
+typedef struct save_param_t
+{
+    OnlineBook* _this;
+    ol_header_t* header;
+    TCHAR* text;
+    int length;
+    std::vector<int> cuts;      // chapter starts in text
+    std::vector<loaded_block_t> deflated; // ranges of text not inflated when it was copied
+    BOOL header_only;
+    LONG seq;
+} save_param_t;
+
 typedef struct req_bookstatus_param_t
 {
     HWND hWnd;
@@ -169,7 +243,8 @@ typedef enum book_event_t
     BE_UPATE_CONTENT,
     BE_PLAY_LOADING,
     BE_STOP_LOADING,
-    BE_SAVE_FILE
+    BE_SAVE_FILE,
+    BE_DISPATCH     // drain m_Events, lParam is a book_event_data_t owned by the handler
 } book_event_t;
 
 struct content_data_t : public book_event_data_t
@@ -191,10 +266,20 @@ struct content_data_t : public book_event_data_t
 struct chapter_data_t : public book_event_data_t
 {
     chapters_t chapters;
+    int index; // chapter to request once applied, -1 for update check
+    int first; // chapters holds the page entries from first on
+    BOOL unchanged; // same page as the last check, chapters is empty
+    BOOL failed; // request failed with ret, chapters is empty
+    ol_toc_t toc;
 
     chapter_data_t()
     {
         chapters.clear();
+        index = -1;
+        first = 0;
+        unchanged = FALSE;
+        failed = FALSE;
+        memset(&toc, 0, sizeof(ol_toc_t));
     }
 };
 
@@ -210,7 +295,7 @@ struct loading_data_t : public book_event_data_t
 
 OnlineBook::OnlineBook()
     : m_hEvent(NULL)
-    , m_hMutex(NULL)
+    , m_Dispatching(0)
     , m_result(FALSE)
     , m_IsLoading(FALSE)
     , m_TagetIndex(-1)
@@ -218,21 +303,36 @@ OnlineBook::OnlineBook()
     , m_cb(NULL)
     , m_arg(NULL)
     , m_IsNotCurnOpenedBook(TRUE)
+    , m_HeaderOnly(FALSE)
+    , m_OlHeaderSize(0)
+    , m_TextFormat(0)
+    , m_SaveSeq(0)
+    , m_SavedSeq(0)
+    , m_hSaveTask(NULL)
+    , m_ReadSpeed(0)
+    , m_ReadIndex(-1)
+    , m_ReadTick(0)
+    , m_Loaded(0)
 {
     memset(m_MainPage, 0, sizeof(m_MainPage));
     memset(m_ChapterPage, 0, sizeof(m_ChapterPage));
     memset(m_BookName, 0, sizeof(m_BookName));
     memset(m_Host, 0, sizeof(m_Host));
-    m_hMutex = CreateMutex(NULL, FALSE, NULL);
+    memset(&m_Toc, 0, sizeof(ol_toc_t));
+    memset(&m_Prefetch, 0, sizeof(prefetch_stats_t));
+    InitializeCriticalSection(&m_RequestLock);
+    InitializeCriticalSection(&m_SaveLock);
 }
 
 OnlineBook::~OnlineBook()
 {
     std::set<req_handler_t>::iterator it;
 
+    // deferred results hold a reference, none is left here
     for (it = m_hRequestList.begin(); it != m_hRequestList.end(); it++)
     {
-        hapi_cancel(*it);
+        if (m_Deferred.find(*it) == m_Deferred.end())
+            hapi_cancel(*it);
     }
 
     if (m_hEvent)
@@ -242,14 +342,12 @@ OnlineBook::~OnlineBook()
     }
 
     ForceKill();
+    TaskScheduler::Instance()->Release(m_hSaveTask);
 
     m_hRequestList.clear();
-    
-    if (m_hMutex)
-    {
-        CloseHandle(m_hMutex);
-        m_hMutex = NULL;
-    }
+    ReleaseEvents();
+    DeleteCriticalSection(&m_RequestLock);
+    DeleteCriticalSection(&m_SaveLock);
     m_result = FALSE;
 }
 
@@ -270,7 +368,15 @@ BOOL OnlineBook::UpdateChapters(int offset)
 
 BOOL OnlineBook::IsLoading(void)
 {
-    return m_hThread != NULL || m_IsLoading;
+    return Book::IsLoading() || m_IsLoading;
+}
+
+void OnlineBook::LoadText(int start, int length, BOOL evict)
+{
+    // pages are given back only between two slices of a search
+    EnterCriticalSection(&m_TextLock);
+    m_Store.Read(m_Text, start, length, evict);
+    LeaveCriticalSection(&m_TextLock);
 }
 
 void OnlineBook::JumpChapter(HWND hWnd, int index)
@@ -373,181 +479,389 @@ int OnlineBook::GetCurChapterIndex(void)
 
 LRESULT OnlineBook::OnBookEvent(HWND hWnd, UINT message, WPARAM wParam, LPARAM lParam)
 {
-    chapter_data_t* chapters = NULL;
-    content_data_t* content = NULL;
+    book_event_data_t* be = NULL;
     loading_data_t* loading = NULL;
-    size_t i;
-    int offset = -1;
-    int ret = 0;
 
     switch (wParam)
     {
-    case BE_UPATE_CHAPTER:
-        chapters = (chapter_data_t*)lParam;
-        if (!chapters)
-            break;
-        if (m_Chapters.empty())
+    case BE_DISPATCH:
+        be = (book_event_data_t*)lParam;
+        if (be)
+            delete be;
+        DispatchEvents(hWnd); // may delete this by the check update callback
+        return 0;
+    case BE_PLAY_LOADING:
+        loading = (loading_data_t*)lParam;
+        PlayLoadingImage(hWnd);
+        if (loading)
+            delete loading;
+        break;
+    case BE_STOP_LOADING:
+        loading = (loading_data_t*)lParam;
+        StopLoadingImage(hWnd);
+        if (loading && loading->idx != -1)
         {
-            m_Chapters = chapters->chapters;
+            MessageBox_(hWnd, IDS_REQUEST_CONTENT_FAIL, IDS_ERROR, MB_ICONERROR | MB_OK);
         }
-        else
-        {
-            // check update
-            if (m_Chapters.size() >= chapters->chapters.size())
-            {
-                chapters->ret = 1;
-                break; // invalid data
-            }
-            for (i = 0; i < m_Chapters.size(); i++)
-            {
-                ASSERT(m_Chapters[i].title == (chapters->chapters)[i].title);
-                ASSERT(m_Chapters[i].url == (chapters->chapters)[i].url);
+        if (loading)
+            delete loading;
+        break;
+    case BE_SAVE_FILE:
+        SaveOlFile();
+        break;
+    default:
+        break;
+    }
 
-                // fixed
-                if (m_Chapters[i].index == -1
-                    && (m_Chapters[i].title != (chapters->chapters)[i].title || m_Chapters[i].url != (chapters->chapters)[i].url))
-                {
-                    m_Chapters[i].title = (chapters->chapters)[i].title;
-                    m_Chapters[i].url = (chapters->chapters)[i].url;
-                }
+    return 0;
+}
 
-                /*  don't update menu
-                if (m_Chapters[i].index == -1
-                    && (m_Chapters[i].title != (chapters->chapters)[i].title))
-                {
-                    chapters->is_updated = 1; // have update
-                }
-                */
+void OnlineBook::FreeBookEvent(WPARAM wParam, LPARAM lParam)
+{
+    switch (wParam)
+    {
+    case BE_DISPATCH:
+        if (lParam)
+            delete (book_event_data_t*)lParam;
+        break;
+    case BE_PLAY_LOADING:
+    case BE_STOP_LOADING:
+        if (lParam)
+            delete (loading_data_t*)lParam;
+        break;
+    default:
+        break;
+    }
+}
+
+void OnlineBook::PostBookEvent(HWND hWnd, int type, book_event_data_t* data)
+{
+    book_event_data_t* be;
+
+    // full, wait for the ui thread to catch up
+    while (!m_Events.Push(type, data))
+    {
+        be = new book_event_data_t;
+        be->_this = this;
+        SendMessage(hWnd, WM_BOOK_EVENT, BE_DISPATCH, (LPARAM)be);
+    }
+
+    // one message drains every event pushed before it is handled
+    if (InterlockedExchange(&m_Dispatching, 1) == 0)
+    {
+        be = new book_event_data_t;
+        be->_this = this;
+        PostMessage(hWnd, WM_BOOK_EVENT, BE_DISPATCH, (LPARAM)be);
+    }
+}
+
+void OnlineBook::DispatchEvents(HWND hWnd)
+{
+    chapter_data_t* chapters = NULL;
+    content_data_t* content = NULL;
+    void* data = NULL;
+    olbook_checkupdate_callback cb = NULL;
+    void* arg = NULL;
+    int is_updated = 0;
+    int err = 0;
+    int type;
+    BOOL changed = FALSE;
+    BOOL painted = FALSE;
+
+    // cleared first, an event pushed during the drain posts a new message
+    InterlockedExchange(&m_Dispatching, 0);
+
+    while (m_Events.Pop(&type, &data))
+    {
+        switch (type)
+        {
+        case BE_UPATE_CHAPTER:
+            chapters = (chapter_data_t*)data;
+            if (chapters->failed)
+            {
+                cb = m_cb;
+                arg = m_arg;
+                m_cb = NULL;
+                m_arg = NULL;
+                is_updated = 0;
+                err = chapters->ret;
+                delete chapters;
+                break;
             }
-            for (i = m_Chapters.size(); i < chapters->chapters.size(); i++)
+            ApplyChapters(chapters);
+            changed = TRUE;
+            if (chapters->index != -1 && !ReadAcquire(&m_Token.cancel))
+                ParserContent(hWnd, chapters->index);
+            if (chapters->index == -1 || chapters->ret != 0)
             {
-                chapters->is_updated = 1; // have update
-                m_Chapters.push_back((chapters->chapters)[i]);
+                // reported once, the caller may free arg afterwards
+                cb = m_cb;
+                arg = m_arg;
+                m_cb = NULL;
+                m_arg = NULL;
+                is_updated = chapters->is_updated;
             }
-        }
-        WriteOlFile();
-        break;
-    case BE_UPATE_CONTENT:
-        content = (content_data_t*)lParam;
-        if (!content)
+            delete chapters;
+            break;
+        case BE_UPATE_CONTENT:
+            content = (content_data_t*)data;
+            ApplyContent(hWnd, content, &painted);
+            changed = TRUE;
+            StopLoading(hWnd, content->index);
+            if (content->text)
+                free(content->text);
+            delete content;
             break;
-        if (content->index < 0 || content->index >= (int)m_Chapters.size())
+        default:
             break;
+        }
+    }
 
-        ASSERT(m_Chapters[content->index].index == -1);
+    // the ol file is written once for the whole batch
+    if (changed)
+        SaveOlFile();
 
-        if (m_Text == NULL) // update text
+    // last, the callback may delete this book
+    if (cb)
+        cb(is_updated, err, arg);
+}
+
+void OnlineBook::ReleaseEvents(void)
+{
+    content_data_t* content = NULL;
+    void* data = NULL;
+    int type;
+
+    while (m_Events.Pop(&type, &data))
+    {
+        if (type == BE_UPATE_CHAPTER)
         {
-            m_Length = content->len;
-            m_Text = (TCHAR*)malloc((m_Length + 1) * sizeof(TCHAR));
-            memcpy(m_Text, content->text, (m_Length + 1) * sizeof(TCHAR));
-            // update chapter index
-            m_Chapters[content->index].index = 0;
-            m_Chapters[content->index].size = content->len;
-            ret = 1;
+            delete (chapter_data_t*)data;
         }
-        else // insert text
+        else if (type == BE_UPATE_CONTENT)
         {
-            // fixed bug, Due to the delay of WM_PAINT processing.
-            // if the BE_UPATE_CONTENT message is received before the Invalidate done refresh, the page operation will be lost
-            UpdateWindow(hWnd);
+            content = (content_data_t*)data;
+            if (content->text)
+                free(content->text);
+            delete content;
+        }
+    }
+}
 
-            m_Length += content->len;
-            m_Text = (TCHAR*)realloc(m_Text, (m_Length + 1) * sizeof(TCHAR));
-            m_Text[m_Length] = 0;
+void OnlineBook::PostChaptersFailed(HWND hWnd, int err)
+{
+    chapter_data_t* chapters;
+
+    chapters = new chapter_data_t;
+    chapters->_this = this;
+    chapters->failed = TRUE;
+    chapters->ret = err;
+    PostBookEvent(hWnd, BE_UPATE_CHAPTER, chapters);
+}
+
+void OnlineBook::PostTocUnchanged(HWND hWnd, const ol_toc_t* toc)
+{
+    chapter_data_t* chapters;
+
+    chapters = new chapter_data_t;
+    chapters->_this = this;
+    chapters->unchanged = TRUE;
+    memcpy(&chapters->toc, toc, sizeof(ol_toc_t));
+    m_UpdateTime = time(NULL);
+    PostBookEvent(hWnd, BE_UPATE_CHAPTER, chapters);
+}
+
+void OnlineBook::ApplyChapters(chapter_data_t* chapters)
+{
+    size_t i;
+
+    if (chapters->unchanged)
+    {
+        memcpy(&m_Toc, &chapters->toc, sizeof(ol_toc_t));
+        return;
+    }
+
+    if (chapters->first > 0)
+    {
+        // new tail of the page checked last time
+        if (chapters->first != (int)m_Chapters.size())
+        {
+            chapters->ret = 1;
+            return; // invalid data
+        }
+        for (i = 0; i < chapters->chapters.size(); i++)
+        {
+            chapters->is_updated = 1; // have update
+            m_Chapters.append(chapters->chapters, (int)i);
+        }
+        memcpy(&m_Toc, &chapters->toc, sizeof(ol_toc_t));
+        return;
+    }
+
+    if (m_Chapters.empty())
+    {
+        m_Chapters = std::move(chapters->chapters);
+        m_Loaded = 0;
+    }
+    else
+    {
+        // check update
+        if (m_Chapters.size() >= chapters->chapters.size())
+        {
+            chapters->ret = 1;
+            return; // invalid data
+        }
+        for (i = 0; i < m_Chapters.size(); i++)
+        {
+            ASSERT(m_Chapters.same((int)i, chapters->chapters, (int)i));
 
-            for (i = content->index + 1; i < m_Chapters.size(); i++)
+            // fixed
+            if (m_Chapters[i].index == -1
+                && !m_Chapters.same((int)i, chapters->chapters, (int)i))
             {
-                if (m_Chapters[i].index != -1)
-                {
-                    if (offset == -1)
-                    {
-                        offset = m_Chapters[i].index;
-                    }
-                    m_Chapters[i].index += content->len;
-                }
+                m_Chapters.set((int)i, chapters->chapters.title((int)i), chapters->chapters[i].title_len, chapters->chapters.url((int)i).c_str());
             }
 
-            if (offset == -1) // append
+            /*  don't update menu
+            if (m_Chapters[i].index == -1
+                && wcscmp(m_Chapters.title((int)i), chapters->chapters.title((int)i)) != 0)
             {
-                m_Chapters[content->index].index = m_Length - content->len;
-                m_Chapters[content->index].size = content->len;
-                memcpy(m_Text + m_Chapters[content->index].index, content->text, sizeof(TCHAR) * content->len);
+                chapters->is_updated = 1; // have update
             }
-            else // insert
-            {
-                m_Chapters[content->index].index = offset;
-                m_Chapters[content->index].size = content->len;
-                memcpy(m_Text + offset + content->len, m_Text + offset, sizeof(TCHAR) * (m_Length - offset - content->len));
-                memcpy(m_Text + offset, content->text, sizeof(TCHAR) * content->len);
+            */
+        }
+        for (i = m_Chapters.size(); i < chapters->chapters.size(); i++)
+        {
+            chapters->is_updated = 1; // have update
+            m_Chapters.append(chapters->chapters, (int)i);
+        }
+    }
+    memcpy(&m_Toc, &chapters->toc, sizeof(ol_toc_t));
+}
 
-                // update book mark
-                UpdateBookMark(hWnd, offset, content->len);
-            }
+void OnlineBook::ApplyContent(HWND hWnd, content_data_t* content, BOOL* painted)
+{
+    std::map<int, DWORD>::iterator it;
+    size_t i;
+    int offset = -1;
+    u32 latency;
 
-            // update current pos
-            if (m_pIndex)
-            {
-                if (m_Index >= m_Chapters[content->index].index)
-                    m_Index += content->len;
-            }
-            ClearLines();
-            // todo after request completed.
-            switch (content->todo)
+    if (content->index < 0 || content->index >= (int)m_Chapters.size())
+        return;
+
+    it = m_FetchStart.find(content->index);
+    if (it != m_FetchStart.end())
+    {
+        latency = GetTickCount() - it->second;
+        m_FetchStart.erase(it);
+        u32& host = s_HostLatency[m_Host];
+        host = host ? (host * 3 + latency) / 4 : latency;
+    }
+
+    ASSERT(m_Chapters[content->index].index == -1);
+    m_Loaded++;
+
+    // offsets of a search in progress go stale, it is dropped
+    m_FindSeq = 0;
+
+    if (m_Text == NULL) // update text
+    {
+        EnterCriticalSection(&m_TextLock);
+        m_Length = content->len;
+        m_Text = (TCHAR*)malloc((m_Length + 1) * sizeof(TCHAR));
+        memcpy(m_Text, content->text, (m_Length + 1) * sizeof(TCHAR));
+        LeaveCriticalSection(&m_TextLock);
+        // update chapter index
+        m_Chapters[content->index].index = 0;
+        m_Chapters[content->index].size = content->len;
+    }
+    else // insert text
+    {
+        // fixed bug, Due to the delay of WM_PAINT processing.
+        // if the BE_UPATE_CONTENT message is received before the Invalidate done refresh, the page operation will be lost
+        // once per dispatch, the contents applied before have not been drawn either
+        if (!*painted)
+        {
+            UpdateWindow(hWnd);
+            *painted = TRUE;
+        }
+
+        EnterCriticalSection(&m_TextLock);
+        m_Length += content->len;
+        m_Text = (TCHAR*)realloc(m_Text, (m_Length + 1) * sizeof(TCHAR));
+        m_Text[m_Length] = 0;
+
+        for (i = content->index + 1; i < m_Chapters.size(); i++)
+        {
+            if (m_Chapters[i].index != -1)
             {
-            case todo_jump:
-                if (m_pIndex)
+                if (offset == -1)
                 {
-                    m_Index = m_Chapters[content->index].index; // will redraw by StopLoadingImage
+                    offset = m_Chapters[i].index;
                 }
-                break;
-            case todo_pageup:
-                PageUp(hWnd, FALSE); // will redraw by StopLoadingImage
-                break;
-            case todo_pagedown:
-                PageDown(hWnd, FALSE); // will redraw by StopLoadingImage
-                break;
-            case todo_lineup:
-                LineUp(hWnd, FALSE); // will redraw by StopLoadingImage
-                break;
-            case todo_linedown:
-                LineDown(hWnd, FALSE); // will redraw by StopLoadingImage
-                break;
-            default:
-                break;
+                m_Chapters[i].index += content->len;
             }
+        }
 
-            if (m_pIndex)
-                logger_printk("--- BE_UPATE_CONTENT: pos=%d, index=%d, size=%d, curpos=%d ---", content->index, m_Chapters[content->index].index, m_Chapters[content->index].size, m_Index);
-            else
-                logger_printk("--- BE_UPATE_CONTENT: pos=%d, index=%d, size=%d ---", content->index, m_Chapters[content->index].index, m_Chapters[content->index].size);
+        if (offset == -1) // append
+        {
+            m_Chapters[content->index].index = m_Length - content->len;
+            m_Chapters[content->index].size = content->len;
+            memcpy(m_Text + m_Chapters[content->index].index, content->text, sizeof(TCHAR) * content->len);
+            m_Store.Insert(m_Text, m_Chapters[content->index].index, content->len);
+            LeaveCriticalSection(&m_TextLock);
         }
-        WriteOlFile();
-        break;
-    case BE_PLAY_LOADING:
-        loading = (loading_data_t*)lParam;
-        PlayLoadingImage(hWnd);
-        if (loading)
-            delete loading;
-        break;
-    case BE_STOP_LOADING:
-        loading = (loading_data_t*)lParam;
-        StopLoadingImage(hWnd);
-        if (loading && loading->idx != -1)
+        else // insert
         {
-            MessageBox_(hWnd, IDS_REQUEST_CONTENT_FAIL, IDS_ERROR, MB_ICONERROR | MB_OK);
+            m_Chapters[content->index].index = offset;
+            m_Chapters[content->index].size = content->len;
+            memmove(m_Text + offset + content->len, m_Text + offset, sizeof(TCHAR) * (m_Length - offset - content->len));
+            memcpy(m_Text + offset, content->text, sizeof(TCHAR) * content->len);
+            m_Store.Insert(m_Text, offset, content->len);
+            LeaveCriticalSection(&m_TextLock);
+
+            // update book mark
+            UpdateBookMark(hWnd, offset, content->len);
         }
-        if (loading)
-            delete loading;
-        break;
-    case BE_SAVE_FILE:
-        WriteOlFile();
-        break;
-    default:
-        break;
-    }
 
-    return 0;
+        // update current pos
+        if (m_pIndex)
+        {
+            if (m_Index >= m_Chapters[content->index].index)
+                m_Index += content->len;
+        }
+        ClearLines();
+        ResetPageCache();
+        // todo after request completed.
+        switch (content->todo)
+        {
+        case todo_jump:
+            if (m_pIndex)
+            {
+                m_Index = m_Chapters[content->index].index; // will redraw by StopLoadingImage
+            }
+            break;
+        case todo_pageup:
+            PageUp(hWnd, FALSE); // will redraw by StopLoadingImage
+            break;
+        case todo_pagedown:
+            PageDown(hWnd, FALSE); // will redraw by StopLoadingImage
+            break;
+        case todo_lineup:
+            LineUp(hWnd, FALSE); // will redraw by StopLoadingImage
+            break;
+        case todo_linedown:
+            LineDown(hWnd, FALSE); // will redraw by StopLoadingImage
+            break;
+        default:
+            break;
+        }
+
+        if (m_pIndex)
+            logger_printk("--- BE_UPATE_CONTENT: pos=%d, index=%d, size=%d, curpos=%d ---", content->index, m_Chapters[content->index].index, m_Chapters[content->index].size, m_Index);
+        else
+            logger_printk("--- BE_UPATE_CONTENT: pos=%d, index=%d, size=%d ---", content->index, m_Chapters[content->index].index, m_Chapters[content->index].size);
+    }
 }
 
 BOOL OnlineBook::ParserBook(HWND hWnd)
@@ -609,17 +923,17 @@ BOOL OnlineBook::ParserChapterPage(HWND hWnd, int idx)
     memset(m_ChapterPage, 0, sizeof(m_ChapterPage));
 
     // check it's requesting
-    WaitForSingleObject(m_hMutex, INFINITE);
+    EnterCriticalSection(&m_RequestLock);
     for (it = m_hRequestList.begin(); it != m_hRequestList.end(); it++)
     {
-        preq = hapi_get_request_info(*it);
+        preq = GetRequestInfo(*it);
         if (preq->completer == GetChapterPageCompleter)
         {
-            ReleaseMutex(m_hMutex);
+            LeaveCriticalSection(&m_RequestLock);
             return TRUE;
         }
     }
-    ReleaseMutex(m_hMutex);
+    LeaveCriticalSection(&m_RequestLock);
 
     param = (req_chapter_param_t*)malloc(sizeof(req_chapter_param_t));
 
@@ -628,6 +942,8 @@ BOOL OnlineBook::ParserChapterPage(HWND hWnd, int idx)
     param->_this = this;
     param->title_list = NULL;
     param->title_url = NULL;
+    param->fetch = NULL;
+    param->page = 0;
 
     memset(&req, 0, sizeof(request_t));
     req.method = GET;
@@ -641,9 +957,9 @@ BOOL OnlineBook::ParserChapterPage(HWND hWnd, int idx)
     hReq = hapi_request(&req);
     if (hReq)
     {
-        WaitForSingleObject(m_hMutex, INFINITE);
+        EnterCriticalSection(&m_RequestLock);
         m_hRequestList.insert(hReq);
-        ReleaseMutex(m_hMutex);
+        LeaveCriticalSection(&m_RequestLock);
     }
     return TRUE;
 }
@@ -664,18 +980,18 @@ BOOL OnlineBook::ParserChapters(HWND hWnd, int idx)
     }
 
     // check it's requesting
-    WaitForSingleObject(m_hMutex, INFINITE);
+    EnterCriticalSection(&m_RequestLock);
     for (it = m_hRequestList.begin(); it != m_hRequestList.end(); it++)
     {
-        preq = hapi_get_request_info(*it);
+        preq = GetRequestInfo(*it);
         if (preq->completer == GetChaptersCompleter
             /*|| preq->completer == GetChapterPageCompleter*/)
         {
-            ReleaseMutex(m_hMutex);
+            LeaveCriticalSection(&m_RequestLock);
             return TRUE;
         }
     }
-    ReleaseMutex(m_hMutex);
+    LeaveCriticalSection(&m_RequestLock);
 
     param = (req_chapter_param_t*)malloc(sizeof(req_chapter_param_t));
 
@@ -684,10 +1000,18 @@ BOOL OnlineBook::ParserChapters(HWND hWnd, int idx)
     param->_this = this;
     param->title_list = NULL;
     param->title_url = NULL;
+    param->extraheader[0] = 0;
+    param->fetch = NULL;
+    param->page = 0;
+
+    // validators of the last check, the server answers 304 when the list did not change
+    if (idx == -1 && !m_Booksrc->enable_chapter_next && m_Toc.count > 0 && m_Toc.count == (u32)m_Chapters.size())
+        toc_request_header(&m_Toc, param->extraheader);
 
     memset(&req, 0, sizeof(request_t));
     req.method = GET;
     req.url = m_ChapterPage; //m_MainPage;
+    req.extraheader = param->extraheader[0] ? param->extraheader : NULL;
     req.completer = GetChaptersCompleter;
     req.param1 = param;
     req.param2 = NULL;
@@ -697,9 +1021,9 @@ BOOL OnlineBook::ParserChapters(HWND hWnd, int idx)
     hReq = hapi_request(&req);
     if (hReq)
     {
-        WaitForSingleObject(m_hMutex, INFINITE);
+        EnterCriticalSection(&m_RequestLock);
         m_hRequestList.insert(hReq);
-        ReleaseMutex(m_hMutex);
+        LeaveCriticalSection(&m_RequestLock);
     }
     return TRUE;
 }
@@ -717,21 +1041,21 @@ BOOL OnlineBook::ParserContent(HWND hWnd, int idx, u32 todo)
         return FALSE;
 
     // check it's requesting
-    WaitForSingleObject(m_hMutex, INFINITE);
+    EnterCriticalSection(&m_RequestLock);
     for (it = m_hRequestList.begin(); it != m_hRequestList.end(); it++)
     {
-        preq = hapi_get_request_info(*it);
+        preq = GetRequestInfo(*it);
         param = (req_content_param_t*)preq->param1;
         if (preq->completer == GetContentCompleter && param->index == idx)
         {
             // update
             if (param->todo != todo)
                 param->todo = todo;
-            ReleaseMutex(m_hMutex);
+            LeaveCriticalSection(&m_RequestLock);
             return TRUE;
         }
     }
-    ReleaseMutex(m_hMutex);
+    LeaveCriticalSection(&m_RequestLock);
 
     param = (req_content_param_t*)malloc(sizeof(req_content_param_t));
 
@@ -741,9 +1065,14 @@ BOOL OnlineBook::ParserContent(HWND hWnd, int idx, u32 todo)
     param->_this = this;
     param->text = NULL;
     param->textlen = 0;
+    param->refs = 1;
+    param->hTurn = CreateEvent(NULL, FALSE, FALSE, NULL);
+    param->ahead = NULL;
+    param->ahead_url[0] = 0;
+    param->adopted = FALSE;
 
     // check URL
-    combine_url(m_Chapters[idx].url.c_str(), m_MainPage, url);
+    combine_url(m_Chapters.url(idx).c_str(), m_MainPage, url);
 
     memset(&req, 0, sizeof(request_t));
     req.method = GET;
@@ -754,12 +1083,22 @@ BOOL OnlineBook::ParserContent(HWND hWnd, int idx, u32 todo)
 
     logger_printk("Request to: %s", req.url);
 
+    // counted before the request, it may complete before hapi_request returns
+    EnterCriticalSection(&m_RequestLock);
+    m_Fetching[idx]++;
+    LeaveCriticalSection(&m_RequestLock);
+
     hReq = hapi_request(&req);
     if (hReq)
     {
-        WaitForSingleObject(m_hMutex, INFINITE);
+        EnterCriticalSection(&m_RequestLock);
         m_hRequestList.insert(hReq);
-        ReleaseMutex(m_hMutex);
+        LeaveCriticalSection(&m_RequestLock);
+        m_FetchStart[idx] = GetTickCount();
+    }
+    else
+    {
+        ReleaseContentParam(param);
     }
     return TRUE;
 }
@@ -779,9 +1118,8 @@ BOOL _check_olfile(const TCHAR *filename)
     fp = _tfopen(filename, _T("rb"));
     if (!fp)
         goto fail;
-    fseek(fp, 0, SEEK_END);
-    len = ftell(fp);
-    fseek(fp, 0, SEEK_SET);
+    if (!file_length(fp, &len))
+        goto fail;
 
     basesize = sizeof(ol_header_t) - sizeof(ol_chapter_info_t);
     if (basesize > len)
@@ -810,6 +1148,7 @@ BOOL _check_olfile(const TCHAR *filename)
     }
 #endif
 
+    free(buf);
     return TRUE;
 
 fail:
@@ -820,24 +1159,25 @@ fail:
     return FALSE;
 }
 
-BOOL OnlineBook::ReadOlFile(BOOL fast)
+BOOL OnlineBook::ReadOlFile(BOOL header_only)
 {
     FILE* fp = NULL;
     char* buf = NULL;
     int len = 0;
     ol_header_t *header = NULL;
     int basesize = 0;
+    int size;
 
     // read file to memory
     fp = _tfopen(m_fileName, _T("rb"));
     if (!fp)
         goto fail;
-    fseek(fp, 0, SEEK_END);
-    len = ftell(fp);
-    fseek(fp, 0, SEEK_SET);
+    if (!file_length(fp, &len))
+        goto fail;
 
-    if (fast)
+    if (header_only)
     {
+        // header and chapter table, the text stays on disk
         basesize = sizeof(ol_header_t) - sizeof(ol_chapter_info_t);
         if (basesize > len)
             goto fail;
@@ -847,17 +1187,31 @@ BOOL OnlineBook::ReadOlFile(BOOL fast)
             goto fail;
 
         fread(buf, 1, basesize, fp);
-        fclose(fp);
-        fp = NULL;
-
         header = (ol_header_t*)buf;
-        if (len < (int)header->header_size)
+        size = (int)header->header_size;
+        if (len < size || size < basesize)
         {
             // invalid file
             goto fail;
         }
-        
-        m_UpdateTime = header->update_time;
+
+        header = (ol_header_t*)realloc(buf, size);
+        if (!header)
+            goto fail;
+        buf = (char*)header;
+        if (size > basesize)
+            fread(buf + basesize, 1, size - basesize, fp);
+        fclose(fp);
+        fp = NULL;
+
+        ParseOlHeader(header);
+        m_Booksrc = FindBookSource(m_Host);
+        if (!m_Booksrc)
+            goto fail;
+        m_HeaderOnly = TRUE;
+        EnterCriticalSection(&m_SaveLock);
+        m_OlHeaderSize = size;
+        LeaveCriticalSection(&m_SaveLock);
         free(buf);
         return TRUE;
     }
@@ -883,17 +1237,28 @@ BOOL OnlineBook::ReadOlFile(BOOL fast)
     m_Booksrc = FindBookSource(m_Host);
     if (!m_Booksrc)
         goto fail;
+    m_HeaderOnly = FALSE;
+    EnterCriticalSection(&m_SaveLock);
+    m_OlHeaderSize = (int)header->header_size;
+    LeaveCriticalSection(&m_SaveLock);
 
     // parse text
     if (m_Chapters.size() > 0 && len > (int)header->header_size)
     {
-        m_Length = (len - header->header_size) / 2;
-        m_Text = (TCHAR*)malloc((len - header->header_size) + sizeof(TCHAR));
-        if (m_Text == NULL)
-            goto fail;
-        memcpy(m_Text, buf + header->header_size, len - header->header_size);
-        m_Text[m_Length] = 0;
-
+        if (header->text_format == OL_TEXT_MAGIC)
+        {
+            if (!m_Store.Load(buf + header->header_size, len - header->header_size, &m_Text, &m_Length))
+                goto fail;
+        }
+        else
+        {
+            m_Length = (len - header->header_size) / 2;
+            m_Text = (TCHAR*)malloc((len - header->header_size) + sizeof(TCHAR));
+            if (m_Text == NULL)
+                goto fail;
+            memcpy(m_Text, buf + header->header_size, len - header->header_size);
+            m_Text[m_Length] = 0;
+        }
     }
     free(buf);
     return TRUE;
@@ -906,33 +1271,179 @@ fail:
     return FALSE;
 }
 
-BOOL OnlineBook::WriteOlFile()
+void OnlineBook::SaveOlFile(void)
 {
-    FILE* fp = NULL;
-    ol_header_t* header = NULL;
+    save_param_t* param;
+    task_t* task;
+    int i;
 
-    GenerateOlHeader(&header);
-    if (!header)
-        goto fail;
+    param = new save_param_t;
+    param->_this = this;
+    param->header = NULL;
+    param->text = NULL;
+    param->length = 0;
+    param->header_only = m_HeaderOnly;
+
+    GenerateOlHeader(&param->header);
+    if (!param->header)
+    {
+        delete param;
+        return;
+    }
+
+    // the text is copied, deflating and writing it is left to the scheduler
+    if (!m_HeaderOnly && m_Text && m_Length > 0)
+    {
+        param->text = (TCHAR*)malloc(m_Length * sizeof(TCHAR));
+        if (!param->text)
+        {
+            free(param->header);
+            delete param;
+            return;
+        }
+        // what is not inflated is copied as it is, the store knows it by its block
+        EnterCriticalSection(&m_TextLock);
+        m_Store.GetDeflated(param->deflated);
+        memcpy(param->text, m_Text, m_Length * sizeof(TCHAR));
+        LeaveCriticalSection(&m_TextLock);
+        param->length = m_Length;
+        // a block per chapter, only the new ones are deflated
+        for (i = 0; i < (int)m_Chapters.size(); i++)
+        {
+            if (m_Chapters[i].index != -1)
+                param->cuts.push_back(m_Chapters[i].index);
+        }
+    }
+    param->seq = ++m_SaveSeq;
+
+    AddRef(this);
+    task = TaskScheduler::Instance()->Submit(SaveTask, param, task_low, NULL, "SaveOlFile");
+    if (!task)
+    {
+        SaveTask(param, NULL);
+        return;
+    }
+    TaskScheduler::Instance()->Release(m_hSaveTask);
+    m_hSaveTask = task;
+}
+
+BOOL OnlineBook::WaitSaved(DWORD timeout)
+{
+    // a save before the last one writes while holding m_SaveLock, which the
+    // last one takes after it, or finds a newer snapshot written and skips
+    return TaskScheduler::Instance()->Wait(m_hSaveTask, timeout);
+}
+
+unsigned OnlineBook::SaveTask(void* arg, task_token_t* token)
+{
+    save_param_t* param = (save_param_t*)arg;
+    OnlineBook* _this = param->_this;
+    BOOL ret = FALSE;
+
+    // saves may finish out of order, an older snapshot never overwrites a newer one
+    EnterCriticalSection(&_this->m_SaveLock);
+    if (param->seq > _this->m_SavedSeq)
+    {
+        ret = _this->WriteOlFile(param);
+        _this->m_SavedSeq = param->seq;
+    }
+    LeaveCriticalSection(&_this->m_SaveLock);
+
+    free(param->header);
+    if (param->text)
+        free(param->text);
+    delete param;
+    Unref(_this);
+    return ret ? 1 : 0;
+}
+
+BOOL OnlineBook::WriteOlFile(save_param_t* param)
+{
+    FILE* fp = NULL;
+    ol_header_t* header = param->header;
+
+    if (param->header_only)
+        return WriteOlHeader(header);
+
+    // the copy holds nothing where a block was not inflated, so when it can
+    // not be packed the file on disk is left as it was
+    if (!m_Store.Pack(param->text, param->length, param->cuts, param->deflated))
+        return FALSE;
+    m_TextFormat = OL_TEXT_MAGIC;
+    header->text_format = m_TextFormat;
 
     fp = _tfopen(m_fileName, _T("wb"));
     if (!fp)
-        goto fail;
+        return FALSE;
     // write header
     fwrite(header, 1, header->header_size, fp);
     // write text
-    if (m_Text && m_Length > 0)
-        fwrite(m_Text, sizeof(TCHAR), m_Length, fp);
+    if (param->text && param->length > 0)
+        m_Store.Write(fp);
     fclose(fp);
-    free(header);
+    m_OlHeaderSize = (int)header->header_size;
     return TRUE;
+}
 
-fail:
-    if (fp)
+BOOL OnlineBook::WriteOlHeader(ol_header_t* header)
+{
+    FILE* fp = NULL;
+    char* text = NULL;
+    int len = 0;
+
+    // the text on disk is as the last full save left it
+    header->text_format = m_TextFormat;
+
+    // same size, only the header is rewritten in place
+    if ((int)header->header_size == m_OlHeaderSize)
+    {
+        fp = _tfopen(m_fileName, _T("r+b"));
+        if (!fp)
+            return FALSE;
+        fwrite(header, 1, header->header_size, fp);
         fclose(fp);
-    if (header)
-        free(header);
-    return FALSE;
+        return TRUE;
+    }
+
+    // the chapter table changed size, the text moves with it
+    fp = _tfopen(m_fileName, _T("rb"));
+    if (!fp)
+        return FALSE;
+    if (!file_length(fp, &len))
+    {
+        fclose(fp);
+        return FALSE;
+    }
+    len -= m_OlHeaderSize;
+    if (len > 0)
+    {
+        text = (char*)malloc(len);
+        if (!text)
+        {
+            fclose(fp);
+            return FALSE;
+        }
+        fseek(fp, m_OlHeaderSize, SEEK_SET);
+        fread(text, 1, len, fp);
+    }
+    fclose(fp);
+
+    fp = _tfopen(m_fileName, _T("wb"));
+    if (!fp)
+    {
+        if (text)
+            free(text);
+        return FALSE;
+    }
+    fwrite(header, 1, header->header_size, fp);
+    if (text)
+    {
+        fwrite(text, 1, len, fp);
+        free(text);
+    }
+    fclose(fp);
+    m_OlHeaderSize = (int)header->header_size;
+    return TRUE;
 }
 
 BOOL OnlineBook::DownloadPrevNext(HWND hWnd)
@@ -950,11 +1461,9 @@ BOOL OnlineBook::DownloadPrevNext(HWND hWnd)
     if (cur < 0 || cur >= (int)m_Chapters.size())
         return FALSE;
 
+    SampleReading();
     if (next >= 0 && next < (int)m_Chapters.size())
-    {
-        if (m_Chapters[next].index == -1)
-            ParserContent(hWnd, next);
-    }
+        PrefetchNext(hWnd, cur);
 
     if (prev >= 0 && prev < (int)m_Chapters.size())
     {
@@ -965,6 +1474,81 @@ BOOL OnlineBook::DownloadPrevNext(HWND hWnd)
     return TRUE;
 }
 
+void OnlineBook::SampleReading(void)
+{
+    DWORD now = GetTickCount();
+    double speed;
+    int delta;
+
+    if (!m_pIndex || m_Index == m_ReadIndex)
+        return;
+
+    // forward page turns only, jumps, inserted chapters and pauses do not tell the speed
+    delta = m_Index - m_ReadIndex;
+    if (m_ReadIndex != -1 && delta > 0 && delta <= 4 * GetPageLength()
+        && now != m_ReadTick && now - m_ReadTick < PREFETCH_IDLE)
+    {
+        speed = delta * 1000.0 / (now - m_ReadTick);
+        m_ReadSpeed = m_ReadSpeed > 0 ? m_ReadSpeed * 0.75 + speed * 0.25 : speed;
+        m_Prefetch.speed = (u32)m_ReadSpeed;
+    }
+    m_ReadIndex = m_Index;
+    m_ReadTick = now;
+}
+
+void OnlineBook::PrefetchNext(HWND hWnd, int cur)
+{
+    std::map<std::string, u32>::iterator lt;
+    double need;
+    int ahead;
+    int avg;
+    int running;
+    BOOL fetching;
+    int i;
+
+    EnterCriticalSection(&m_RequestLock);
+    running = (int)m_Fetching.size();
+    LeaveCriticalSection(&m_RequestLock);
+
+    lt = s_HostLatency.find(m_Host);
+    m_Prefetch.latency = lt != s_HostLatency.end() ? lt->second : PREFETCH_LATENCY;
+
+    // text that has to be ahead of the reader for a request to come back before it is read
+    need = m_ReadSpeed * m_Prefetch.latency * PREFETCH_MARGIN / 1000;
+    avg = m_Loaded > 0 ? m_Length / m_Loaded : PREFETCH_CHAPTER_SIZE;
+    ahead = m_Chapters[cur].index != -1 ? m_Chapters[cur].index + m_Chapters[cur].size - m_Index : 0;
+
+    // the next chapter always, the ones after it while the reader would get there first
+    for (i = cur + 1; i < (int)m_Chapters.size() && i <= cur + PREFETCH_MAX_AHEAD; i++)
+    {
+        if (i > cur + 1 && (ahead >= need || ahead >= PREFETCH_MAX_CHARS))
+            break;
+        if (m_Chapters[i].index != -1)
+        {
+            ahead += m_Chapters[i].size;
+            continue;
+        }
+        EnterCriticalSection(&m_RequestLock);
+        fetching = m_Fetching.find(i) != m_Fetching.end();
+        LeaveCriticalSection(&m_RequestLock);
+        if (!fetching)
+        {
+            if (i > cur + 1 && running >= PREFETCH_MAX_RUNNING)
+                break;
+            ParserContent(hWnd, i);
+            running++;
+        }
+        ahead += avg;
+    }
+    m_Prefetch.window = i - cur - 1;
+    m_Prefetch.running = (u32)running;
+}
+
+const prefetch_stats_t* OnlineBook::GetPrefetchStats(void)
+{
+    return &m_Prefetch;
+}
+
 BOOL OnlineBook::OnDrawPageEvent(HWND hWnd)
 {
 #if TEST_MODEL
@@ -977,7 +1561,8 @@ BOOL OnlineBook::OnDrawPageEvent(HWND hWnd)
         {
             ASSERT(it->index >= 0);
             ASSERT(it->index < m_Length);
-            ASSERT(wcsncmp(it->title.c_str(), m_Text + it->index, it->title.size()) == 0);
+            LoadText(it->index, it->title_len);
+            ASSERT(wcsncmp(m_Chapters.title(*it), m_Text + it->index, it->title_len) == 0);
             ASSERT(len == it->index);
             len += it->size;
             if (last_index != -1)
@@ -1032,6 +1617,8 @@ BOOL OnlineBook::OnUpDownEvent(HWND hWnd, int draw_type)
             if (m_Index + GetPageLength() == m_Length
                 && m_Chapters[next].index == -1)
             {
+                m_Prefetch.stalls++;
+                logger_printk("stall at chapter %d, speed=%u, latency=%u, window=%u", next, m_Prefetch.speed, m_Prefetch.latency, m_Prefetch.window);
                 m_TagetIndex = next;
                 ParserContent(hWnd, next, draw_type == DRAW_PAGE_DOWN ? todo_pagedown : todo_linedown);
                 PlayLoading(hWnd);
@@ -1207,110 +1794,318 @@ BOOL OnlineBook::RequestNextPage(OnlineBook *_this, request_t *r, const char *ur
 
     hReq = hapi_request(&req);
 
-    if (hReq && m_hMutex)
+    if (hReq)
     {
-        WaitForSingleObject(m_hMutex, INFINITE);
+        EnterCriticalSection(&m_RequestLock);
         m_hRequestList.erase(hOld);
         m_hRequestList.insert(hReq);
-        ReleaseMutex(m_hMutex);
+        LeaveCriticalSection(&m_RequestLock);
     }
     return hReq != NULL;
 }
 
-int OnlineBook::FilterContent(TCHAR* text, int *len)
+req_handler_t OnlineBook::RequestChapters(req_chapter_param_t* param, const char* url)
 {
-    int srclen = *len;
-    int dstlen = 0;
-    int i,found = 0,kwlen = 0;
-    int offset = 0;
-    TCHAR *dsttext = NULL;
-    std::wcmatch cm;
-    std::wregex* e = NULL;
+    req_handler_t hReq = NULL;
+    request_t req;
+    char url_[1024] = { 0 };
+
+    strcpy(url_, url);
+
+    memset(&req, 0, sizeof(request_t));
+    req.method = GET;
+    req.url = url_;
+    req.completer = GetChaptersCompleter;
+    req.param1 = param;
+    req.param2 = NULL;
+
+    logger_printk("Request to: %s", req.url);
+
+    hReq = hapi_request(&req);
+    if (hReq)
+    {
+        EnterCriticalSection(&m_RequestLock);
+        m_hRequestList.insert(hReq);
+        LeaveCriticalSection(&m_RequestLock);
+    }
+    return hReq;
+}
+
+BOOL OnlineBook::StartTocFetch(req_chapter_param_t* param, const char* url, const char* next)
+{
+    toc_pattern_t pattern;
+    toc_fetch_t* fetch;
+    toc_page_t* page;
+    char nexturl[1024];
+    char dsturl[1024];
+    BOOL started;
+    int i;
+
+    combine_url(next, url, nexturl);
+    if (!toc_parse_pattern(url, nexturl, &pattern))
+        return FALSE;
+
+    fetch = new toc_fetch_t;
+    InitializeCriticalSection(&fetch->lock);
+    fetch->hWnd = param->hWnd;
+    fetch->index = param->index;
+    memcpy(&fetch->pattern, &pattern, sizeof(toc_pattern_t));
+    fetch->stop = TOC_FETCH_MAX - 1;
+    fetch->running = 0;
+    fetch->finished = FALSE;
+
+    // the first page is in
+    fetch->pages.resize(1);
+    page = &fetch->pages[0];
+    page->state = tps_done;
+    page->titles = *param->title_list;
+    for (i = 0; i < (int)param->title_url->size(); i++)
+    {
+        combine_url(param->title_url->at(i).c_str(), url, dsturl);
+        page->urls.push_back(dsturl);
+    }
+    page->next = nexturl;
+
+    EnterCriticalSection(&fetch->lock);
+    LaunchTocPages(fetch);
+    started = fetch->running > 0;
+    fetch->finished = !started;
+    LeaveCriticalSection(&fetch->lock);
+
+    if (!started)
+    {
+        // the serial chain goes on with param
+        DeleteCriticalSection(&fetch->lock);
+        delete fetch;
+    }
+    return started;
+}
+
+void OnlineBook::LaunchTocPages(toc_fetch_t* fetch)
+{
+    req_chapter_param_t* param;
+    char url[1024];
+    int n;
 
-    if (m_Booksrc->content_filter_type == 1) // filter by keyword
+    // fetch->lock is held
+    while (fetch->running < TOC_FETCH_LIMIT && (int)fetch->pages.size() <= fetch->stop)
     {
-        dsttext = (TCHAR*)malloc(sizeof(TCHAR) * (srclen + 1));
-        memset(dsttext, 0, sizeof(TCHAR) * (srclen + 1));
-        kwlen = (int)_tcslen(m_Booksrc->content_filter_keyword);
-        for (i=0; i<srclen; i++)
+        param = (req_chapter_param_t*)malloc(sizeof(req_chapter_param_t));
+        if (!param)
+            break;
+
+        n = (int)fetch->pages.size();
+        param->hWnd = fetch->hWnd;
+        param->index = fetch->index;
+        param->_this = this;
+        param->title_list = NULL;
+        param->title_url = NULL;
+        param->extraheader[0] = 0;
+        param->fetch = fetch;
+        param->page = n;
+
+        fetch->pages.resize(n + 1);
+        fetch->running++;
+        toc_page_url(&fetch->pattern, n, url);
+        if (!RequestChapters(param, url))
         {
-            if (srclen-i > kwlen)
-            {
-                if (_tcsncmp(text + i, m_Booksrc->content_filter_keyword, kwlen) == 0)
-                {
-                    found = 1;
-                    i += kwlen-1; // for loop will i++, so kwlen-1
-                    continue;
-                }
-            }
-            dsttext[dstlen++] = text[i];
+            fetch->running--;
+            fetch->pages.resize(n);
+            free(param);
+            break;
         }
-        if (found)
+    }
+}
+
+void OnlineBook::OnTocPage(req_chapter_param_t* param, request_result_t* result, std::vector<std::string>* titles, std::vector<std::string>* urls, const char* next)
+{
+    toc_fetch_t* fetch = param->fetch;
+    toc_page_t* page;
+    std::vector<std::string> all_titles;
+    std::vector<std::string> all_urls;
+    std::string serial;
+    chapter_data_t* chapters;
+    req_chapter_param_t* p;
+    char url[1024];
+    HWND hWnd = fetch->hWnd;
+    int index = fetch->index;
+    int last = -1;
+    int i, j;
+    BOOL release;
+
+    EnterCriticalSection(&fetch->lock);
+    fetch->running--;
+    if (!fetch->finished && (result->cancel || ReadAcquire(&m_Token.cancel)))
+        fetch->finished = TRUE; // the book is going away
+    if (!fetch->finished)
+    {
+        page = &fetch->pages[param->page];
+        if (titles)
         {
-            memcpy(text, dsttext, sizeof(TCHAR) * (dstlen + 1));
-            *len = dstlen;
-            if (dstlen == 0)
+            page->state = tps_done;
+            page->titles.swap(*titles);
+            for (i = 0; i < (int)urls->size(); i++)
             {
-                text[0] =_T('\n');
-                *len = 1;
+                combine_url(urls->at(i).c_str(), result->req->url, url);
+                page->urls.push_back(url);
             }
+            page->next = next;
         }
-    }
-    else if (m_Booksrc->content_filter_type == 2) // filter by regex
-    {
-        try
+        else
         {
-            e = new std::wregex(m_Booksrc->content_filter_keyword);
+            page->state = tps_failed;
         }
-        catch (...)
+
+        // nothing after a page that ends the list or leaves the pattern is requested
+        toc_page_url(&fetch->pattern, param->page + 1, url);
+        if (param->page < fetch->stop && (page->state != tps_done || page->next != url))
+            fetch->stop = param->page;
+
+        // pages in order up to the first one missing
+        for (j = 0; j < (int)fetch->pages.size(); j++)
         {
-            if (e)
+            page = &fetch->pages[j];
+            if (page->state == tps_pending)
+                break;
+            if (page->state == tps_failed)
+            {
+                // the serial chain retries it
+                last = j - 1;
+                serial = fetch->pages[last].next;
+                break;
+            }
+            if (page->next.empty())
+            {
+                last = j;
+                break;
+            }
+            toc_page_url(&fetch->pattern, j + 1, url);
+            if (page->next != url)
             {
-                delete e;
+                last = j;
+                serial = page->next;
+                break;
             }
-            return found;
         }
-        dsttext = (TCHAR*)malloc(sizeof(TCHAR) * (srclen + 1));
-        memset(dsttext, 0, sizeof(TCHAR) * (srclen + 1));
 
-        while (std::regex_search(text + offset, cm, *e, std::regex_constants::format_first_only))
+        if (last == -1)
         {
-            found = 1;
-            if (cm.position() > 0)
+            LaunchTocPages(fetch);
+            if (fetch->running == 0)
             {
-                memcpy(dsttext + dstlen, text + offset, sizeof(TCHAR) * cm.position());
-                dstlen += (int)cm.position();
+                // nothing more may be requested, the serial chain takes over
+                last = (int)fetch->pages.size() - 1;
+                serial = fetch->pages[last].next;
             }
-            offset += (int)(cm.position() + cm.length());
         }
-        if (e)
-        {
-            delete e;
-        }
-        if (found)
+
+        if (last != -1)
         {
-            if (srclen > offset)
+            fetch->finished = TRUE;
+            for (j = 0; j <= last; j++)
             {
-                memcpy(dsttext + dstlen, text + offset, sizeof(TCHAR) * (srclen - offset));
-                dstlen += (srclen - offset);
-            }
-            memcpy(text, dsttext, sizeof(TCHAR) * (dstlen + 1));
-            *len = dstlen;
-            if (dstlen == 0)
-            {
-                text[0] = _T('\n');
-                *len = 1;
+                all_titles.insert(all_titles.end(), fetch->pages[j].titles.begin(), fetch->pages[j].titles.end());
+                all_urls.insert(all_urls.end(), fetch->pages[j].urls.begin(), fetch->pages[j].urls.end());
             }
         }
     }
-    else // not do filter
+    release = fetch->finished && fetch->running == 0;
+    LeaveCriticalSection(&fetch->lock);
+
+    if (release)
+    {
+        DeleteCriticalSection(&fetch->lock);
+        delete fetch;
+    }
+
+    if (last == -1)
+        return;
+
+    if (!serial.empty())
+    {
+        p = (req_chapter_param_t*)malloc(sizeof(req_chapter_param_t));
+        if (p)
+        {
+            p->hWnd = hWnd;
+            p->index = index;
+            p->_this = this;
+            p->title_list = new std::vector<std::string>;
+            p->title_url = new std::vector<std::string>;
+            p->title_list->swap(all_titles);
+            p->title_url->swap(all_urls);
+            p->extraheader[0] = 0;
+            p->fetch = NULL;
+            p->page = last + 1;
+            if (RequestChapters(p, serial.c_str()))
+                return;
+
+            // as the serial chain does, keep what is in
+            p->title_list->swap(all_titles);
+            p->title_url->swap(all_urls);
+            delete p->title_list;
+            delete p->title_url;
+            free(p);
+        }
+    }
+
+    // update chapter
+    chapters = NewChapters(all_titles, all_urls, 0, result->req->url);
+    if (chapters)
     {
+        m_UpdateTime = time(NULL);
+        chapters->index = index;
+        PostBookEvent(hWnd, BE_UPATE_CHAPTER, chapters);
     }
-    if (dsttext)
+
+    // <-- for manual check update
+    if (index == -1 && m_IsLoading)
     {
-        free(dsttext);
+        StopLoading(hWnd, -1);
     }
-    return found;
+    // -->
+}
+
+chapter_data_t* OnlineBook::NewChapters(std::vector<std::string>& titles, std::vector<std::string>& urls, int first, const char* base)
+{
+    chapter_data_t* chapters;
+    TCHAR* dst = NULL;
+    int dstlen;
+    char dsturl[1024];
+    int i;
+
+    chapters = new chapter_data_t;
+    chapters->_this = this;
+    chapters->first = first;
+    chapters->chapters.reserve(urls.size() - first, 0);
+    for (i = first; i < (int)urls.size(); i++)
+    {
+        if (ReadAcquire(&m_Token.cancel))
+        {
+            delete chapters;
+            return NULL;
+        }
+
+        // format title
+        dst = Utf8ToUtf16(titles[i].c_str());
+        dstlen = (int)_tcslen(dst);
+        FormatText(dst, &dstlen);
+
+        combine_url(urls[i].c_str(), base, dsturl);
+
+        chapters->chapters.push_back(-1, dst, dstlen, dsturl);
+    }
+    return chapters;
+}
+
+int OnlineBook::FilterContent(TCHAR* text, int *len)
+{
+    ContentFilter* filter;
+
+    // compiled once per source, shared by the completers
+    filter = ContentFilter::Get(m_Booksrc->content_filter_type, m_Booksrc->content_filter_keyword);
+    if (!filter)
+        return 0;
+    return filter->Apply(text, len);
 }
 
 BOOL OnlineBook::GenerateOlHeader(ol_header_t** header)
@@ -1320,27 +2115,38 @@ BOOL OnlineBook::GenerateOlHeader(ol_header_t** header)
     int i;
     ol_header_t* header_ = NULL;
     char* buf = NULL;
+    u32* url_offsets = NULL;
 
     int base_size = sizeof(ol_header_t) + (sizeof(ol_chapter_info_t) * ((int)m_Chapters.size() - 1));
     int bookname_size = ((int)_tcslen(m_BookName) + 1) * sizeof(TCHAR);
     int mainpage_size = ((int)strlen(m_MainPage) + 1) * sizeof(char);
     int host_size = ((int)strlen(m_Host) + 1) * sizeof(char);
+    int toc_size = sizeof(ol_toc_t);
+    int titles_size = m_Chapters.title_pool_size();
+    int urls_size = m_Chapters.url_export_size();
 
     // calc buf size
     buf_size += base_size;
     buf_size += bookname_size;
     buf_size += mainpage_size;
     buf_size += host_size;
-    for (i = 0; i < (int)m_Chapters.size(); i++)
-    {
-        buf_size += ((int)m_Chapters[i].title.size() + 1) * sizeof(TCHAR);
-        buf_size += ((int)m_Chapters[i].url.size() + 1) * sizeof(char);
-    }
+    buf_size += toc_size;
+    buf_size += titles_size;
+    buf_size += urls_size;
 
     // set offset
     header_ = (ol_header_t*)malloc(buf_size);
     if (!header_)
         return FALSE;
+    if (!m_Chapters.empty())
+    {
+        url_offsets = (u32*)malloc(sizeof(u32) * m_Chapters.size());
+        if (!url_offsets)
+        {
+            free(header_);
+            return FALSE;
+        }
+    }
     header_->header_size = buf_size;
     offset = base_size;
     header_->book_name_offset = offset;
@@ -1349,29 +2155,36 @@ BOOL OnlineBook::GenerateOlHeader(ol_header_t** header)
     offset += mainpage_size;
     header_->host_offset = offset;
     offset += host_size;
+    header_->toc_magic = OL_TOC_MAGIC;
+    header_->toc_offset = offset;
+    offset += toc_size;
+    EnterCriticalSection(&m_SaveLock);
+    header_->text_format = m_TextFormat;
+    LeaveCriticalSection(&m_SaveLock);
+    header_->reserve[0] = 0;
     header_->update_time = m_UpdateTime;
     // header_->is_finished = m_IsFinished; deprecated
     header_->chapter_size = (int)m_Chapters.size();
-    for (i = 0; i < (int)m_Chapters.size(); i++)
-    {
-        header_->chapter_info_list[i].index = m_Chapters[i].index;
-        header_->chapter_info_list[i].size = m_Chapters[i].size;
-        header_->chapter_info_list[i].title_offset = offset;
-        offset += ((int)m_Chapters[i].title.size() + 1) * sizeof(TCHAR);
-        header_->chapter_info_list[i].url_offset = offset;
-        offset += ((int)m_Chapters[i].url.size() + 1) * sizeof(char);
-    }
 
-    // set data
+    // set data, the title pool is written as is, urls are expanded
     buf = (char*)header_;
     memcpy(buf + header_->book_name_offset, m_BookName, bookname_size);
     memcpy(buf + header_->main_page_offset, m_MainPage, mainpage_size);
     memcpy(buf + header_->host_offset, m_Host, host_size);
+    memcpy(buf + header_->toc_offset, &m_Toc, toc_size);
+    if (titles_size > 0)
+        memcpy(buf + offset, m_Chapters.title_pool(), titles_size);
+    if (url_offsets)
+        m_Chapters.export_urls(buf + offset + titles_size, url_offsets);
     for (i = 0; i < (int)m_Chapters.size(); i++)
     {
-        memcpy(buf + header_->chapter_info_list[i].title_offset, m_Chapters[i].title.c_str(), (m_Chapters[i].title.size() + 1) * sizeof(TCHAR));
-        memcpy(buf + header_->chapter_info_list[i].url_offset, m_Chapters[i].url.c_str(), (m_Chapters[i].url.size() + 1) * sizeof(char));
+        header_->chapter_info_list[i].index = m_Chapters[i].index;
+        header_->chapter_info_list[i].size = m_Chapters[i].size;
+        header_->chapter_info_list[i].title_offset = offset + m_Chapters[i].title * sizeof(TCHAR);
+        header_->chapter_info_list[i].url_offset = offset + titles_size + url_offsets[i];
     }
+    if (url_offsets)
+        free(url_offsets);
 
     *header = header_;
     return TRUE;
@@ -1380,30 +2193,191 @@ BOOL OnlineBook::GenerateOlHeader(ol_header_t** header)
 BOOL OnlineBook::ParseOlHeader(ol_header_t* header)
 {
     int chapter_size = (int)header->chapter_size;
-    chapter_item_t item;
+    ol_chapter_info_t* cinfo;
     char* buf = (char*)header;
+    TCHAR* title;
     int i;
 
     _tcscpy(m_BookName, (TCHAR*)(buf + header->book_name_offset));
     strcpy(m_MainPage, buf + header->main_page_offset);
     strcpy(m_Host, buf + header->host_offset);
     m_UpdateTime = header->update_time;
+    EnterCriticalSection(&m_SaveLock);
+    m_TextFormat = header->text_format == OL_TEXT_MAGIC ? OL_TEXT_MAGIC : 0;
+    LeaveCriticalSection(&m_SaveLock);
+    memset(&m_Toc, 0, sizeof(ol_toc_t));
+    if (header->toc_magic == OL_TOC_MAGIC && header->toc_offset + sizeof(ol_toc_t) <= header->header_size)
+    {
+        memcpy(&m_Toc, buf + header->toc_offset, sizeof(ol_toc_t));
+        m_Toc.etag[sizeof(m_Toc.etag) - 1] = 0;
+        m_Toc.last_modified[sizeof(m_Toc.last_modified) - 1] = 0;
+    }
 
     m_Chapters.clear();
+    m_Chapters.reserve(chapter_size, 0);
+    m_Loaded = 0;
     for (i = 0; i < chapter_size; i++)
     {
-        ol_chapter_info_t* cinfo = &(header->chapter_info_list[i]);
-        item.index = cinfo->index;
-        item.size = cinfo->size;
-        item.title = (TCHAR*)(buf + cinfo->title_offset);
-        item.url = buf + cinfo->url_offset;
-        item.title_len = cinfo->title_offset/2;
-        m_Chapters.push_back(item);
+        cinfo = &(header->chapter_info_list[i]);
+        title = (TCHAR*)(buf + cinfo->title_offset);
+        m_Chapters.push_back(cinfo->index, title, (int)_tcslen(title), buf + cinfo->url_offset, cinfo->size);
+        if (cinfo->index != -1)
+            m_Loaded++;
+    }
+
+    return TRUE;
+}
+
+static char* copy_bytes(const char* src, int len)
+{
+    char* dst;
+
+    if (!src)
+        return NULL;
+    dst = (char*)malloc(len + 1);
+    if (dst)
+    {
+        memcpy(dst, src, len);
+        dst[len] = 0;
+    }
+    return dst;
+}
+
+static void free_headers(http_header_t* header)
+{
+    http_header_t* next;
+
+    while (header)
+    {
+        next = header->next;
+        free(header->name);
+        free(header->value);
+        free(header);
+        header = next;
+    }
+}
+
+static http_header_t* copy_headers(const http_header_t* header)
+{
+    http_header_t* head = NULL;
+    http_header_t** tail = &head;
+
+    for (; header; header = header->next)
+    {
+        *tail = (http_header_t*)malloc(sizeof(http_header_t));
+        if (!*tail)
+            break;
+        (*tail)->name = header->name ? copy_bytes(header->name, (int)strlen(header->name)) : NULL;
+        (*tail)->value = header->value ? copy_bytes(header->value, (int)strlen(header->value)) : NULL;
+        (*tail)->next = NULL;
+        tail = &(*tail)->next;
     }
+    return head;
+}
+
+static void free_deferred(deferred_result_t* d)
+{
+    free_headers(d->result.header);
+    if (d->result.status_desc)
+        free(d->result.status_desc);
+    if (d->result.body)
+        free(d->result.body);
+    if (d->req.url)
+        free(d->req.url);
+    if (d->req.content)
+        free(d->req.content);
+    delete d;
+}
 
+BOOL OnlineBook::Defer(request_result_t* result, complete_cb completer, task_priority_t priority)
+{
+    deferred_result_t* d;
+    task_t* task;
+    BOOL listed;
+
+    // a cancelled request is only cleaned up, on the network thread as before
+    if (result->cancel || ReadAcquire(&m_Token.cancel) || IsDeferred(result))
+        return FALSE;
+
+    d = new deferred_result_t;
+    d->_this = this;
+    d->completer = completer;
+    memcpy(&d->result, result, sizeof(request_result_t));
+    memcpy(&d->req, result->req, sizeof(request_t));
+    d->req.url = copy_bytes(result->req->url, result->req->url ? (int)strlen(result->req->url) : 0);
+    d->req.content = copy_bytes(result->req->content, result->req->content_length);
+    d->result.req = &d->req;
+    d->result.header = copy_headers(result->header);
+    d->result.status_desc = result->status_desc ? copy_bytes(result->status_desc, (int)strlen(result->status_desc)) : NULL;
+    d->result.body = copy_bytes(result->body, result->bodylen);
+    // the libhttps handler is gone once this returns, d stands in for it until the task ends
+    d->result.handler = (req_handler_t)d;
+
+    EnterCriticalSection(&m_RequestLock);
+    listed = m_hRequestList.erase(result->handler) > 0;
+    if (listed)
+        m_hRequestList.insert(d->result.handler);
+    m_Deferred[d->result.handler] = d;
+    LeaveCriticalSection(&m_RequestLock);
+
+    AddRef(this);
+    task = TaskScheduler::Instance()->Submit(DeferredTask, d, priority, &m_Token, "ParsePage");
+    if (!task)
+    {
+        EnterCriticalSection(&m_RequestLock);
+        m_Deferred.erase(d->result.handler);
+        if (m_hRequestList.erase(d->result.handler) > 0)
+            m_hRequestList.insert(result->handler);
+        LeaveCriticalSection(&m_RequestLock);
+        free_deferred(d);
+        Unref(this);
+        return FALSE;
+    }
+    TaskScheduler::Instance()->Release(task);
     return TRUE;
 }
 
+BOOL OnlineBook::IsDeferred(request_result_t* result)
+{
+    BOOL deferred;
+
+    EnterCriticalSection(&m_RequestLock);
+    deferred = m_Deferred.find(result->handler) != m_Deferred.end();
+    LeaveCriticalSection(&m_RequestLock);
+    return deferred;
+}
+
+request_t* OnlineBook::GetRequestInfo(req_handler_t hReq)
+{
+    std::map<req_handler_t, deferred_result_t*>::iterator it;
+
+    // m_RequestLock is held, a deferred request is no longer known to libhttps
+    it = m_Deferred.find(hReq);
+    if (it != m_Deferred.end())
+        return &it->second->req;
+    return hapi_get_request_info(hReq);
+}
+
+unsigned OnlineBook::DeferredTask(void* arg, task_token_t* token)
+{
+    deferred_result_t* d = (deferred_result_t*)arg;
+    OnlineBook* _this = d->_this;
+    unsigned ret;
+
+    // the book was closed meanwhile, seen like its requests cancelled then
+    if (ReadAcquire(&token->cancel))
+        d->result.cancel = 1;
+    ret = d->completer(&d->result);
+
+    EnterCriticalSection(&_this->m_RequestLock);
+    _this->m_hRequestList.erase(d->result.handler);
+    _this->m_Deferred.erase(d->result.handler);
+    LeaveCriticalSection(&_this->m_RequestLock);
+    free_deferred(d);
+    Unref(_this);
+    return ret;
+}
+
 unsigned int OnlineBook::GetChapterPageCompleter(request_result_t *result)
 {
     req_chapter_param_t* param = (req_chapter_param_t*)result->param1;
@@ -1411,18 +2385,22 @@ unsigned int OnlineBook::GetChapterPageCompleter(request_result_t *result)
     char* html = NULL;
     int htmllen = 0;
     std::vector<std::string> chapter_url;
-    void* doc = NULL;
-    void* ctx = NULL;
+    html_query_t queries[1];
     int needfree = 0;
     int ret = 1;
 
+    // parsed on the scheduler, the network thread goes back to its transfers
+    if (_this->Defer(result, GetChapterPageCompleter, task_normal))
+        return 0;
+
     check_request_result(result);
 
-    HtmlParser::Instance()->HtmlParseBegin(html, htmllen, &doc, &ctx, &_this->m_bForceKill);
-    HtmlParser::Instance()->HtmlParseByXpath(doc, ctx, _this->m_Booksrc->chapter_page_xpath, chapter_url, &_this->m_bForceKill);
-    HtmlParser::Instance()->HtmlParseEnd(doc, ctx);
+    queries[0].xpath = _this->m_Booksrc->chapter_page_xpath;
+    queries[0].value = &chapter_url;
+    queries[0].clear = FALSE;
+    HtmlParser::Instance()->HtmlParseByXpaths(html, htmllen, queries, 1, &_this->m_Token.cancel);
 
-    if (_this->m_bForceKill)
+    if (ReadAcquire(&_this->m_Token.cancel))
         goto end;
 
     if (chapter_url.size() == 0)
@@ -1446,13 +2424,10 @@ end:
     {
         if (ret && _this->m_hEvent)
             SetEvent(_this->m_hEvent);
-        if (_this->m_hMutex)
-        {
-            WaitForSingleObject(_this->m_hMutex, INFINITE);
-            if (_this->m_hRequestList.find(result->handler) != _this->m_hRequestList.end())
-                _this->m_hRequestList.erase(result->handler);
-            ReleaseMutex(_this->m_hMutex);
-        }
+        EnterCriticalSection(&_this->m_RequestLock);
+        if (_this->m_hRequestList.find(result->handler) != _this->m_hRequestList.end())
+            _this->m_hRequestList.erase(result->handler);
+        LeaveCriticalSection(&_this->m_RequestLock);
     }
     if (param)
     {
@@ -1462,13 +2437,11 @@ end:
             _this->StopLoading(param->hWnd, -1);
         }
         // -->
+        // the update check learns the failure on the ui thread
+        if (ret != 0 && !result->cancel && !ReadAcquire(&_this->m_Token.cancel) && _this->m_cb)
+            _this->PostChaptersFailed(param->hWnd, ret);
         free(param);
     }
-    if (ret != 0)
-    {
-        if (_this->m_cb)
-            _this->m_cb(FALSE, ret, _this->m_arg);
-    }
     return ret;
 }
 
@@ -1482,30 +2455,60 @@ unsigned int OnlineBook::GetChaptersCompleter(request_result_t *result)
     std::vector<std::string> title_url;
     std::vector<std::string> url_xpath;
     std::vector<std::string> keyword_xpath;
-    void* doc = NULL;
-    void* ctx = NULL;
+    html_query_t queries[4];
+    int count = 2;
     int i;
-    chapter_data_t chapters;
-    chapter_item_t item;
-    TCHAR* dst = NULL;
-    int dstlen;
+    chapter_data_t* chapters = NULL;
     int needfree = 0;
     int ret = 1;
-    char dsturl[1024];
+    ol_toc_t toc;
+    int first = 0;
+    BOOL page_ok = FALSE;
+    BOOL handed = FALSE;    // the list is finished by the parallel fetch
+    char nexturl[1024] = { 0 };
+
+    // parsed on the scheduler, the network thread goes back to its transfers
+    if (_this->Defer(result, GetChaptersCompleter, task_normal))
+        return 0;
+
+    // not modified since the last check
+    if (!result->cancel && result->errno_ == succ && result->status_code == 304 && param->index == -1)
+    {
+        _this->PostTocUnchanged(param->hWnd, &_this->m_Toc);
+        ret = 0;
+        goto end;
+    }
 
     check_request_result(result);
 
-    HtmlParser::Instance()->HtmlParseBegin(html, htmllen, &doc, &ctx, &_this->m_bForceKill);
-    HtmlParser::Instance()->HtmlParseByXpath(doc, ctx, _this->m_Booksrc->chapter_title_xpath, title_list, &_this->m_bForceKill);
-    HtmlParser::Instance()->HtmlParseByXpath(doc, ctx, _this->m_Booksrc->chapter_url_xpath, title_url, &_this->m_bForceKill);
+    memset(&toc, 0, sizeof(ol_toc_t));
+    // same page as the last check, nothing to parse
+    if (param->index == -1 && !_this->m_Booksrc->enable_chapter_next && toc_read_page(&_this->m_Toc, result, &toc))
+    {
+        _this->PostTocUnchanged(param->hWnd, &toc);
+        ret = 0;
+        goto end;
+    }
+
+    queries[0].xpath = _this->m_Booksrc->chapter_title_xpath;
+    queries[0].value = &title_list;
+    queries[0].clear = FALSE;
+    queries[1].xpath = _this->m_Booksrc->chapter_url_xpath;
+    queries[1].value = &title_url;
+    queries[1].clear = FALSE;
     if (_this->m_Booksrc->enable_chapter_next)
     {
-        HtmlParser::Instance()->HtmlParseByXpath(doc, ctx, _this->m_Booksrc->chapter_next_url_xpath, url_xpath, &_this->m_bForceKill, TRUE);
-        HtmlParser::Instance()->HtmlParseByXpath(doc, ctx, _this->m_Booksrc->chapter_next_keyword_xpath, keyword_xpath, &_this->m_bForceKill, TRUE);
+        queries[2].xpath = _this->m_Booksrc->chapter_next_url_xpath;
+        queries[2].value = &url_xpath;
+        queries[2].clear = TRUE;
+        queries[3].xpath = _this->m_Booksrc->chapter_next_keyword_xpath;
+        queries[3].value = &keyword_xpath;
+        queries[3].clear = TRUE;
+        count = 4;
     }
-    HtmlParser::Instance()->HtmlParseEnd(doc, ctx);
+    HtmlParser::Instance()->HtmlParseByXpaths(html, htmllen, queries, count, &_this->m_Token.cancel);
 
-    if (_this->m_bForceKill)
+    if (ReadAcquire(&_this->m_Token.cancel))
         goto end;
 
     if (title_list.size() == 0 || title_list.size() != title_url.size())
@@ -1516,6 +2519,17 @@ unsigned int OnlineBook::GetChaptersCompleter(request_result_t *result)
 
     if (_this->m_Booksrc->enable_chapter_next)
     {
+        // a page of a parallel fetch is handed over at end
+        if (param->fetch)
+        {
+            if (!url_xpath.empty() && !keyword_xpath.empty()
+                && strstr(_this->m_Booksrc->chapter_next_keyword, keyword_xpath[0].c_str()))
+                combine_url(url_xpath[0].c_str(), result->req->url, nexturl);
+            page_ok = TRUE;
+            ret = 0;
+            goto end;
+        }
+
         // save data
         if (param->title_url == NULL)
         {
@@ -1530,98 +2544,85 @@ unsigned int OnlineBook::GetChaptersCompleter(request_result_t *result)
         {
             if (strstr(_this->m_Booksrc->chapter_next_keyword, keyword_xpath[0].c_str())) // exist next content
             {
+                // the next pages follow a url pattern, request them at once
+                if (param->page == 0 && _this->StartTocFetch(param, result->req->url, url_xpath[0].c_str()))
+                {
+                    handed = TRUE;
+                    ret = 0;
+                    goto end;
+                }
+
                 // request next content
+                param->page++;
                 if (_this->RequestNextPage(_this, result->req, url_xpath[0].c_str(), result->handler))
                     goto _next;
             }
         }
 
         // update chapter
-        chapters._this = _this;
-        for (i = 0; i < (int)param->title_url->size(); i++)
-        {
-            if (_this->m_bForceKill)
-                goto end;
-
-            // format title
-            dst = Utf8ToUtf16(param->title_list->at(i).c_str());
-            dstlen = (int)_tcslen(dst);
-            _this->FormatText(dst, &dstlen);
-
-            combine_url(param->title_url->at(i).c_str(), result->req->url, dsturl);
-
-            item.index = -1;
-            item.size = 0;
-            item.title = dst;
-            item.url = dsturl;
-            item.title_len = dstlen;
-            chapters.chapters.push_back(item);
-        }
+        chapters = _this->NewChapters(*param->title_list, *param->title_url, 0, result->req->url);
+        if (!chapters)
+            goto end;
     }
     else
     {
-        // update chapter
-        chapters._this = _this;
-        for (i = 0; i < (int)title_url.size(); i++)
+        // the page keeps the entries of the last check in front, only the new tail is converted
+        if (param->index == -1)
         {
-            if (_this->m_bForceKill)
+            first = toc_new_entries(&_this->m_Toc, title_list, title_url, &toc);
+            // only the markup around the list changed
+            if (_this->m_Toc.count > 0 && first == (int)title_url.size())
+            {
+                _this->PostTocUnchanged(param->hWnd, &toc);
+                ret = 0;
                 goto end;
-
-            // format title
-            dst = Utf8ToUtf16(title_list[i].c_str());
-            dstlen = (int)_tcslen(dst);
-            _this->FormatText(dst, &dstlen);
-
-            combine_url(title_url[i].c_str(), result->req->url, dsturl);
-
-            item.index = -1;
-            item.size = 0;
-            item.title = dst;
-            item.url = dsturl;
-            item.title_len = dstlen;
-            chapters.chapters.push_back(item);
+            }
         }
+
+        // update chapter
+        chapters = _this->NewChapters(title_list, title_url, first, result->req->url);
+        if (!chapters)
+            goto end;
+        memcpy(&chapters->toc, &toc, sizeof(ol_toc_t));
     }
     _this->m_UpdateTime = time(NULL);
-    SendMessage(param->hWnd, WM_BOOK_EVENT, BE_UPATE_CHAPTER, (LPARAM)&chapters);
 
-    if (_this->m_bForceKill)
-        goto end;
-
-    // parser content
-    if (param->index == -1)
-    {
-        chapters.ret = 1;
-    }
-    else
-    {
-        _this->ParserContent(param->hWnd, param->index);
-    }
+    // the ui thread applies the chapters, then requests the content of index
+    // or reports the update check
+    chapters->index = param->index;
+    _this->PostBookEvent(param->hWnd, BE_UPATE_CHAPTER, chapters);
+    chapters = NULL;
     ret = 0;
 
 end:
     if (needfree && html)
         free(html);
+    if (param->fetch)
+    {
+        // the fetch reports the list once the pages it needs are in, a failure included
+        _this->OnTocPage(param, result, page_ok ? &title_list : NULL, &title_url, nexturl);
+        handed = TRUE;
+        ret = 0;
+    }
     if (!result->cancel)
     {
         if (ret && _this->m_hEvent)
             SetEvent(_this->m_hEvent);
-        if (_this->m_hMutex)
-        {
-            WaitForSingleObject(_this->m_hMutex, INFINITE);
-            if (_this->m_hRequestList.find(result->handler) != _this->m_hRequestList.end())
-                _this->m_hRequestList.erase(result->handler);
-            ReleaseMutex(_this->m_hMutex);
-        }
+        EnterCriticalSection(&_this->m_RequestLock);
+        if (_this->m_hRequestList.find(result->handler) != _this->m_hRequestList.end())
+            _this->m_hRequestList.erase(result->handler);
+        LeaveCriticalSection(&_this->m_RequestLock);
     }
     if (param)
     {
         // <-- for manual check update
-        if (param->index == -1 && _this->m_IsLoading)
+        if (param->index == -1 && _this->m_IsLoading && !handed)
         {
             _this->StopLoading(param->hWnd, -1);
         }
         // -->
+        if (ret != 0 && !result->cancel && !ReadAcquire(&_this->m_Token.cancel) && param->index == -1 && _this->m_cb)
+            _this->PostChaptersFailed(param->hWnd, ret);
 
         if (param->title_url)
             delete param->title_url;
@@ -1629,11 +2630,8 @@ end:
             delete param->title_list;
         free(param);
     }
-    if (chapters.ret != 0)
-    {
-        if (_this->m_cb)
-            _this->m_cb(chapters.is_updated, ret, _this->m_arg);
-    }
+    if (chapters)
+        delete chapters;
     return ret;
 
 _next:
@@ -1642,6 +2640,94 @@ _next:
     return 1;   
 }
 
+req_handler_t OnlineBook::RequestContent(req_content_param_t* param, const char* url, BOOL ahead)
+{
+    req_handler_t hReq = NULL;
+    request_t req;
+
+    logger_printk("Request to: %s%s", url, ahead ? " (ahead)" : "");
+
+    memset(&req, 0, sizeof(request_t));
+    req.method = GET;
+    req.url = (char*)url;
+    req.completer = GetContentCompleter;
+    req.param1 = param;
+    req.param2 = ahead ? CONTENT_AHEAD : NULL;
+
+    hReq = hapi_request(&req);
+    if (hReq)
+    {
+        EnterCriticalSection(&m_RequestLock);
+        m_hRequestList.insert(hReq);
+        LeaveCriticalSection(&m_RequestLock);
+    }
+    return hReq;
+}
+
+void OnlineBook::DropAheadContent(req_content_param_t* param)
+{
+    req_handler_t ahead;
+
+    // the page ahead finishes on its own and lets go of param
+    EnterCriticalSection(&m_RequestLock);
+    ahead = param->ahead;
+    param->ahead = NULL;
+    param->adopted = FALSE;
+    LeaveCriticalSection(&m_RequestLock);
+    if (ahead)
+        SetEvent(param->hTurn);
+}
+
+BOOL OnlineBook::TakeAheadTurn(req_content_param_t* param, request_result_t* result)
+{
+    BOOL adopted;
+
+    // the page before is parsing on another worker already, so the wait is short;
+    // a cancelled result is still on the network thread, it does not wait
+    if (IsDeferred(result))
+        WaitForSingleObject(param->hTurn, INFINITE);
+
+    // not adopted by now, it never is: the page before sees it gone
+    EnterCriticalSection(&m_RequestLock);
+    adopted = param->adopted;
+    param->ahead = NULL;
+    if (!adopted && !result->cancel)
+        m_hRequestList.erase(result->handler);
+    LeaveCriticalSection(&m_RequestLock);
+    if (!adopted)
+        ReleaseContentParam(param);
+    return adopted;
+}
+
+BOOL OnlineBook::CanRequestAhead(req_content_param_t* param)
+{
+    BOOL can;
+
+    // a dropped page ahead holds param until it has seen it is not adopted
+    EnterCriticalSection(&m_RequestLock);
+    can = !param->ahead && InterlockedCompareExchange(&param->refs, 1, 1) == 1;
+    LeaveCriticalSection(&m_RequestLock);
+    return can;
+}
+
+void OnlineBook::ReleaseContentParam(req_content_param_t* param)
+{
+    std::map<int, int>::iterator it;
+
+    if (InterlockedDecrement(&param->refs) != 0)
+        return;
+    EnterCriticalSection(&m_RequestLock);
+    it = m_Fetching.find(param->index);
+    if (it != m_Fetching.end() && --it->second == 0)
+        m_Fetching.erase(it);
+    LeaveCriticalSection(&m_RequestLock);
+    if (param->text)
+        free(param->text);
+    if (param->hTurn)
+        CloseHandle(param->hTurn);
+    free(param);
+}
+
 unsigned int OnlineBook::GetContentCompleter(request_result_t *result)
 {
     req_content_param_t* param = (req_content_param_t*)result->param1;
@@ -1651,31 +2737,69 @@ unsigned int OnlineBook::GetContentCompleter(request_result_t *result)
     std::vector<std::string> content_list;
     std::vector<std::string> url_xpath;
     std::vector<std::string> keyword_xpath;
-    content_data_t data;
-    void* doc = NULL;
-    void* ctx = NULL;
+    std::string ahead_url;
+    std::string ahead_keyword;
+    char nexturl[1024] = { 0 };
+    content_data_t* data = NULL;
+    html_query_t queries[3];
+    int count = 1;
     TCHAR* dst = NULL;
     int dstlen;
     int needfree = 0;
+    BOOL adopted;
     int ret = 1;
 
+    // parsed on the scheduler, the network thread goes back to its transfers
+    if (_this->Defer(result, GetContentCompleter, task_high))
+        return 0;
+
+    // a page requested ahead goes on once the page before it is done with param
+    if (result->param2 == CONTENT_AHEAD && !_this->TakeAheadTurn(param, result))
+        return 1;
+
     check_request_result(result);
 
+    // the next page link is usually found early in the raw page, fetch it while this one is parsed;
+    // one page ahead at a time, a dropped one has to let go of param first
+    if (_this->m_Booksrc->enable_content_next && _this->CanRequestAhead(param)
+        && 0 == HtmlParser::Instance()->HtmlScanByXpath(html, htmllen, _this->m_Booksrc->content_next_url_xpath, _this->m_Booksrc->content_next_keyword_xpath, ahead_url, ahead_keyword, &_this->m_Token.cancel)
+        && !ahead_keyword.empty() && strstr(_this->m_Booksrc->content_next_keyword, ahead_keyword.c_str()))
+    {
+        // held over the request, its result can not take its turn before ahead is set
+        EnterCriticalSection(&_this->m_RequestLock);
+        if (_this->CanRequestAhead(param))
+        {
+            combine_url(ahead_url.c_str(), result->req->url, param->ahead_url);
+            param->adopted = FALSE;
+            InterlockedIncrement(&param->refs);
+            param->ahead = _this->RequestContent(param, param->ahead_url, TRUE);
+            if (!param->ahead)
+                InterlockedDecrement(&param->refs);
+        }
+        LeaveCriticalSection(&_this->m_RequestLock);
+    }
+
     _this->FormatHtml(&html, &htmllen, &needfree);
 
-    if (_this->m_bForceKill)
+    if (ReadAcquire(&_this->m_Token.cancel))
         goto end;
 
-    HtmlParser::Instance()->HtmlParseBegin(html, htmllen, &doc, &ctx, &_this->m_bForceKill);
-    HtmlParser::Instance()->HtmlParseByXpath(doc, ctx, _this->m_Booksrc->content_xpath, content_list, &_this->m_bForceKill);
+    queries[0].xpath = _this->m_Booksrc->content_xpath;
+    queries[0].value = &content_list;
+    queries[0].clear = FALSE;
     if (_this->m_Booksrc->enable_content_next)
     {
-        HtmlParser::Instance()->HtmlParseByXpath(doc, ctx, _this->m_Booksrc->content_next_url_xpath, url_xpath, &_this->m_bForceKill, TRUE);
-        HtmlParser::Instance()->HtmlParseByXpath(doc, ctx, _this->m_Booksrc->content_next_keyword_xpath, keyword_xpath, &_this->m_bForceKill, TRUE);
+        queries[1].xpath = _this->m_Booksrc->content_next_url_xpath;
+        queries[1].value = &url_xpath;
+        queries[1].clear = TRUE;
+        queries[2].xpath = _this->m_Booksrc->content_next_keyword_xpath;
+        queries[2].value = &keyword_xpath;
+        queries[2].clear = TRUE;
+        count = 3;
     }
-    HtmlParser::Instance()->HtmlParseEnd(doc, ctx);
+    HtmlParser::Instance()->HtmlParseByXpaths(html, htmllen, queries, count, &_this->m_Token.cancel);
     
-    if (_this->m_bForceKill)
+    if (ReadAcquire(&_this->m_Token.cancel))
         goto end;
 
     if (content_list.size() == 0 || content_list[0].size() == 0)
@@ -1693,18 +2817,18 @@ unsigned int OnlineBook::GetContentCompleter(request_result_t *result)
         if (param->text == NULL)
         {
             content_list[0].insert(0, "\n");
-            content_list[0].insert(0, Utf16ToUtf8(_this->m_Chapters[param->index].title.c_str()));
+            content_list[0].insert(0, Utf16ToUtf8(_this->m_Chapters.title(param->index)));
             content_list[0].append("\n");
         }
     }
     else
     {
         content_list[0].insert(0, "\n");
-        content_list[0].insert(0, Utf16ToUtf8(_this->m_Chapters[param->index].title.c_str()));
+        content_list[0].insert(0, Utf16ToUtf8(_this->m_Chapters.title(param->index)));
         content_list[0].append("\n");
     }
 
-    if (_this->m_bForceKill)
+    if (ReadAcquire(&_this->m_Token.cancel))
         goto end;
 
     // format content
@@ -1712,12 +2836,12 @@ unsigned int OnlineBook::GetContentCompleter(request_result_t *result)
     if (!dst)
         goto end;
 
-    if (_this->m_bForceKill)
+    if (ReadAcquire(&_this->m_Token.cancel))
         goto end;
 
     _this->FormatText(dst, &dstlen);
 
-    if (_this->m_bForceKill)
+    if (ReadAcquire(&_this->m_Token.cancel))
         goto end;
 
     if (_this->FilterContent(dst, &dstlen))
@@ -1725,7 +2849,7 @@ unsigned int OnlineBook::GetContentCompleter(request_result_t *result)
         _this->FormatText(dst, &dstlen);
     }
 
-    if (_this->m_bForceKill)
+    if (ReadAcquire(&_this->m_Token.cancel))
         goto end;
 
     if (_this->m_Booksrc->enable_content_next)
@@ -1750,28 +2874,57 @@ unsigned int OnlineBook::GetContentCompleter(request_result_t *result)
         {
             if (strstr(_this->m_Booksrc->content_next_keyword, keyword_xpath[0].c_str())) // exist next content
             {
+                combine_url(url_xpath[0].c_str(), result->req->url, nexturl);
+                EnterCriticalSection(&_this->m_RequestLock);
+                adopted = param->ahead && 0 == strcmp(param->ahead_url, nexturl);
+                if (adopted)
+                {
+                    _this->m_hRequestList.erase(result->handler);
+                    param->adopted = TRUE;
+                }
+                LeaveCriticalSection(&_this->m_RequestLock);
+                if (adopted)
+                {
+                    // the page requested ahead is the right one, it goes on with param
+                    InterlockedDecrement(&param->refs);
+                    SetEvent(param->hTurn);
+                    goto _next;
+                }
+
                 // request next content
-                if (_this->RequestNextPage(_this, result->req, url_xpath[0].c_str(), result->handler))
+                _this->DropAheadContent(param);
+                if (_this->RequestContent(param, nexturl, FALSE))
+                {
+                    EnterCriticalSection(&_this->m_RequestLock);
+                    _this->m_hRequestList.erase(result->handler);
+                    LeaveCriticalSection(&_this->m_RequestLock);
                     goto _next;
+                }
             }
         }
 
-        data._this = _this;
-        data.index = param->index;
-        data.text = param->text;
-        data.len = param->textlen;
-        data.todo = param->todo;
+        // the text goes with the event
+        data = new content_data_t;
+        data->_this = _this;
+        data->index = param->index;
+        data->text = param->text;
+        data->len = param->textlen;
+        data->todo = param->todo;
+        param->text = NULL;
     }
     else
     {
-        data._this = _this;
-        data.index = param->index;
-        data.text = dst;
-        data.len = dstlen;
-        data.todo = param->todo;
+        data = new content_data_t;
+        data->_this = _this;
+        data->index = param->index;
+        data->text = dst;
+        data->len = dstlen;
+        data->todo = param->todo;
+        dst = NULL;
     }
 
-    SendMessage(param->hWnd, WM_BOOK_EVENT, BE_UPATE_CONTENT, (LPARAM)&data);
+    // applied on the ui thread, which also stops the loading image then
+    _this->PostBookEvent(param->hWnd, BE_UPATE_CONTENT, data);
 
     _this->m_result = TRUE;
     ret = 0;
@@ -1784,23 +2937,21 @@ end:
             HtmlParser::Instance()->FreeFormat(html);
     if (dst)
         free(dst);
+    if (param)
+        _this->DropAheadContent(param);
     if (!result->cancel)
     {
         if (_this->m_hEvent)
             SetEvent(_this->m_hEvent);
-        if (_this->m_hMutex)
-        {
-            WaitForSingleObject(_this->m_hMutex, INFINITE);
-            if (_this->m_hRequestList.find(result->handler) != _this->m_hRequestList.end())
-                _this->m_hRequestList.erase(result->handler);
-            ReleaseMutex(_this->m_hMutex);
-        }
+        EnterCriticalSection(&_this->m_RequestLock);
+        if (_this->m_hRequestList.find(result->handler) != _this->m_hRequestList.end())
+            _this->m_hRequestList.erase(result->handler);
+        LeaveCriticalSection(&_this->m_RequestLock);
         if (param)
         {
-            _this->StopLoading(param->hWnd, param->index);
-            if (param->text)
-                free(param->text);
-            free(param);
+            if (ret != 0)
+                _this->StopLoading(param->hWnd, param->index);
+            _this->ReleaseContentParam(param);
         }
     }
     return ret;
@@ -1821,13 +2972,12 @@ void OnlineBook::UpdateBookSource(void)
     m_Booksrc = FindBookSource(m_Host);
 }
 
-int OnlineBook::CheckUpdate(HWND hWnd, olbook_checkupdate_callback cb, void* arg)
+int OnlineBook::PrepareCheck(void)
 {
     u64 current_time = 0;
 
-    logger_printk("file=%s", Utf16ToAnsi(m_fileName));
-
-    if (m_IsNotCurnOpenedBook)
+    // a book that is not opened needs only its header and chapter table
+    if (m_IsNotCurnOpenedBook && !m_HeaderOnly)
     {
         if (!ReadOlFile(TRUE))
             return 1; // fail
@@ -1837,11 +2987,23 @@ int OnlineBook::CheckUpdate(HWND hWnd, olbook_checkupdate_callback cb, void* arg
     if (current_time <= m_UpdateTime || current_time - m_UpdateTime < 4 * 3600)
         return 0; // completed
 
-    if (m_IsNotCurnOpenedBook)
-    {
-        if (!ReadOlFile())
-            return 1; // fail
-    }
+    return 2; // due
+}
+
+const char* OnlineBook::GetHost(void)
+{
+    return m_Host;
+}
+
+int OnlineBook::CheckUpdate(HWND hWnd, olbook_checkupdate_callback cb, void* arg)
+{
+    int ret;
+
+    logger_printk("file=%s", Utf16ToAnsi(m_fileName));
+
+    ret = PrepareCheck();
+    if (ret != 2)
+        return ret;
     
     m_cb = cb;
     m_arg = arg;
@@ -5,7 +5,10 @@
 #include "Book.h"
 #include "https.h"
 #include "HtmlParser.h"
+#include "EventQueue.h"
+#include "BlockStore.h"
 #include <set>
+#include <map>
 
 typedef enum comp_todo_t
 {
@@ -19,6 +22,31 @@ typedef enum comp_todo_t
 
 typedef void (*olbook_checkupdate_callback)(int is_update, int err, void *param);
 
+#define PREFETCH_MAX_AHEAD          8           // chapters after the current one
+#define PREFETCH_MAX_RUNNING        3           // chapter requests in flight
+#define PREFETCH_MAX_CHARS          (2 << 20)   // text ahead of the reader
+#define PREFETCH_LATENCY            3000        // ms, before a host was measured
+#define PREFETCH_MARGIN             2           // chapters ahead cover this many fetches
+#define PREFETCH_CHAPTER_SIZE       5000        // chars, before a chapter was loaded
+#define PREFETCH_IDLE               (5 * 60 * 1000) // a longer pause is not reading
+
+typedef struct prefetch_stats_t
+{
+    u32 window;         // chapters kept ahead at the last check
+    u32 running;        // chapter requests in flight
+    u32 speed;          // chars per second
+    u32 latency;        // ms of a chapter request to this host
+    u32 stalls;         // the reader reached a chapter not loaded yet
+} prefetch_stats_t;
+
+struct chapter_data_t;
+struct content_data_t;
+struct req_chapter_param_t;
+struct req_content_param_t;
+struct toc_fetch_t;
+struct deferred_result_t;
+struct save_param_t;
+
 class OnlineBook : public Book
 {
 public:
@@ -31,6 +59,7 @@ public:
     virtual BOOL UpdateChapters(int offset);
     virtual BOOL IsLoading(void);
     virtual void JumpChapter(HWND hWnd, int index);
+    virtual void LoadText(int start, int length, BOOL evict = FALSE);
     virtual void JumpPrevChapter(HWND hWnd);
     virtual void JumpNextChapter(HWND hWnd);
     virtual int GetCurChapterIndex(void);
@@ -41,8 +70,10 @@ protected:
     BOOL ParserChapterPage(HWND hWnd, int idx); // chapter index
     BOOL ParserChapters(HWND hWnd, int idx); // chapter index
     BOOL ParserContent(HWND hWnd, int idx, u32 todo = todo_nothing); // chapter index
-    BOOL ReadOlFile(BOOL fast=FALSE);
-    BOOL WriteOlFile();
+    BOOL ReadOlFile(BOOL header_only=FALSE);
+    void SaveOlFile(void);
+    BOOL WriteOlFile(save_param_t *param);
+    BOOL WriteOlHeader(ol_header_t *header);
     BOOL GenerateOlHeader(ol_header_t **header);
     BOOL ParseOlHeader(ol_header_t *header);
     BOOL DownloadPrevNext(HWND hWnd);
@@ -54,34 +85,82 @@ protected:
     void PlayLoading(HWND hWnd);
     void StopLoading(HWND hWnd, int idx);
     BOOL RequestNextPage(OnlineBook* _this, request_t *r, const char *url, req_handler_t hOld);
+    req_handler_t RequestChapters(req_chapter_param_t *param, const char *url);
+    BOOL StartTocFetch(req_chapter_param_t *param, const char *url, const char *next);
+    void LaunchTocPages(toc_fetch_t *fetch);
+    void OnTocPage(req_chapter_param_t *param, request_result_t *result, std::vector<std::string> *titles, std::vector<std::string> *urls, const char *next);
+    chapter_data_t* NewChapters(std::vector<std::string> &titles, std::vector<std::string> &urls, int first, const char *base);
+    req_handler_t RequestContent(req_content_param_t *param, const char *url, BOOL ahead);
+    void DropAheadContent(req_content_param_t *param);
+    BOOL TakeAheadTurn(req_content_param_t *param, request_result_t *result);
+    BOOL CanRequestAhead(req_content_param_t *param);
+    void ReleaseContentParam(req_content_param_t *param);
     int FilterContent(TCHAR *text, int *len);
+    void PostBookEvent(HWND hWnd, int type, book_event_data_t *data);
+    void DispatchEvents(HWND hWnd);
+    void ReleaseEvents(void);
+    void PostChaptersFailed(HWND hWnd, int err);
+    void PostTocUnchanged(HWND hWnd, const ol_toc_t *toc);
+    void ApplyChapters(chapter_data_t *chapters);
+    void ApplyContent(HWND hWnd, content_data_t *content, BOOL *painted);
+    void SampleReading(void);
+    void PrefetchNext(HWND hWnd, int cur);
+    BOOL Defer(request_result_t *result, complete_cb completer, task_priority_t priority);
+    BOOL IsDeferred(request_result_t *result);
+    request_t* GetRequestInfo(req_handler_t hReq);
 
 public:
     void UpdateBookSource(void);
+    int PrepareCheck(void); // 0: not due, 1: fail, 2: due
+    const char* GetHost(void);
+    const prefetch_stats_t* GetPrefetchStats(void);
     int CheckUpdate(HWND hWnd, olbook_checkupdate_callback cb, void* arg);
+    BOOL WaitSaved(DWORD timeout);  // ms or INFINITE, TRUE once no save is left to write the file
     int ManualCheckUpdate(HWND hWnd, olbook_checkupdate_callback cb, void* arg);
+    static void FreeBookEvent(WPARAM wParam, LPARAM lParam); // for an event no book takes any more
 
 private:
     static unsigned int GetChapterPageCompleter(request_result_t *result);
     static unsigned int GetChaptersCompleter(request_result_t *result);
     static unsigned int GetContentCompleter(request_result_t *result);
+    static unsigned DeferredTask(void* arg, task_token_t* token);
+    static unsigned SaveTask(void* arg, task_token_t* token);
 
 protected:
     HANDLE m_hEvent;
-    HANDLE m_hMutex;
+    CRITICAL_SECTION m_RequestLock;     // m_hRequestList
     std::set<req_handler_t> m_hRequestList;
+    std::map<req_handler_t, deferred_result_t*> m_Deferred; // entries of m_hRequestList parsed on the scheduler
+    EventQueue m_Events;                // results of the completers, applied on the ui thread
+    volatile LONG m_Dispatching;        // a BE_DISPATCH message is pending
     BOOL m_result;
     char m_MainPage[1024];
     char m_ChapterPage[1024];
     TCHAR m_BookName[256];
     char m_Host[1024];
     u64 m_UpdateTime;
+    ol_toc_t m_Toc;                     // chapter list page at the last update check
     BOOL m_IsLoading;
     int m_TagetIndex;
     book_source_t* m_Booksrc;
     olbook_checkupdate_callback m_cb;
     void* m_arg;
     BOOL m_IsNotCurnOpenedBook;
+    BOOL m_HeaderOnly;                  // read for an update check, m_Text is not loaded
+    int m_OlHeaderSize;                 // header size of the file on disk
+    u32 m_TextFormat;                   // text_format of the file on disk
+    BlockStore m_Store;                 // deflated chapters of m_Text
+    CRITICAL_SECTION m_SaveLock;        // m_Store, m_TextFormat and m_OlHeaderSize, on every thread
+    LONG m_SaveSeq;                     // snapshots taken, ui thread
+    LONG m_SavedSeq;                    // last snapshot written
+    task_t* m_hSaveTask;                // the last save, older ones wait for it or skip, ui thread
+    prefetch_stats_t m_Prefetch;
+    double m_ReadSpeed;                 // chars per second, 0 until measured
+    int m_ReadIndex;                    // position of the last reading sample
+    DWORD m_ReadTick;
+    std::map<int, DWORD> m_FetchStart;  // chapter requests by chapter, ui thread
+    std::map<int, int> m_Fetching;      // content params alive by chapter, m_RequestLock
+    int m_Loaded;                       // chapters with text, kept with m_Chapters
 };
 
 #endif
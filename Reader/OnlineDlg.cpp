@@ -5,8 +5,9 @@
 #include "HtmlParser.h"
 #include "https.h"
 #include "Utils.h"
+#include "BookSources.h"
 
-extern header_t* _header;
+extern BookSources* _BookSources;
 extern HWND _hWnd;
 extern HINSTANCE hInst;
 extern void OnOpenOlBook(HWND, void*);
@@ -64,7 +65,7 @@ void TestXpathFromDump(void)
     int htmllen;
     void* doc = NULL;
     void* ctx = NULL;
-    BOOL fkill = FALSE;
+    LONG fkill = FALSE;
     const char* xpath1 = "//div[@id='list']/dl/dd[position()>12]/a";
     const char* xpath2 = "//div[@id='list']/dl/dd[position()>12]/a/@href";
     std::vector<std::string> value1, value2;
@@ -94,16 +95,16 @@ void ReloadBookSourceCombobox(HWND hDlg, int iPos)
 {
     int i;
     SendMessage(GetDlgItem(hDlg, IDC_COMBO_BS_LIST), CB_RESETCONTENT, 0, NULL);
-    for (i = 0; i < _header->book_source_count; i++)
+    for (i = 0; i < _BookSources->Count(); i++)
     {
-        SendMessage(GetDlgItem(hDlg, IDC_COMBO_BS_LIST), CB_ADDSTRING, 0, (LPARAM)_header->book_sources[i].title);
+        SendMessage(GetDlgItem(hDlg, IDC_COMBO_BS_LIST), CB_ADDSTRING, 0, (LPARAM)_BookSources->Get(i)->title);
     }
 #if ENABLE_GLOBAL_SEARCH
-    if (_header->book_source_count > 0)
+    if (_BookSources->Count() > 0)
         SendMessage(GetDlgItem(hDlg, IDC_COMBO_BS_LIST), CB_ADDSTRING, 0, (LPARAM)_T("ALL"));
-    if (iPos < 0 || iPos > _header->book_source_count)
+    if (iPos < 0 || iPos > _BookSources->Count())
 #else
-    if (g_lastPos < 0 || g_lastPos >= _header->book_source_count)
+    if (g_lastPos < 0 || g_lastPos >= _BookSources->Count())
 #endif
         iPos = 0;
     SendMessage(GetDlgItem(hDlg, IDC_COMBO_BS_LIST), CB_SETCURSEL, iPos, NULL);
@@ -153,7 +154,7 @@ static INT_PTR CALLBACK OnlineDlgProc(HWND hDlg, UINT message, WPARAM wParam, LP
                 ListView_GetItemText(hList, iPos, colnum, path, 1024);
                 ListView_GetItemText(hList, iPos, 1, param.book_name, 256);
                 strcpy(param.main_page, Utf16ToUtf8(path));
-                strcpy(param.host, _header->book_sources[idx].host);
+                strcpy(param.host, _BookSources->Get(idx)->host);
                 OnOpenOlBook(_hWnd, &param);
                 g_lastPos = idx;
                 EndDialog(hDlg, LOWORD(wParam));
@@ -245,9 +246,9 @@ static unsigned int RequestQueryCompleter(request_result_t* result)
     LV_COLUMN lvc = {0};
     LVITEM lvitem = {0};
     int i, col;
-    void* doc = NULL;
-    void* ctx = NULL;
-    BOOL cancel = FALSE;
+    html_query_t queries[3];
+    int count = 2;
+    LONG cancel = FALSE;
     TCHAR colname[256] = {0};
     char Url[1024] = {0};
     int needfree = 0;
@@ -271,7 +272,7 @@ static unsigned int RequestQueryCompleter(request_result_t* result)
         return 1;
     }
 
-    if (bs_idx < 0 || bs_idx >= _header->book_source_count)
+    if (bs_idx < 0 || bs_idx >= _BookSources->Count())
     {
         if (g_query_param->is_global)
             goto _next;
@@ -315,12 +316,20 @@ static unsigned int RequestQueryCompleter(request_result_t* result)
         needfree = 1;
     }
 
-    HtmlParser::Instance()->HtmlParseBegin(html, htmllen, &doc, &ctx, &cancel);
-    HtmlParser::Instance()->HtmlParseByXpath(doc, ctx, _header->book_sources[bs_idx].book_name_xpath, table_name, &cancel, TRUE);
-    HtmlParser::Instance()->HtmlParseByXpath(doc, ctx, _header->book_sources[bs_idx].book_mainpage_xpath, table_url, &cancel);
-    if (_header->book_sources[bs_idx].book_author_xpath[0])
-        HtmlParser::Instance()->HtmlParseByXpath(doc, ctx, _header->book_sources[bs_idx].book_author_xpath, table_author, &cancel, TRUE);
-    HtmlParser::Instance()->HtmlParseEnd(doc, ctx);
+    queries[0].xpath = _BookSources->Get(bs_idx)->book_name_xpath;
+    queries[0].value = &table_name;
+    queries[0].clear = TRUE;
+    queries[1].xpath = _BookSources->Get(bs_idx)->book_mainpage_xpath;
+    queries[1].value = &table_url;
+    queries[1].clear = FALSE;
+    if (_BookSources->Get(bs_idx)->book_author_xpath[0])
+    {
+        queries[2].xpath = _BookSources->Get(bs_idx)->book_author_xpath;
+        queries[2].value = &table_author;
+        queries[2].clear = TRUE;
+        count = 3;
+    }
+    HtmlParser::Instance()->HtmlParseByXpaths(html, htmllen, queries, count, &cancel);
 
     // check value
     if (table_url.empty() || table_name.size() != table_url.size())
@@ -395,7 +404,7 @@ static unsigned int RequestQueryCompleter(request_result_t* result)
             lvitem.cchTextMax = MAX_PATH;
             lvitem.iItem = i + colnum;
             lvitem.iSubItem = col++;
-            lvitem.pszText = _header->book_sources[bs_idx].title;
+            lvitem.pszText = _BookSources->Get(bs_idx)->title;
             lvitem.lParam = bs_idx;
             ::SendMessage(hList, LVM_INSERTITEM, lvitem.iItem, (LPARAM)&lvitem);
             ::SendMessage(hList, LVM_SETITEMTEXT, lvitem.iItem, (LPARAM)&lvitem);
@@ -438,7 +447,7 @@ static unsigned int RequestQueryCompleter(request_result_t* result)
     }
 
 _next:
-    if (g_query_param->is_global && (++bs_idx < _header->book_source_count))
+    if (g_query_param->is_global && (++bs_idx < _BookSources->Count()))
     {
         g_query_param->bs_idx++;
         OnRequestCharset();
@@ -464,9 +473,9 @@ static int OnRequestQuery(http_charset_t charset)
     else
         keyword = Utf16ToAnsi(g_query_param->text);
 
-    if (_header->book_sources[bs_idx].query_method == 0) // GET
+    if (_BookSources->Get(bs_idx)->query_method == 0) // GET
     {
-        query_format = _header->book_sources[bs_idx].query_url;
+        query_format = _BookSources->Get(bs_idx)->query_url;
 
         hapi_url_encode(keyword, &encode);
         sprintf(url, query_format, encode);
@@ -474,16 +483,16 @@ static int OnRequestQuery(http_charset_t charset)
     }
     else // POST
     {
-        strcpy(url, _header->book_sources[bs_idx].query_url);
+        strcpy(url, _BookSources->Get(bs_idx)->query_url);
 
         hapi_url_encode(keyword, &encode);
-        sprintf(content, _header->book_sources[bs_idx].query_params, encode);
+        sprintf(content, _BookSources->Get(bs_idx)->query_params, encode);
         hapi_buffer_free(encode);
     }
 
     // do request
     memset(&req, 0, sizeof(request_t));
-    req.method = _header->book_sources[bs_idx].query_method == 0 ? GET : POST;
+    req.method = _BookSources->Get(bs_idx)->query_method == 0 ? GET : POST;
     req.url = url;
     req.content = content;
     req.content_length = (int)strlen(content);
@@ -530,7 +539,7 @@ static unsigned int RequestCharsetCompleter(request_result_t* result)
     return 0;
 
 _next:
-    if (g_query_param->is_global && (++bs_idx < _header->book_source_count))
+    if (g_query_param->is_global && (++bs_idx < _BookSources->Count()))
     {
         g_query_param->bs_idx++;
         OnRequestCharset();
@@ -551,18 +560,18 @@ static int OnRequestCharset(void)
     http_charset_t charset;
     int bs_idx = g_query_param->bs_idx;
 
-    if (_header->book_sources[bs_idx].query_charset != 0) // 0: auto
+    if (_BookSources->Get(bs_idx)->query_charset != 0) // 0: auto
     {
-        if (_header->book_sources[bs_idx].query_charset == 1) // utf8
+        if (_BookSources->Get(bs_idx)->query_charset == 1) // utf8
             charset = utf_8;
         else
             charset = gbk;
         return OnRequestQuery(charset);
     }
     keyword = Utf16ToUtf8(g_query_param->text);
-    if (_header->book_sources[bs_idx].query_method == 0) // GET
+    if (_BookSources->Get(bs_idx)->query_method == 0) // GET
     {
-        query_format = _header->book_sources[bs_idx].query_url;
+        query_format = _BookSources->Get(bs_idx)->query_url;
 
         hapi_url_encode(keyword, &encode);
         sprintf(url, query_format, encode);
@@ -570,10 +579,10 @@ static int OnRequestCharset(void)
     }
     else // POST
     {
-        strcpy(url, _header->book_sources[bs_idx].query_url);
+        strcpy(url, _BookSources->Get(bs_idx)->query_url);
 
         hapi_url_encode(keyword, &encode);
-        sprintf(content, _header->book_sources[bs_idx].query_params, encode);
+        sprintf(content, _BookSources->Get(bs_idx)->query_params, encode);
         hapi_buffer_free(encode);
     }
 
@@ -613,7 +622,7 @@ static void EnableDialog(HWND hDlg, BOOL enable)
 
 static BOOL _begin_query(HWND hDlg)
 {
-    if (_header->book_source_count == 0)
+    if (_BookSources->Count() == 0)
     {
         if (IDYES == MessageBox_(hDlg, IDS_NOTEXIST_BOOKSOURCE, IDS_ERROR, MB_ICONERROR | MB_YESNO))
         {
@@ -638,16 +647,16 @@ static BOOL _begin_query(HWND hDlg)
 
     g_query_param->bs_idx = (int)SendMessage(GetDlgItem(hDlg, IDC_COMBO_BS_LIST), CB_GETCURSEL, 0, NULL);
 #if ENABLE_GLOBAL_SEARCH
-    if (g_query_param->bs_idx < 0 || g_query_param->bs_idx > _header->book_source_count)
+    if (g_query_param->bs_idx < 0 || g_query_param->bs_idx > _BookSources->Count())
 #else
-    if (g_query_param->bs_idx < 0 || g_query_param->bs_idx >= _header->book_source_count)
+    if (g_query_param->bs_idx < 0 || g_query_param->bs_idx >= _BookSources->Count())
 #endif    
     {
         MessageBox_(hDlg, IDS_SELECT_BOOKSOURCE, IDS_ERROR, MB_ICONERROR | MB_OK);
         goto _failed;
     }
 
-    if (g_query_param->bs_idx == _header->book_source_count)
+    if (g_query_param->bs_idx == _BookSources->Count())
     {
         g_query_param->bs_idx = 0;
         g_query_param->is_global = 1;
@@ -1,5 +1,8 @@
 #include "Page.h"
 #include "Book.h"
+#include "Composite.h"
+#include "PageCache.h"
+#include "CoverImage.h"
 
 #define CHAR_GAP                (m_header->char_gap)
 #define LINE_GAP                (m_header->line_gap)
@@ -29,19 +32,67 @@ Page::Page()
     , m_PageLength(0)
     , m_header(0)
     , m_dcList(NULL)
+    , m_FontList(NULL)
+    , m_dcCount(0)
     , m_dcIndex(0)
     , m_LineCount(0)
     , m_DrawType(DRAW_NULL)
     , m_BlankPage(TRUE)
     , m_ChapterStart(0)
     , m_ChapterLength(0)
+    , m_RunDx(NULL)
+    , m_RunDxSize(0)
+    , m_DrawnSurface(NULL)
+    , m_OldLines(NULL)
+    , m_OldLineSize(0)
+    , m_Smooth(FALSE)
+    , m_ScrollOffset(0)
+    , m_StripTarget(-1)
+    , m_CoverScaled(NULL)
+    , m_CoverSource(NULL)
+    , m_ImageCache(NULL)
+    , m_TextWidth(0)
+    , m_TextHeight(0)
 {
+    m_PageCache = new PageCache();
+    m_DrawnKey = (page_cache_key_t *)calloc(1, sizeof(page_cache_key_t));
+    m_StripKey = (page_cache_key_t *)calloc(1, sizeof(page_cache_key_t));
     memset(&m_PageInfo, 0, sizeof(page_info_t));
+    memset(&m_RenderStats, 0, sizeof(render_stats_t));
+    memset(m_Strips, 0, sizeof(m_Strips));
+    InitializeCriticalSection(&m_TextLock);
 }
 
 Page::~Page()
 {
     ReleasePageInfo();
+    ReleaseFonts();
+    delete m_PageCache;
+    free(m_DrawnKey);
+    free(m_StripKey);
+    render_surface_delete(&m_Strips[0].surface);
+    render_surface_delete(&m_Strips[1].surface);
+    if (m_CoverScaled)
+    {
+        delete m_CoverScaled;
+        m_CoverScaled = NULL;
+    }
+    if (m_ImageCache)
+    {
+        delete m_ImageCache;
+        m_ImageCache = NULL;
+    }
+    if (m_OldLines)
+    {
+        free(m_OldLines);
+        m_OldLines = NULL;
+    }
+    if (m_RunDx)
+    {
+        free(m_RunDx);
+        m_RunDx = NULL;
+    }
+    DeleteCriticalSection(&m_TextLock);
 }
 
 void Page::Init(int *p_index, header_t *header)
@@ -148,30 +199,58 @@ void Page::LineDown(HWND hWnd, BOOL draw)
     }
 }
 
-void Page::DrawPage(HWND hWnd, HDC hdc, RECT* rc, BOOL enable_alpha)
+void Page::DrawPage(HWND hWnd, HDC hdc, RECT* rc, BOOL enable_alpha, u32 bg_id, HDC bg_dc)
 {
-    int i, j, x, y;
-    line_info_t* p_line;
-    char_info_t* p_char;
     alpha_dc_info_t alpha_dc;
+    alpha_dc_info_t *p_alpha_dc = enable_alpha ? &alpha_dc : NULL;
+    page_cache_key_t key;
+    int draw_type = m_DrawType;
+    int width = rc->right - rc->left;
+    int height = rc->bottom - rc->top;
+    BOOL scroll, test = FALSE;
+
+    memset(&m_RenderStats, 0, sizeof(render_stats_t));
+
+    // between two line steps of smooth scroll only the strips move
+    if (m_Smooth && m_DrawType == DRAW_NULL && m_Strips[0].valid)
+    {
+        MakeCacheKey(&key, DRAW_NULL, rc, enable_alpha, bg_id);
+        if (memcmp(&key, m_StripKey, sizeof(page_cache_key_t)) == 0)
+        {
+            m_BlankPage = enable_alpha && m_Strips[0].blank && (!m_Strips[1].valid || m_Strips[1].blank);
+            return;
+        }
+    }
 
     if (enable_alpha)
         m_BlankPage = TRUE;
     else
         m_BlankPage = FALSE;
 
-    if (!IsValid())
-        return;
-
-    if (!OnDrawPageEvent(hWnd))
-        return;
-
     if (enable_alpha)
     {
         memset(&alpha_dc, 0, sizeof(alpha_dc_info_t));
-        CreateAlphaTextBitmap(hdc, rc->right - rc->left, rc->bottom - rc->top, &alpha_dc);
+        CreateAlphaTextBitmap(hdc, width, height, &alpha_dc);
     }
 
+    if (!IsValid() || !OnDrawPageEvent(hWnd))
+    {
+        // the surface may be kept across frames, don't leave the last page on it
+        ClearSurface(hdc, p_alpha_dc, bg_dc, width, 0, height);
+        m_DrawnSurface = NULL;
+        ResetStrips();
+        if (enable_alpha)
+        {
+            DeleteAlphaTextBitmap(hdc, &alpha_dc);
+        }
+        return;
+    }
+
+    scroll = CanScrollSurface(hdc, rc, p_alpha_dc, bg_id, bg_dc);
+    if (!scroll)
+        ClearSurface(hdc, p_alpha_dc, bg_dc, width, 0, height);
+    m_DrawnSurface = NULL;
+
     if (DrawCover(hdc, rc))
     {
         m_Index = 0;
@@ -182,15 +261,149 @@ void Page::DrawPage(HWND hWnd, HDC hdc, RECT* rc, BOOL enable_alpha)
         m_PageInfo.length = 1;
         ClearLines();
         if (enable_alpha)
-        {
-            DeleteAlphaTextBitmap(hdc, &alpha_dc);
             m_BlankPage = FALSE;
+    }
+    else
+    {
+        // page flip rendered ahead during idle time, just copy it
+        if (!DrawCachedPage(hdc, rc, p_alpha_dc, bg_id))
+        {
+            if (scroll)
+                ScrollAndDraw(hdc, rc, p_alpha_dc, bg_dc);
+            else
+                LayoutAndDraw(hdc, rc, p_alpha_dc);
+
+            m_Index = m_PageInfo.start;
+            m_PageLength = m_PageInfo.length;
+            test = TRUE;
         }
-        return;
+
+        // a line step can reuse what is left on the surface, unless the caller
+        // composes smooth scroll strips over it
+        if ((enable_alpha && !alpha_dc.owned) || (!enable_alpha && bg_dc && !m_Smooth))
+        {
+            MakeCacheKey(m_DrawnKey, DRAW_NULL, rc, enable_alpha, bg_id);
+            m_DrawnSurface = enable_alpha ? (void *)alpha_dc.pvBits : (void *)hdc;
+        }
+        Save(hWnd);
     }
 
-    BeginDraw();
+    if (m_Smooth)
+    {
+        CaptureStrip(hdc, rc, p_alpha_dc, draw_type, bg_id);
+    }
+    if (enable_alpha)
+    {
+        DeleteAlphaTextBitmap(hdc, &alpha_dc);
+    }
+    if (test)
+        TestCase(rc);
+}
+
+BOOL Page::PrerenderPage(HDC hdc, RECT *rc, BOOL enable_alpha, int draw_type, HDC bg_dc, u32 bg_id)
+{
+    page_cache_key_t key;
+    page_cache_entry_t *entry;
+    page_info_t saved;
+    render_stats_t stats;
+    alpha_dc_info_t alpha_dc;
+    int index, page_length, chapter_start, chapter_length;
+    BOOL blank;
+
+    if (!IsValid() || m_DrawType != DRAW_NULL || IsCoverPage() || m_PageInfo.lines.used == 0)
+        return FALSE;
+    // smooth scroll steps one line at a time, a page flip is not coming
+    if (m_Smooth)
+        return FALSE;
+    if (!enable_alpha && !bg_dc)
+        return FALSE;
+
+    // same conditions as PageDown() and PageUp(), the cover is never cached
+    if (draw_type == DRAW_PAGE_DOWN)
+    {
+        if (m_Index + m_PageInfo.length >= m_Length)
+            return FALSE;
+    }
+    else if (draw_type == DRAW_PAGE_UP)
+    {
+        if (m_Index <= GetTextBeginIndex())
+            return FALSE;
+    }
+    else
+    {
+        return FALSE;
+    }
+
+    MakeCacheKey(&key, draw_type, rc, enable_alpha, bg_id);
+    if (m_PageCache->Contains(&key))
+        return TRUE;
+
+    entry = m_PageCache->Alloc(&key, hdc);
+    if (!entry)
+        return FALSE;
+
+    // lay out on a copy of the current page, everything is put back afterwards
+    saved = m_PageInfo;
+    CopyPageInfo(&m_PageInfo, &saved);
+    index = m_Index;
+    page_length = m_PageLength;
+    chapter_start = m_ChapterStart;
+    chapter_length = m_ChapterLength;
+    blank = m_BlankPage;
+    stats = m_RenderStats;
+
+    m_DrawType = draw_type;
+    m_LineCount = LEFT_NUM;
+    m_BlankPage = enable_alpha;
+    if (enable_alpha)
+    {
+        memset(&alpha_dc, 0, sizeof(alpha_dc_info_t));
+        CreateAlphaTextBitmap(entry->hdc, rc->right - rc->left, rc->bottom - rc->top, &alpha_dc);
+    }
+    ClearSurface(entry->hdc, enable_alpha ? &alpha_dc : NULL, bg_dc, entry->width, 0, entry->height);
 
+    LayoutAndDraw(entry->hdc, rc, enable_alpha ? &alpha_dc : NULL);
+
+    if (enable_alpha)
+    {
+        DeleteAlphaTextBitmap(entry->hdc, &alpha_dc);
+    }
+
+    entry->info = m_PageInfo;
+    entry->chapter_start = m_ChapterStart;
+    entry->chapter_length = m_ChapterLength;
+    entry->blank = m_BlankPage;
+    if (entry->info.lines.used > 0)
+        m_PageCache->Commit(entry);
+    else
+        m_PageCache->Remove(entry);
+
+    m_PageInfo = saved;
+    m_Index = index;
+    m_PageLength = page_length;
+    m_ChapterStart = chapter_start;
+    m_ChapterLength = chapter_length;
+    m_BlankPage = blank;
+    m_RenderStats = stats;
+    m_DrawType = DRAW_NULL;
+    m_LineCount = 0;
+    return entry->valid;
+}
+
+void Page::ResetPageCache(void)
+{
+    // the surface of the last frame is stale as well
+    m_PageCache->Clear();
+    m_DrawnSurface = NULL;
+}
+
+const page_cache_stats_t* Page::GetPageCacheStats(void)
+{
+    return m_PageCache->GetStats();
+}
+
+void Page::CalcPage(HDC hdc, RECT *rc)
+{
     switch (m_DrawType)
     {
     case DRAW_NULL:
@@ -208,39 +421,344 @@ void Page::DrawPage(HWND hWnd, HDC hdc, RECT* rc, BOOL enable_alpha)
 
     m_DrawType = DRAW_NULL;
     m_LineCount = 0;
+}
 
-    y = TOP_MIN;
-    for (i = 0; i < m_PageInfo.lines.used; i++)
+void Page::LayoutAndDraw(HDC hdc, RECT *rc, alpha_dc_info_t *p_alpha_dc)
+{
+    BeginDraw();
+    CalcPage(hdc, rc);
+    DrawLineRange(hdc, p_alpha_dc, 0, m_PageInfo.lines.used);
+    EndDraw(hdc);
+}
+
+BOOL Page::CanScrollSurface(HDC hdc, RECT *rc, alpha_dc_info_t *p_alpha_dc, u32 bg_id, HDC bg_dc)
+{
+    page_cache_key_t key;
+    void *surface = p_alpha_dc ? (void *)p_alpha_dc->pvBits : (void *)hdc;
+
+    if (m_DrawType != DRAW_LINE_DOWN && m_DrawType != DRAW_LINE_UP)
+        return FALSE;
+    if (!m_DrawnSurface || m_DrawnSurface != surface || m_PageInfo.lines.used == 0)
+        return FALSE;
+    if (!p_alpha_dc && !bg_dc)
+        return FALSE;
+    // line up onto the cover
+    if (m_DrawType == DRAW_LINE_UP && m_Index == GetTextBeginIndex() && GetCover())
+        return FALSE;
+
+    // the surface still holds the current page with the same layout
+    MakeCacheKey(&key, DRAW_NULL, rc, p_alpha_dc != NULL, bg_id);
+    return memcmp(&key, m_DrawnKey, sizeof(page_cache_key_t)) == 0;
+}
+
+void Page::ScrollAndDraw(HDC hdc, RECT *rc, alpha_dc_info_t *p_alpha_dc, HDC bg_dc)
+{
+    line_info_t *p_lines;
+    int width = rc->right - rc->left;
+    int height = rc->bottom - rc->top;
+    int i, old_used, old_idx, new_idx, kept;
+    int src_y, dst_y, kept_h;
+
+    BeginDraw();
+
+    // line headers before the step, the chars of removed lines are freed by CalcPage
+    old_used = m_PageInfo.lines.used;
+    if (old_used > m_OldLineSize)
     {
-        p_line = &m_PageInfo.lines.lines[i];
-        x = LEFT_MIN + p_line->x;
-        for (j = 0; j < p_line->char_cnt; j++)
+        m_OldLineSize = old_used;
+        m_OldLines = (line_info_t *)realloc(m_OldLines, sizeof(line_info_t) * m_OldLineSize);
+    }
+    memcpy(m_OldLines, m_PageInfo.lines.lines, sizeof(line_info_t) * old_used);
+
+    CalcPage(hdc, rc);
+
+    p_lines = m_PageInfo.lines.lines;
+    kept = MatchLines(old_used, &old_idx, &new_idx);
+    if (kept == 0)
+    {
+        ClearSurface(hdc, p_alpha_dc, bg_dc, width, 0, height);
+        DrawLineRange(hdc, p_alpha_dc, 0, m_PageInfo.lines.used);
+        EndDraw(hdc);
+        return;
+    }
+
+    src_y = TOP_MIN;
+    for (i = 0; i < old_idx; i++)
+        src_y += m_OldLines[i].cy + m_OldLines[i].gap;
+    dst_y = TOP_MIN;
+    for (i = 0; i < new_idx; i++)
+        dst_y += p_lines[i].cy + p_lines[i].gap;
+    kept_h = 0;
+    for (i = new_idx; i < new_idx + kept; i++)
+        kept_h += p_lines[i].cy + p_lines[i].gap;
+    kept_h = min(kept_h, height - max(src_y, dst_y));
+
+    // shift the lines both pages share, then draw only the exposed ones
+    MoveSurfaceRows(hdc, p_alpha_dc, width, src_y, dst_y, kept_h);
+    ClearSurface(hdc, p_alpha_dc, bg_dc, width, 0, dst_y);
+    ClearSurface(hdc, p_alpha_dc, bg_dc, width, dst_y + kept_h, height);
+    DrawLineRange(hdc, p_alpha_dc, 0, new_idx);
+    DrawLineRange(hdc, p_alpha_dc, new_idx + kept, m_PageInfo.lines.used);
+
+    for (i = new_idx; i < new_idx + kept; i++)
+    {
+        if (p_lines[i].char_cnt > 0)
         {
-            p_char = &p_line->chars[j];
-            if (enable_alpha)
-            {
-                DrawAlphaText(hdc, p_char, x, y, p_line->cy, &alpha_dc);
-            }
-            else
-            {
-                SelectFontByDcIndex(hdc, p_char->dc_idx);
-                TextOut(hdc, x, y + (p_line->cy - p_char->cy), &m_Text[p_char->idx], 1);
-            }
-            x += p_char->cx + CHAR_GAP;
+            m_BlankPage = FALSE;
+            break;
         }
-        y += p_line->cy + p_line->gap;
     }
+    EndDraw(hdc);
+}
+
+int Page::MatchLines(int old_used, int *old_idx, int *new_idx)
+{
+    line_info_t *p_new = m_PageInfo.lines.lines;
+    int used = m_PageInfo.lines.used;
+    int i, n;
+
+    *old_idx = 0;
+    *new_idx = 0;
+    if (old_used == 0 || used == 0)
+        return 0;
+
+    // line down drops lines at the top, line up inserts them
+    for (i = 0; i < old_used && m_OldLines[i].start != p_new[0].start; i++)
+        ;
+    if (i < old_used)
+    {
+        *old_idx = i;
+    }
+    else
+    {
+        for (i = 0; i < used && p_new[i].start != m_OldLines[0].start; i++)
+            ;
+        if (i == used)
+            return 0;
+        *new_idx = i;
+    }
+
+    for (n = 0; *old_idx + n < old_used && *new_idx + n < used; n++)
+    {
+        // start, length, x, cy, gap
+        if (memcmp(&m_OldLines[*old_idx + n].start, &p_new[*new_idx + n].start, sizeof(int) * 5) != 0
+            || m_OldLines[*old_idx + n].char_cnt != p_new[*new_idx + n].char_cnt)
+            break;
+    }
+    return n;
+}
+
+void Page::CaptureStrip(HDC hdc, RECT *rc, alpha_dc_info_t *p_alpha_dc, int draw_type, u32 bg_id)
+{
+    scroll_strip_t *strip;
+    int width = rc->right - rc->left;
+    int height = rc->bottom - rc->top;
+    BOOL dib = p_alpha_dc != NULL;
+
+    // the line step asked by SmoothScroll fills the lower strip,
+    // any other draw starts over from this page
+    if (m_StripTarget == 1 && draw_type == DRAW_LINE_DOWN && m_Strips[0].valid)
+    {
+        strip = &m_Strips[1];
+    }
+    else
+    {
+        ResetStrips();
+        strip = &m_Strips[0];
+    }
+    m_StripTarget = -1;
+    strip->valid = FALSE;
+
+    if (dib && !p_alpha_dc->pvBits)
+        return;
+
+    if (!strip->surface.hBitmap || strip->surface.width != width || strip->surface.height != height
+        || strip->surface.dib != dib)
+    {
+        render_surface_delete(&strip->surface);
+        if (!render_surface_create(hdc, &strip->surface, width, height, dib))
+            return;
+        m_RenderStats.gdi_allocs += 2;
+    }
+
+    if (dib)
+        memcpy(strip->surface.pvBits, p_alpha_dc->pvBits, width * height * 4);
+    else
+        BitBlt(strip->surface.hdc, 0, 0, width, height, hdc, 0, 0, SRCCOPY);
+
+    strip->line_height = 0;
+    if (m_PageInfo.lines.used > 0)
+        strip->line_height = m_PageInfo.lines.lines[0].cy + m_PageInfo.lines.lines[0].gap;
+    strip->blank = m_BlankPage;
+    strip->valid = TRUE;
+    MakeCacheKey(m_StripKey, DRAW_NULL, rc, dib, bg_id);
+}
+
+BOOL Page::ScrollLineDown(HWND hWnd, int target)
+{
+    // the next chapter may be on its way
+    if (!OnUpDownEvent(hWnd, DRAW_LINE_DOWN))
+        return TRUE;
+    if (!IsValid())
+        return TRUE;
+
+    if (m_Index + m_PageInfo.length >= m_Length)
+        return FALSE;
 
+    m_DrawType = DRAW_LINE_DOWN;
+    m_LineCount = 1;
+    m_StripTarget = target;
+    ReDraw(hWnd);
+    return TRUE;
+}
+
+void Page::ResetStrips(void)
+{
+    m_Strips[0].valid = FALSE;
+    m_Strips[1].valid = FALSE;
+    m_ScrollOffset = 0;
+    m_StripTarget = -1;
+}
+
+void Page::MoveSurfaceRows(HDC hdc, alpha_dc_info_t *p_alpha_dc, int width, int src_y, int dst_y, int height)
+{
+    int stride;
+
+    if (height <= 0 || src_y == dst_y)
+        return;
+
+    if (p_alpha_dc)
+    {
+        if (!p_alpha_dc->pvBits)
+            return;
+        // bottom-up DIB, top-down row r is DIB row (height - 1 - r)
+        stride = p_alpha_dc->width * 4;
+        memmove(p_alpha_dc->pvBits + (p_alpha_dc->height - dst_y - height) * stride,
+            p_alpha_dc->pvBits + (p_alpha_dc->height - src_y - height) * stride, height * stride);
+    }
+    else
+    {
+        BitBlt(hdc, 0, dst_y, width, height, hdc, 0, src_y, SRCCOPY);
+    }
+}
+
+void Page::ClearSurface(HDC hdc, alpha_dc_info_t *p_alpha_dc, HDC bg_dc, int width, int top, int bottom)
+{
+    if (p_alpha_dc)
+    {
+        top = max(top, 0);
+        bottom = min(bottom, p_alpha_dc->height);
+        if (!p_alpha_dc->pvBits || bottom <= top)
+            return;
+        memset(p_alpha_dc->pvBits + (p_alpha_dc->height - bottom) * p_alpha_dc->width * 4, 0,
+            (bottom - top) * p_alpha_dc->width * 4);
+    }
+    else if (bg_dc && bottom > top)
+    {
+        // without bg_dc the caller has drawn the background
+        BitBlt(hdc, 0, top, width, bottom - top, bg_dc, 0, top, SRCCOPY);
+    }
+}
+
+BOOL Page::DrawCachedPage(HDC hdc, RECT *rc, alpha_dc_info_t *p_alpha_dc, u32 bg_id)
+{
+    page_cache_key_t key;
+    page_cache_entry_t *entry;
+    lines_t lines;
+
+    if (m_DrawType != DRAW_PAGE_DOWN && m_DrawType != DRAW_PAGE_UP)
+        return FALSE;
+
+    MakeCacheKey(&key, m_DrawType, rc, p_alpha_dc != NULL, bg_id);
+    entry = m_PageCache->Find(&key);
+    if (!entry)
+        return FALSE;
+
+    // take over the cached layout, the entry frees the old lines
+    lines = m_PageInfo.lines;
+    m_PageInfo = entry->info;
+    entry->info.lines = lines;
+    m_ChapterStart = entry->chapter_start;
+    m_ChapterLength = entry->chapter_length;
     m_Index = m_PageInfo.start;
     m_PageLength = m_PageInfo.length;
+    m_DrawType = DRAW_NULL;
+    m_LineCount = 0;
 
-    if (enable_alpha)
+    if (p_alpha_dc)
     {
-        DeleteAlphaTextBitmap(hdc, &alpha_dc);
+        memcpy(p_alpha_dc->pvBits, entry->pvBits, entry->width * entry->height * 4);
+        m_BlankPage = entry->blank;
+    }
+    else
+    {
+        BitBlt(hdc, 0, 0, entry->width, entry->height, entry->hdc, 0, 0, SRCCOPY);
+    }
+    m_PageCache->Remove(entry);
+    return TRUE;
+}
+
+void Page::MakeCacheKey(page_cache_key_t *key, int draw_type, RECT *rc, BOOL alpha, u32 bg_id)
+{
+    extern BYTE _textAlpha;
+    line_info_t *p_line;
+    u32 hash = 2166136261u;
+    int i;
+
+    memset(key, 0, sizeof(page_cache_key_t));
+    key->from = m_Index;
+    key->draw_type = draw_type;
+    key->text = m_Text;
+    key->length = m_Length;
+    key->width = rc->right - rc->left;
+    key->height = rc->bottom - rc->top;
+    key->alpha = alpha;
+    key->bg = alpha ? 0 : bg_id;
+
+    for (i = 0; i < m_PageInfo.lines.used; i++)
+    {
+        p_line = &m_PageInfo.lines.lines[i];
+        hash = page_cache_hash(hash, &p_line->start, sizeof(int) * 5); // start, length, x, cy, gap
+    }
+    key->page = hash;
+
+    // everything from font to internal_border, then word_wrap to chapter_page
+    hash = 2166136261u;
+    hash = page_cache_hash(hash, &m_header->font, offsetof(header_t, internal_border) + sizeof(RECT) - offsetof(header_t, font));
+    hash = page_cache_hash(hash, &m_header->word_wrap, offsetof(header_t, global_key) - offsetof(header_t, word_wrap));
+#if ENABLE_TAG
+    hash = page_cache_hash(hash, &m_header->tag_count, sizeof(int) + sizeof(tagitem_t) * MAX_TAG_COUNT);
+#endif
+    hash = page_cache_hash(hash, &_textAlpha, sizeof(BYTE));
+    key->layout = hash;
+}
+
+void Page::CopyPageInfo(page_info_t *dst, const page_info_t *src)
+{
+    const line_info_t *p_src;
+    line_info_t *p_dst;
+    int i;
+
+    memset(dst, 0, sizeof(page_info_t));
+    dst->start = src->start;
+    dst->length = src->length;
+    if (src->lines.used == 0)
+        return;
+
+    dst->lines.lines = (line_info_t *)malloc(sizeof(line_info_t) * src->lines.used);
+    dst->lines.total = src->lines.used;
+    dst->lines.used = src->lines.used;
+    for (i = 0; i < src->lines.used; i++)
+    {
+        p_src = &src->lines.lines[i];
+        p_dst = &dst->lines.lines[i];
+        *p_dst = *p_src;
+        if (p_src->chars)
+        {
+            p_dst->chars = (char_info_t *)malloc(sizeof(char_info_t) * p_src->char_cnt);
+            memcpy(p_dst->chars, p_src->chars, sizeof(char_info_t) * p_src->char_cnt);
+        }
     }
-    EndDraw();
-    Save(hWnd);
-    TestCase(rc);
 }
 
 void Page::ReDraw(HWND hWnd)
@@ -286,6 +804,7 @@ BOOL Page::GetCurPageText(TCHAR **text)
 
     if (m_PageLength > 0)
     {
+        LoadText(m_Index, m_PageLength);
         for (i=0; i<m_PageLength; i++)
         {
             c = m_Text + (m_Index + i);
@@ -337,7 +856,9 @@ BOOL Page::SetCurPageText(HWND hWnd, TCHAR *dst_text)
         dst_len = (int)_tcslen(dst_text);
         book->FormatText(dst_text, &dst_len);
 
-        // change text
+        // change text, a search running meanwhile sees the old or the new one
+        EnterCriticalSection(&m_TextLock);
+        LoadText(0, m_Length, FALSE);
         len = m_Length - src_len + dst_len;
         text = (TCHAR *)malloc(sizeof(TCHAR) * (len+1));
         text[len] = 0;
@@ -348,6 +869,7 @@ BOOL Page::SetCurPageText(HWND hWnd, TCHAR *dst_text)
         free(m_Text);
         m_Text = text;
         m_Length = len;
+        LeaveCriticalSection(&m_TextLock);
 
         free(src_text);
 
@@ -360,6 +882,7 @@ BOOL Page::SetCurPageText(HWND hWnd, TCHAR *dst_text)
             return FALSE;
 
         // redraw page
+        ResetPageCache();
         ReDraw(hWnd);
         return TRUE;
     }
@@ -371,13 +894,137 @@ BOOL Page::IsBlankPage(void)
     return m_BlankPage;
 }
 
+const render_stats_t* Page::GetRenderStats(void)
+{
+    return &m_RenderStats;
+}
+
+void Page::StartSmoothScroll(HWND hWnd)
+{
+    if (m_Smooth)
+        return;
+
+    m_Smooth = TRUE;
+    ResetStrips();
+    ReDraw(hWnd);
+}
+
+void Page::StopSmoothScroll(HWND hWnd)
+{
+    if (!m_Smooth)
+        return;
+
+    m_Smooth = FALSE;
+    ResetStrips();
+    render_surface_delete(&m_Strips[0].surface);
+    render_surface_delete(&m_Strips[1].surface);
+    ReDraw(hWnd);
+}
+
+BOOL Page::SmoothScroll(HWND hWnd, double pixels)
+{
+    scroll_strip_t strip;
+    int offset = (int)m_ScrollOffset;
+    int line_height = GetScrollLineHeight();
+
+    if (!m_Smooth)
+    {
+        StartSmoothScroll(hWnd);
+        return TRUE;
+    }
+
+    // wait for the page or the line step being drawn
+    if (!m_Strips[0].valid || m_StripTarget >= 0)
+        return TRUE;
+
+    // the next line is rendered before any of it is scrolled in
+    if (m_Strips[0].line_height > 0 && !m_Strips[1].valid)
+        return ScrollLineDown(hWnd, 1);
+
+    m_ScrollOffset += pixels;
+    if (m_ScrollOffset < line_height)
+    {
+        if ((int)m_ScrollOffset != offset)
+            ReDraw(hWnd);
+        return TRUE;
+    }
+    m_ScrollOffset -= line_height;
+
+    // cover or empty page, nothing slides, step once its time is up
+    if (m_Strips[0].line_height <= 0)
+    {
+        m_ScrollOffset = 0;
+        return ScrollLineDown(hWnd, 0);
+    }
+
+    // the first line is out, the lower strip is the page at the top now
+    strip = m_Strips[0];
+    m_Strips[0] = m_Strips[1];
+    m_Strips[1] = strip;
+    m_Strips[1].valid = FALSE;
+    if (m_ScrollOffset >= m_Strips[0].line_height)
+        m_ScrollOffset = 0;
+    if (!ScrollLineDown(hWnd, 1))
+        m_ScrollOffset = 0;
+    ReDraw(hWnd);
+    return TRUE;
+}
+
+int Page::GetScrollLineHeight(void)
+{
+    if (m_Strips[0].valid && m_Strips[0].line_height > 0)
+        return m_Strips[0].line_height;
+
+    // no line to slide, pace it as a line of the body font
+    return max(abs(m_header->font.lfHeight), 1);
+}
+
+int Page::GetScrollStrips(RECT *rc, strip_blit_t *blits)
+{
+    int height = rc->bottom - rc->top - TOP_MIN - BOTTOM_MIN;
+    int d = m_Strips[0].line_height;
+    int o = (int)m_ScrollOffset;
+
+    if (!m_Smooth || !m_Strips[0].valid)
+        return 0;
+
+    // the cover fills the whole surface
+    if (d <= 0)
+    {
+        blits[0].hdc = m_Strips[0].surface.hdc;
+        blits[0].src_y = 0;
+        blits[0].dst_y = 0;
+        blits[0].height = rc->bottom - rc->top;
+        return 1;
+    }
+
+    o = min(max(o, 0), d);
+    blits[0].hdc = m_Strips[0].surface.hdc;
+    blits[0].src_y = TOP_MIN + o;
+    blits[0].dst_y = TOP_MIN;
+    if (!m_Strips[1].valid)
+    {
+        blits[0].height = height - o;
+        return blits[0].height > 0 ? 1 : 0;
+    }
+
+    // what is left of the first line, then the next page right below it,
+    // the next page starts with the second line of this one
+    blits[0].height = min(d - o, height);
+    if (blits[0].height >= height)
+        return 1;
+    blits[1].hdc = m_Strips[1].surface.hdc;
+    blits[1].src_y = TOP_MIN;
+    blits[1].dst_y = TOP_MIN + blits[0].height;
+    blits[1].height = height - blits[0].height;
+    return 2;
+}
+
 BOOL Page::DrawCover(HDC hdc, RECT* rc)
 {
     Gdiplus::Bitmap *cover = NULL;
     Gdiplus::Graphics *g = NULL;
     int w,h,bw,bh;
-    double d,bd;
-    Gdiplus::Rect src;
     Gdiplus::Rect dst;
 
     cover = GetCover();
@@ -403,33 +1050,35 @@ BOOL Page::DrawCover(HDC hdc, RECT* rc)
     // calc image rect
     w = rc->right - rc->left;
     h = rc->bottom - rc->top;
-    bw = cover->GetWidth();
-    bh = cover->GetHeight();
-    d = ((double)w)/h;
-    bd = ((double)bw)/bh;
-    if (bd > d)
-    {
-        // image is too wide
-        bw = w;
-        bh = (int)(bw / bd);
-    }
-    else if (bd < d)
-    {
-        // image is too high
-        bh = h;
-        bw = (int)(bd * bh);
-    }
-    src.X = 0;
-    src.Y = 0;
-    src.Width = cover->GetWidth();
-    src.Height = cover->GetHeight();
+    if (w <= 0 || h <= 0)
+        return TRUE;
+    CoverImage::Fit(w, h, cover->GetWidth(), cover->GetHeight(), &bw, &bh);
+
+    // scaled once per window size, a repaint is a plain copy of it
+    if (!m_CoverScaled || m_CoverSource != cover
+        || (int)m_CoverScaled->GetWidth() != bw || (int)m_CoverScaled->GetHeight() != bh)
+    {
+        if (m_CoverScaled)
+            delete m_CoverScaled;
+        m_CoverScaled = CoverImage::Scale(cover, bw, bh);
+        m_CoverSource = cover;
+    }
+
     dst.X = (w - bw)/2;
     dst.Y = (h - bh)/2;
     dst.Width = bw;
     dst.Height = bh;
     g = new Gdiplus::Graphics(hdc);
-    g->SetInterpolationMode(Gdiplus::InterpolationModeHighQualityBicubic);
-    g->DrawImage(cover, dst, src.X, src.Y, src.Width, src.Height, Gdiplus::UnitPixel);
+    if (m_CoverScaled)
+    {
+        g->SetInterpolationMode(Gdiplus::InterpolationModeNearestNeighbor);
+        g->DrawImage(m_CoverScaled, dst, 0, 0, bw, bh, Gdiplus::UnitPixel);
+    }
+    else
+    {
+        g->SetInterpolationMode(Gdiplus::InterpolationModeHighQualityBicubic);
+        g->DrawImage(cover, dst, 0, 0, cover->GetWidth(), cover->GetHeight(), Gdiplus::UnitPixel);
+    }
     delete g;
     return TRUE;
 }
@@ -437,6 +1086,23 @@ BOOL Page::DrawCover(HDC hdc, RECT* rc)
 void Page::CreateAlphaTextBitmap(HDC hdc, int width, int height, alpha_dc_info_t *p_alpha_dc)
 {
     BITMAPINFOHEADER BMIH;
+    DIBSECTION ds;
+    HGDIOBJ hBmp;
+
+    p_alpha_dc->width = width;
+    p_alpha_dc->height = height;
+
+    // reuse the DIB already selected in hdc (see RenderContext), callers clear it
+    hBmp = GetCurrentObject(hdc, OBJ_BITMAP);
+    if (hBmp && GetObject(hBmp, sizeof(DIBSECTION), &ds) == sizeof(DIBSECTION)
+        && ds.dsBm.bmBits && ds.dsBmih.biBitCount == 32
+        && ds.dsBmih.biWidth == width && ds.dsBmih.biHeight == height)
+    {
+        p_alpha_dc->hDIB = (HBITMAP)hBmp;
+        p_alpha_dc->pvBits = (BYTE *)ds.dsBm.bmBits;
+        p_alpha_dc->owned = FALSE;
+        return;
+    }
 
     // Specify DIB setup
     memset(&BMIH, 0x0, sizeof(BITMAPINFOHEADER));
@@ -448,101 +1114,427 @@ void Page::CreateAlphaTextBitmap(HDC hdc, int width, int height, alpha_dc_info_t
     BMIH.biCompression = BI_RGB;
 
     // Create and select DIB into DC
-    p_alpha_dc->width = width;
-    p_alpha_dc->height = height;
     p_alpha_dc->hDIB = CreateDIBSection(hdc, (LPBITMAPINFO)&BMIH, 0, (LPVOID*)&p_alpha_dc->pvBits, NULL, 0); 
+    p_alpha_dc->owned = TRUE;
     SelectObject(hdc, p_alpha_dc->hDIB);
+    m_RenderStats.gdi_allocs++;
 }
 
 void Page::DeleteAlphaTextBitmap(HDC hdc, alpha_dc_info_t *p_alpha_dc)
 {
     if (p_alpha_dc)
     {
-        if (p_alpha_dc->hDIB)
+        if (p_alpha_dc->hDIB && p_alpha_dc->owned)
             DeleteObject(p_alpha_dc->hDIB);
     }
 }
 
-void Page::DrawAlphaText(HDC hdc, char_info_t* p_char, int x, int y, int h, alpha_dc_info_t *p_alpha_dc)
+void Page::DrawLineRange(HDC hdc, alpha_dc_info_t *p_alpha_dc, int first, int last)
+{
+    line_info_t *p_first, *p_last;
+
+    if (first >= last)
+        return;
+
+    // laid out earlier, its text may have been let go since; the one read
+    // that gives pages back, nothing reads the text between two draws
+    // without loading its range first
+    p_first = &m_PageInfo.lines.lines[first];
+    p_last = &m_PageInfo.lines.lines[last - 1];
+    LoadText(p_first->start, p_last->start + p_last->length - p_first->start, TRUE);
+
+    if (p_alpha_dc)
+    {
+        // all text first, then one compositing pass; tags keep their own colors
+        DrawLines(hdc, p_alpha_dc, FALSE, first, last);
+        CompositeAlphaText(p_alpha_dc, first, last);
+#if ENABLE_TAG
+        DrawLines(hdc, p_alpha_dc, TRUE, first, last);
+#endif
+    }
+    else
+    {
+        DrawLines(hdc, NULL, FALSE, first, last);
+    }
+    DrawImages(hdc, p_alpha_dc, first, last);
+}
+
+void Page::DrawLines(HDC hdc, alpha_dc_info_t *p_alpha_dc, BOOL tags, int first, int last)
+{
+    int i, j, x, y, count, width;
+    line_info_t* p_line;
+
+    y = TOP_MIN;
+    for (i = 0; i < first; i++)
+    {
+        y += m_PageInfo.lines.lines[i].cy + m_PageInfo.lines.lines[i].gap;
+    }
+    for (i = first; i < last; i++)
+    {
+        p_line = &m_PageInfo.lines.lines[i];
+        x = LEFT_MIN + p_line->x;
+        for (j = 0; j < p_line->char_cnt; j += count)
+        {
+            count = GetGlyphRun(p_line, j, &width);
+            if (!p_alpha_dc)
+            {
+                DrawTextRun(hdc, p_line, j, count, x, y);
+            }
+            else if ((p_line->chars[j].dc_idx >= 2) == !!tags)
+            {
+                DrawAlphaText(hdc, p_line, j, count, x, y, width, p_alpha_dc);
+            }
+            x += width + CHAR_GAP;
+        }
+        y += p_line->cy + p_line->gap;
+    }
+}
+
+void Page::DrawAlphaText(HDC hdc, line_info_t* p_line, int start, int count, int x, int y, int width, alpha_dc_info_t *p_alpha_dc)
 {
-    BYTE FillR,FillG,FillB,ThisA;
     BYTE *DataPtr;
-    BOOL is_tag = FALSE;
+    char_info_t* p_char = &p_line->chars[start];
+    int h = p_line->cy;
     int i,j;
-    extern BYTE _textAlpha;
-
-    is_tag = p_char->dc_idx >= 2;
 
     SelectFontByDcIndex(hdc, p_char->dc_idx);
 
-    if (!is_tag)
+    if (p_char->dc_idx < 2)
     {
+        // white coverage on the black DIB, converted later by CompositeAlphaText
         SetTextColor(hdc, 0x00FFFFFF);
-        SetBkColor(hdc, 0x00000000);
-        SetBkMode(hdc, OPAQUE);
-
-        FillR = GetRValue(m_dcList[p_char->dc_idx].TextColor);
-        FillG = GetGValue(m_dcList[p_char->dc_idx].TextColor);
-        FillB = GetBValue(m_dcList[p_char->dc_idx].TextColor);
+        SetBkMode(hdc, TRANSPARENT);
+        DrawTextRun(hdc, p_line, start, count, x, y);
+        return;
     }
 
-    // draw text
-    TextOut(hdc, x, y + (h - p_char->cy), &m_Text[p_char->idx], 1);
+    // draw tag
+    DrawTextRun(hdc, p_line, start, count, x, y);
 
-    // convert pixel
     for (i = p_alpha_dc->height - y - (h - p_char->cy) - 1; i >= p_alpha_dc->height - y - h; i--)
     {
-        for (j = x; j < x + p_char->cx; j++)
+        for (j = x; j < x + width - 1; j++) // OPAQUE is paints background starting at x-1, ending at cx+1
         {
             DataPtr = &p_alpha_dc->pvBits[(i * p_alpha_dc->width + j) * 4];
+            *(DataPtr+3) = 0xff;
+        }
+    }
+    m_BlankPage = FALSE;
+}
 
-            if (is_tag)
+void Page::CompositeAlphaText(alpha_dc_info_t *p_alpha_dc, int first, int last)
+{
+    line_info_t* p_line;
+    DWORD color = 0;
+    int i, j, y, dc_idx;
+    BOOL mixed;
+    int top = -1, bottom = -1; // current band, top-down rows
+
+    // consecutive lines with the same color are converted as one band,
+    // a band is a contiguous block of the bottom-up DIB
+    y = TOP_MIN;
+    for (i = 0; i < first; i++)
+    {
+        y += m_PageInfo.lines.lines[i].cy + m_PageInfo.lines.lines[i].gap;
+    }
+    for (i = first; i <= last; i++)
+    {
+        dc_idx = -1;
+        mixed = FALSE;
+        if (i < last)
+        {
+            p_line = &m_PageInfo.lines.lines[i];
+            for (j = 0; j < p_line->char_cnt; j++)
             {
-                if (j == x + p_char->cx - 1)
-                    continue; // OPAQUE is paints background starting at x-1, ending at cx+1
+                if (p_line->chars[j].dc_idx >= 2)
+                    continue;
+                if (dc_idx == -1)
+                    dc_idx = p_line->chars[j].dc_idx;
+                else if (m_dcList[p_line->chars[j].dc_idx].TextColor != m_dcList[dc_idx].TextColor)
+                    mixed = TRUE;
+            }
+        }
+
+        if (top >= 0 && (dc_idx == -1 || mixed || m_dcList[dc_idx].TextColor != color))
+        {
+            CompositeRect(p_alpha_dc, 0, top, p_alpha_dc->width, bottom, color);
+            top = -1;
+        }
+
+        if (i == last)
+            break;
 
-                if (m_BlankPage)
-                    m_BlankPage = FALSE;
-                *(DataPtr+3) = 0xff;
+        if (mixed)
+        {
+            // title and body colors on one line, each run keeps its own
+            CompositeLineRuns(p_alpha_dc, p_line, y);
+        }
+        else if (dc_idx != -1)
+        {
+            if (top < 0)
+            {
+                top = y;
+                color = m_dcList[dc_idx].TextColor;
             }
-            else
+            bottom = y + p_line->cy;
+        }
+        y += p_line->cy + p_line->gap;
+    }
+}
+
+void Page::CompositeLineRuns(alpha_dc_info_t *p_alpha_dc, line_info_t* p_line, int y)
+{
+    DWORD color = 0;
+    int j, x, count, width;
+    int left = 0, split;
+    BOOL started = FALSE;
+
+    // the columns switch color halfway in the gap before a run, so that every
+    // pixel of the line is converted once, glyph overhangs included
+    x = LEFT_MIN + p_line->x;
+    for (j = 0; j < p_line->char_cnt; j += count)
+    {
+        count = GetGlyphRun(p_line, j, &width);
+        if (p_line->chars[j].dc_idx < 2)
+        {
+            if (!started)
             {
-                if (m_BlankPage)
-                {
-                    if ((*((UINT*)DataPtr)) & 0x00FFFFFF)
-                        m_BlankPage = FALSE;
-                }
+                color = m_dcList[p_line->chars[j].dc_idx].TextColor;
+                started = TRUE;
+            }
+            else if (m_dcList[p_line->chars[j].dc_idx].TextColor != color)
+            {
+                split = x - CHAR_GAP / 2;
+                CompositeRect(p_alpha_dc, left, y, split, y + p_line->cy, color);
+                left = split;
+                color = m_dcList[p_line->chars[j].dc_idx].TextColor;
+            }
+        }
+        x += width + CHAR_GAP;
+    }
+    CompositeRect(p_alpha_dc, left, y, p_alpha_dc->width, y + p_line->cy, color);
+}
 
-                ThisA = *DataPtr; // Move alpha and pre-multiply with RGB 
-                *DataPtr++ = (FillB * ThisA * _textAlpha) >> 16; 
-                *DataPtr++ = (FillG * ThisA * _textAlpha) >> 16; 
-                *DataPtr++ = (FillR * ThisA * _textAlpha) >> 16;
-                *DataPtr++ = (ThisA * _textAlpha) >> 8; // Set text Alpha
+void Page::CompositeRect(alpha_dc_info_t *p_alpha_dc, int left, int top, int right, int bottom, DWORD color)
+{
+    extern BYTE _textAlpha;
+    BOOL found = FALSE;
+    int row;
+
+    left = max(left, 0);
+    right = min(right, p_alpha_dc->width);
+    top = max(top, 0);
+    bottom = min(bottom, p_alpha_dc->height);
+    if (right <= left || bottom <= top)
+        return;
+
+    // whole rows are one contiguous block of the bottom-up DIB
+    if (left == 0 && right == p_alpha_dc->width)
+    {
+        found = alpha_composite_text(p_alpha_dc->pvBits + (p_alpha_dc->height - bottom) * p_alpha_dc->width * 4,
+            (bottom - top) * p_alpha_dc->width, color, _textAlpha);
+    }
+    else
+    {
+        for (row = p_alpha_dc->height - bottom; row < p_alpha_dc->height - top; row++)
+        {
+            if (alpha_composite_text(p_alpha_dc->pvBits + (row * p_alpha_dc->width + left) * 4,
+                right - left, color, _textAlpha))
+            {
+                found = TRUE;
             }
         }
     }
+    if (found)
+        m_BlankPage = FALSE;
+}
+
+void Page::DrawTextRun(HDC hdc, line_info_t* p_line, int start, int count, int x, int y)
+{
+    char_info_t* p_char = &p_line->chars[start];
+    int i;
+
+    if (count > m_RunDxSize)
+    {
+        m_RunDxSize = max(count, 64);
+        m_RunDx = (int *)realloc(m_RunDx, sizeof(int) * m_RunDxSize);
+    }
+
+    // same positions as the layout, one call per run
+    for (i = 0; i < count; i++)
+    {
+        m_RunDx[i] = p_char[i].cx + CHAR_GAP;
+    }
+
+    SelectFontByDcIndex(hdc, p_char->dc_idx);
+    ExtTextOut(hdc, x, y + (p_line->cy - p_char->cy), 0, NULL, &m_Text[p_char->idx], count, m_RunDx);
+    m_RenderStats.text_calls++;
+    m_RenderStats.glyphs += count;
+}
+
+void Page::DrawImages(HDC hdc, alpha_dc_info_t *p_alpha_dc, int first, int last)
+{
+    Gdiplus::Bitmap *image;
+    Gdiplus::Graphics *g;
+    Gdiplus::BitmapData bits;
+    line_info_t* p_line;
+    SIZE sz;
+    int i, r, x, y, iw, ih, left, right, top;
+
+    y = TOP_MIN;
+    for (i = 0; i < first; i++)
+    {
+        y += m_PageInfo.lines.lines[i].cy + m_PageInfo.lines.lines[i].gap;
+    }
+    for (i = first; i < last; i++, y += p_line->cy + p_line->gap)
+    {
+        p_line = &m_PageInfo.lines.lines[i];
+        if (p_line->image < 0 || !GetImageBox(m_Text[p_line->start], m_TextWidth, m_TextHeight, &sz))
+            continue;
+
+        // decoded here, the first time the page with it is drawn
+        image = GetImage(p_line->image, sz.cx, sz.cy);
+        if (!image)
+            continue;
+        iw = image->GetWidth();
+        ih = image->GetHeight();
+        x = LEFT_MIN + p_line->x + (sz.cx - iw) / 2;
+        top = y + (p_line->cy - ih) / 2;
+
+        if (!p_alpha_dc)
+        {
+            g = new Gdiplus::Graphics(hdc);
+            g->SetInterpolationMode(Gdiplus::InterpolationModeNearestNeighbor);
+            g->DrawImage(image, x, top, iw, ih);
+            delete g;
+            continue;
+        }
+
+        // premultiplied rows straight into the bottom-up DIB, GDI+ on the dc would drop the alpha
+        Gdiplus::Rect rect(0, 0, iw, ih);
+        if (Gdiplus::Ok != image->LockBits(&rect, Gdiplus::ImageLockModeRead, PixelFormat32bppPARGB, &bits))
+            continue;
+        left = max(x, 0);
+        right = min(x + iw, p_alpha_dc->width);
+        for (r = 0; r < ih && left < right; r++)
+        {
+            if (top + r < 0 || top + r >= p_alpha_dc->height)
+                continue;
+            memcpy(&p_alpha_dc->pvBits[((p_alpha_dc->height - 1 - top - r) * p_alpha_dc->width + left) * 4],
+                (BYTE *)bits.Scan0 + r * bits.Stride + (left - x) * 4, (right - left) * 4);
+        }
+        image->UnlockBits(&bits);
+        m_BlankPage = FALSE;
+    }
+}
+
+Gdiplus::Bitmap* Page::GetImage(int id, int width, int height)
+{
+    Gdiplus::Bitmap *image;
+    std::string data;
+
+    if (!m_ImageCache)
+        m_ImageCache = new ImageCache(INLINE_IMAGE_CACHE_BYTES);
+    image = m_ImageCache->Get(id, width, height);
+    if (image)
+        return image;
+
+    if (!ReadImage(id, data, 0))
+        return NULL;
+    image = CoverImage::Decode(data.c_str(), data.size(), width, height);
+    if (image)
+        m_ImageCache->Put(id, width, height, image);
+    return image;
+}
+
+BOOL Page::GetImageBox(wchar_t c, int width, int height, SIZE *sz)
+{
+    int iw, ih;
+
+    if (!is_inline_image(c) || width <= 0 || height <= 0)
+        return FALSE;
+    if (!GetImageSize(c - INLINE_IMAGE_BASE, &iw, &ih))
+        return FALSE;
+
+    // only made smaller, a small picture stays the size it was made
+    if (iw > width || ih > height)
+    {
+        CoverImage::Fit(width, height, iw, ih, &iw, &ih);
+    }
+    sz->cx = iw;
+    sz->cy = ih;
+    return TRUE;
+}
+
+int Page::GetGlyphRun(line_info_t* p_line, int start, int *width)
+{
+    char_info_t* p_char = &p_line->chars[start];
+    int i;
+
+    *width = p_char->cx;
+
+    // tags paint an OPAQUE box per glyph, keep them single
+    if (p_char->dc_idx >= 2)
+        return 1;
+
+    for (i = start + 1; i < p_line->char_cnt; i++)
+    {
+        if (p_line->chars[i].dc_idx != p_char->dc_idx
+            || p_line->chars[i].cy != p_char->cy
+            || p_line->chars[i].idx != p_line->chars[i - 1].idx + 1)
+            break;
+        *width += CHAR_GAP + p_line->chars[i].cx;
+    }
+    return i - start;
 }
 
 void Page::BeginDraw(void)
 {
+    LOGFONT *font;
+    int i, count;
+
 #if ENABLE_TAG
-    int i;
-    m_dcList = (dc_info_t*)malloc(sizeof(dc_info_t) * (TAG_COUNT + 2));
+    count = TAG_COUNT + 2;
 #else
-    m_dcList = (dc_info_t*)malloc(sizeof(dc_info_t) * 2);
+    count = 2;
 #endif
-    m_dcList[0].hFont = CreateFontIndirect(&m_header->font);
+    if (count != m_dcCount)
+    {
+        ReleaseFonts();
+        m_dcList = (dc_info_t*)calloc(count, sizeof(dc_info_t));
+        m_FontList = (LOGFONT*)calloc(count, sizeof(LOGFONT));
+        m_dcCount = count;
+    }
+
+    // fonts live across frames, rebuild only the ones whose LOGFONT changed
+    for (i = 0; i < count; i++)
+    {
+        if (i == 0)
+            font = &m_header->font;
+        else if (i == 1)
+            font = &m_header->font_title;
+#if ENABLE_TAG
+        else
+            font = &TAGS[i - 2].font;
+#endif
+        if (m_dcList[i].hFont && memcmp(font, &m_FontList[i], sizeof(LOGFONT)) == 0)
+            continue;
+        if (m_dcList[i].hFont)
+            DeleteObject(m_dcList[i].hFont);
+        m_dcList[i].hFont = CreateFontIndirect(font);
+        memcpy(&m_FontList[i], font, sizeof(LOGFONT));
+        m_RenderStats.gdi_allocs++;
+    }
+
     m_dcList[0].BkColor = 0x0;
     m_dcList[0].TextColor = GetTextAlpha(m_header->font_color);
     m_dcList[0].BkMode = TRANSPARENT;
-    m_dcList[1].hFont = CreateFontIndirect(&m_header->font_title);
     m_dcList[1].BkColor = 0x0;
     m_dcList[1].TextColor = GetTextAlpha(m_header->font_color_title);
     m_dcList[1].BkMode = TRANSPARENT;
 #if ENABLE_TAG
     for (i = 0; i < TAG_COUNT; i++)
     {
-        m_dcList[i + 2].hFont = CreateFontIndirect(&TAGS[i].font);
         m_dcList[i + 2].BkColor = TAGS[i].bg_color;
         m_dcList[i + 2].TextColor = TAGS[i].font_color;
         m_dcList[i + 2].BkMode = OPAQUE;
@@ -551,19 +1543,33 @@ void Page::BeginDraw(void)
     m_dcIndex = -1;
 }
 
-void Page::EndDraw(void)
+void Page::EndDraw(HDC hdc)
+{
+    // hdc may outlive this frame, never leave a cached font selected in it
+    SelectObject(hdc, GetStockObject(SYSTEM_FONT));
+    m_dcIndex = -1;
+}
+
+void Page::ReleaseFonts(void)
 {
     int i;
-#if ENABLE_TAG
-    for (i = 0; i < TAG_COUNT + 2; i++)
-#else
-    for (i = 0; i < 2; i++)
-#endif
+
+    if (m_dcList)
     {
-        DeleteObject(m_dcList[i].hFont);
+        for (i = 0; i < m_dcCount; i++)
+        {
+            if (m_dcList[i].hFont)
+                DeleteObject(m_dcList[i].hFont);
+        }
+        free(m_dcList);
+        m_dcList = NULL;
     }
-    free(m_dcList);
-    m_dcList = NULL;
+    if (m_FontList)
+    {
+        free(m_FontList);
+        m_FontList = NULL;
+    }
+    m_dcCount = 0;
 }
 
 DWORD Page::GetTextAlpha(DWORD color)
@@ -656,6 +1662,7 @@ int Page::GetPrevParagraph(int start, int max_len, int *is_blank, int *crlf_len)
 
     *is_blank = 1;
     *crlf_len = 0;
+    LoadText(end - 1, start - end + 2);
     for (i = start; i >= end; i--, length++)
     {
         if ((i - 1 >= 0 && m_Text[i] == L'\n' && m_Text[i - 1] == L'\r') // \r\n
@@ -704,6 +1711,8 @@ int Page::GetNextParagraph(int start, int max_len, int *is_blank, int *crlf_len)
             end = m_ChapterStart + m_ChapterLength;
     }
 
+    // and the one before, it tells a new paragraph
+    LoadText(start - 1, end - start + 1);
     for (i = start; i < end; i++, length++)
     {
         if ((i + 1 < end && m_Text[i] == L'\r' && m_Text[i + 1] == L'\n') // \r\n
@@ -740,8 +1749,26 @@ int Page::ParagraphToLines(HDC hdc, int start, int length, int width, int height
     int x, y, w, h;
     int char_start, line_start, word_start;
     int line_len, char_len, word_height, word_width; // for WORD_WRAP
-    char_info_t *chars = (char_info_t *)malloc(sizeof(char_info_t) * length);
+    char_info_t *chars;
+
+    if (length == 1 && start >= 0 && start < m_Length && is_inline_image(m_Text[start]) && HasInlineImages())
+    {
+        // an image is a paragraph of its own, one line the size it is drawn at;
+        // one that can not be read keeps the height of a blank line
+        if (!GetImageBox(m_Text[start], width, m_TextHeight, &sz))
+        {
+            SelectFont(hdc, start, FALSE);
+            GetTextExtentPoint32(hdc, _T(" "), 1, &sz);
+            sz.cx = -1;
+        }
+        if (sz.cy > height)
+            return 0;
+        AddCharsToLine(line_idx++, NULL, 0, 0, start, 1, sz.cx < 0 ? 0 : (width - sz.cx) / 2, sz.cy, LINE_GAP,
+            sz.cx < 0 ? -1 : m_Text[start] - INLINE_IMAGE_BASE);
+        return line_idx - line_idx_bak;
+    }
 
+    chars = (char_info_t *)malloc(sizeof(char_info_t) * length);
     ASSERT(start >= GetTextBeginIndex() && end <= m_Length);
     if (start < 0 || end > m_Length || !chars)
     {
@@ -895,7 +1922,7 @@ int Page::ParagraphToLines(HDC hdc, int start, int length, int width, int height
     return line_idx - line_idx_bak;
 }
 
-int Page::AddCharsToLine(int line_idx, char_info_t *chars, int char_start, int char_len, int line_start, int line_len, int x, int cy, int gap)
+int Page::AddCharsToLine(int line_idx, char_info_t *chars, int char_start, int char_len, int line_start, int line_len, int x, int cy, int gap, int image)
 {
     const int LINE_UNIT = 32;
     char_info_t *p_chars;
@@ -948,6 +1975,7 @@ int Page::AddCharsToLine(int line_idx, char_info_t *chars, int char_start, int c
     p_lines->lines[line_idx].gap = gap;
     p_lines->lines[line_idx].chars = p_chars;
     p_lines->lines[line_idx].char_cnt = char_len;
+    p_lines->lines[line_idx].image = image;
     p_lines->used++;
     return 0;
 }
@@ -1018,6 +2046,8 @@ void Page::CalcPageDown(HDC hdc, RECT *rc)
     line_info_t *p_line;
 
     h = height;
+    m_TextWidth = width;
+    m_TextHeight = height;
 
     if (m_DrawType == DRAW_NULL) // for repaint
     {
@@ -1217,6 +2247,8 @@ void Page::CalcPageUp(HDC hdc, RECT *rc)
 
     if (m_Index <= GetTextBeginIndex())
         return;
+    m_TextWidth = width;
+    m_TextHeight = height;
 
     if (m_DrawType == DRAW_PAGE_UP)
     {
@@ -1466,6 +2498,7 @@ int Page::IsTag(int index)
             begin = index - len + 1 > 0 ? index - len + 1 : 0;
             end = index + 1/*+ len - 1 > m_TextLength ? m_TextLength : index + len - 1*/;
 
+            LoadText(begin, end - begin + len);
             for (j = begin; j < end; j++)
             {
                 if (wcsncmp(TAGS[i].keyword, m_Text + j, len) == 0)
@@ -1497,6 +2530,7 @@ BOOL Page::IsBlankLine(int start, int length)
     int i;
     if (start >= 0 && length > 0 && m_Text && start + length <= m_Length)
     {
+        LoadText(start, length);
         for (i = 0; i < length; i++)
         {
             if (!is_blank(m_Text[start + i]) && !IsNewLine(m_Text[start + i]))
@@ -1612,4 +2646,23 @@ int Page::GetTextBeginIndex(void)
 Gdiplus::Bitmap* Page::GetCover(void)
 {
     return NULL;
+}
+
+BOOL Page::GetImageSize(int id, int *width, int *height)
+{
+    return FALSE;
+}
+
+BOOL Page::ReadImage(int id, std::string &data, size_t max_size)
+{
+    return FALSE;
+}
+
+BOOL Page::HasInlineImages(void)
+{
+    return FALSE;
+}
+
+void Page::LoadText(int start, int length, BOOL evict)
+{
 }
\ No newline at end of file
@@ -3,6 +3,8 @@
 
 #include <vector>
 #include "types.h"
+#include "RenderContext.h"
+#include "InlineImage.h"
 
 typedef struct char_info_t
 {
@@ -21,6 +23,7 @@ typedef struct line_info_t
     int gap;
     char_info_t *chars;
     int char_cnt;
+    int image;      // id of the inline image the line shows, -1 for text
 } line_info_t;
 
 typedef struct lines_t
@@ -51,8 +54,32 @@ typedef struct alpha_dc_info_t
     BYTE *pvBits;
     int width;
     int height;
+    BOOL owned; // FALSE when the DIB belongs to the hdc owner
 } alpha_dc_info_t;
 
+typedef struct render_stats_t
+{
+    u32 text_calls;     // ExtTextOut calls of the last frame
+    u32 glyphs;         // glyphs drawn in the last frame
+    u32 gdi_allocs;     // fonts and bitmaps created in the last frame
+} render_stats_t;
+
+typedef struct scroll_strip_t
+{
+    render_surface_t surface;   // copy of the rendered page
+    int line_height;            // first line and its gap, the distance of one step
+    BOOL blank;
+    BOOL valid;
+} scroll_strip_t;
+
+typedef struct strip_blit_t
+{
+    HDC hdc;
+    int src_y;
+    int dst_y;
+    int height;
+} strip_blit_t;
+
 #define DRAW_NULL               0
 #define DRAW_PAGE_DOWN          1
 #define DRAW_PAGE_UP            2
@@ -61,6 +88,10 @@ typedef struct alpha_dc_info_t
 
 #define m_Index                 (*m_pIndex)
 
+class PageCache;
+struct page_cache_key_t;
+struct page_cache_stats_t;
+
 #define is_space(c)             ((c) == 0x20 || (c) == 0x09 /*|| (c) == 0x0A*/ || (c) == 0x0B || (c) == 0x0C /*|| (c) == 0x0D*/)
 #define is_hyphen(c)            ((c) == 0x2D /* - */)
 #define is_blank(c)             ((c) == 0x20 || (c) == 0x09 || /*(c) == 0x0A ||*/ (c) == 0x0B || (c) == 0x0C || /*(c) == 0x0D ||*/ (c) == 0x3000 || (c) == 0xA0)
@@ -76,7 +107,10 @@ public:
     void PageDown(HWND hWnd, BOOL draw = TRUE);
     void LineUp(HWND hWnd, BOOL draw = TRUE);
     void LineDown(HWND hWnd, BOOL draw = TRUE);
-    void DrawPage(HWND hWnd, HDC hdc, RECT *rc, BOOL enable_alpha);
+    void DrawPage(HWND hWnd, HDC hdc, RECT *rc, BOOL enable_alpha, u32 bg_id = 0, HDC bg_dc = NULL);
+    BOOL PrerenderPage(HDC hdc, RECT *rc, BOOL enable_alpha, int draw_type, HDC bg_dc, u32 bg_id);
+    void ResetPageCache(void);
+    const page_cache_stats_t* GetPageCacheStats(void);
     void ReDraw(HWND hWnd);
     int  GetPageLength(void);
     int  GetTextLength(void);
@@ -87,21 +121,53 @@ public:
     BOOL GetCurPageText(TCHAR **text);
     BOOL SetCurPageText(HWND hWnd, TCHAR *text);
     BOOL IsBlankPage(void);
+    const render_stats_t* GetRenderStats(void);
+    void StartSmoothScroll(HWND hWnd);
+    void StopSmoothScroll(HWND hWnd);
+    BOOL SmoothScroll(HWND hWnd, double pixels);
+    int  GetScrollLineHeight(void);
+    int  GetScrollStrips(RECT *rc, strip_blit_t *blits);
+    virtual Gdiplus::Bitmap* GetCover(void);
+    virtual void LoadText(int start, int length, BOOL evict = FALSE); // before m_Text is read there, only the draw evicts
 
 protected:
     BOOL DrawCover(HDC hdc, RECT *rc);
     void CreateAlphaTextBitmap(HDC hdc, int width, int height, alpha_dc_info_t *p_alpha_dc);
     void DeleteAlphaTextBitmap(HDC hdc, alpha_dc_info_t *p_alpha_dc);
-    void DrawAlphaText(HDC hdc, char_info_t* p_char, int x, int y, int h, alpha_dc_info_t *p_alpha_dc);
+    void CalcPage(HDC hdc, RECT *rc);
+    void LayoutAndDraw(HDC hdc, RECT *rc, alpha_dc_info_t *p_alpha_dc);
+    BOOL CanScrollSurface(HDC hdc, RECT *rc, alpha_dc_info_t *p_alpha_dc, u32 bg_id, HDC bg_dc);
+    void ScrollAndDraw(HDC hdc, RECT *rc, alpha_dc_info_t *p_alpha_dc, HDC bg_dc);
+    int  MatchLines(int old_used, int *old_idx, int *new_idx);
+    void MoveSurfaceRows(HDC hdc, alpha_dc_info_t *p_alpha_dc, int width, int src_y, int dst_y, int height);
+    void ClearSurface(HDC hdc, alpha_dc_info_t *p_alpha_dc, HDC bg_dc, int width, int top, int bottom);
+    void CaptureStrip(HDC hdc, RECT *rc, alpha_dc_info_t *p_alpha_dc, int draw_type, u32 bg_id);
+    BOOL ScrollLineDown(HWND hWnd, int target);
+    void ResetStrips(void);
+    BOOL DrawCachedPage(HDC hdc, RECT *rc, alpha_dc_info_t *p_alpha_dc, u32 bg_id);
+    void MakeCacheKey(page_cache_key_t *key, int draw_type, RECT *rc, BOOL alpha, u32 bg_id);
+    void CopyPageInfo(page_info_t *dst, const page_info_t *src);
+    void DrawLineRange(HDC hdc, alpha_dc_info_t *p_alpha_dc, int first, int last);
+    void DrawLines(HDC hdc, alpha_dc_info_t *p_alpha_dc, BOOL tags, int first, int last);
+    void DrawAlphaText(HDC hdc, line_info_t* p_line, int start, int count, int x, int y, int width, alpha_dc_info_t *p_alpha_dc);
+    void CompositeAlphaText(alpha_dc_info_t *p_alpha_dc, int first, int last);
+    void CompositeLineRuns(alpha_dc_info_t *p_alpha_dc, line_info_t* p_line, int y);
+    void CompositeRect(alpha_dc_info_t *p_alpha_dc, int left, int top, int right, int bottom, DWORD color);
+    void DrawTextRun(HDC hdc, line_info_t* p_line, int start, int count, int x, int y);
+    void DrawImages(HDC hdc, alpha_dc_info_t *p_alpha_dc, int first, int last);
+    Gdiplus::Bitmap* GetImage(int id, int width, int height);
+    BOOL GetImageBox(wchar_t c, int width, int height, SIZE *sz);
+    int  GetGlyphRun(line_info_t* p_line, int start, int *width);
     void BeginDraw(void);
-    void EndDraw(void);
+    void EndDraw(HDC hdc);
+    void ReleaseFonts(void);
     DWORD GetTextAlpha(DWORD color);
     int  SelectFont(HDC hdc, int index, BOOL is_title);
     void SelectFontByDcIndex(HDC hdc, int dc_idx);
     int  GetPrevParagraph(int start, int max_len, int *is_blank, int *crlf_len);
     int  GetNextParagraph(int start, int max_len, int *is_blank, int *crlf_len);
     int  ParagraphToLines(HDC hdc, int start, int end, int width, int height, int line_idx);
-    int  AddCharsToLine(int line_idx, char_info_t *chars, int char_start, int char_len, int line_start, int line_len, int x, int cy, int gap);
+    int  AddCharsToLine(int line_idx, char_info_t *chars, int char_start, int char_len, int line_start, int line_len, int x, int cy, int gap, int image = -1);
     void RemoveLines(int line_idx, int count);
     void ClearLines(void);
     void ReleasePageInfo(void);
@@ -124,15 +190,18 @@ protected:
     virtual BOOL IsValid(void);
     virtual BOOL OnDrawPageEvent(HWND hWnd);
     virtual BOOL OnUpDownEvent(HWND hWnd, int draw_type);
-    virtual Gdiplus::Bitmap* GetCover(void);
     virtual int  GetTextBeginIndex(void);
     virtual BOOL IsChapterIndex(int index) = 0;
     virtual BOOL IsChapter(int index) = 0;
     virtual BOOL GetChapterInfo(int type, int *start, int *length) = 0; // type=0 curn chapter, type=1 next chapter, type=-1, prev chapter
+    virtual BOOL GetImageSize(int id, int *width, int *height);
+    virtual BOOL ReadImage(int id, std::string &data, size_t max_size); // max_size=0 whole image
+    virtual BOOL HasInlineImages(void); // FALSE: a private use character is text
 
 protected:
     wchar_t* m_Text;
     int m_Length;
+    CRITICAL_SECTION m_TextLock;        // m_Text changes after opening vs the search task
     int *m_pIndex;
     int m_PageLength;
     header_t *m_header;
@@ -140,12 +209,32 @@ protected:
 private:
     page_info_t m_PageInfo;
     dc_info_t *m_dcList;
+    LOGFONT *m_FontList;    // fonts of m_dcList, kept until they change
+    int m_dcCount;
     int m_dcIndex;
     int m_LineCount;
     int m_DrawType;
     BOOL m_BlankPage;
     int m_ChapterStart;     // for CHAPTER_PAGE
     int m_ChapterLength;    // CHAPTER_PAGE
+    int *m_RunDx;           // advances of one glyph run
+    int m_RunDxSize;
+    render_stats_t m_RenderStats;
+    PageCache *m_PageCache; // next and prev page rendered ahead
+    page_cache_key_t *m_DrawnKey;   // page left on m_DrawnSurface by the last DrawPage
+    void *m_DrawnSurface;
+    line_info_t *m_OldLines;        // line headers before a scroll, chars not owned
+    int m_OldLineSize;
+    scroll_strip_t m_Strips[2];     // smooth scroll: page at the top, page one line later
+    page_cache_key_t *m_StripKey;
+    BOOL m_Smooth;
+    double m_ScrollOffset;          // pixels of m_Strips[0] scrolled out
+    int m_StripTarget;              // strip the pending draw goes to, -1 none
+    Gdiplus::Bitmap *m_CoverScaled; // cover at the size it was last drawn, until the window resizes
+    Gdiplus::Bitmap *m_CoverSource; // the cover it was scaled from
+    ImageCache *m_ImageCache;       // inline images decoded at the size they are drawn
+    int m_TextWidth;                // text area of the last layout, images are fit in it
+    int m_TextHeight;
 };
 
 #endif
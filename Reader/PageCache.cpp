@@ -0,0 +1,164 @@
+#include "PageCache.h"
+
+u32 page_cache_hash(u32 hash, const void *data, size_t size)
+{
+    const BYTE *p = (const BYTE *)data;
+    size_t i;
+
+    // FNV-1a
+    for (i = 0; i < size; i++)
+    {
+        hash ^= p[i];
+        hash *= 16777619u;
+    }
+    return hash;
+}
+
+PageCache::PageCache()
+{
+    memset(m_Slots, 0, sizeof(m_Slots));
+    memset(&m_Stats, 0, sizeof(page_cache_stats_t));
+}
+
+PageCache::~PageCache()
+{
+    int i;
+
+    for (i = 0; i < PAGE_CACHE_SLOTS; i++)
+    {
+        FreeInfo(&m_Slots[i].info);
+        DeleteSurface(&m_Slots[i]);
+    }
+}
+
+page_cache_entry_t* PageCache::Find(const page_cache_key_t *key)
+{
+    int i;
+
+    for (i = 0; i < PAGE_CACHE_SLOTS; i++)
+    {
+        if (m_Slots[i].valid && memcmp(&m_Slots[i].key, key, sizeof(page_cache_key_t)) == 0)
+        {
+            m_Stats.hits++;
+            return &m_Slots[i];
+        }
+    }
+    m_Stats.misses++;
+    return NULL;
+}
+
+BOOL PageCache::Contains(const page_cache_key_t *key)
+{
+    int i;
+
+    for (i = 0; i < PAGE_CACHE_SLOTS; i++)
+    {
+        if (m_Slots[i].valid && memcmp(&m_Slots[i].key, key, sizeof(page_cache_key_t)) == 0)
+            return TRUE;
+    }
+    return FALSE;
+}
+
+page_cache_entry_t* PageCache::Alloc(const page_cache_key_t *key, HDC hdc)
+{
+    page_cache_entry_t *entry = &m_Slots[key->draw_type == DRAW_PAGE_UP ? 1 : 0];
+    BITMAPINFOHEADER BMIH;
+
+    entry->valid = FALSE;
+    FreeInfo(&entry->info);
+
+    // the surface is kept while the window size and mode stay the same
+    if (!entry->hBitmap || entry->width != key->width || entry->height != key->height
+        || (entry->pvBits != NULL) != !!key->alpha)
+    {
+        DeleteSurface(entry);
+        entry->hdc = CreateCompatibleDC(hdc);
+        if (key->alpha)
+        {
+            memset(&BMIH, 0x0, sizeof(BITMAPINFOHEADER));
+            BMIH.biSize = sizeof(BMIH);
+            BMIH.biWidth = key->width;
+            BMIH.biHeight = key->height;
+            BMIH.biPlanes = 1;
+            BMIH.biBitCount = 32;
+            BMIH.biCompression = BI_RGB;
+            entry->hBitmap = CreateDIBSection(hdc, (LPBITMAPINFO)&BMIH, 0, (LPVOID*)&entry->pvBits, NULL, 0);
+        }
+        else
+        {
+            entry->hBitmap = CreateCompatibleBitmap(hdc, key->width, key->height);
+        }
+        if (!entry->hdc || !entry->hBitmap)
+        {
+            DeleteSurface(entry);
+            return NULL;
+        }
+        entry->hOld = (HBITMAP)SelectObject(entry->hdc, entry->hBitmap);
+        entry->width = key->width;
+        entry->height = key->height;
+    }
+
+    memcpy(&entry->key, key, sizeof(page_cache_key_t));
+    return entry;
+}
+
+void PageCache::Commit(page_cache_entry_t *entry)
+{
+    entry->valid = TRUE;
+    m_Stats.prerenders++;
+}
+
+void PageCache::Remove(page_cache_entry_t *entry)
+{
+    entry->valid = FALSE;
+    FreeInfo(&entry->info);
+}
+
+void PageCache::Clear(void)
+{
+    int i;
+
+    for (i = 0; i < PAGE_CACHE_SLOTS; i++)
+    {
+        if (m_Slots[i].valid)
+            m_Stats.invalidations++;
+        Remove(&m_Slots[i]);
+    }
+}
+
+const page_cache_stats_t* PageCache::GetStats(void)
+{
+    return &m_Stats;
+}
+
+void PageCache::FreeInfo(page_info_t *info)
+{
+    int i;
+
+    for (i = 0; i < info->lines.used; i++)
+    {
+        if (info->lines.lines[i].chars)
+            free(info->lines.lines[i].chars);
+    }
+    if (info->lines.lines)
+        free(info->lines.lines);
+    memset(info, 0, sizeof(page_info_t));
+}
+
+void PageCache::DeleteSurface(page_cache_entry_t *entry)
+{
+    if (entry->hdc)
+    {
+        if (entry->hOld)
+            SelectObject(entry->hdc, entry->hOld);
+        DeleteDC(entry->hdc);
+    }
+    if (entry->hBitmap)
+        DeleteObject(entry->hBitmap);
+    entry->hdc = NULL;
+    entry->hBitmap = NULL;
+    entry->hOld = NULL;
+    entry->pvBits = NULL;
+    entry->width = 0;
+    entry->height = 0;
+}
@@ -0,0 +1,74 @@
+#ifndef __PAGE_CACHE_H__
+#define __PAGE_CACHE_H__
+
+#include "types.h"
+#include "Page.h"
+
+#define PAGE_CACHE_SLOTS        2 // next page, prev page
+
+typedef struct page_cache_key_t
+{
+    int from;               // m_Index the flip starts from
+    int draw_type;          // DRAW_PAGE_DOWN or DRAW_PAGE_UP
+    u32 page;               // hash of the current lines, the flip keeps some of them
+    u32 layout;             // hash of fonts, colors, gaps and borders
+    const wchar_t *text;
+    int length;
+    int width;
+    int height;
+    BOOL alpha;
+    u32 bg;                 // background id, non layered window only
+} page_cache_key_t;
+
+typedef struct page_cache_entry_t
+{
+    page_cache_key_t key;
+    BOOL valid;
+    page_info_t info;       // layout of the rendered page, owns its lines
+    int chapter_start;
+    int chapter_length;
+    BOOL blank;
+    HDC hdc;
+    HBITMAP hBitmap;
+    HBITMAP hOld;
+    BYTE *pvBits;           // 32bpp DIB for layered window, otherwise NULL
+    int width;
+    int height;
+} page_cache_entry_t;
+
+typedef struct page_cache_stats_t
+{
+    u32 hits;
+    u32 misses;
+    u32 prerenders;
+    u32 invalidations;
+} page_cache_stats_t;
+
+u32 page_cache_hash(u32 hash, const void *data, size_t size);
+
+// Pages rendered ahead of a flip, one slot per direction.
+class PageCache
+{
+public:
+    PageCache();
+    ~PageCache();
+
+public:
+    page_cache_entry_t* Find(const page_cache_key_t *key); // counts hit and miss
+    BOOL Contains(const page_cache_key_t *key);
+    page_cache_entry_t* Alloc(const page_cache_key_t *key, HDC hdc);
+    void Commit(page_cache_entry_t *entry);
+    void Remove(page_cache_entry_t *entry);
+    void Clear(void);
+    const page_cache_stats_t* GetStats(void);
+
+private:
+    void FreeInfo(page_info_t *info);
+    void DeleteSurface(page_cache_entry_t *entry);
+
+private:
+    page_cache_entry_t m_Slots[PAGE_CACHE_SLOTS];
+    page_cache_stats_t m_Stats;
+};
+
+#endif
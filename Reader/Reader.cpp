@@ -13,6 +13,8 @@
 #include "barcode.h"
 #include "OnlineDlg.h"
 #include "DisplaySet.h"
+#include "TaskScheduler.h"
+#include "CoverImage.h"
 #if ENABLE_TAG
 #include "tagset.h"
 #endif
@@ -450,7 +452,7 @@ LRESULT CALLBACK WndProc(HWND hWnd, UINT message, WPARAM wParam, LPARAM lParam)
             {
                 if (_Book && !_Book->IsLoading() && _item)
                 {
-                    if (_item->mark_size <= 0)
+                    if (_Cache.get_mark_count(_item) <= 0)
                         break;
                     GetClientRectExceptStatusBar(hWnd, &rc);
                     SetWindowPos(_hTreeMark, NULL, rc.left, rc.top, rc.right-rc.left, rc.bottom-rc.top, SWP_SHOWWINDOW);
@@ -511,7 +513,7 @@ LRESULT CALLBACK WndProc(HWND hWnd, UINT message, WPARAM wParam, LPARAM lParam)
                         TreeView_GetItem(_hTreeMark, &item);
                         if (_Book && !_Book->IsLoading() && _item)
                         {
-                            _item->index = _item->mark[item.lParam];
+                            _item->index = _Cache.get_mark(_item, (int)item.lParam);
                             _Book->ReDraw(hWnd);
                         }
                         //ShowWindow(_hTreeMark, SW_HIDE);
@@ -575,7 +577,7 @@ LRESULT CALLBACK WndProc(HWND hWnd, UINT message, WPARAM wParam, LPARAM lParam)
                     {
                         if (_Book)
                         {
-                            delete _Book;
+                            Book::Destroy(_Book);
                             _Book = NULL;
                         }
                         PostMessage(hWnd, WM_UPDATE_CHAPTERS, 0, NULL);
@@ -738,11 +740,10 @@ LRESULT CALLBACK WndProc(HWND hWnd, UINT message, WPARAM wParam, LPARAM lParam)
                     chkbook_arg_t* arg = GetCheckBookArguments();
                     arg->book = (OnlineBook*)_Book;
                     arg->hWnd = hWnd;
-                    arg->checked_list.insert(_Book->GetFileName());
                     if (2 != ((OnlineBook*)_Book)->ManualCheckUpdate(hWnd, OnManualCheckBookUpdateCallback, arg))
                     {
                         if (arg->book != _Book)
-                            delete arg->book;
+                            Book::Destroy(arg->book);
                         arg->book = NULL;
                     }
                 }
@@ -978,6 +979,13 @@ LRESULT CALLBACK WndProc(HWND hWnd, UINT message, WPARAM wParam, LPARAM lParam)
             OnCheckBookUpdate(hWnd);
             break;
 #endif
+        case IDT_TIMER_PRERENDER:
+            KillTimer(hWnd, IDT_TIMER_PRERENDER);
+            OnPrerender(hWnd);
+            break;
+        case IDT_TIMER_SCROLL:
+            OnSmoothScroll(hWnd);
+            break;
         case IDT_TIMER_LOADING:
             {
                 GUID Guid;
@@ -1003,7 +1011,17 @@ LRESULT CALLBACK WndProc(HWND hWnd, UINT message, WPARAM wParam, LPARAM lParam)
         break;
 #endif
     case WM_OPEN_BOOK:
-        OnOpenBookResult(hWnd, wParam == 1);
+        // a book closed while it was opening still reports
+        if (_Book && (Book *)lParam == _Book)
+            OnOpenBookResult(hWnd, wParam == 1);
+        break;
+    case WM_FIND_RESULT:
+        if (_Book && _item && _Book->IsFindResult(wParam))
+        {
+            _item->index = (int)lParam;
+            _Book->ReDraw(hWnd);
+            Save(hWnd);
+        }
         break;
     case WM_COPYDATA:
         OnCopyData(hWnd, message, wParam, lParam);
@@ -1014,12 +1032,10 @@ LRESULT CALLBACK WndProc(HWND hWnd, UINT message, WPARAM wParam, LPARAM lParam)
             if (_Book && (!be || _Book == be->_this))
                 _Book->OnBookEvent(hWnd, message, wParam, lParam);
 #ifdef ENABLE_NETWORK
-            else
+            else if (!_UpdateChecker.OnBookEvent(hWnd, message, wParam, lParam))
             {
-                chkbook_arg_t* arg = GetCheckBookArguments();
-                be = (book_event_data_t*)lParam;
-                if (arg && arg->book && be && arg->book == be->_this)
-                    arg->book->OnBookEvent(hWnd, message, wParam, lParam);
+                // posted by a book closed since
+                OnlineBook::FreeBookEvent(wParam, lParam);
             }
 #endif
         }
@@ -1463,6 +1479,7 @@ INT_PTR CALLBACK Setting(HWND hDlg, UINT message, WPARAM wParam, LPARAM lParam)
     BOOL bResult = FALSE;
     int value = 0;
     int cid;
+    int apm;
     LRESULT res;
     TCHAR buf[256] = { 0 };
     RECT rc = { 0 };
@@ -1499,7 +1516,9 @@ INT_PTR CALLBACK Setting(HWND hDlg, UINT message, WPARAM wParam, LPARAM lParam)
         SendMessage(GetDlgItem(hDlg, IDC_COMBO_APM), CB_ADDSTRING, 0, (LPARAM)buf);
         LoadString(hInst, IDS_DYNAMIC_CALC, buf, 256);
         SendMessage(GetDlgItem(hDlg, IDC_COMBO_APM), CB_ADDSTRING, 0, (LPARAM)buf);
-        SendMessage(GetDlgItem(hDlg, IDC_COMBO_APM), CB_SETCURSEL, _header->autopage_mode >> 8, NULL);
+        LoadString(hInst, IDS_SMOOTH_SCROLL, buf, 256);
+        SendMessage(GetDlgItem(hDlg, IDC_COMBO_APM), CB_ADDSTRING, 0, (LPARAM)buf);
+        SendMessage(GetDlgItem(hDlg, IDC_COMBO_APM), CB_SETCURSEL, (_header->autopage_mode & 0xf0) >> 4, NULL);
         return (INT_PTR)TRUE;
 
     case WM_COMMAND:
@@ -1562,11 +1581,18 @@ INT_PTR CALLBACK Setting(HWND hDlg, UINT message, WPARAM wParam, LPARAM lParam)
             _header->disable_lrhide = res == BST_CHECKED ? 0 : 1;
             res = SendMessage(GetDlgItem(hDlg, IDC_CHECK_ESCHIDE), BM_GETCHECK, 0, NULL);
             _header->disable_eschide = res == BST_CHECKED ? 0 : 1;
+            apm = _header->autopage_mode;
             res = SendMessage(GetDlgItem(hDlg, IDC_RADIO_ATPAGE), BM_GETCHECK, 0, NULL);
             _header->autopage_mode = 0;
             _header->autopage_mode |= res == BST_CHECKED ? apm_page : apm_line;
             res = SendMessage(GetDlgItem(hDlg, IDC_COMBO_APM), CB_GETCURSEL, 0, NULL);
-            _header->autopage_mode |= res == 1 ? apm_count : apm_fixed;
+            _header->autopage_mode |= res == 2 ? apm_smooth : (res == 1 ? apm_count : apm_fixed);
+            if (_IsAutoPage && apm != _header->autopage_mode)
+            {
+                // timers differ between modes
+                StopAutoPage(GetParent(hDlg));
+                StartAutoPage(GetParent(hDlg));
+            }
             Save(GetParent(hDlg));
             EndDialog(hDlg, LOWORD(wParam));
             return (INT_PTR)TRUE;
@@ -1901,6 +1927,7 @@ LRESULT OnUpdateMenu(HWND hWnd)
     static Gdiplus::Bitmap* s_bitmap = NULL;
     static HGLOBAL s_hMemory = NULL;
     static HBITMAP hBitmap = NULL;
+    static HBITMAP s_thumbs[COVER_THUMB_MENU_ITEMS] = { 0 };
     TCHAR buf[MAX_LOADSTRING];
     int menu_begin_id = IDM_OPEN_BEGIN;
     HMENU hMenuBar = GetMenu(hWnd);
@@ -1923,6 +1950,14 @@ LRESULT OnUpdateMenu(HWND hWnd)
         DeleteObject(hBitmap);
         hBitmap = NULL;
     }
+    for (int i=0; i<COVER_THUMB_MENU_ITEMS; i++)
+    {
+        if (s_thumbs[i])
+        {
+            DeleteObject(s_thumbs[i]);
+            s_thumbs[i] = NULL;
+        }
+    }
     if (!s_bitmap)
     {
         LoadResourceImage(MAKEINTRESOURCE(IDB_PNG_NEW), _T("PNG"), &s_bitmap, &s_hMemory);
@@ -1939,6 +1974,18 @@ LRESULT OnUpdateMenu(HWND hWnd)
     {
         item_t* item = _Cache.get_item(i);
         AppendMenu(hFile, MF_STRING, (UINT_PTR)menu_begin_id, item->file_name);
+        // cover thumbnail saved when the book was last opened
+        if (i < COVER_THUMB_MENU_ITEMS)
+        {
+            s_thumbs[i] = _Cache.load_thumb(item);
+            if (s_thumbs[i])
+            {
+                mi.cbSize = sizeof(MENUITEMINFO);
+                mi.fMask = MIIM_BITMAP;
+                mi.hbmpItem = s_thumbs[i];
+                SetMenuItemInfo(hFile, menu_begin_id, FALSE, &mi);
+            }
+        }
 #ifdef ENABLE_NETWORK
         if (0 == _tcscmp(PathFindExtension(item->file_name), _T(".ol")) && item->is_new)
         {
@@ -1968,7 +2015,7 @@ LRESULT OnOpenItem(HWND hWnd, int item_id, BOOL forced)
         DestroyWindow(_hFindDlg);
         _hFindDlg = NULL;
     }
-    if (!forced && _item && _item->id == item_id && _Book && !_Book->IsLoading())
+    if (!forced && _item && _item == _Cache.get_item(item_id) && _Book && !_Book->IsLoading())
     {
         return 0;
     }
@@ -2016,7 +2063,7 @@ LRESULT OnClearFileList(HWND hWnd, UINT message, WPARAM wParam, LPARAM lParam)
 
     if (_Book)
     {
-        delete _Book;
+        Book::Destroy(_Book);
         _Book = NULL;
     }
     _Cache.delete_all_item();
@@ -2088,41 +2135,51 @@ LRESULT OnRestoreDefault(HWND hWnd, UINT message, WPARAM wParam, LPARAM lParam)
 LRESULT OnPaint(HWND hWnd, HDC hdc)
 {
     RECT rc;
-    HBRUSH hBrush = NULL;
     HDC memdc = NULL;
-    HBITMAP hBmp = NULL;
     Gdiplus::Bitmap *image;
     Gdiplus::Graphics *g = NULL;
     Gdiplus::Rect rect;
     UINT w,h;
     double scale;
+    BOOL scroll;
+    HDC bg_dc;
+    strip_blit_t blits[2];
+    int i, count;
 
     GetClientRectExceptStatusBar(hWnd, &rc);
 
-    // memory dc
-    memdc = CreateCompatibleDC(hdc);
+    _Render.BeginFrame();
 
-    // load bg image
+    // load bg image, memory dc is kept by _Render with the background drawn;
+    // over a plain background the last page is kept for DrawPage to scroll
     image = LoadBGImage(rc.right-rc.left,rc.bottom-rc.top);
-    if (image)
+    scroll = _Book && !_Book->IsLoading() && !(_loading && _loading->enable) && !image;
+    memdc = _Render.GetBackBuffer(hdc, rc.right-rc.left, rc.bottom-rc.top, _header->bg_color, image, !scroll);
+    if (!memdc)
     {
-        image->GetHBITMAP(Gdiplus::Color(0, 0, 0, 0), &hBmp);
-        SelectObject(memdc, hBmp);
+        _Render.EndFrame();
+        return 0;
     }
-    else
+
+    if (_Book && !_Book->IsLoading())
     {
-        hBmp = CreateCompatibleBitmap(hdc, rc.right-rc.left, rc.bottom-rc.top);
-        SelectObject(memdc, hBmp);
+        bg_dc = scroll ? _Render.GetBackgroundDC() : NULL;
+        _Book->DrawPage(hWnd, memdc, &rc, FALSE, _Render.GetBackgroundId(), bg_dc);
+        _Render.CountAlloc(_Book->GetRenderStats()->gdi_allocs);
 
-        // set bg color
-        hBrush = CreateSolidBrush(_header->bg_color);
-        SelectObject(memdc, hBrush);
-        FillRect(memdc, &rc, hBrush);
+        // smooth scroll, the strips go over the background
+        count = _Book->GetScrollStrips(&rc, blits);
+        if (count > 0 && bg_dc)
+        {
+            BitBlt(memdc, 0, 0, rc.right-rc.left, rc.bottom-rc.top, bg_dc, 0, 0, SRCCOPY);
+            for (i = 0; i < count; i++)
+                BitBlt(memdc, 0, blits[i].dst_y, rc.right-rc.left, blits[i].height, blits[i].hdc, 0, blits[i].src_y, SRCCOPY);
+        }
     }
-
-    if (_Book && !_Book->IsLoading())
+    else if (_Book)
     {
-        _Book->DrawPage(hWnd, memdc, &rc, FALSE);
+        // the back buffer no longer holds the page
+        _Book->ResetPageCache();
     }
     if (_loading && _loading->enable)
     {
@@ -2151,11 +2208,10 @@ LRESULT OnPaint(HWND hWnd, HDC hdc)
 
     BitBlt(hdc, rc.left, rc.top, rc.right-rc.left, rc.bottom-rc.top, memdc, rc.left, rc.top, SRCCOPY);
 
-    DeleteObject(hBmp);
-    DeleteObject(hBrush);
-    DeleteDC(memdc);
     if (g)
         delete g;
+    _Render.EndFrame();
+    SetTimer(hWnd, IDT_TIMER_PRERENDER, USER_TIMER_MINIMUM, NULL);
     UpdateProgess();
     UpdateTitle(hWnd);
     return 0;
@@ -2167,7 +2223,6 @@ VOID OnDraw(HWND hWnd)
     HDC hdc_screen = NULL;
     HDC hdc_text = NULL;
     HDC memdc = NULL;
-    HBITMAP hbitmap_bg = NULL;
     Gdiplus::Bitmap *image;
     Gdiplus::Graphics *g = NULL;
     Gdiplus::Rect rect;
@@ -2175,22 +2230,28 @@ VOID OnDraw(HWND hWnd)
     double scale;    
     BYTE alpha = _header->alpha;
     BOOL is_blank = TRUE;
+    strip_blit_t blits[2];
+    int i, count = 0;
 
     GetClientRectExceptStatusBar(hWnd, &rc);
 
     w = rc.right-rc.left;
     h = rc.bottom-rc.top;
 
-    // memory dc
     hdc_screen = GetDC(NULL);
-    memdc = CreateCompatibleDC(hdc_screen);
+    _Render.BeginFrame();
 
-    // draw text to dc, DrawPage() will create bitmap
+    // draw text to dc, DrawPage() clears and reuses the DIB of _Render
     if (_Book && !_Book->IsLoading())
     {
-        hdc_text = CreateCompatibleDC(hdc_screen);
-        _Book->DrawPage(hWnd, hdc_text, &rc, TRUE);
-        is_blank = _Book->IsBlankPage();
+        hdc_text = _Render.GetTextDC(hdc_screen, w, h);
+        if (hdc_text)
+        {
+            _Book->DrawPage(hWnd, hdc_text, &rc, TRUE);
+            _Render.CountAlloc(_Book->GetRenderStats()->gdi_allocs);
+            is_blank = _Book->IsBlankPage();
+            count = _Book->GetScrollStrips(&rc, blits);
+        }
     }
 
     if (is_blank)
@@ -2198,17 +2259,14 @@ VOID OnDraw(HWND hWnd)
         alpha = _header->alpha < MIN_ALPHA_VALUE ? MIN_ALPHA_VALUE : _header->alpha;
     }
 
-    // load bg image
+    // load bg image, memory dc is kept by _Render with the background drawn
     image = LoadBGImage(w, h, alpha);
-    if (image)
+    memdc = _Render.GetLayerBuffer(hdc_screen, w, h, _header->bg_color, alpha, image);
+    if (!memdc)
     {
-        image->GetHBITMAP(Gdiplus::Color(0, 0, 0, 0), &hbitmap_bg);
-        SelectObject(memdc, hbitmap_bg);
-    }
-    else
-    {
-        hbitmap_bg = CreateAlphaBGColorBitmap(hWnd, _header->bg_color, rc.right-rc.left, rc.bottom-rc.top, alpha);
-        SelectObject(memdc, hbitmap_bg);
+        _Render.EndFrame();
+        ReleaseDC(NULL, hdc_screen);
+        return;
     }
     
     if (_loading && _loading->enable)
@@ -2244,10 +2302,17 @@ VOID OnDraw(HWND hWnd)
         bf.BlendFlags = 0;
         bf.SourceConstantAlpha = 0xFF; 
         bf.AlphaFormat = AC_SRC_ALPHA;
-        AlphaBlend(memdc, 0, 0, w, h, hdc_text, 0, 0, w, h, bf);
-
-        // Clean up 
-        DeleteDC(hdc_text); 
+        if (count > 0)
+        {
+            // smooth scroll, blend the strips instead of the page
+            for (i = 0; i < count; i++)
+                AlphaBlend(memdc, 0, blits[i].dst_y, rc.right-rc.left, blits[i].height,
+                    blits[i].hdc, 0, blits[i].src_y, rc.right-rc.left, blits[i].height, bf);
+        }
+        else
+        {
+            AlphaBlend(memdc, 0, 0, w, h, hdc_text, 0, 0, w, h, bf);
+        }
     }
 
     // update layered
@@ -2264,16 +2329,67 @@ VOID OnDraw(HWND hWnd)
     UpdateLayeredWindow(hWnd, hdc_screen, &ptPos, &sizeWnd, memdc, &ptSrc, 0, &blend, ULW_ALPHA);
     
 
-    DeleteObject(hbitmap_bg);
-    DeleteDC(memdc);
     ReleaseDC(NULL, hdc_screen);
     if (g)
         delete g;
+    _Render.EndFrame();
+    SetTimer(hWnd, IDT_TIMER_PRERENDER, USER_TIMER_MINIMUM, NULL);
     UpdateProgess();
     UpdateTitle(hWnd);
     return;
 }
 
+VOID OnPrerender(HWND hWnd)
+{
+    RECT rc;
+    HDC hdc;
+    BOOL alpha = _WndInfo.bLayered;
+    HDC bg_dc = alpha ? NULL : _Render.GetBackgroundDC();
+    u32 bg_id = alpha ? 0 : _Render.GetBackgroundId();
+
+    if (!_Book || _Book->IsLoading() || (_loading && _loading->enable))
+        return;
+
+    GetClientRectExceptStatusBar(hWnd, &rc);
+    hdc = GetDC(alpha ? NULL : hWnd);
+
+    // WM_TIMER only comes when the queue is empty, page down first,
+    // and give way to any input before the second page
+    _Book->PrerenderPage(hdc, &rc, alpha, DRAW_PAGE_DOWN, bg_dc, bg_id);
+    if (GetQueueStatus(QS_INPUT))
+        SetTimer(hWnd, IDT_TIMER_PRERENDER, USER_TIMER_MINIMUM, NULL);
+    else
+        _Book->PrerenderPage(hdc, &rc, alpha, DRAW_PAGE_UP, bg_dc, bg_id);
+
+    ReleaseDC(alpha ? NULL : hWnd, hdc);
+}
+
+VOID OnSmoothScroll(HWND hWnd)
+{
+    LARGE_INTEGER now, freq;
+    double ms;
+
+    // WM_TIMER is coarse, the distance follows the real elapsed time
+    QueryPerformanceCounter(&now);
+    QueryPerformanceFrequency(&freq);
+    ms = (double)(now.QuadPart - _ScrollTick.QuadPart) * 1000.0 / freq.QuadPart;
+    _ScrollTick = now;
+
+    if (!_Book || _Book->IsLoading())
+        return;
+    if (!IsSmoothAutoPage())
+    {
+        StopAutoPage(hWnd);
+        return;
+    }
+
+    // no jump after a stall, one line every uElapse
+    if (ms > 100.0)
+        ms = 100.0;
+    if (!_Book->SmoothScroll(hWnd, ms * _Book->GetScrollLineHeight() / max(_header->uElapse, 1)))
+        StopAutoPage(hWnd);
+}
+
 BOOL ResetLayerd(HWND hWnd)
 {
     LONG_PTR exstyle;
@@ -2320,6 +2436,10 @@ VOID Invalidate(HWND hWnd, BOOL bOnlyClient, BOOL bErase)
 
 LRESULT OnSize(HWND hWnd, UINT message, WPARAM wParam, LPARAM lParam)
 {
+    if (_Book)
+    {
+        _Book->ResetPageCache();
+    }
     if (_WndInfo.status == ds_borderless)
     {
         OnDraw(hWnd);
@@ -2514,7 +2634,6 @@ LRESULT OnAddMark(HWND hWnd, UINT message, WPARAM wParam, LPARAM lParam)
             if (_Cache.add_mark(_item, _item->index))
             {
                 OnUpdateBookMark(hWnd);
-                Save(hWnd);
             }
         }
     }
@@ -2759,31 +2878,10 @@ LRESULT OnFindText(HWND hWnd, UINT message, WPARAM wParam, LPARAM lParam)
             DestroyWindow(_hFindDlg);
             _hFindDlg = NULL;
         }
-        else if (fr.Flags & FR_DOWN) // back search
+        else if (len > 0 && _item)
         {
-            for (int i=_item->index+1; i<_Book->GetTextLength()-len+1; i++)
-            {
-                if (0 == memcmp(szFindWhat, _Book->GetText()+i, len*sizeof(TCHAR)))
-                {
-                    _item->index = i;
-                    _Book->ReDraw(hWnd);
-                    Save(hWnd);
-                    break;
-                }
-            }
-        }
-        else // front search
-        {
-            for (int i=_item->index-1; i>=0; i--)
-            {
-                if (0 == memcmp(szFindWhat, _Book->GetText()+i, len*sizeof(TCHAR)))
-                {
-                    _item->index = i;
-                    _Book->ReDraw(hWnd);
-                    Save(hWnd);
-                    break;
-                }
-            }
+            // searched on the scheduler, the hit comes back as WM_FIND_RESULT
+            _Book->Find(hWnd, szFindWhat, _item->index, (fr.Flags & FR_DOWN) ? TRUE : FALSE);
         }
     }
     else
@@ -2823,7 +2921,7 @@ LRESULT OnUpdateChapters(HWND hWnd)
         chapters = _Book->GetChapters();
         for (i = 0; i < (int)chapters->size(); i++)
         {
-            tvi.pszText = (TCHAR*)(*chapters)[i].title.c_str();
+            tvi.pszText = (TCHAR*)chapters->title(i);
             tvi.cchTextMax = sizeof(tvi.pszText) / sizeof(tvi.pszText[0]);
             tvi.lParam = (LPARAM)i;
             tvins.item = tvi;
@@ -2844,7 +2942,7 @@ LRESULT OnUpdateBookMark(HWND hWnd)
     TVITEM tvi = {0};
     TVINSERTSTRUCT tvins = {0};
     HTREEITEM hPrev = (HTREEITEM)TVI_FIRST;
-    int i;
+    int i, count, mark;
     TCHAR szText[MAX_MARK_TEXT] = {0};
     int len;
 
@@ -2853,10 +2951,15 @@ LRESULT OnUpdateBookMark(HWND hWnd)
     {
         tvi.mask = TVIF_TEXT /*| TVIF_IMAGE | TVIF_SELECTEDIMAGE */| TVIF_PARAM;
 
-        for (i=0; i<_item->mark_size; i++)
+        count = _Cache.get_mark_count(_item);
+        for (i=0; i<count; i++)
         {
-            len = _item->mark[i] + (MAX_MARK_TEXT - 1) > _Book->GetTextLength() ? _Book->GetTextLength() - _item->mark[i] : (MAX_MARK_TEXT - 1);
-            memcpy(szText, _Book->GetText()+_item->mark[i], sizeof(TCHAR)*len);
+            mark = _Cache.get_mark(_item, i);
+            if (mark < 0 || mark > _Book->GetTextLength())
+                continue;
+            len = mark + (MAX_MARK_TEXT - 1) > _Book->GetTextLength() ? _Book->GetTextLength() - mark : (MAX_MARK_TEXT - 1);
+            _Book->LoadText(mark, len);
+            memcpy(szText, _Book->GetText()+mark, sizeof(TCHAR)*len);
             szText[len] = 0;
 
             tvi.pszText = szText; 
@@ -2887,7 +2990,7 @@ LRESULT OnOpenBookResult(HWND hWnd, BOOL result)
         StopLoadingImage(hWnd);
         _tcscpy(fileName, _Book->GetFileName());
         type = _Book->GetBookType() == book_online ? MB_RETRYCANCEL : MB_OK;
-        delete _Book;
+        Book::Destroy(_Book);
         _Book = NULL;
         if (IDRETRY == MessageBox_(hWnd, IDS_OPEN_FILE_FAILED, IDS_ERROR, type | MB_ICONERROR))
         {
@@ -2904,11 +3007,11 @@ LRESULT OnOpenBookResult(HWND hWnd, BOOL result)
     if (NULL == item)
     {
         item = _Cache.new_item(_Book->GetFileName());
-        _header = _Cache.get_header(); // after realloc the header address has been changed
     }
 
     // open item
-    _item = _Cache.open_item(item->id);
+    _item = _Cache.open_item(item);
+    _Cache.save_thumb(_item, _Book->GetCover());
 
     // set param
     _Book->Init(&_item->index, _header);
@@ -3042,11 +3145,10 @@ LRESULT CALLBACK KeyboardProc(int nCode, WPARAM wParam, LPARAM lParam)
                             chkbook_arg_t* arg = GetCheckBookArguments();
                             arg->book = (OnlineBook*)_Book;
                             arg->hWnd = _hWnd;
-                            arg->checked_list.insert(_Book->GetFileName());
                             if (2 != ((OnlineBook*)_Book)->ManualCheckUpdate(_hWnd, OnManualCheckBookUpdateCallback, arg))
                             {
                                 if (arg->book != _Book)
-                                    delete arg->book;
+                                    Book::Destroy(arg->book);
                                 arg->book = NULL;
                             }
                         }
@@ -3084,7 +3186,7 @@ BOOL IsVaildFile(HWND hWnd, TCHAR *filename, int *p_size)
     ext = PathFindExtension(filename);
 
 #ifdef ENABLE_NETWORK
-    if (!_header || _header->book_source_count == 0)
+    if (!_BookSources || _BookSources->Count() == 0)
     {
         if (0 == _tcscmp(ext, _T(".ol")))
         {
@@ -3131,9 +3233,6 @@ void OnOpenBook(HWND hWnd, TCHAR *filename, BOOL forced)
     TCHAR *ext = NULL;
     int size = 0;
     TCHAR szFileName[MAX_PATH] = {0};
-#ifdef ENABLE_NETWORK
-    chkbook_arg_t* arg = NULL;
-#endif
 
     _tcscpy(szFileName, filename);
     ext = PathFindExtension(szFileName);
@@ -3149,7 +3248,7 @@ void OnOpenBook(HWND hWnd, TCHAR *filename, BOOL forced)
     {
         if (!forced)
         {
-            if (_item && item->id == _item->id && _Book && !_Book->IsLoading()) // current is opened
+            if (item == _item && _Book && !_Book->IsLoading()) // current is opened
             {
                 OnUpdateMenu(hWnd);
                 return;
@@ -3160,7 +3259,7 @@ void OnOpenBook(HWND hWnd, TCHAR *filename, BOOL forced)
 
     if (_Book)
     {
-        delete _Book;
+        Book::Destroy(_Book);
         _Book = NULL;
     }
 
@@ -3186,14 +3285,8 @@ void OnOpenBook(HWND hWnd, TCHAR *filename, BOOL forced)
 #ifdef ENABLE_NETWORK
     else if (_tcscmp(ext, _T(".ol")) == 0)
     {
-        arg = GetCheckBookArguments();
-        if (arg && arg->book && arg->book->GetBookType() == book_online
-            && 0 == _tcscmp(arg->book->GetFileName(), szFileName))
-        {
-            if (arg->book != _Book)
-                delete arg->book;
-            arg->book = NULL;
-        }
+        // the file is written by the opened book from now on
+        _UpdateChecker.Cancel(szFileName);
         _Book = new OnlineBook;
         _Book->SetFileName(szFileName);
         _Book->OpenBook(NULL, size, hWnd);
@@ -3296,18 +3389,12 @@ void OnOpenOlBook(HWND hWnd, void* olparam)
 
 void UpdateBookMark(HWND hWnd, int index, int size)
 {
-    int i;
     if (!_item || !_Book || _tcscmp(_item->file_name, _Book->GetFileName()) != 0)
     {
         return;
     }
 
-    for (i=0; i<_item->mark_size; i++)
-    {
-        if (_item->mark[i] < index)
-            continue;
-        _item->mark[i] += size;
-    }
+    _Cache.shift_mark(_item, index, size);
 }
 #endif
 
@@ -3327,6 +3414,7 @@ BOOL Init(void)
     }
 
     _header = _Cache.get_header();
+    _BookSources = _Cache.get_book_sources();
 
     // delete not exist items
     for (int i=0; i<_header->item_count; i++)
@@ -3360,12 +3448,18 @@ BOOL Init(void)
 
 void Exit(void)
 {
+#ifdef ENABLE_NETWORK
+    _UpdateChecker.Stop();
+#endif
     if (_Book)
     {
-        delete _Book;
+        Book::Destroy(_Book);
         _Book = NULL;
     }
 
+    TaskScheduler::ReleaseInstance();
+    _Render.Release();
+
     if (!_Cache.exit())
     {
         MessageBox_(NULL, IDS_SAVE_CACHE_FAIL, IDS_ERROR, MB_OK);
@@ -3396,7 +3490,7 @@ static void _free_resource(HWND hWnd)
     // close book
     if (_Book)
     {
-        delete _Book;
+        Book::Destroy(_Book);
         _Book = NULL;
     }
     // reset
@@ -3737,11 +3831,25 @@ BOOL FileExists(TCHAR *file)
         !(dwAttrib & FILE_ATTRIBUTE_DIRECTORY));
 }
 
+BOOL IsSmoothAutoPage(void)
+{
+    // a normal window composes the strips over a plain background only
+    return (_header->autopage_mode & 0x0f) == apm_line
+        && (_header->autopage_mode & 0xf0) == apm_smooth
+        && (_WndInfo.bLayered || !_header->bg_image.enable);
+}
+
 void StartAutoPage(HWND hWnd)
 {
     if (_item && !_IsAutoPage && _Book && !_Book->IsLoading())
     {
-        if ((_header->autopage_mode & 0xf0) == apm_count)
+        if (IsSmoothAutoPage())
+        {
+            QueryPerformanceCounter(&_ScrollTick);
+            _Book->StartSmoothScroll(hWnd);
+            SetTimer(hWnd, IDT_TIMER_SCROLL, USER_TIMER_MINIMUM, NULL);
+        }
+        else if ((_header->autopage_mode & 0xf0) == apm_count)
         {
             SetTimer(hWnd, IDT_TIMER_PAGE, _header->uElapse * _Book->GetPageLength(), NULL);
         }
@@ -3759,6 +3867,9 @@ void StopAutoPage(HWND hWnd)
     if (_IsAutoPage)
     {
         KillTimer(hWnd, IDT_TIMER_PAGE);
+        KillTimer(hWnd, IDT_TIMER_SCROLL);
+        if (_Book)
+            _Book->StopSmoothScroll(hWnd);
         _IsAutoPage = FALSE;
         UpdateProgess();
     }
@@ -3769,6 +3880,7 @@ void PauseAutoPage(HWND hWnd)
     if (_IsAutoPage)
     {
         KillTimer(hWnd, IDT_TIMER_PAGE);
+        KillTimer(hWnd, IDT_TIMER_SCROLL);
     }
 }
 
@@ -3776,7 +3888,12 @@ void ResumeAutoPage(HWND hWnd)
 {
     if (_item && _IsAutoPage && _Book && !_Book->IsLoading())
     {
-        if ((_header->autopage_mode & 0xf0) == apm_count)
+        if (IsSmoothAutoPage())
+        {
+            QueryPerformanceCounter(&_ScrollTick);
+            SetTimer(hWnd, IDT_TIMER_SCROLL, USER_TIMER_MINIMUM, NULL);
+        }
+        else if ((_header->autopage_mode & 0xf0) == apm_count)
         {
             SetTimer(hWnd, IDT_TIMER_PAGE, _header->uElapse * _Book->GetPageLength(), NULL);
         }
@@ -3788,6 +3905,9 @@ void ResumeAutoPage(HWND hWnd)
     else
     {
         KillTimer(hWnd, IDT_TIMER_PAGE);
+        KillTimer(hWnd, IDT_TIMER_SCROLL);
+        if (_Book)
+            _Book->StopSmoothScroll(hWnd);
         _IsAutoPage = FALSE;
     }
 }
@@ -3834,57 +3954,37 @@ chkbook_arg_t* GetCheckBookArguments()
 
 void StartCheckBookUpdate(HWND hWnd)
 {
+    _UpdateChecker.SetCallback(OnBookUpdateResult, hWnd);
     KillTimer(hWnd, IDT_TIMER_CHECKBOOK);
     SetTimer(hWnd, IDT_TIMER_CHECKBOOK, 60 * 1000 /*one minute*/, NULL);
 }
 
-void OnCheckBookUpdateCallback(int is_update, int err, void* param)
+void OnBookUpdateResult(const TCHAR* file_name, int is_update, int err, void* arg)
 {
-    chkbook_arg_t* arg = (chkbook_arg_t*)param;
-    int i;
-
-    if (!arg)
-        return;
+    HWND hWnd = (HWND)arg;
+    item_t* item;
 
-    if (!arg->book)
+    // sweep done, the next one in an hour
+    if (!file_name)
+    {
+        KillTimer(hWnd, IDT_TIMER_CHECKBOOK);
+        SetTimer(hWnd, IDT_TIMER_CHECKBOOK, 60 * 60 * 1000 /*one hour*/, NULL);
         return;
-
-    logger_printk("file=%s", Utf16ToAnsi(arg->book->GetFileName()));
+    }
 
     if (is_update)
     {
-        for (i = 0; i < _header->item_count; i++)
-        {
-            item_t* item = _Cache.get_item(i);
-            if (_tcscmp(item->file_name, arg->book->GetFileName()) == 0)
-            {
-                item->is_new = TRUE;
-                Save(arg->hWnd);
-                break;
-            }
-        }
-
-        OnUpdateMenu(arg->hWnd);
-
-        if (arg->book == _Book)
+        item = _Cache.find_item((TCHAR*)file_name);
+        if (item)
         {
-            arg->book = NULL;
-            PostMessage(arg->hWnd, WM_UPDATE_CHAPTERS, 0, NULL);
+            item->is_new = TRUE;
+            Save(hWnd);
         }
-    }
 
-    if (arg->book)
-    {
-        if (arg->book != _Book)
-            delete arg->book;
-        arg->book = NULL;
-    }   
+        OnUpdateMenu(hWnd);
 
-    // check next book
-    if (arg->hWnd)
-    {
-        KillTimer(arg->hWnd, IDT_TIMER_CHECKBOOK);
-        SetTimer(arg->hWnd, IDT_TIMER_CHECKBOOK, 60 * 1000 /*one minute*/, NULL);
+        if (_Book && _Book->GetBookType() == book_online && _tcscmp(_Book->GetFileName(), file_name) == 0)
+            PostMessage(hWnd, WM_UPDATE_CHAPTERS, 0, NULL);
     }
 }
 
@@ -3912,87 +4012,23 @@ void OnManualCheckBookUpdateCallback(int is_update, int err, void* param)
     if (arg->book)
     {
         if (arg->book != _Book)
-            delete arg->book;
+            Book::Destroy(arg->book);
         arg->book = NULL;
     }
 }
 
 void OnCheckBookUpdate(HWND hWnd)
 {
-    chkbook_arg_t* arg = GetCheckBookArguments();
-    item_t* item = NULL;
-    int i;
-    int found = -1;
-
-    if (!arg)
-        return;
-
-    if (arg->book)
-    {
-        if (arg->book != _Book)
-            delete arg->book;
-        arg->book = NULL;
-    }   
-
-_check_next:
-    found = -1;
-    // find an online book
-    for (i = 0; i < _header->item_count; i++)
+    // a sweep in progress only drops the checks that went away
+    if (!_UpdateChecker.Start(hWnd, &_Cache))
     {
-        item = _Cache.get_item(i);
-        if (0 == _tcscmp(PathFindExtension(item->file_name), _T(".ol")))
-        {
-            if (arg->checked_list.find(item->file_name) != arg->checked_list.end())
-            {
-                continue;
-            }
-            found = i;
-            break;
-        }
+        _UpdateChecker.Reap();
     }
-
-    if (found != -1)
+    else if (_UpdateChecker.IsRunning())
     {
-        item = _Cache.get_item(found);
-        if (_Book && _Book->GetBookType() == book_online && _tcscmp(_Book->GetFileName(), item->file_name) == 0)
-        {
-            arg->hWnd = hWnd;
-            arg->checked_list.insert(item->file_name);
-            arg->book = (OnlineBook*)_Book;
-            if (2 != ((OnlineBook*)_Book)->CheckUpdate(hWnd, OnCheckBookUpdateCallback, arg))
-            {
-                found = -1;
-                goto _check_next;
-            }
-        }
-        else
-        {
-            arg->hWnd = hWnd;
-            arg->checked_list.insert(item->file_name);
-            arg->book = new OnlineBook;
-            arg->book->SetFileName(item->file_name);
-            if (2 != arg->book->CheckUpdate(hWnd, OnCheckBookUpdateCallback, arg))
-            {
-                if (arg->book != _Book)
-                    delete arg->book;
-                arg->book = NULL;
-
-                found = -1;
-                goto _check_next;
-            }
-        }
-    }
-    else
-    {
-        if (arg->book)
-        {
-            if (arg->book != _Book)
-                delete arg->book;
-            arg->book = NULL;
-        }
-        arg->checked_list.clear();
+        // looked after every minute until OnBookUpdateResult sees the end
         KillTimer(hWnd, IDT_TIMER_CHECKBOOK);
-        SetTimer(hWnd, IDT_TIMER_CHECKBOOK, 60 * 60 * 1000 /*one hour*/, NULL);
+        SetTimer(hWnd, IDT_TIMER_CHECKBOOK, 60 * 1000 /*one minute*/, NULL);
     }
 }
 #endif
@@ -4156,58 +4192,6 @@ void ShowSysTray(HWND hWnd, BOOL bShow)
     }
 }
 
-HBITMAP CreateAlphaBGColorBitmap(HWND hWnd, COLORREF inColour, int width, int height, BYTE alpha)
-{
-    // Create DC and select font into it
-    HDC hColorDC = CreateCompatibleDC(NULL);
-    HBITMAP hDIB = NULL;
-    BITMAPINFOHEADER BMIH;
-    void *pvBits = NULL;
-    HBITMAP hOldBMP = NULL;
-    BYTE* DataPtr = NULL;
-    BYTE FillR,FillG,FillB;
-    int x,y;
-
-    // Specify DIB setup
-    memset(&BMIH, 0x0, sizeof(BITMAPINFOHEADER));
-    BMIH.biSize = sizeof(BMIH);
-    BMIH.biWidth = width;
-    BMIH.biHeight = height;
-    BMIH.biPlanes = 1;
-    BMIH.biBitCount = 32;
-    BMIH.biCompression = BI_RGB;
-
-    // Create and select DIB into DC
-    hDIB = CreateDIBSection(hColorDC, (LPBITMAPINFO)&BMIH, 0, (LPVOID*)&pvBits, NULL, 0); 
-    hOldBMP = (HBITMAP)SelectObject(hColorDC, hDIB);
-    if (hOldBMP)
-    {
-        DataPtr = (BYTE*)pvBits;
-        FillR = GetRValue(inColour);
-        FillG = GetGValue(inColour);
-        FillB = GetBValue(inColour);
-        for (y = 0; y < BMIH.biHeight; y++)
-        { 
-            for (x = 0; x < BMIH.biWidth; x++)
-            {
-                *DataPtr++ = (FillB * alpha) >> 8; 
-                *DataPtr++ = (FillG * alpha) >> 8; 
-                *DataPtr++ = (FillR * alpha) >> 8;
-                *DataPtr++ = alpha;
-            }
-        }
-
-        // De-select bitmap
-        SelectObject(hColorDC, hOldBMP);
-    }
-
-    // destroy temp DC
-    DeleteDC(hColorDC);
-
-    // Return DIBSection 
-    return hDIB;
-}
-
 void SetTreeviewFont()
 {
     static HFONT s_hFont = NULL;
@@ -4340,16 +4324,9 @@ BOOL LoadResourceImage(LPCWSTR lpName, LPCWSTR lpType, Gdiplus::Bitmap **image,
 
 book_source_t* FindBookSource(const char* host)
 {
-    int i = 0;
-
-    if (!host)
+    if (!host || !_BookSources)
         return NULL;
-    for (i = 0; i < _header->book_source_count; i++)
-    {
-        if (0 == strcmp(_header->book_sources[i].host, host))
-            return &_header->book_sources[i];
-    }
-    return NULL;
+    return _BookSources->Find(host);
 }
 
 void SetGlobalKey(HWND hWnd)
@@ -6,9 +6,11 @@
 #include "Cache.h"
 #include "Utils.h"
 #include "Book.h"
+#include "RenderContext.h"
 #ifdef ENABLE_NETWORK
 #include "Upgrade.h"
 #include "OnlineBook.h"
+#include "UpdateChecker.h"
 #include "https.h"
 #endif
 #include "HtmlParser.h"
@@ -30,7 +32,6 @@ struct chkbook_arg_t
 {
     HWND hWnd;
     OnlineBook* book;
-    std::set<std::wstring> checked_list;
 
     chkbook_arg_t()
     {
@@ -44,16 +45,20 @@ struct chkbook_arg_t
 Cache               _Cache(CACHE_FILE_NAME);
 header_t*           _header                 = NULL;
 item_t*             _item                   = NULL;
+BookSources*        _BookSources            = NULL;
 HWND                _hFindDlg               = NULL;
 HWND                _hTreeView              = NULL;
 HWND                _hTreeMark              = NULL;
 UINT                _uFindReplaceMsg        = 0;
 window_info_t       _WndInfo                = { 0 };
 BOOL                _IsAutoPage             = FALSE;
+LARGE_INTEGER       _ScrollTick             = { 0 };
 #ifdef ENABLE_NETWORK
 Upgrade             _Upgrade;
+UpdateChecker       _UpdateChecker;
 #endif
 Book *              _Book                   = NULL;
+RenderContext       _Render;
 loading_data_t *    _loading                = NULL;
 HHOOK               _hMouseHook             = NULL;
 #if ENABLE_GLOBAL_KEY
@@ -72,6 +77,8 @@ LRESULT             OnClearFileList(HWND, UINT, WPARAM, LPARAM);
 LRESULT             OnRestoreDefault(HWND, UINT, WPARAM, LPARAM);
 LRESULT             OnPaint(HWND, HDC);
 VOID                OnDraw(HWND);
+VOID                OnPrerender(HWND);
+VOID                OnSmoothScroll(HWND);
 BOOL                ResetLayerd(HWND);
 VOID                Invalidate(HWND, BOOL, BOOL);
 LRESULT             OnSize(HWND, UINT, WPARAM, LPARAM);
@@ -124,12 +131,13 @@ void                StopAutoPage(HWND);
 void                PauseAutoPage(HWND);
 void                ResumeAutoPage(HWND);
 void                ResetAutoPage(HWND hWnd);
+BOOL                IsSmoothAutoPage(void);
 #ifdef ENABLE_NETWORK
 void                CheckUpgrade(HWND);
 BOOL                UpgradeCallback(void *, json_item_data_t *);
 chkbook_arg_t*      GetCheckBookArguments();
 void                StartCheckBookUpdate(HWND hWnd);
-void                OnCheckBookUpdateCallback(int is_update, int err, void* param);
+void                OnBookUpdateResult(const TCHAR* file_name, int is_update, int err, void* arg);
 void                OnCheckBookUpdate(HWND hWnd);
 void                OnOpenOlBook(HWND, void*);
 void                UpdateBookMark(HWND, int, int);
@@ -140,7 +148,6 @@ ULONGLONG           GetDllVersion(LPCTSTR);
 BOOL CALLBACK       EnumWindowsProc(HWND, LPARAM);
 void                ShowInTaskbar(HWND, BOOL);
 void                ShowSysTray(HWND, BOOL);
-HBITMAP             CreateAlphaBGColorBitmap(HWND hWnd, COLORREF inColour, int width, int height, BYTE alpha);
 void                SetTreeviewFont();
 BOOL                LoadResourceImage(LPCWSTR, LPCWSTR, Gdiplus::Bitmap**, HGLOBAL*);
 book_source_t*      FindBookSource(const char* host);
@@ -0,0 +1,253 @@
+#include "RenderContext.h"
+
+extern header_t* _header;
+
+BOOL render_surface_create(HDC hdc, render_surface_t *surface, int width, int height, BOOL dib)
+{
+    BITMAPINFOHEADER BMIH;
+
+    memset(surface, 0, sizeof(render_surface_t));
+    if (width <= 0 || height <= 0)
+        return FALSE;
+
+    surface->hdc = CreateCompatibleDC(hdc);
+    if (dib)
+    {
+        memset(&BMIH, 0x0, sizeof(BITMAPINFOHEADER));
+        BMIH.biSize = sizeof(BMIH);
+        BMIH.biWidth = width;
+        BMIH.biHeight = height;
+        BMIH.biPlanes = 1;
+        BMIH.biBitCount = 32;
+        BMIH.biCompression = BI_RGB;
+        surface->hBitmap = CreateDIBSection(hdc, (LPBITMAPINFO)&BMIH, 0, (LPVOID*)&surface->pvBits, NULL, 0);
+    }
+    else
+    {
+        surface->hBitmap = CreateCompatibleBitmap(hdc, width, height);
+    }
+
+    if (!surface->hdc || !surface->hBitmap)
+    {
+        render_surface_delete(surface);
+        return FALSE;
+    }
+    surface->hOld = (HBITMAP)SelectObject(surface->hdc, surface->hBitmap);
+    surface->width = width;
+    surface->height = height;
+    surface->dib = dib;
+    return TRUE;
+}
+
+void render_surface_delete(render_surface_t *surface)
+{
+    if (surface->hdc)
+    {
+        if (surface->hOld)
+            SelectObject(surface->hdc, surface->hOld);
+        DeleteDC(surface->hdc);
+    }
+    if (surface->hBitmap)
+        DeleteObject(surface->hBitmap);
+    memset(surface, 0, sizeof(render_surface_t));
+}
+
+RenderContext::RenderContext()
+{
+    memset(&m_Back, 0, sizeof(render_surface_t));
+    memset(&m_Bg, 0, sizeof(render_surface_t));
+    memset(&m_Text, 0, sizeof(render_surface_t));
+    memset(&m_BgKey, 0, sizeof(render_bg_key_t));
+    memset(&m_Counter, 0, sizeof(render_counter_t));
+    m_BgId = 0;
+}
+
+RenderContext::~RenderContext()
+{
+    Release();
+}
+
+void RenderContext::BeginFrame(void)
+{
+    m_Counter.frame_allocs = 0;
+}
+
+void RenderContext::EndFrame(void)
+{
+    m_Counter.frames++;
+    if (m_Counter.frame_allocs)
+    {
+        logger_printk("frame=%u, allocs=%u, total=%u", m_Counter.frames, m_Counter.frame_allocs, m_Counter.total_allocs);
+    }
+}
+
+void RenderContext::CountAlloc(u32 count)
+{
+    m_Counter.frame_allocs += count;
+    m_Counter.total_allocs += count;
+}
+
+const render_counter_t* RenderContext::GetCounter(void)
+{
+    return &m_Counter;
+}
+
+HDC RenderContext::GetBackBuffer(HDC hdc, int width, int height, COLORREF color, Gdiplus::Bitmap *image, BOOL fill)
+{
+    render_bg_key_t key;
+
+    memset(&key, 0, sizeof(render_bg_key_t));
+    key.layered = FALSE;
+    key.image = image;
+    key.color = color;
+    key.alpha = 0xFF;
+    key.width = width;
+    key.height = height;
+
+    if (!CheckSurface(hdc, &m_Back, width, height, FALSE))
+        return NULL;
+    UpdateBackground(hdc, &key, image);
+    if (fill)
+        CopySurface(&m_Back, &m_Bg);
+    return m_Back.hdc;
+}
+
+HDC RenderContext::GetLayerBuffer(HDC hdc, int width, int height, COLORREF color, BYTE alpha, Gdiplus::Bitmap *image)
+{
+    render_bg_key_t key;
+
+    memset(&key, 0, sizeof(render_bg_key_t));
+    key.layered = TRUE;
+    key.image = image;
+    key.color = color;
+    key.alpha = alpha;
+    key.width = width;
+    key.height = height;
+
+    if (!CheckSurface(hdc, &m_Back, width, height, TRUE))
+        return NULL;
+    UpdateBackground(hdc, &key, image);
+    CopySurface(&m_Back, &m_Bg);
+    return m_Back.hdc;
+}
+
+HDC RenderContext::GetTextDC(HDC hdc, int width, int height)
+{
+    if (!CheckSurface(hdc, &m_Text, width, height, TRUE))
+        return NULL;
+    return m_Text.hdc;
+}
+
+HDC RenderContext::GetBackgroundDC(void)
+{
+    return m_BgKey.layered ? NULL : m_Bg.hdc;
+}
+
+u32 RenderContext::GetBackgroundId(void)
+{
+    return m_BgId;
+}
+
+void RenderContext::Release(void)
+{
+    render_surface_delete(&m_Back);
+    render_surface_delete(&m_Bg);
+    render_surface_delete(&m_Text);
+    memset(&m_BgKey, 0, sizeof(render_bg_key_t));
+}
+
+void RenderContext::UpdateBackground(HDC hdc, render_bg_key_t *key, Gdiplus::Bitmap *image)
+{
+    HBITMAP hBmp = NULL;
+    HDC hImgDC;
+    HBITMAP hOld;
+    UINT *bits;
+    UINT pixel;
+    int i, count;
+    RECT rc;
+    HBRUSH hBrush;
+
+    // LoadBGImage may hand out a new image at a reused address, check its source too
+    if (image && _header)
+    {
+        _tcscpy(key->file_name, _header->bg_image.file_name);
+        key->mode = _header->bg_image.mode;
+    }
+
+    if (m_Bg.hBitmap && memcmp(key, &m_BgKey, sizeof(render_bg_key_t)) == 0)
+        return;
+
+    if (!CheckSurface(hdc, &m_Bg, key->width, key->height, key->layered))
+        return;
+
+    if (image)
+    {
+        image->GetHBITMAP(Gdiplus::Color(0, 0, 0, 0), &hBmp);
+        if (hBmp)
+        {
+            hImgDC = CreateCompatibleDC(hdc);
+            hOld = (HBITMAP)SelectObject(hImgDC, hBmp);
+            BitBlt(m_Bg.hdc, 0, 0, key->width, key->height, hImgDC, 0, 0, SRCCOPY);
+            SelectObject(hImgDC, hOld);
+            DeleteDC(hImgDC);
+            DeleteObject(hBmp);
+            CountAlloc(2);
+        }
+    }
+    else if (key->layered)
+    {
+        // premultiplied color, one pixel pattern
+        pixel = ((UINT)key->alpha << 24)
+            | (((GetRValue(key->color) * key->alpha) >> 8) << 16)
+            | (((GetGValue(key->color) * key->alpha) >> 8) << 8)
+            | ((GetBValue(key->color) * key->alpha) >> 8);
+        bits = (UINT *)m_Bg.pvBits;
+        count = key->width * key->height;
+        for (i = 0; i < count; i++)
+            bits[i] = pixel;
+    }
+    else
+    {
+        rc.left = 0;
+        rc.top = 0;
+        rc.right = key->width;
+        rc.bottom = key->height;
+        hBrush = CreateSolidBrush(key->color);
+        FillRect(m_Bg.hdc, &rc, hBrush);
+        DeleteObject(hBrush);
+        CountAlloc(1);
+    }
+
+    memcpy(&m_BgKey, key, sizeof(render_bg_key_t));
+    m_BgId++;
+}
+
+BOOL RenderContext::CheckSurface(HDC hdc, render_surface_t *surface, int width, int height, BOOL dib)
+{
+    if (surface->hBitmap && surface->width == width && surface->height == height && surface->dib == dib)
+        return TRUE;
+
+    render_surface_delete(surface);
+    if (width <= 0 || height <= 0)
+        return FALSE;
+
+    CountAlloc(2);
+    if (!render_surface_create(hdc, surface, width, height, dib))
+        return FALSE;
+
+    // background follows the surface
+    if (surface == &m_Bg)
+        memset(&m_BgKey, 0, sizeof(render_bg_key_t));
+    return TRUE;
+}
+
+void RenderContext::CopySurface(render_surface_t *dst, render_surface_t *src)
+{
+    if (!src->hBitmap)
+        return;
+
+    if (dst->pvBits && src->pvBits)
+        memcpy(dst->pvBits, src->pvBits, dst->width * dst->height * 4);
+    else
+        BitBlt(dst->hdc, 0, 0, dst->width, dst->height, src->hdc, 0, 0, SRCCOPY);
+}
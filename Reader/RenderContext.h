@@ -0,0 +1,81 @@
+#ifndef __RENDER_CONTEXT_H__
+#define __RENDER_CONTEXT_H__
+
+#include "types.h"
+
+typedef struct render_surface_t
+{
+    HDC hdc;
+    HBITMAP hBitmap;
+    HBITMAP hOld;
+    BYTE *pvBits; // NULL for device dependent bitmaps
+    int width;
+    int height;
+    BOOL dib;
+} render_surface_t;
+
+typedef struct render_bg_key_t
+{
+    BOOL layered;
+    void *image;
+    TCHAR file_name[MAX_PATH];
+    int mode;
+    COLORREF color;
+    BYTE alpha;
+    int width;
+    int height;
+} render_bg_key_t;
+
+typedef struct render_counter_t
+{
+    u32 frames;
+    u32 frame_allocs;   // GDI objects created by the last frame
+    u32 total_allocs;
+} render_counter_t;
+
+// 32bpp DIB when dib is TRUE, otherwise compatible with hdc; selected into its own DC
+BOOL render_surface_create(HDC hdc, render_surface_t *surface, int width, int height, BOOL dib);
+void render_surface_delete(render_surface_t *surface);
+
+// Owns the DCs and bitmaps used by OnPaint/OnDraw across frames.
+// They are rebuilt only when the window size, background or colors change,
+// a steady state frame creates no GDI object.
+class RenderContext
+{
+public:
+    RenderContext();
+    ~RenderContext();
+
+public:
+    void BeginFrame(void);
+    void EndFrame(void);
+    void CountAlloc(u32 count);
+    const render_counter_t* GetCounter(void);
+
+    // compatible back buffer, with fill FALSE the last frame is kept and the caller
+    // draws the background itself from GetBackgroundDC()
+    HDC GetBackBuffer(HDC hdc, int width, int height, COLORREF color, Gdiplus::Bitmap *image, BOOL fill = TRUE);
+    // premultiplied 32bpp buffer with the background already drawn, for layered window
+    HDC GetLayerBuffer(HDC hdc, int width, int height, COLORREF color, BYTE alpha, Gdiplus::Bitmap *image);
+    // 32bpp DIB for Page::DrawPage, the content is not cleared
+    HDC GetTextDC(HDC hdc, int width, int height);
+    // cached background of the normal window and its id, changes on every rebuild
+    HDC GetBackgroundDC(void);
+    u32 GetBackgroundId(void);
+    void Release(void);
+
+private:
+    void UpdateBackground(HDC hdc, render_bg_key_t *key, Gdiplus::Bitmap *image);
+    BOOL CheckSurface(HDC hdc, render_surface_t *surface, int width, int height, BOOL dib);
+    void CopySurface(render_surface_t *dst, render_surface_t *src);
+
+private:
+    render_surface_t m_Back;
+    render_surface_t m_Bg;
+    render_surface_t m_Text;
+    render_bg_key_t m_BgKey;
+    render_counter_t m_Counter;
+    u32 m_BgId;
+};
+
+#endif
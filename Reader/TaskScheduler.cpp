@@ -0,0 +1,314 @@
+#include "TaskScheduler.h"
+#include <chrono>
+
+#define MIN_WORKER_COUNT        2
+#define MAX_WORKER_COUNT        8
+
+struct task_t
+{
+    task_proc_t proc;
+    void *arg;
+    task_priority_t priority;
+    task_token_t *token;
+    const char *name;
+    std::atomic<int> ref;
+    std::mutex lock;
+    std::condition_variable done_cv;
+    BOOL done;
+    unsigned result;
+    u64 submit_time;
+};
+
+static TaskScheduler *s_TaskScheduler = NULL;
+static thread_local void *s_Worker = NULL; // worker_t of the calling thread
+
+TaskScheduler::TaskScheduler()
+    : m_Pending(0)
+    , m_Exit(false)
+    , m_Next(0)
+{
+    worker_t *worker;
+    int count, i;
+
+    memset(m_Stats, 0, sizeof(m_Stats));
+
+    count = (int)std::thread::hardware_concurrency();
+    if (count < MIN_WORKER_COUNT)
+        count = MIN_WORKER_COUNT;
+    if (count > MAX_WORKER_COUNT)
+        count = MAX_WORKER_COUNT;
+
+    // create all workers first, so that stealing never sees a half built list
+    for (i = 0; i < count; i++)
+    {
+        worker = new worker_t;
+        worker->_this = this;
+        worker->id = i;
+        m_Workers.push_back(worker);
+    }
+    for (i = 0; i < count; i++)
+    {
+        m_Workers[i]->thread = std::thread(WorkerThread, m_Workers[i]);
+    }
+}
+
+TaskScheduler::~TaskScheduler()
+{
+    int i;
+
+    // the workers drain the queues first, a pending save is still written
+    {
+        std::lock_guard<std::mutex> lock(m_Lock);
+        m_Exit = true;
+    }
+    m_Wake.notify_all();
+    for (i = 0; i < (int)m_Workers.size(); i++)
+    {
+        if (m_Workers[i]->thread.joinable())
+            m_Workers[i]->thread.join();
+    }
+    for (i = 0; i < (int)m_Workers.size(); i++)
+    {
+        delete m_Workers[i];
+    }
+    m_Workers.clear();
+}
+
+TaskScheduler* TaskScheduler::Instance()
+{
+    if (!s_TaskScheduler)
+        s_TaskScheduler = new TaskScheduler;
+    return s_TaskScheduler;
+}
+
+void TaskScheduler::ReleaseInstance()
+{
+    if (s_TaskScheduler)
+    {
+        delete s_TaskScheduler;
+        s_TaskScheduler = NULL;
+    }
+}
+
+task_t* TaskScheduler::Submit(task_proc_t proc, void *arg, task_priority_t priority, task_token_t *token, const char *name)
+{
+    task_t *task;
+    worker_t *worker;
+
+    if (!proc || m_Workers.empty())
+        return NULL;
+    if (priority < task_high || priority >= task_priority_count)
+        priority = task_normal;
+
+    task = new task_t;
+    task->proc = proc;
+    task->arg = arg;
+    task->priority = priority;
+    task->token = token;
+    task->name = name ? name : "";
+    task->ref = 2; // one for the queue, one for the caller
+    task->done = FALSE;
+    task->result = 0;
+    task->submit_time = Now();
+
+    // counted before it is queued, the workers do not exit while it is pending
+    {
+        std::lock_guard<std::mutex> lock(m_Lock);
+        if (m_Exit)
+        {
+            delete task;
+            return NULL;
+        }
+        m_Pending++;
+    }
+
+    // sub tasks stay on the submitting worker, others are spread round robin
+    worker = (worker_t *)s_Worker;
+    if (!worker || worker->_this != this)
+        worker = m_Workers[m_Next++ % m_Workers.size()];
+
+    {
+        std::lock_guard<std::mutex> lock(worker->lock);
+        worker->queues[priority].push_back(task);
+    }
+    {
+        std::lock_guard<std::mutex> lock(m_StatsLock);
+        m_Stats[priority].submitted++;
+    }
+    m_Wake.notify_one();
+    return task;
+}
+
+BOOL TaskScheduler::Wait(task_t *task, DWORD timeout)
+{
+    if (!task)
+        return TRUE;
+
+    std::unique_lock<std::mutex> lock(task->lock);
+    if (timeout == INFINITE)
+    {
+        task->done_cv.wait(lock, [task] { return task->done != FALSE; });
+        return TRUE;
+    }
+    return task->done_cv.wait_for(lock, std::chrono::milliseconds(timeout), [task] { return task->done != FALSE; }) ? TRUE : FALSE;
+}
+
+BOOL TaskScheduler::IsDone(task_t *task)
+{
+    return Wait(task, 0);
+}
+
+unsigned TaskScheduler::GetResult(task_t *task)
+{
+    return task ? task->result : 0;
+}
+
+void TaskScheduler::Release(task_t *task)
+{
+    if (!task)
+        return;
+    if (--task->ref == 0)
+        delete task;
+}
+
+void TaskScheduler::GetStats(task_priority_t priority, task_stats_t *stats)
+{
+    if (!stats || priority < task_high || priority >= task_priority_count)
+        return;
+    std::lock_guard<std::mutex> lock(m_StatsLock);
+    memcpy(stats, &m_Stats[priority], sizeof(task_stats_t));
+}
+
+int TaskScheduler::GetWorkerCount(void)
+{
+    return (int)m_Workers.size();
+}
+
+task_t* TaskScheduler::Pop(worker_t *worker, BOOL *stolen)
+{
+    task_t *task = NULL;
+    worker_t *victim;
+    int count = (int)m_Workers.size();
+    int i, j;
+
+    // higher lanes first; own queue from the front, victims from the back
+    for (i = 0; i < task_priority_count; i++)
+    {
+        {
+            std::lock_guard<std::mutex> lock(worker->lock);
+            if (!worker->queues[i].empty())
+            {
+                task = worker->queues[i].front();
+                worker->queues[i].pop_front();
+            }
+        }
+        if (task)
+        {
+            *stolen = FALSE;
+            return task;
+        }
+
+        for (j = 1; j < count; j++)
+        {
+            victim = m_Workers[(worker->id + j) % count];
+            {
+                std::lock_guard<std::mutex> lock(victim->lock);
+                if (!victim->queues[i].empty())
+                {
+                    task = victim->queues[i].back();
+                    victim->queues[i].pop_back();
+                }
+            }
+            if (task)
+            {
+                *stolen = TRUE;
+                return task;
+            }
+        }
+    }
+    return NULL;
+}
+
+void TaskScheduler::Run(worker_t *worker, task_t *task, BOOL stolen)
+{
+    u64 begin, wait_us, run_us = 0;
+    BOOL cancelled;
+
+    (void)worker;
+    begin = Now();
+    wait_us = begin - task->submit_time;
+
+    // a task cancelled before it started still runs, it owns arg and returns at
+    // once; the token is not touched once it returns, its owner may be gone
+    cancelled = task->token && ReadAcquire(&task->token->cancel);
+    task->result = task->proc(task->arg, task->token);
+    run_us = Now() - begin;
+
+    {
+        std::lock_guard<std::mutex> lock(m_StatsLock);
+        if (cancelled)
+        {
+            m_Stats[task->priority].cancelled++;
+        }
+        else
+        {
+            m_Stats[task->priority].completed++;
+        }
+        m_Stats[task->priority].run_us += run_us;
+        if (run_us > m_Stats[task->priority].max_run_us)
+            m_Stats[task->priority].max_run_us = run_us;
+        if (stolen)
+            m_Stats[task->priority].stolen++;
+        m_Stats[task->priority].wait_us += wait_us;
+    }
+
+    logger_printk("task[%s] worker=%d, lane=%d, wait=%lluus, run=%lluus%s", task->name, worker->id,
+        task->priority, wait_us, run_us, cancelled ? ", cancelled" : "");
+
+    Finish(task);
+}
+
+void TaskScheduler::Finish(task_t *task)
+{
+    {
+        std::lock_guard<std::mutex> lock(task->lock);
+        task->done = TRUE;
+    }
+    task->done_cv.notify_all();
+    Release(task);
+}
+
+u64 TaskScheduler::Now(void)
+{
+    return (u64)std::chrono::duration_cast<std::chrono::microseconds>(
+        std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+void TaskScheduler::WorkerThread(worker_t *worker)
+{
+    TaskScheduler *_this = worker->_this;
+    task_t *task;
+    BOOL stolen;
+
+    s_Worker = worker;
+    while (TRUE)
+    {
+        // one pending count per queued task, a woken worker always finds one
+        {
+            std::unique_lock<std::mutex> lock(_this->m_Lock);
+            _this->m_Wake.wait(lock, [_this] { return _this->m_Exit || _this->m_Pending > 0; });
+            if (_this->m_Pending == 0)
+                break;
+            _this->m_Pending--;
+        }
+        task = NULL;
+        while (!task)
+        {
+            task = _this->Pop(worker, &stolen);
+            if (!task)
+                std::this_thread::yield();
+        }
+        _this->Run(worker, task, stolen);
+    }
+    s_Worker = NULL;
+}
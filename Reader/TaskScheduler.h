@@ -0,0 +1,97 @@
+#ifndef __TASK_SCHEDULER_H__
+#define __TASK_SCHEDULER_H__
+
+#include "types.h"
+#include <deque>
+#include <vector>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <atomic>
+
+typedef enum task_priority_t
+{
+    task_high,      // work for the visible page
+    task_normal,    // book parsing, chapter indexing
+    task_low,       // background checking, persistence
+    task_priority_count
+} task_priority_t;
+
+// cancellation token, owned by the submitter and must outlive the task; the
+// flag is set by InterlockedExchange and tested by ReadAcquire on any thread
+typedef struct task_token_t
+{
+    volatile LONG cancel;
+} task_token_t;
+
+// runs once, also when the token was cancelled before it started: it frees
+// what arg owns and returns at once then
+typedef unsigned (*task_proc_t)(void *arg, task_token_t *token);
+
+typedef struct task_stats_t
+{
+    u32 submitted;
+    u32 completed;
+    u32 cancelled;      // cancelled before it started, ran only to free arg
+    u32 stolen;
+    u64 wait_us;        // queued time
+    u64 run_us;
+    u64 max_run_us;
+} task_stats_t;
+
+typedef struct task_t task_t;
+
+// Worker threads with a queue per priority lane each. A task is queued on the
+// worker that submits it, or round robin from other threads; an idle worker
+// steals from the back of the others. Only the standard library is used, it
+// builds and runs the same off Windows.
+class TaskScheduler
+{
+private:
+    TaskScheduler();
+    ~TaskScheduler();
+
+public:
+    static TaskScheduler* Instance();
+    static void ReleaseInstance();      // runs the queued tasks to the end first
+
+    // returned handle must be freed by Release(), which does not wait:
+    // a task released while it runs finishes on its own
+    task_t* Submit(task_proc_t proc, void *arg, task_priority_t priority, task_token_t *token, const char *name);
+    BOOL Wait(task_t *task, DWORD timeout);     // ms or INFINITE, TRUE once the task is done
+    BOOL IsDone(task_t *task);
+    unsigned GetResult(task_t *task);
+    void Release(task_t *task);
+    void GetStats(task_priority_t priority, task_stats_t *stats);
+    int GetWorkerCount(void);
+
+private:
+    typedef std::deque<task_t *> queue_t;
+    typedef struct worker_t
+    {
+        TaskScheduler *_this;
+        int id;
+        std::thread thread;
+        std::mutex lock;
+        queue_t queues[task_priority_count];
+    } worker_t;
+
+    task_t* Pop(worker_t *worker, BOOL *stolen);
+    void Run(worker_t *worker, task_t *task, BOOL stolen);
+    void Finish(task_t *task);
+    static u64 Now(void);
+
+    static void WorkerThread(worker_t *worker);
+
+private:
+    std::vector<worker_t *> m_Workers;
+    std::mutex m_Lock;                  // m_Pending and m_Exit
+    std::condition_variable m_Wake;
+    int m_Pending;                      // queued tasks no worker has woken up for
+    bool m_Exit;
+    std::atomic<unsigned> m_Next;
+    std::mutex m_StatsLock;
+    task_stats_t m_Stats[task_priority_count];
+};
+
+#endif
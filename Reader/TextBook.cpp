@@ -262,10 +262,11 @@ end:
 
 BOOL TextBook::ReadBook(void)
 {
-    FILE *fp = NULL;
-    char *buf = NULL;
-    int len;
-    int size;
+    HANDLE hFile = INVALID_HANDLE_VALUE;
+    HANDLE hMapping = NULL;
+    LARGE_INTEGER size;
+    const char *buf = NULL;
+    size_t len;
     BOOL ret = FALSE;
 
     if (m_Data && m_Size > 0)
@@ -275,22 +276,27 @@ BOOL TextBook::ReadBook(void)
     }
     else if (m_fileName[0])
     {
-        fp = _tfopen(m_fileName, _T("rb"));
-        if (!fp)
-            goto end;
-
-        fseek(fp, 0, SEEK_END);
-        len = ftell(fp);
-        fseek(fp, 0, SEEK_SET);
-
-        buf = (char *)malloc(len + 2);
-        buf[len] = 0;
-        buf[len+1] = 0;
-        if (!buf)
+        // mapped rather than read, the pages are decoded a slice at a time and
+        // dropped again, a file of several GB never has a heap copy
+        hFile = CreateFileW(m_fileName, GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_FLAG_SEQUENTIAL_SCAN, NULL);
+        if (hFile == INVALID_HANDLE_VALUE)
             goto end;
-        size = (int)fread(buf, 1, len, fp);
-        if (size != len)
+        if (!GetFileSizeEx(hFile, &size) || (u64)size.QuadPart > (SIZE_T)-1)
             goto end;
+        len = (size_t)size.QuadPart;
+        if (len == 0)
+        {
+            buf = "";
+        }
+        else
+        {
+            hMapping = CreateFileMapping(hFile, NULL, PAGE_READONLY, 0, 0, NULL);
+            if (!hMapping)
+                goto end;
+            buf = (const char *)MapViewOfFile(hMapping, FILE_MAP_READ, 0, 0, 0);
+            if (!buf)
+                goto end;
+        }
     }
     else
     {
@@ -300,18 +306,25 @@ BOOL TextBook::ReadBook(void)
     if (!DecodeText(buf, len, &m_Text, &m_Length))
         goto end;
 
-    if (m_bForceKill)
+    if (ReadAcquire(&m_Token.cancel))
         goto end;
 
     ret = TRUE;
 
 end:
-    if (fp)
-        fclose(fp);
-    if (buf)
-        free(buf);
+    if (hMapping)
+    {
+        if (buf)
+            UnmapViewOfFile(buf);
+        CloseHandle(hMapping);
+    }
+    if (hFile != INVALID_HANDLE_VALUE)
+        CloseHandle(hFile);
     if (m_Data)
+    {
+        free(m_Data);
         m_Data = NULL;
+    }
     m_Size = 0;
 
     return ret;
@@ -347,12 +360,11 @@ BOOL TextBook::ParserChaptersDefault(void)
     int title_len = 0;
     BOOL bFound = FALSE;
     int idx_1 = -1, idx_2 = -1;
-    chapter_item_t chapter;
     std::wstring number_marker;
 
     while (TRUE)
     {
-        if (m_bForceKill)
+        if (ReadAcquire(&m_Token.cancel))
         {
             return FALSE;
         }
@@ -394,10 +406,7 @@ BOOL TextBook::ParserChaptersDefault(void)
             std::wstring combined = BuildChapterTitle(number_marker, title_line);
             if (!combined.empty())
             {
-                chapter.index = (int)(text - m_Text);
-                chapter.title = combined;
-                chapter.title_len = (int)combined.size();
-                m_Chapters.push_back(chapter);
+                m_Chapters.push_back((int)(text - m_Text), combined.c_str(), (int)combined.size());
 
                 text += consumed;
                 continue;
@@ -462,10 +471,7 @@ BOOL TextBook::ParserChaptersDefault(void)
             memcpy(title, text + idx_1, title_len * sizeof(wchar_t));
             title[title_len] = 0;
 
-            chapter.index = /*idx_1 +*/ (int)(text - m_Text);
-            chapter.title = title;
-            chapter.title_len = title_len;
-            m_Chapters.push_back(chapter);
+            m_Chapters.push_back(/*idx_1 +*/ (int)(text - m_Text), title, title_len);
         }
 
         // set index
@@ -484,11 +490,10 @@ BOOL TextBook::ParserChaptersKeyword(void)
     BOOL bFound = FALSE;
     int idx_1 = -1;
     int cmplen;
-    chapter_item_t chapter;
 
     while (TRUE)
     {
-        if (m_bForceKill)
+        if (ReadAcquire(&m_Token.cancel))
         {
             return FALSE;
         }
@@ -519,10 +524,7 @@ BOOL TextBook::ParserChaptersKeyword(void)
                 memcpy(title, text + idx_1, title_len * sizeof(wchar_t));
                 title[title_len] = 0;
 
-                chapter.index = /*idx_1 +*/ (int)(text - m_Text);
-                chapter.title = title;
-                chapter.title_len = title_len;
-                m_Chapters.push_back(chapter);
+                m_Chapters.push_back(/*idx_1 +*/ (int)(text - m_Text), title, title_len);
             }
         }
 
@@ -536,7 +538,6 @@ BOOL TextBook::ParserChaptersRegex(void)
 {
     wchar_t title[MAX_CHAPTER_LENGTH] = { 0 };
     int title_len = 0;
-    chapter_item_t chapter;
     int offset = 0;
     std::wcmatch cm;
     std::wregex *e = NULL;
@@ -557,7 +558,7 @@ BOOL TextBook::ParserChaptersRegex(void)
 
     while (std::regex_search(text, cm, *e, std::regex_constants::format_first_only))
     {
-        if (m_bForceKill)
+        if (ReadAcquire(&m_Token.cancel))
         {
             break;
         }
@@ -566,10 +567,7 @@ BOOL TextBook::ParserChaptersRegex(void)
         memcpy(title, cm.str().c_str(), title_len * sizeof(wchar_t));
         title[title_len] = 0;
 
-        chapter.index = offset + (int)cm.position();
-        chapter.title = title;
-        chapter.title_len = title_len;
-        m_Chapters.push_back(chapter);
+        m_Chapters.push_back(offset + (int)cm.position(), title, title_len);
 
 
         text += cm.position() + cm.length();
@@ -0,0 +1,65 @@
+#include "TextDecode.h"
+
+size_t mb_slice(UINT cp, const char* str, size_t size, size_t slice)
+{
+    size_t n = slice;
+    size_t i;
+
+    if (size <= slice)
+        return size;
+    if (cp == CP_UTF8)
+    {
+        // not inside a sequence, at most three continuation bytes back
+        for (i = 0; i < 3 && ((u8)str[n] & 0xC0) == 0x80; i++)
+            n--;
+        return n;
+    }
+    // a byte that cannot lead ends a character, the lead bytes after it pair
+    // up from there; an odd run leaves a lead byte right before the cut
+    for (i = n; i > 0 && IsDBCSLeadByteEx(cp, (BYTE)str[i - 1]); i--)
+        ;
+    if ((n - i) & 1)
+        n--;
+    return n;
+}
+
+wchar_t* mb_to_utf16(UINT cp, const char* str, size_t size, size_t slice, int* len)
+{
+    wchar_t* result;
+    size_t pos, end;
+    u64 total = 0;
+    int n;
+
+    // counted first, the text is allocated once
+    for (pos = 0; pos < size; pos = end)
+    {
+        end = pos + mb_slice(cp, str + pos, size - pos, slice);
+        n = MultiByteToWideChar(cp, 0, str + pos, (int)(end - pos), NULL, 0);
+        if (n <= 0)
+            return NULL;
+        total += n;
+        if (total > (u64)TEXT_MAX_LENGTH)
+            return NULL;
+    }
+    result = (wchar_t*)malloc((size_t)(total + 1) * sizeof(wchar_t));
+    if (!result)
+        return NULL;
+    *len = 0;
+    for (pos = 0; pos < size; pos = end)
+    {
+        end = pos + mb_slice(cp, str + pos, size - pos, slice);
+        *len += MultiByteToWideChar(cp, 0, str + pos, (int)(end - pos), (LPWSTR)result + *len, (int)total - *len);
+    }
+    result[*len] = 0;
+    return result;
+}
+
+wchar_t* ansi_to_utf16_ex(const char* str, size_t size, int* len)
+{
+    return mb_to_utf16(CP_ACP, str, size, MB_SLICE_SIZE, len);
+}
+
+wchar_t* utf8_to_utf16_ex(const char* str, size_t size, int* len)
+{
+    return mb_to_utf16(CP_UTF8, str, size, MB_SLICE_SIZE, len);
+}
@@ -0,0 +1,19 @@
+#ifndef __TEXT_DECODE_H__
+#define __TEXT_DECODE_H__
+
+#include "types.h"
+#include <limits.h>
+
+#define MB_SLICE_SIZE   (64 << 20)  // bytes per MultiByteToWideChar call, its sizes are int
+// characters of text a book can hold: offsets into it are int, and so are
+// its size in bytes here and there; a longer one fails to open
+#define TEXT_MAX_LENGTH ((int)(INT_MAX / sizeof(TCHAR)))
+
+// Text of any size to UTF-16 through MultiByteToWideChar, one slice at a
+// time, never cutting a character; NULL when it is over TEXT_MAX_LENGTH.
+size_t mb_slice(UINT cp, const char* str, size_t size, size_t slice);
+wchar_t* mb_to_utf16(UINT cp, const char* str, size_t size, size_t slice, int* len);
+wchar_t* ansi_to_utf16_ex(const char* str, size_t size, int* len);
+wchar_t* utf8_to_utf16_ex(const char* str, size_t size, int* len);
+
+#endif
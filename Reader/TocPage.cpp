@@ -0,0 +1,146 @@
+#ifdef ENABLE_NETWORK
+#include "TocPage.h"
+
+u32 toc_hash(u32 hash, const void *data, size_t size)
+{
+    const BYTE *p = (const BYTE *)data;
+    size_t i;
+
+    // FNV-1a
+    for (i = 0; i < size; i++)
+    {
+        hash ^= p[i];
+        hash *= 16777619u;
+    }
+    return hash;
+}
+
+static void toc_header_value(const http_header_t *header, const char *name, char *value, size_t size)
+{
+    const char *p;
+
+    value[0] = 0;
+    for (; header; header = header->next)
+    {
+        if (header->name && header->value && _stricmp(header->name, name) == 0)
+        {
+            p = header->value;
+            while (*p == ' ' || *p == '\t')
+                p++;
+            if (strlen(p) < size)
+                strcpy(value, p);
+            return;
+        }
+    }
+}
+
+// header holds 256 chars, the server answers 304 when the list did not change
+void toc_request_header(const ol_toc_t *last, char *header)
+{
+    header[0] = 0;
+    if (last->etag[0])
+        sprintf(header, "If-None-Match: %s\r\n", last->etag);
+    if (last->last_modified[0])
+        sprintf(header + strlen(header), "If-Modified-Since: %s\r\n", last->last_modified);
+}
+
+// TRUE when the body is the page of the last check byte for byte
+BOOL toc_read_page(const ol_toc_t *last, const request_result_t *result, ol_toc_t *toc)
+{
+    memset(toc, 0, sizeof(ol_toc_t));
+    toc->hash = toc_hash(TOC_HASH_INIT, result->body, result->bodylen);
+    toc_header_value(result->header, "ETag", toc->etag, sizeof(toc->etag));
+    toc_header_value(result->header, "Last-Modified", toc->last_modified, sizeof(toc->last_modified));
+    if (last->count > 0 && toc->hash == last->hash)
+    {
+        toc->count = last->count;
+        toc->prefix_hash = last->prefix_hash;
+        return TRUE;
+    }
+    return FALSE;
+}
+
+// the entries before the one returned are those of the last check, in the
+// same order; titles.size() when the list is that one, 0 when its head changed
+int toc_new_entries(const ol_toc_t *last, const std::vector<std::string> &titles, const std::vector<std::string> &urls, ol_toc_t *toc)
+{
+    u32 hash = TOC_HASH_INIT;
+    int first = 0;
+    int i;
+
+    for (i = 0; i < (int)urls.size(); i++)
+    {
+        if ((u32)i == last->count && hash == last->prefix_hash)
+            first = i;
+        hash = toc_hash(hash, titles[i].c_str(), titles[i].size() + 1);
+        hash = toc_hash(hash, urls[i].c_str(), urls[i].size() + 1);
+    }
+    if ((u32)i == last->count && hash == last->prefix_hash)
+        first = i;
+    toc->count = (u32)urls.size();
+    toc->prefix_hash = hash;
+    return first;
+}
+
+BOOL toc_parse_pattern(const char *first, const char *next, toc_pattern_t *pattern)
+{
+    int flen = (int)strlen(first);
+    int nlen = (int)strlen(next);
+    int p = 0, s = 0;
+    int i, m = -1, n;
+    int midlen, seplen;
+    const char *mid;
+
+    // common prefix and suffix, the numbers between them are kept whole
+    while (p < flen && p < nlen && first[p] == next[p])
+        p++;
+    while (s < flen - p && s < nlen - p && first[flen - 1 - s] == next[nlen - 1 - s])
+        s++;
+    while (p > 0 && isdigit((BYTE)next[p - 1]))
+        p--;
+    while (s > 0 && isdigit((BYTE)next[nlen - s]))
+        s--;
+
+    // "list_1.html" -> "list_2.html", the number of the first page is in its url
+    if (flen - p - s > 0)
+    {
+        if (first[p] == '0')
+            return FALSE;
+        for (i = p; i < flen - s; i++)
+        {
+            if (!isdigit((BYTE)first[i]))
+                return FALSE;
+        }
+        m = atoi(first + p);
+    }
+
+    // "list.html" -> "list_2.html", a separator and the number of the second page
+    mid = next + p;
+    midlen = nlen - p - s;
+    for (seplen = 0; seplen < midlen && !isdigit((BYTE)mid[seplen]); seplen++);
+    if (seplen == midlen || (m >= 0 && seplen > 0) || seplen > 16 || mid[seplen] == '0')
+        return FALSE;
+    for (i = seplen; i < midlen; i++)
+    {
+        if (!isdigit((BYTE)mid[i]))
+            return FALSE;
+    }
+    n = atoi(mid + seplen);
+    if (m >= 0 && n != m + 1)
+        return FALSE;
+
+    if (p + seplen + s + 16 >= (int)sizeof(pattern->prefix) || s >= (int)sizeof(pattern->suffix))
+        return FALSE;
+    memcpy(pattern->prefix, next, p + seplen);
+    pattern->prefix[p + seplen] = 0;
+    strcpy(pattern->suffix, next + nlen - s);
+    pattern->base = n;
+    return TRUE;
+}
+
+void toc_page_url(const toc_pattern_t *pattern, int page, char *url)
+{
+    sprintf(url, "%s%d%s", pattern->prefix, pattern->base + page - 1, pattern->suffix);
+}
+
+#endif
@@ -0,0 +1,31 @@
+#ifndef __TOC_PAGE_H__
+#define __TOC_PAGE_H__
+#ifdef ENABLE_NETWORK
+
+#include "types.h"
+#include "https.h"
+#include <vector>
+#include <string>
+
+#define TOC_HASH_INIT               2166136261u
+
+// The chapter list page of an online book between two update checks: the
+// validators kept of it, and how much of a new copy is still the old list.
+u32 toc_hash(u32 hash, const void *data, size_t size);
+void toc_request_header(const ol_toc_t *last, char *header);
+BOOL toc_read_page(const ol_toc_t *last, const request_result_t *result, ol_toc_t *toc);
+int toc_new_entries(const ol_toc_t *last, const std::vector<std::string> &titles, const std::vector<std::string> &urls, ol_toc_t *toc);
+
+// url of page n >= 1 is prefix + (base + n - 1) + suffix, page 0 is the first url
+typedef struct toc_pattern_t
+{
+    char prefix[1024];
+    char suffix[256];
+    int base;
+} toc_pattern_t;
+
+BOOL toc_parse_pattern(const char *first, const char *next, toc_pattern_t *pattern);
+void toc_page_url(const toc_pattern_t *pattern, int page, char *url);
+
+#endif
+#endif
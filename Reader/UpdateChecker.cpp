@@ -0,0 +1,335 @@
+#ifdef ENABLE_NETWORK
+#include "UpdateChecker.h"
+#include "Utils.h"
+#include <shlwapi.h>
+
+extern Book *_Book;
+
+struct update_task_t
+{
+    UpdateChecker *owner;
+    OnlineBook *book;       // a reference of its own, also on the opened book
+    BOOL owned;             // FALSE when it is the opened book
+    std::wstring file_name;
+    std::string host;
+    DWORD start;            // tick of the launch
+};
+
+UpdateChecker::UpdateChecker()
+    : m_hWnd(NULL)
+    , m_Next(0)
+    , m_cb(NULL)
+    , m_arg(NULL)
+{
+}
+
+UpdateChecker::~UpdateChecker()
+{
+    Stop();
+}
+
+void UpdateChecker::SetCallback(update_result_cb_t cb, void *arg)
+{
+    m_cb = cb;
+    m_arg = arg;
+}
+
+BOOL UpdateChecker::Start(HWND hWnd, Cache *cache)
+{
+    header_t *header = cache->get_header();
+    item_t *item;
+    int i;
+
+    if (IsRunning())
+        return FALSE;
+
+    // most recently read first
+    m_hWnd = hWnd;
+    m_Files.clear();
+    m_Next = 0;
+    for (i = 0; i < header->item_count; i++)
+    {
+        item = cache->get_item(i);
+        if (0 == _tcscmp(PathFindExtension(item->file_name), _T(".ol")))
+            m_Files.push_back(item->file_name);
+    }
+
+    Schedule();
+    return TRUE;
+}
+
+BOOL UpdateChecker::IsRunning(void)
+{
+    return m_Next < m_Files.size() || !m_Running.empty() || !m_Waiting.empty();
+}
+
+void UpdateChecker::Reap(void)
+{
+    update_task_t *task;
+    DWORD now = GetTickCount();
+    size_t i;
+    BOOL dropped = FALSE;
+
+    for (i = 0; i < m_Running.size(); )
+    {
+        task = m_Running[i];
+        // the opened book was closed, or the request never came back; held
+        // by the task, a closed book's address is not reused while it runs
+        if ((!task->owned && (Book*)task->book != _Book) || now - task->start > UPDATE_TIMEOUT)
+        {
+            m_Running.erase(m_Running.begin() + i);
+            m_HostRunning[task->host]--;
+            Release(task);
+            dropped = TRUE;
+            continue;
+        }
+        i++;
+    }
+    ReapSaving(FALSE, NULL);
+    if (dropped)
+        Schedule();
+}
+
+void UpdateChecker::Cancel(const TCHAR *file_name)
+{
+    std::deque<update_task_t*>::iterator it;
+    update_task_t *task;
+    size_t i;
+
+    for (i = 0; i < m_Running.size(); i++)
+    {
+        task = m_Running[i];
+        if (task->file_name == file_name)
+        {
+            m_Running.erase(m_Running.begin() + i);
+            m_HostRunning[task->host]--;
+            Release(task);
+            Schedule();
+            break;
+        }
+    }
+    for (it = m_Waiting.begin(); it != m_Waiting.end(); it++)
+    {
+        task = *it;
+        if (task->file_name == file_name)
+        {
+            m_Waiting.erase(it);
+            Release(task);
+            break;
+        }
+    }
+    // the file is read next, a check that saved it must be done writing
+    ReapSaving(TRUE, file_name);
+}
+
+void UpdateChecker::Stop(void)
+{
+    size_t i;
+
+    for (i = 0; i < m_Running.size(); i++)
+        Release(m_Running[i]);
+    while (!m_Waiting.empty())
+    {
+        Release(m_Waiting.front());
+        m_Waiting.pop_front();
+    }
+    m_Running.clear();
+    m_HostRunning.clear();
+    m_Files.clear();
+    m_Next = 0;
+    ReapSaving(TRUE, NULL);
+}
+
+BOOL UpdateChecker::OnBookEvent(HWND hWnd, UINT message, WPARAM wParam, LPARAM lParam)
+{
+    book_event_data_t *be = (book_event_data_t *)lParam;
+    size_t i;
+
+    if (!be)
+        return FALSE;
+
+    for (i = 0; i < m_Running.size(); i++)
+    {
+        if (m_Running[i]->book == be->_this)
+        {
+            m_Running[i]->book->OnBookEvent(hWnd, message, wParam, lParam);
+            return TRUE;
+        }
+    }
+    return FALSE;
+}
+
+void UpdateChecker::OnCheckResult(int is_update, int err, void *param)
+{
+    update_task_t *task = (update_task_t *)param;
+
+    task->owner->Finish(task, is_update, err);
+}
+
+update_task_t* UpdateChecker::Prepare(const std::wstring &file_name)
+{
+    update_task_t *task;
+    OnlineBook *book;
+    BOOL owned = TRUE;
+
+    if (_Book && _Book->GetBookType() == book_online && file_name == _Book->GetFileName())
+    {
+        // its chapters are in memory, a manual check may be running
+        if (_Book->IsLoading())
+            return NULL;
+        book = (OnlineBook *)_Book;
+        Book::AddRef(book);
+        owned = FALSE;
+    }
+    else
+    {
+        book = new OnlineBook;
+        book->SetFileName(file_name.c_str());
+    }
+
+    // only the header and chapter table are read
+    if (2 != book->PrepareCheck())
+    {
+        if (owned)
+            Book::Destroy(book);
+        else
+            Book::Unref(book);
+        return NULL;
+    }
+
+    task = new update_task_t;
+    task->owner = this;
+    task->book = book;
+    task->owned = owned;
+    task->file_name = file_name;
+    task->host = book->GetHost();
+    task->start = 0;
+    return task;
+}
+
+void UpdateChecker::Schedule(void)
+{
+    std::deque<update_task_t*>::iterator it;
+    update_task_t *task;
+
+    while (m_Running.size() < UPDATE_MAX_RUNNING)
+    {
+        // a waiting book whose host has room goes first
+        task = NULL;
+        for (it = m_Waiting.begin(); it != m_Waiting.end(); it++)
+        {
+            if (m_HostRunning[(*it)->host] < UPDATE_HOST_LIMIT)
+            {
+                task = *it;
+                m_Waiting.erase(it);
+                break;
+            }
+        }
+
+        if (!task)
+        {
+            // keep the number of books held in memory bounded
+            if (m_Next >= m_Files.size() || m_Waiting.size() >= UPDATE_MAX_RUNNING)
+                break;
+            task = Prepare(m_Files[m_Next++]);
+            if (!task)
+                continue;
+            if (m_HostRunning[task->host] >= UPDATE_HOST_LIMIT)
+            {
+                m_Waiting.push_back(task);
+                continue;
+            }
+        }
+
+        if (!Launch(task))
+            Release(task);
+    }
+
+    if (!IsRunning())
+    {
+        m_Files.clear();
+        m_Next = 0;
+        m_HostRunning.clear();
+        if (m_cb)
+            m_cb(NULL, 0, 0, m_arg);
+    }
+}
+
+BOOL UpdateChecker::Launch(update_task_t *task)
+{
+    task->start = GetTickCount();
+    if (2 != task->book->CheckUpdate(m_hWnd, OnCheckResult, task))
+        return FALSE;
+
+    m_Running.push_back(task);
+    m_HostRunning[task->host]++;
+    return TRUE;
+}
+
+void UpdateChecker::Release(update_task_t *task)
+{
+    if (task->owned)
+    {
+        // the found update is written by a save task, the book is kept until it ends
+        if (!task->book->WaitSaved(0))
+        {
+            Book::AddRef(task->book);
+            m_Saving.push_back(task->book);
+        }
+        Book::Destroy(task->book);
+    }
+    else
+    {
+        Book::Unref(task->book);
+    }
+    delete task;
+}
+
+void UpdateChecker::ReapSaving(BOOL wait, const TCHAR *file_name)
+{
+    OnlineBook *book;
+    size_t i;
+
+    for (i = 0; i < m_Saving.size(); )
+    {
+        book = m_Saving[i];
+        if (file_name && _tcscmp(book->GetFileName(), file_name))
+        {
+            i++;
+            continue;
+        }
+        if (!book->WaitSaved(wait ? INFINITE : 0))
+        {
+            i++;
+            continue;
+        }
+        m_Saving.erase(m_Saving.begin() + i);
+        Book::Unref(book);
+    }
+}
+
+void UpdateChecker::Finish(update_task_t *task, int is_update, int err)
+{
+    std::vector<update_task_t*>::iterator it;
+
+    for (it = m_Running.begin(); it != m_Running.end(); it++)
+    {
+        if (*it == task)
+            break;
+    }
+    if (it == m_Running.end())
+        return;
+    m_Running.erase(it);
+    m_HostRunning[task->host]--;
+
+    logger_printk("file=%s, update=%d, err=%d", Utf16ToAnsi(task->file_name.c_str()), is_update, err);
+
+    // called from the book's own dispatch, deleting it is the last thing done with it
+    if (m_cb)
+        m_cb(task->file_name.c_str(), is_update, err, m_arg);
+    Release(task);
+
+    Schedule();
+}
+
+#endif
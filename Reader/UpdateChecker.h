@@ -0,0 +1,63 @@
+#ifndef __UPDATE_CHECKER_H__
+#define __UPDATE_CHECKER_H__
+#ifdef ENABLE_NETWORK
+
+#include "Cache.h"
+#include "OnlineBook.h"
+#include <string>
+#include <vector>
+#include <deque>
+#include <map>
+
+#define UPDATE_MAX_RUNNING      8                   // books checked at once
+#define UPDATE_HOST_LIMIT       2                   // of them on one host
+#define UPDATE_TIMEOUT          (5 * 60 * 1000)     // a check without result is dropped
+
+// result of one book as soon as it is known, file_name is NULL once the sweep is done
+typedef void (*update_result_cb_t)(const TCHAR *file_name, int is_update, int err, void *arg);
+
+struct update_task_t;
+
+// Background update check of the online books in the recent list.
+// A sweep takes the .ol files once, most recently read first, and reads only
+// the header and chapter table of each. Up to UPDATE_MAX_RUNNING checks run at
+// once, at most UPDATE_HOST_LIMIT per host; a book whose host is full waits
+// while the sweep goes on with the next ones.
+class UpdateChecker
+{
+public:
+    UpdateChecker();
+    ~UpdateChecker();
+
+public:
+    void SetCallback(update_result_cb_t cb, void *arg);
+    BOOL Start(HWND hWnd, Cache *cache);            // FALSE when a sweep is running
+    BOOL IsRunning(void);
+    void Reap(void);                                // drops checks of a closed book and timed out ones
+    void Cancel(const TCHAR *file_name);            // the book is about to be opened
+    void Stop(void);
+    BOOL OnBookEvent(HWND hWnd, UINT message, WPARAM wParam, LPARAM lParam); // FALSE when no check owns it
+
+private:
+    static void OnCheckResult(int is_update, int err, void *param);
+    update_task_t* Prepare(const std::wstring &file_name);
+    void Schedule(void);
+    BOOL Launch(update_task_t *task);
+    void Release(update_task_t *task);
+    void Finish(update_task_t *task, int is_update, int err);
+    void ReapSaving(BOOL wait, const TCHAR *file_name);
+
+private:
+    HWND m_hWnd;
+    std::vector<std::wstring> m_Files;          // .ol files of this sweep
+    size_t m_Next;
+    std::vector<update_task_t*> m_Running;
+    std::deque<update_task_t*> m_Waiting;       // due, their host is full
+    std::map<std::string, int> m_HostRunning;
+    std::vector<OnlineBook*> m_Saving;          // checked and released, still writing their file
+    update_result_cb_t m_cb;
+    void *m_arg;
+};
+
+#endif
+#endif
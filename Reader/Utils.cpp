@@ -2,6 +2,7 @@
 #include <stdint.h>
 #include <string.h>
 #include <stdio.h>
+#include <limits.h>
 #ifdef ZLIB_ENABLE
 #include "zlib.h"
 #else
@@ -586,3 +587,17 @@ int memvcmp(void *memory, unsigned char val, unsigned int size)
     unsigned char *mm = (unsigned char*)memory;
     return (*mm == val) && memcmp(mm, mm + 1, size - 1) == 0;
 }
+
+// length of a file that is read whole into one buffer; FALSE past INT_MAX bytes
+BOOL file_length(FILE *fp, int *len)
+{
+    __int64 size;
+
+    if (_fseeki64(fp, 0, SEEK_END) != 0)
+        return FALSE;
+    size = _ftelli64(fp);
+    if (_fseeki64(fp, 0, SEEK_SET) != 0 || size < 0 || size > INT_MAX)
+        return FALSE;
+    *len = (int)size;
+    return TRUE;
+}
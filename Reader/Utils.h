@@ -2,6 +2,8 @@
 #define __UTILS_H__
 
 #include "types.h"
+#include "TextDecode.h"
+#include <stdio.h>
 
 // convert
 wchar_t* ansi_to_utf16(const char* str, int size, int* len);
@@ -45,4 +47,7 @@ void GetApplicationVersion(TCHAR *version);
 
 int memvcmp(void *memory, unsigned char val, unsigned int size);
 
+// file
+BOOL file_length(FILE *fp, int *len);
+
 #endif
\ No newline at end of file
@@ -0,0 +1,475 @@
+#include "XhtmlText.h"
+#include "Page.h"
+#include "libxml/HTMLparser.h"
+#include "libxml/parserInternals.h"
+
+#define XT_INLINE       0
+#define XT_BLOCK        1
+#define XT_BREAK        2
+#define XT_CELL         3
+#define XT_SKIP         4
+#define XT_PRE          5
+#define XT_HEADING      6       // h1 to h3, a block too
+#define XT_TITLE        7
+#define XT_BODY         8
+#define XT_IMAGE        9
+
+typedef struct xt_element_t
+{
+    const char *name;
+    int kind;
+} xt_element_t;
+
+static const xt_element_t s_Elements[] = {
+    { "address", XT_BLOCK }, { "article", XT_BLOCK }, { "aside", XT_BLOCK }, { "blockquote", XT_BLOCK },
+    { "body", XT_BODY }, { "br", XT_BREAK }, { "caption", XT_BLOCK }, { "center", XT_BLOCK },
+    { "dd", XT_BLOCK }, { "div", XT_BLOCK }, { "dl", XT_BLOCK }, { "dt", XT_BLOCK },
+    { "figcaption", XT_BLOCK }, { "figure", XT_BLOCK }, { "footer", XT_BLOCK }, { "h1", XT_HEADING },
+    { "h2", XT_HEADING }, { "h3", XT_HEADING }, { "h4", XT_BLOCK }, { "h5", XT_BLOCK },
+    { "h6", XT_BLOCK }, { "header", XT_BLOCK }, { "hr", XT_BLOCK }, { "image", XT_IMAGE },
+    { "img", XT_IMAGE }, { "li", XT_BLOCK }, { "main", XT_BLOCK }, { "mbp:pagebreak", XT_BLOCK },
+    { "nav", XT_BLOCK }, { "ol", XT_BLOCK }, { "p", XT_BLOCK }, { "pre", XT_PRE },
+    { "script", XT_SKIP }, { "section", XT_BLOCK }, { "style", XT_SKIP }, { "table", XT_BLOCK },
+    { "td", XT_CELL }, { "th", XT_CELL }, { "title", XT_TITLE }, { "tr", XT_BLOCK },
+    { "ul", XT_BLOCK },
+};
+
+XhtmlText::XhtmlText()
+    : m_Text(NULL)
+    , m_Length(0)
+    , m_Size(0)
+    , m_LineStart(0)
+    , m_SolidEnd(0)
+    , m_BlankLines(0)
+    , m_Space(FALSE)
+    , m_Depth(0)
+    , m_BodyAt(0)
+    , m_SkipAt(0)
+    , m_PreAt(0)
+    , m_HeadingAt(0)
+    , m_TitleAt(0)
+    , m_HeadingDone(FALSE)
+    , m_TitleDone(FALSE)
+    , m_Stop(NULL)
+    , m_ImageCb(NULL)
+    , m_ImageArg(NULL)
+    , m_Ctxt(NULL)
+{
+}
+
+XhtmlText::~XhtmlText()
+{
+    if (m_Text)
+        free(m_Text);
+}
+
+void XhtmlText::SetImageCallback(xhtml_image_cb cb, void *arg)
+{
+    m_ImageCb = cb;
+    m_ImageArg = arg;
+}
+
+BOOL XhtmlText::Parse(const char *html, int len, volatile LONG *stop)
+{
+    htmlParserCtxtPtr ctxt;
+    BOOL stopped;
+
+    if (!html || len <= 0 || (stop && ReadAcquire(stop)))
+        return FALSE;
+
+    // a character never takes less than a byte of the page, the breaks take the place of tags
+    m_Size = len + 2;
+    m_Text = (wchar_t *)malloc(sizeof(wchar_t) * m_Size);
+    if (!m_Text)
+        return FALSE;
+
+    // the context htmlReadMemory makes, the charset is guessed the same way
+    ctxt = xmlCreateMemoryParserCtxt(html, len);
+    if (!ctxt)
+        return FALSE;
+    memset(ctxt->sax, 0, sizeof(htmlSAXHandler));
+    ctxt->sax->startElement = OnStartElement;
+    ctxt->sax->endElement = OnEndElement;
+    ctxt->sax->characters = OnCharacters;
+    ctxt->sax->ignorableWhitespace = OnCharacters;
+    ctxt->sax->cdataBlock = OnCharacters;
+    ctxt->userData = this;
+    htmlCtxtUseOptions(ctxt, HTML_PARSE_RECOVER | HTML_PARSE_NOERROR | HTML_PARSE_NOWARNING | HTML_PARSE_NONET);
+    ctxt->html = 1;
+    m_Stop = stop;
+    m_Ctxt = ctxt;
+
+    htmlParseDocument(ctxt);
+    EndLine(FALSE);
+
+    stopped = stop && ReadAcquire(stop);
+    if (ctxt->myDoc)
+        xmlFreeDoc(ctxt->myDoc);
+    htmlFreeParserCtxt(ctxt);
+    m_Ctxt = NULL;
+
+    TrimName(m_Heading);
+    TrimName(m_Title);
+    return !stopped;
+}
+
+wchar_t* XhtmlText::Detach(int *len)
+{
+    wchar_t *text = m_Text;
+
+    *len = m_Length;
+    m_Text = NULL;
+    m_Length = 0;
+    if (!text || *len == 0)
+    {
+        if (text)
+            free(text);
+        *len = 0;
+        return NULL;
+    }
+    text[*len] = 0;
+    return text;
+}
+
+const std::wstring& XhtmlText::GetHeading(void)
+{
+    return m_Heading;
+}
+
+const std::wstring& XhtmlText::GetTitle(void)
+{
+    return m_Title;
+}
+
+int XhtmlText::Classify(const char *name)
+{
+    int lo = 0;
+    int hi = sizeof(s_Elements) / sizeof(s_Elements[0]) - 1;
+    int mid;
+    int cmp;
+
+    while (lo <= hi)
+    {
+        mid = (lo + hi) / 2;
+        cmp = strcmp(name, s_Elements[mid].name);
+        if (cmp == 0)
+            return s_Elements[mid].kind;
+        if (cmp < 0)
+            hi = mid - 1;
+        else
+            lo = mid + 1;
+    }
+    return XT_INLINE;
+}
+
+void XhtmlText::OnStartElement(void *ctx, const unsigned char *name, const unsigned char **atts)
+{
+    ((XhtmlText *)ctx)->StartElement((const char *)name, (const char **)atts);
+}
+
+void XhtmlText::OnEndElement(void *ctx, const unsigned char *name)
+{
+    ((XhtmlText *)ctx)->EndElement((const char *)name);
+}
+
+void XhtmlText::OnCharacters(void *ctx, const unsigned char *ch, int len)
+{
+    ((XhtmlText *)ctx)->Text((const char *)ch, len);
+}
+
+void XhtmlText::StartElement(const char *name, const char **atts)
+{
+    int kind;
+
+    if (m_Stop && ReadAcquire(m_Stop))
+    {
+        xmlStopParser((xmlParserCtxtPtr)m_Ctxt);
+        return;
+    }
+
+    m_Depth++;
+    kind = Classify(name);
+    switch (kind)
+    {
+    case XT_BODY:
+        if (!m_BodyAt)
+            m_BodyAt = m_Depth;
+        break;
+    case XT_SKIP:
+        if (!m_SkipAt)
+            m_SkipAt = m_Depth;
+        break;
+    case XT_TITLE:
+        if (!m_TitleDone && !m_BodyAt && !m_TitleAt)
+            m_TitleAt = m_Depth;
+        break;
+    case XT_HEADING:
+        if (!m_HeadingDone && !m_HeadingAt)
+            m_HeadingAt = m_Depth;
+        break;
+    case XT_PRE:
+        if (!m_PreAt)
+            m_PreAt = m_Depth;
+        break;
+    }
+
+    if (m_BodyAt <= 0 || m_SkipAt)
+        return;
+    if (kind == XT_BREAK)
+        EndLine(TRUE);
+    else if (kind == XT_CELL)
+        m_Space = TRUE;
+    else if (kind == XT_BLOCK || kind == XT_HEADING || kind == XT_PRE)
+        EndLine(FALSE);
+    else if (kind == XT_IMAGE)
+        Image(atts);
+}
+
+void XhtmlText::EndElement(const char *name)
+{
+    int kind;
+
+    if (m_Depth == 0)
+        return;
+
+    if (m_BodyAt > 0 && !m_SkipAt)
+    {
+        kind = Classify(name);
+        if (kind == XT_CELL)
+            m_Space = TRUE;
+        else if (kind == XT_BLOCK || kind == XT_HEADING || kind == XT_PRE)
+            EndLine(FALSE);
+    }
+
+    if (m_Depth == m_HeadingAt)
+    {
+        m_HeadingAt = 0;
+        m_HeadingDone = TRUE;
+    }
+    if (m_Depth == m_TitleAt)
+    {
+        m_TitleAt = 0;
+        m_TitleDone = TRUE;
+    }
+    if (m_Depth == m_SkipAt)
+        m_SkipAt = 0;
+    if (m_Depth == m_PreAt)
+        m_PreAt = 0;
+    if (m_Depth == m_BodyAt)
+        m_BodyAt = -1;  // the text after it is not taken
+    m_Depth--;
+}
+
+void XhtmlText::Text(const char *ch, int len)
+{
+    const unsigned char *p = (const unsigned char *)ch;
+    BOOL body = m_BodyAt > 0 && !m_SkipAt;
+    wchar_t units[2];
+    u32 cp;
+    int count;
+    int n;
+    int i;
+    int k;
+
+    if (!body && !m_HeadingAt && !m_TitleAt)
+        return;
+
+    // the parser hands over whole UTF-8 sequences
+    for (i = 0; i < len; i += n)
+    {
+        if (p[i] < 0x80)
+        {
+            cp = p[i];
+            n = 1;
+        }
+        else if (p[i] < 0xE0)
+        {
+            cp = p[i] & 0x1F;
+            n = 2;
+        }
+        else if (p[i] < 0xF0)
+        {
+            cp = p[i] & 0x0F;
+            n = 3;
+        }
+        else
+        {
+            cp = p[i] & 0x07;
+            n = 4;
+        }
+        if (i + n > len)
+            break;
+        for (k = 1; k < n; k++)
+            cp = (cp << 6) | (p[i + k] & 0x3F);
+
+        if (cp >= 0x10000)
+        {
+            cp -= 0x10000;
+            units[0] = (wchar_t)(0xD800 + (cp >> 10));
+            units[1] = (wchar_t)(0xDC00 + (cp & 0x3FF));
+            count = 2;
+        }
+        else
+        {
+            // the private use area is taken by the image placeholders
+            units[0] = is_inline_image(cp) ? (wchar_t)0xFFFD : (wchar_t)cp;
+            count = 1;
+        }
+
+        for (k = 0; k < count; k++)
+        {
+            if (body)
+                Put(units[k]);
+            if (m_HeadingAt)
+                PutName(m_Heading, units[k]);
+            if (m_TitleAt)
+                PutName(m_Title, units[k]);
+        }
+    }
+}
+
+void XhtmlText::Put(wchar_t c)
+{
+    BOOL white = c == 0x20 || c == 0x09 || c == 0x0A || c == 0x0D || c == 0x0C;
+
+    if (!m_PreAt && white)
+    {
+        m_Space = TRUE;
+        return;
+    }
+    if (c == 0x0D)
+        return;
+    if (c == 0x0A)
+    {
+        EndLine(TRUE);
+        return;
+    }
+
+    if (m_Space)
+    {
+        m_Space = FALSE;
+        if (m_SolidEnd > m_LineStart)
+            Append(0x20);
+    }
+    if (is_blank(c))
+    {
+        Append(c);
+        return;
+    }
+
+    // first character of the line, an indent longer than FormatText keeps is cut the same way
+    if (m_SolidEnd == m_LineStart)
+    {
+        if (m_Length - m_LineStart > 4 && (m_Text[m_LineStart] == 0x20 || m_Text[m_LineStart] == 0xA0))
+        {
+            m_Length = m_LineStart;
+            Append(0x20);
+            Append(0x20);
+            Append(0x20);
+            Append(0x20);
+        }
+        else if (m_Length - m_LineStart > 2 && m_Text[m_LineStart] == 0x3000)
+        {
+            m_Length = m_LineStart;
+            Append(0x3000);
+            Append(0x3000);
+        }
+    }
+    Append(c);
+    m_SolidEnd = m_Length;
+    m_BlankLines = 0;
+}
+
+void XhtmlText::Append(wchar_t c)
+{
+    wchar_t *text;
+
+    // room for the terminator too
+    if (m_Length + 1 >= m_Size)
+    {
+        text = (wchar_t *)realloc(m_Text, sizeof(wchar_t) * m_Size * 2);
+        if (!text)
+            return;
+        m_Text = text;
+        m_Size *= 2;
+    }
+    m_Text[m_Length++] = c;
+}
+
+void XhtmlText::EndLine(BOOL hard)
+{
+    m_Space = FALSE;
+
+    // blanks at the end of a line are dropped
+    if (m_SolidEnd > m_LineStart)
+    {
+        m_Length = m_SolidEnd;
+        Append(0x0A);
+        m_LineStart = m_SolidEnd = m_Length;
+        return;
+    }
+    m_Length = m_LineStart;
+
+    // a blank line, only a <br> or a new line in <pre> makes one; never at the top
+    if (!hard || m_Length == 0 || m_BlankLines >= XHTML_BLANK_LINES)
+        return;
+    Append(0x0A);
+    m_LineStart = m_SolidEnd = m_Length;
+    m_BlankLines++;
+}
+
+void XhtmlText::Image(const char **atts)
+{
+    const char *src = NULL;
+    int id;
+    int i;
+
+    if (!m_ImageCb || !atts)
+        return;
+
+    // <img src>, or <image xlink:href> inside an svg
+    for (i = 0; atts[i]; i += 2)
+    {
+        if (!atts[i + 1])
+            break;
+        if (strcmp(atts[i], "src") == 0 || strcmp(atts[i], "xlink:href") == 0 || strcmp(atts[i], "href") == 0)
+        {
+            src = atts[i + 1];
+            break;
+        }
+    }
+    if (!src || !*src)
+        return;
+    id = m_ImageCb(m_ImageArg, src);
+    if (id < 0 || id >= INLINE_IMAGE_MAX)
+        return;
+
+    EndLine(FALSE);
+    Append((wchar_t)(INLINE_IMAGE_BASE + id));
+    m_SolidEnd = m_Length;
+    m_BlankLines = 0;
+    EndLine(FALSE);
+}
+
+void XhtmlText::PutName(std::wstring &name, wchar_t c)
+{
+    if (c == 0x20 || c == 0x09 || c == 0x0A || c == 0x0D || c == 0x0C)
+    {
+        if (!name.empty() && name[name.size() - 1] != 0x20)
+            name += (wchar_t)0x20;
+        return;
+    }
+    name += c;
+}
+
+void XhtmlText::TrimName(std::wstring &name)
+{
+    size_t start = 0;
+    size_t end = name.size();
+
+    while (start < end && is_blank(name[start]))
+        start++;
+    while (end > start && is_blank(name[end - 1]))
+        end--;
+    name = name.substr(start, end - start);
+}
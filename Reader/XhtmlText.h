@@ -0,0 +1,72 @@
+#ifndef __XHTML_TEXT_H__
+#define __XHTML_TEXT_H__
+
+#include "types.h"
+#include <string>
+
+#define XHTML_BLANK_LINES       1       // blank lines kept between paragraphs, as FormatText does
+
+// id of the image an <img> or <image> shows, -1 to leave it out
+typedef int (*xhtml_image_cb)(void *arg, const char *src);
+
+// Text of an EPUB or MOBI chapter in one pass over the SAX events of the page.
+// The body is decoded to UTF-16 straight into one buffer and formatted on the
+// way the same as FormatText: block elements end a line, <br> breaks one,
+// whitespace is collapsed outside <pre>, long indents are cut and blank lines
+// limited. The first h1-h3 and the <title> are kept for the chapter title.
+// An image the callback knows is a line of its own, the one character
+// INLINE_IMAGE_BASE + id that the page lays out as the picture.
+class XhtmlText
+{
+public:
+    XhtmlText();
+    ~XhtmlText();
+
+public:
+    void SetImageCallback(xhtml_image_cb cb, void *arg);
+    BOOL Parse(const char *html, int len, volatile LONG *stop);     // FALSE when stopped
+    wchar_t* Detach(int *len);                              // the body text, the caller frees it; NULL when empty
+    const std::wstring& GetHeading(void);                   // first h1, h2 or h3
+    const std::wstring& GetTitle(void);
+
+private:
+    static int Classify(const char *name);
+    static void OnStartElement(void *ctx, const unsigned char *name, const unsigned char **atts);
+    static void OnEndElement(void *ctx, const unsigned char *name);
+    static void OnCharacters(void *ctx, const unsigned char *ch, int len);
+
+    void StartElement(const char *name, const char **atts);
+    void EndElement(const char *name);
+    void Text(const char *ch, int len);
+    void Put(wchar_t c);
+    void Append(wchar_t c);
+    void EndLine(BOOL hard);
+    void Image(const char **atts);
+    static void PutName(std::wstring &name, wchar_t c);
+    static void TrimName(std::wstring &name);
+
+private:
+    wchar_t *m_Text;
+    int m_Length;
+    int m_Size;
+    int m_LineStart;        // first character of the line being written
+    int m_SolidEnd;         // after its last non blank character, m_LineStart when none yet
+    int m_BlankLines;
+    BOOL m_Space;           // collapsed whitespace, written before the next character of the line
+    int m_Depth;
+    int m_BodyAt;           // depth of <body>, 0 outside of it
+    int m_SkipAt;           // of <script> or <style>
+    int m_PreAt;
+    int m_HeadingAt;
+    int m_TitleAt;
+    BOOL m_HeadingDone;
+    BOOL m_TitleDone;
+    std::wstring m_Heading;
+    std::wstring m_Title;
+    volatile LONG *m_Stop;
+    xhtml_image_cb m_ImageCb;
+    void *m_ImageArg;
+    void *m_Ctxt;
+};
+
+#endif
@@ -0,0 +1,343 @@
+#include "XpathStream.h"
+#include "libxml/HTMLparser.h"
+#include "libxml/HTMLtree.h"
+#include "libxml/parserInternals.h"
+
+#define XS_TEXT         1
+#define XS_CDATA        2       // script and style, a node of its own as in the tree
+
+XpathStream::XpathStream()
+    : m_Depth(0)
+    , m_Run(0)
+    , m_Stop(NULL)
+    , m_Ctxt(NULL)
+{
+}
+
+XpathStream::~XpathStream()
+{
+}
+
+BOOL XpathStream::Add(const char *xpath, std::vector<std::string> *value)
+{
+    xs_path_t path;
+
+    if (!xpath || !value || !Compile(xpath, path))
+        return FALSE;
+    path.value = value;
+    m_Paths.push_back(path);
+    return TRUE;
+}
+
+int XpathStream::Run(const char *html, int len, volatile LONG *stop)
+{
+    htmlParserCtxtPtr ctxt;
+    size_t i;
+    BOOL stopped;
+
+    if (!html || len <= 0 || (stop && ReadAcquire(stop)))
+        return 1;
+
+    // the context htmlReadMemory makes, so the charset is guessed the same way;
+    // only the events go here instead of the tree builder
+    ctxt = xmlCreateMemoryParserCtxt(html, len);
+    if (!ctxt)
+        return 1;
+
+    memset(ctxt->sax, 0, sizeof(htmlSAXHandler));
+    ctxt->sax->startElement = OnStartElement;
+    ctxt->sax->endElement = OnEndElement;
+    ctxt->sax->characters = OnCharacters;
+    ctxt->sax->ignorableWhitespace = OnCharacters;
+    ctxt->sax->cdataBlock = OnCdataBlock;
+    ctxt->sax->comment = OnComment;
+    ctxt->sax->processingInstruction = OnBreak;
+    ctxt->userData = this;
+    htmlCtxtUseOptions(ctxt, HTML_PARSE_RECOVER | HTML_PARSE_NOERROR | HTML_PARSE_NOWARNING);
+    ctxt->html = 1;
+
+    // the document node, the first step is tried on its children
+    m_States.assign(m_Paths.size(), 0);
+    m_Selected.assign(m_Paths.size(), 0);
+    for (i = 0; i < m_Paths.size(); i++)
+        m_States[i] = 1;
+    m_Opened.assign(1, 0);
+    m_Collectors.clear();
+    m_Depth = 0;
+    m_Run = 0;
+    m_Stop = stop;
+    m_Ctxt = ctxt;
+
+    htmlParseDocument(ctxt);
+
+    stopped = stop && ReadAcquire(stop);
+    if (ctxt->myDoc)
+        xmlFreeDoc(ctxt->myDoc);
+    htmlFreeParserCtxt(ctxt);
+    m_Ctxt = NULL;
+    return stopped ? 1 : 0;
+}
+
+BOOL XpathStream::Compile(const char *xpath, xs_path_t &path)
+{
+    const char *p = xpath;
+    xs_step_t step;
+    std::string name;
+    std::string value;
+    char quote;
+    const char *end;
+
+    path.steps.clear();
+    path.target = xs_element;
+    while (*p)
+    {
+        if (p[0] != '/')
+            return FALSE;
+        step.descendant = p[1] == '/';
+        p += step.descendant ? 2 : 1;
+
+        // last step
+        if (*p == '@' || 0 == strncmp(p, "text()", 6))
+        {
+            if (step.descendant || path.steps.empty())
+                return FALSE;
+            if (*p == '@')
+            {
+                p = ParseName(p + 1, path.attr);
+                path.target = xs_attr;
+            }
+            else
+            {
+                p += 6;
+                path.target = xs_text;
+            }
+            return p && *p == 0;
+        }
+
+        if (*p == '*')
+        {
+            step.name = "*";
+            p++;
+        }
+        else if (!(p = ParseName(p, step.name)))
+        {
+            return FALSE;
+        }
+
+        step.attrs.clear();
+        while (*p == '[')
+        {
+            for (p++; *p == ' '; p++);
+            if (*p != '@' || !(p = ParseName(p + 1, name)))
+                return FALSE;
+            for (; *p == ' '; p++);
+            if (*p != '=')
+                return FALSE;
+            for (p++; *p == ' '; p++);
+            quote = *p;
+            if ((quote != '\'' && quote != '"') || !(end = strchr(p + 1, quote)))
+                return FALSE;
+            value.assign(p + 1, end - p - 1);
+            for (p = end + 1; *p == ' '; p++);
+            if (*p != ']')
+                return FALSE;
+            p++;
+            step.attrs.push_back(std::make_pair(name, value));
+        }
+
+        path.steps.push_back(step);
+        if (path.steps.size() > XS_MAX_STEPS)
+            return FALSE;
+    }
+    return !path.steps.empty();
+}
+
+const char* XpathStream::ParseName(const char *p, std::string &name)
+{
+    const char *start = p;
+
+    // no prefixes, position() or other functions, they stay with the xpath engine
+    if (!isalpha((unsigned char)*p) && *p != '_')
+        return NULL;
+    while (isalnum((unsigned char)*p) || *p == '_' || *p == '-' || *p == '.')
+        p++;
+    if (*p == '(' || *p == ':')
+        return NULL;
+    name.assign(start, p - start);
+    return p;
+}
+
+BOOL XpathStream::Match(const xs_step_t &step, const char *name, const char **atts)
+{
+    const char *value;
+    size_t i;
+
+    if (step.name != "*" && step.name != name)
+        return FALSE;
+    for (i = 0; i < step.attrs.size(); i++)
+    {
+        value = FindAttr(atts, step.attrs[i].first);
+        if (!value || step.attrs[i].second != value)
+            return FALSE;
+    }
+    return TRUE;
+}
+
+const char* XpathStream::FindAttr(const char **atts, const std::string &name)
+{
+    if (!atts)
+        return NULL;
+    for (; atts[0]; atts += 2)
+    {
+        // an attribute without a value is an empty one in the tree, or its name when it is a boolean one
+        if (name == atts[0])
+            return atts[1] ? atts[1] : htmlIsBooleanAttr((const xmlChar *)atts[0]) ? atts[0] : "";
+    }
+    return NULL;
+}
+
+void XpathStream::OnStartElement(void *ctx, const unsigned char *name, const unsigned char **atts)
+{
+    ((XpathStream *)ctx)->StartElement((const char *)name, (const char **)atts);
+}
+
+void XpathStream::OnEndElement(void *ctx, const unsigned char *name)
+{
+    (void)name;
+    ((XpathStream *)ctx)->EndElement();
+}
+
+void XpathStream::OnCharacters(void *ctx, const unsigned char *ch, int len)
+{
+    ((XpathStream *)ctx)->Text((const char *)ch, len, XS_TEXT);
+}
+
+void XpathStream::OnCdataBlock(void *ctx, const unsigned char *ch, int len)
+{
+    ((XpathStream *)ctx)->Text((const char *)ch, len, XS_CDATA);
+}
+
+void XpathStream::OnBreak(void *ctx, const unsigned char *a, const unsigned char *b)
+{
+    (void)a;
+    (void)b;
+    ((XpathStream *)ctx)->m_Run = 0;
+}
+
+void XpathStream::OnComment(void *ctx, const unsigned char *value)
+{
+    (void)value;
+    ((XpathStream *)ctx)->m_Run = 0;
+}
+
+void XpathStream::StartElement(const char *name, const char **atts)
+{
+    size_t count = m_Paths.size();
+    size_t parent = m_Depth * count;
+    size_t self;
+    size_t i;
+    xs_path_t *path;
+    xs_collector_t collector;
+    const char *attr;
+    u32 states;
+    u32 next;
+    int last;
+    int s;
+    BOOL selected;
+
+    if (m_Stop && ReadAcquire(m_Stop))
+    {
+        xmlStopParser((xmlParserCtxtPtr)m_Ctxt);
+        return;
+    }
+
+    m_Run = 0;
+    m_Depth++;
+    self = m_Depth * count;
+    if (m_States.size() < self + count)
+    {
+        m_States.resize(self + count);
+        m_Selected.resize(self + count);
+    }
+    if (m_Opened.size() <= m_Depth)
+        m_Opened.resize(m_Depth + 1);
+    m_Opened[m_Depth] = 0;
+
+    for (i = 0; i < count; i++)
+    {
+        path = &m_Paths[i];
+        last = (int)path->steps.size() - 1;
+        states = m_States[parent + i];
+        next = 0;
+        selected = FALSE;
+        for (s = 0; states; s++, states >>= 1)
+        {
+            if (!(states & 1))
+                continue;
+            // a '//' step is still tried further down
+            if (path->steps[s].descendant)
+                next |= 1u << s;
+            if (!Match(path->steps[s], name, atts))
+                continue;
+            if (s == last)
+                selected = TRUE;
+            else
+                next |= 1u << (s + 1);
+        }
+        m_States[self + i] = next;
+        m_Selected[self + i] = 0;
+        if (!selected)
+            continue;
+
+        // results are pushed when they start, that is document order
+        switch (path->target)
+        {
+        case xs_element:
+            collector.value = path->value;
+            collector.index = path->value->size();
+            path->value->push_back(std::string());
+            m_Collectors.push_back(collector);
+            m_Opened[m_Depth]++;
+            break;
+        case xs_text:
+            m_Selected[self + i] = 1;
+            break;
+        case xs_attr:
+            attr = FindAttr(atts, path->attr);
+            if (attr)
+                path->value->push_back(attr);
+            break;
+        }
+    }
+}
+
+void XpathStream::EndElement(void)
+{
+    if (m_Depth == 0)
+        return;
+    m_Run = 0;
+    m_Collectors.resize(m_Collectors.size() - m_Opened[m_Depth]);
+    m_Depth--;
+}
+
+void XpathStream::Text(const char *ch, int len, int kind)
+{
+    size_t count = m_Paths.size();
+    size_t self = m_Depth * count;
+    size_t i;
+
+    for (i = 0; i < m_Collectors.size(); i++)
+        (*m_Collectors[i].value)[m_Collectors[i].index].append(ch, len);
+
+    // the parser hands a long text over in pieces, the tree joins them in one node
+    for (i = 0; i < count; i++)
+    {
+        if (!m_Selected[self + i])
+            continue;
+        if (m_Run == kind)
+            m_Paths[i].value->back().append(ch, len);
+        else
+            m_Paths[i].value->push_back(std::string(ch, len));
+    }
+    m_Run = kind;
+}
@@ -0,0 +1,83 @@
+#ifndef __XPATH_STREAM_H__
+#define __XPATH_STREAM_H__
+
+#include "types.h"
+#include <string>
+#include <vector>
+
+#define XS_MAX_STEPS            32          // steps of one path, the states of a node are a bitmask
+
+typedef enum xs_target_t
+{
+    xs_element = 0,     // text of the whole element, as xmlNodeGetContent
+    xs_text,            // text() nodes right under it
+    xs_attr             // @name of it
+} xs_target_t;
+
+typedef struct xs_step_t
+{
+    BOOL descendant;    // '//' before the step, '/' otherwise
+    std::string name;   // "*" for any element
+    std::vector<std::pair<std::string, std::string> > attrs;   // [@name='value'] predicates
+} xs_step_t;
+
+typedef struct xs_path_t
+{
+    std::vector<xs_step_t> steps;
+    xs_target_t target;
+    std::string attr;   // of xs_attr
+    std::vector<std::string> *value;
+} xs_path_t;
+
+typedef struct xs_collector_t
+{
+    std::vector<std::string> *value;
+    size_t index;
+} xs_collector_t;
+
+// Streaming extractor for the location paths most book sources use, such as
+// //div[@id='content'], //dd/a/@href or //h1/text(): child and descendant
+// steps of element names with attribute equality predicates, ending with an
+// element, text() or @attr. The paths are run as state machines over the SAX
+// events of one libxml2 parse, no tree is built. Add() refuses anything else,
+// the caller takes the DOM path for it.
+class XpathStream
+{
+public:
+    XpathStream();
+    ~XpathStream();
+
+public:
+    BOOL Add(const char *xpath, std::vector<std::string> *value);  // FALSE when the xpath is not in the subset
+    int Run(const char *html, int len, volatile LONG *stop);                // every path added over one parse, 0 on success
+
+private:
+    static BOOL Compile(const char *xpath, xs_path_t &path);
+    static const char* ParseName(const char *p, std::string &name);
+    static BOOL Match(const xs_step_t &step, const char *name, const char **atts);
+    static const char* FindAttr(const char **atts, const std::string &name);
+
+    static void OnStartElement(void *ctx, const unsigned char *name, const unsigned char **atts);
+    static void OnEndElement(void *ctx, const unsigned char *name);
+    static void OnCharacters(void *ctx, const unsigned char *ch, int len);
+    static void OnCdataBlock(void *ctx, const unsigned char *ch, int len);
+    static void OnBreak(void *ctx, const unsigned char *a, const unsigned char *b);
+    static void OnComment(void *ctx, const unsigned char *value);
+
+    void StartElement(const char *name, const char **atts);
+    void EndElement(void);
+    void Text(const char *ch, int len, int kind);
+
+private:
+    std::vector<xs_path_t> m_Paths;
+    std::vector<u32> m_States;              // per depth and path, the steps the children of the node are tried with
+    std::vector<char> m_Selected;           // per depth and path, the node is a result of a text() path
+    std::vector<xs_collector_t> m_Collectors;   // open elements of element paths, innermost last
+    std::vector<size_t> m_Opened;           // per depth, collectors opened by the node
+    size_t m_Depth;
+    int m_Run;                              // kind of the text node being read, 0 for none
+    volatile LONG *m_Stop;
+    void *m_Ctxt;
+};
+
+#endif
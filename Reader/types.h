@@ -30,7 +30,6 @@
 #define MAX_CHAPTER_LENGTH          256
 #define MAX_MARK_COUNT              256
 #define MAX_TAG_COUNT               256
-#define MAX_BOOKSRC_COUNT           64
 #define MAX_CUST_COLOR_COUNT        16
 #define MAX_KEYSET_COUNT            32
 
@@ -59,6 +58,7 @@
 #define WM_SYSTRAY                  (WM_USER + 103)
 #define WM_BOOK_EVENT               (WM_USER + 104)
 #define WM_SAVE_CACHE               (WM_USER + 105)
+#define WM_FIND_RESULT              (WM_USER + 106)
 #define WM_TASKBAR_CREATED          (RegisterWindowMessage(_T("TaskbarCreated")))
 
 
@@ -69,6 +69,8 @@
 #define IDT_TIMER_CHECKBOOK         104
 #endif
 #define IDT_TIMER_LOADING           105
+#define IDT_TIMER_PRERENDER         106
+#define IDT_TIMER_SCROLL            107
 
 
 typedef unsigned char               u8;
@@ -77,12 +79,17 @@ typedef unsigned long long          u64;
 
 typedef struct item_t
 {
-    int id;
+    int id; // position in the recent list, refreshed by Cache::get_item
     int index; // save text current pos
-    TCHAR file_name[MAX_PATH];
+    TCHAR *file_name;
     int mark_size;
-    int mark[MAX_MARK_COUNT]; // book mark
+    int mark_cap;
+    int *mark; // book mark
     int is_new;
+    u32 hash; // links below are owned by Cache
+    struct item_t *hash_next;
+    struct item_t *prev;
+    struct item_t *next;
 } item_t;
 
 typedef enum bg_image_mode_t
@@ -97,7 +104,8 @@ typedef enum auto_page_mode_t
     apm_page = 0x00,
     apm_line = 0x01,
     apm_fixed = 0x00,
-    apm_count = 0x10
+    apm_count = 0x10,
+    apm_smooth = 0x20   // apm_line only, scrolls by pixels
 } auto_page_mode_t;
 
 typedef enum wheel_speed_t
@@ -173,7 +181,7 @@ typedef struct book_source_t
     char content_next_url_xpath[1024];
     char content_next_keyword_xpath[1024];
     char content_next_keyword[256];
-    int content_filter_type; // 0: disable, 1: keyword, 2: regex
+    int content_filter_type; // 0: disable, 1: keyword, 2: regex, 3: rules, one per line, "re:" before a regex
     wchar_t content_filter_keyword[1024];
 
 } book_source_t;
@@ -240,16 +248,8 @@ typedef struct header_t
     tagitem_t tags[MAX_TAG_COUNT];
 #endif
     int meun_font_follow;
-    int book_source_count;
-    book_source_t book_sources[MAX_BOOKSRC_COUNT];
 } header_t;
 
-typedef struct body_t
-{
-    item_t items[1];
-} body_t;
-
-
 typedef enum type_t
 {
     Unknown = 0,
@@ -299,6 +299,18 @@ typedef struct ol_chapter_info_t
     u32 size;
 } ol_chapter_info_t;
 
+#define OL_TOC_MAGIC                0x434F544C // "LTOC"
+
+// validators of the chapter list page from the last update check
+typedef struct ol_toc_t
+{
+    u32 hash;               // of the whole page
+    u32 count;              // entries on the page
+    u32 prefix_hash;        // of the titles and urls of those entries
+    char etag[128];
+    char last_modified[64];
+} ol_toc_t;
+
 typedef struct ol_header_t
 {
     u32 header_size;
@@ -307,7 +319,10 @@ typedef struct ol_header_t
     u32 host_offset;
     u64 update_time;
     u32 is_finished; // for bookstatus, deprecated
-    u32 reserve[4]; // reserve
+    u32 toc_magic; // OL_TOC_MAGIC when toc_offset is set, older files left these words unset
+    u32 toc_offset; // ol_toc_t
+    u32 text_format; // OL_TEXT_MAGIC when the text is stored as deflated blocks, raw UTF-16 otherwise
+    u32 reserve[1]; // reserve
     u32 chapter_size;
     ol_chapter_info_t chapter_info_list[1];
 } ol_header_t;
@@ -0,0 +1,22 @@
+// the bitmap as the image cache counts it, the pixels are never drawn here
+#ifndef __COMPAT_GDIPLUS_H__
+#define __COMPAT_GDIPLUS_H__
+
+namespace Gdiplus
+{
+class Bitmap
+{
+public:
+    Bitmap(int width, int height) : m_Width(width), m_Height(height) { Live()++; }
+    ~Bitmap() { Live()--; }
+    UINT GetWidth(void) { return (UINT)m_Width; }
+    UINT GetHeight(void) { return (UINT)m_Height; }
+    static int& Live(void) { static int live; return live; }  // not yet deleted
+
+private:
+    int m_Width;
+    int m_Height;
+};
+}
+
+#endif
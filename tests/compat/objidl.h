@@ -0,0 +1 @@
+// not used by the units built here
@@ -0,0 +1,17 @@
+// Unicode build only, TCHAR is wchar_t as in the Windows project
+#ifndef __COMPAT_TCHAR_H__
+#define __COMPAT_TCHAR_H__
+
+#include <wchar.h>
+
+typedef wchar_t TCHAR;
+#define _T(x)       L##x
+#define _tcslen     wcslen
+#define _tcscpy     wcscpy
+#define _tcscmp     wcscmp
+#define _tcsncmp    wcsncmp
+#define _tcsstr     wcsstr
+#define _tcschr     wcschr
+#define _tcsrchr    wcsrchr
+
+#endif
@@ -0,0 +1,126 @@
+// The part of the Win32 API the platform independent units use, so that they
+// build and run their tests off Windows. Not a port, only what they touch.
+#ifndef __COMPAT_WINDOWS_H__
+#define __COMPAT_WINDOWS_H__
+
+#include <stdint.h>
+#include <string.h>
+#include <strings.h>
+#include <wchar.h>
+#include <pthread.h>
+
+#ifndef _UNICODE
+#define _UNICODE
+#endif
+#ifndef UNICODE
+#define UNICODE
+#endif
+
+#define __stdcall
+#define __cdecl
+#define WINAPI
+#define CALLBACK
+
+typedef int                 BOOL;
+typedef unsigned char       BYTE;
+typedef unsigned short      WORD;
+typedef uint32_t            DWORD;
+typedef int32_t             LONG;
+typedef uint32_t            ULONG;
+typedef unsigned int        UINT;
+typedef int64_t             LONGLONG;
+typedef wchar_t             WCHAR;
+typedef char                CHAR;
+typedef void*               HANDLE;
+typedef void*               HWND;
+typedef void*               HMENU;
+typedef void*               HDC;
+typedef void*               HBITMAP;
+typedef void*               HFONT;
+typedef void*               HINSTANCE;
+typedef uintptr_t           WPARAM;
+typedef intptr_t            LPARAM;
+typedef intptr_t            LRESULT;
+typedef DWORD               COLORREF;
+typedef size_t              SIZE_T;
+typedef intptr_t            INT_PTR;
+typedef uintptr_t           UINT_PTR;
+typedef const wchar_t*      LPCTSTR;
+typedef const wchar_t*      LPCWSTR;
+typedef wchar_t*            LPWSTR;
+typedef const char*         LPCSTR;
+
+#ifndef TRUE
+#define TRUE                1
+#define FALSE               0
+#endif
+#define MAX_PATH            260
+#define INFINITE            0xFFFFFFFF
+#define WM_USER             0x0400
+#define CP_ACP              0
+#define CP_UTF8             65001
+
+#define RGB(r, g, b)        ((COLORREF)(((BYTE)(r) | ((WORD)((BYTE)(g)) << 8)) | (((DWORD)(BYTE)(b)) << 16)))
+#define GetRValue(rgb)      ((BYTE)(rgb))
+#define GetGValue(rgb)      ((BYTE)(((WORD)(rgb)) >> 8))
+#define GetBValue(rgb)      ((BYTE)((rgb) >> 16))
+
+typedef struct RECT { LONG left, top, right, bottom; } RECT;
+typedef struct POINT { LONG x, y; } POINT;
+typedef struct SIZE { LONG cx, cy; } SIZE;
+
+typedef struct LOGFONT
+{
+    LONG lfHeight, lfWidth, lfEscapement, lfOrientation, lfWeight;
+    BYTE lfItalic, lfUnderline, lfStrikeOut, lfCharSet;
+    BYTE lfOutPrecision, lfClipPrecision, lfQuality, lfPitchAndFamily;
+    WCHAR lfFaceName[32];
+} LOGFONT;
+
+typedef struct WINDOWPLACEMENT
+{
+    UINT length, flags, showCmd;
+    POINT ptMinPosition, ptMaxPosition;
+    RECT rcNormalPosition;
+} WINDOWPLACEMENT;
+
+static inline LONG InterlockedIncrement(volatile LONG *p) { return __atomic_add_fetch(p, 1, __ATOMIC_SEQ_CST); }
+static inline LONG InterlockedDecrement(volatile LONG *p) { return __atomic_sub_fetch(p, 1, __ATOMIC_SEQ_CST); }
+static inline LONG InterlockedExchange(volatile LONG *p, LONG v) { return __atomic_exchange_n(p, v, __ATOMIC_SEQ_CST); }
+static inline LONG InterlockedExchangeAdd(volatile LONG *p, LONG v) { return __atomic_fetch_add(p, v, __ATOMIC_SEQ_CST); }
+static inline LONG InterlockedCompareExchange(volatile LONG *p, LONG v, LONG cmp)
+{
+    __atomic_compare_exchange_n(p, &cmp, v, false, __ATOMIC_SEQ_CST, __ATOMIC_SEQ_CST);
+    return cmp;
+}
+
+static inline LONG ReadAcquire(const volatile LONG *p) { return __atomic_load_n(p, __ATOMIC_ACQUIRE); }
+static inline LONG ReadNoFence(const volatile LONG *p) { return __atomic_load_n(p, __ATOMIC_RELAXED); }
+
+typedef pthread_mutex_t CRITICAL_SECTION;
+static inline void InitializeCriticalSection(CRITICAL_SECTION *cs)
+{
+    pthread_mutexattr_t attr;
+    pthread_mutexattr_init(&attr);
+    pthread_mutexattr_settype(&attr, PTHREAD_MUTEX_RECURSIVE);
+    pthread_mutex_init(cs, &attr);
+    pthread_mutexattr_destroy(&attr);
+}
+static inline void DeleteCriticalSection(CRITICAL_SECTION *cs) { pthread_mutex_destroy(cs); }
+static inline void EnterCriticalSection(CRITICAL_SECTION *cs) { pthread_mutex_lock(cs); }
+static inline void LeaveCriticalSection(CRITICAL_SECTION *cs) { pthread_mutex_unlock(cs); }
+
+#define _stricmp            strcasecmp
+
+static inline DWORD GetTickCount(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (DWORD)(ts.tv_sec * 1000 + ts.tv_nsec / 1000000);
+}
+
+// the code pages are the test's, it defines these with the ones it needs
+int MultiByteToWideChar(UINT cp, DWORD flags, LPCSTR str, int size, LPWSTR out, int out_size);
+BOOL IsDBCSLeadByteEx(UINT cp, BYTE c);
+
+#endif
@@ -0,0 +1,52 @@
+#ifndef __TEST_H__
+#define __TEST_H__
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <chrono>
+
+// a failed check reports and carries on, main returns test_result()
+static int s_TestFailures = 0;
+
+#define CHECK(x)                                                            \
+    do {                                                                    \
+        if (!(x)) {                                                         \
+            fprintf(stderr, "%s:%d: check failed: %s\n", __FILE__, __LINE__, #x); \
+            s_TestFailures++;                                               \
+        }                                                                   \
+    } while (0)
+
+#define CHECK_EQ(a, b)                                                      \
+    do {                                                                    \
+        long long a_ = (long long)(a), b_ = (long long)(b);                 \
+        if (a_ != b_) {                                                     \
+            fprintf(stderr, "%s:%d: check failed: %s == %s (%lld != %lld)\n", \
+                __FILE__, __LINE__, #a, #b, a_, b_);                        \
+            s_TestFailures++;                                               \
+        }                                                                   \
+    } while (0)
+
+#define RUN_TEST(fn)                                                        \
+    do {                                                                    \
+        int before_ = s_TestFailures;                                       \
+        fn();                                                               \
+        printf("%s %s\n", s_TestFailures == before_ ? "PASS" : "FAIL", #fn); \
+    } while (0)
+
+static inline int test_result(void)
+{
+    return s_TestFailures == 0 ? 0 : 1;
+}
+
+static inline double test_now(void)
+{
+    return std::chrono::duration<double>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+// throughput lines are only printed, a slow machine does not fail a benchmark
+static inline void bench_report(const char *name, double bytes, double seconds)
+{
+    printf("BENCH %s: %.1f MB/s (%.3f s)\n", name, bytes / (1024.0 * 1024.0) / seconds, seconds);
+}
+
+#endif
@@ -0,0 +1,314 @@
+#include "test.h"
+#include "BlockStore.h"
+#include "zlib.h"
+#include <string>
+#include <vector>
+
+#define CHAPTERS            200
+
+// chapters of made up CJK text: a title line, then paragraphs of words drawn
+// from a small vocabulary, the common ones far more often
+static std::wstring MakeBook(int chapters, std::vector<int> &cuts, unsigned seed)
+{
+    std::wstring text;
+    unsigned r;
+    int i, j, k, w;
+
+    cuts.clear();
+    for (i = 0; i < chapters; i++)
+    {
+        cuts.push_back((int)text.size());
+        text += L"\x7b2c" + std::to_wstring(i + 1) + L"\x7ae0\n";
+        for (j = 0; j < 20 + (int)(seed % 30); j++)
+        {
+            text += L"\x3000\x3000";
+            for (k = 0; k < 20 + (int)(seed % 30); k++)
+            {
+                seed = seed * 1103515245 + 12345;
+                r = (seed >> 16) % 1000;
+                w = (int)(r * r / 2500);
+                text += (wchar_t)(0x4E00 + w * 7 % 2000);
+                if (w % 3)
+                    text += (wchar_t)(0x4E00 + w * 13 % 2000);
+                if (k % 9 == 8)
+                    text += L'\xff0c';
+            }
+            text += L"\x3002\n";
+        }
+    }
+    return text;
+}
+
+// what WriteOlFile writes after the header
+static std::string Save(BlockStore &store, std::wstring &text, std::vector<int> cuts, std::vector<loaded_block_t> &deflated)
+{
+    std::string data;
+    FILE *fp;
+    long size;
+
+    CHECK(store.Pack(&text[0], (int)text.size(), cuts, deflated));
+    fp = tmpfile();
+    CHECK(store.Write(fp));
+    size = ftell(fp);
+    data.resize(size);
+    rewind(fp);
+    CHECK_EQ(fread(&data[0], 1, size, fp), size);
+    fclose(fp);
+    return data;
+}
+
+static std::string Save(BlockStore &store, std::wstring &text, std::vector<int> cuts)
+{
+    std::vector<loaded_block_t> deflated;
+
+    return Save(store, text, cuts, deflated);
+}
+
+static BOOL Same(const TCHAR *text, const std::wstring &expect, int start, int length)
+{
+    return 0 == memcmp(text + start, expect.c_str() + start, length * sizeof(TCHAR));
+}
+
+static void TestLoadInflatesNothing(void)
+{
+    std::vector<int> cuts;
+    std::wstring book = MakeBook(CHAPTERS, cuts, 1);
+    std::string data;
+    BlockStore writer, reader;
+    TCHAR *text = NULL;
+    int length = 0;
+
+    data = Save(writer, book, cuts);
+    CHECK(reader.Load(data.c_str(), (int)data.size(), &text, &length));
+    CHECK_EQ(length, book.size());
+    CHECK_EQ(reader.GetInflatedCount(), 0);
+    CHECK_EQ(text[length], 0);
+
+    // a read inflates only the blocks of its range
+    CHECK(reader.Read(text, cuts[10] + 5, 10, TRUE));
+    CHECK_EQ(reader.GetInflatedCount(), 1);
+    CHECK(Same(text, book, cuts[10], cuts[11] - cuts[10]));
+    CHECK(reader.Read(text, cuts[20] - 3, 6, TRUE));
+    CHECK_EQ(reader.GetInflatedCount(), 3);
+    CHECK(Same(text, book, cuts[19], cuts[21] - cuts[19]));
+
+    CHECK(reader.Read(text, 0, length, FALSE));
+    CHECK_EQ(reader.GetInflatedCount(), CHAPTERS);
+    CHECK(Same(text, book, 0, length));
+    free(text);
+}
+
+static void TestEvictsTheOldest(void)
+{
+    std::vector<int> cuts;
+    std::wstring book = MakeBook(CHAPTERS, cuts, 2);
+    std::string data;
+    BlockStore writer, reader;
+    TCHAR *text = NULL;
+    int length = 0;
+    int i, j;
+
+    data = Save(writer, book, cuts);
+    CHECK(reader.Load(data.c_str(), (int)data.size(), &text, &length));
+
+    // read front to back and back again, the way a reader pages
+    for (j = 0; j < 2; j++)
+    {
+        for (i = 0; i < CHAPTERS; i++)
+        {
+            int c = j == 0 ? i : CHAPTERS - 1 - i;
+            int end = c + 1 < CHAPTERS ? cuts[c + 1] : length;
+
+            CHECK(reader.Read(text, cuts[c], end - cuts[c], TRUE));
+            CHECK(Same(text, book, cuts[c], end - cuts[c]));
+            CHECK(reader.GetInflatedCount() <= BLOCK_CACHE_COUNT);
+        }
+    }
+
+    // more blocks than the cache holds in one read are all kept for it
+    CHECK(reader.Read(text, cuts[50], cuts[50 + BLOCK_CACHE_COUNT * 2] - cuts[50], TRUE));
+    CHECK_EQ(reader.GetInflatedCount(), BLOCK_CACHE_COUNT * 2);
+    CHECK(Same(text, book, cuts[50], cuts[50 + BLOCK_CACHE_COUNT * 2] - cuts[50]));
+    CHECK(reader.Read(text, cuts[0], 1, TRUE));
+    CHECK_EQ(reader.GetInflatedCount(), BLOCK_CACHE_COUNT);
+
+    // reads off the ui thread never give pages back
+    for (i = 100; i < 150; i++)
+        CHECK(reader.Read(text, cuts[i], 1, FALSE));
+    CHECK_EQ(reader.GetInflatedCount(), BLOCK_CACHE_COUNT + 50);
+    free(text);
+}
+
+// a chapter comes in while most of the book is still deflated, then it is saved
+static void TestSaveWithDeflatedBlocks(void)
+{
+    std::vector<int> cuts, new_cuts;
+    std::vector<loaded_block_t> deflated;
+    std::wstring book = MakeBook(CHAPTERS, cuts, 3);
+    std::wstring chapter = L"\x7b2c\x0078\x7ae0\n\x3000\x3000\x65b0\x7ae0\x8282\x3002\n";
+    std::wstring expect, copy;
+    std::string data, saved;
+    BlockStore writer, store, reader;
+    TCHAR *text = NULL, *text2 = NULL;
+    int length = 0, length2 = 0;
+    int offset, i;
+
+    data = Save(writer, book, cuts);
+    CHECK(store.Load(data.c_str(), (int)data.size(), &text, &length));
+    CHECK(store.Read(text, cuts[3], 10, TRUE));
+    CHECK(store.Read(text, cuts[150], 10, TRUE));
+
+    // the way ApplyContent inserts it before chapter 100
+    offset = cuts[100];
+    text = (TCHAR *)realloc(text, (length + chapter.size() + 1) * sizeof(TCHAR));
+    memmove(text + offset + chapter.size(), text + offset, (length - offset) * sizeof(TCHAR));
+    memcpy(text + offset, chapter.c_str(), chapter.size() * sizeof(TCHAR));
+    length += (int)chapter.size();
+    text[length] = 0;
+    store.Insert(text, offset, (int)chapter.size());
+
+    expect = book.substr(0, offset) + chapter + book.substr(offset);
+    for (i = 0; i < CHAPTERS; i++)
+        new_cuts.push_back(cuts[i] < offset ? cuts[i] : cuts[i] + (int)chapter.size());
+    new_cuts.push_back(offset);
+
+    // the copy SaveOlFile makes, garbage where nothing was inflated
+    store.GetDeflated(deflated);
+    CHECK_EQ(deflated.size(), CHAPTERS - 2);
+    copy.assign(text, length);
+    saved = Save(store, copy, new_cuts, deflated);
+
+    // still readable after the save dropped the blocks it did not write
+    CHECK(store.Read(text, 0, length, TRUE));
+    CHECK(Same(text, expect, 0, length));
+
+    CHECK(reader.Load(saved.c_str(), (int)saved.size(), &text2, &length2));
+    CHECK_EQ(length2, expect.size());
+    CHECK(reader.Read(text2, 0, length2, FALSE));
+    CHECK(Same(text2, expect, 0, length2));
+    free(text);
+    free(text2);
+}
+
+// the crc of a text followed by its own crc is the same for every text, so
+// two such chapters of one length differ only in what they hold
+static std::wstring Colliding(const std::wstring &prefix)
+{
+    std::wstring text = prefix + std::wstring(4 / sizeof(TCHAR), L' ');
+    u32 crc = (u32)crc32(0, (const Bytef *)prefix.c_str(), (uInt)(prefix.size() * sizeof(TCHAR)));
+
+    memcpy(&text[prefix.size()], &crc, 4);
+    return text;
+}
+
+static void TestSameCrcOtherText(void)
+{
+    std::wstring a = Colliding(L"\x7b2c\x4e00\x7ae0\n\x3000\x3000\x7532\x3002\n");
+    std::wstring b = Colliding(L"\x7b2c\x4e8c\x7ae0\n\x3000\x3000\x4e59\x3002\n");
+    std::wstring book = a + b + a, copy;
+    std::vector<int> cuts = { 0, (int)a.size(), (int)(a.size() + b.size()) };
+    std::vector<loaded_block_t> deflated;
+    std::string data, saved;
+    BlockStore writer, store, reader;
+    TCHAR *text = NULL, *text2 = NULL;
+    int length = 0, length2 = 0;
+
+    CHECK(a.size() == b.size() && a != b);
+    CHECK_EQ(crc32(0, (const Bytef *)a.c_str(), (uInt)(a.size() * sizeof(TCHAR))),
+        crc32(0, (const Bytef *)b.c_str(), (uInt)(b.size() * sizeof(TCHAR))));
+
+    // packed from the text, the second chapter is not taken for the first
+    data = Save(writer, book, cuts);
+    CHECK(store.Load(data.c_str(), (int)data.size(), &text, &length));
+    CHECK(store.Read(text, 0, length, FALSE));
+    CHECK(Same(text, book, 0, length));
+
+    // and again, from blocks read and from blocks still deflated
+    copy.assign(text, length);
+    saved = Save(store, copy, cuts);
+    CHECK(reader.Load(saved.c_str(), (int)saved.size(), &text2, &length2));
+    CHECK(reader.Read(text2, a.size(), 1, FALSE));
+    reader.GetDeflated(deflated);
+    CHECK_EQ(deflated.size(), 2);
+    copy.assign(length2, L'?');
+    memcpy(&copy[a.size()], text2 + a.size(), b.size() * sizeof(TCHAR));
+    saved = Save(reader, copy, cuts, deflated);
+    free(text2);
+    CHECK(reader.Load(saved.c_str(), (int)saved.size(), &text2, &length2));
+    CHECK(reader.Read(text2, 0, length2, FALSE));
+    CHECK(Same(text2, book, 0, length2));
+    free(text);
+    free(text2);
+}
+
+static void TestDamagedBlockReadsBlank(void)
+{
+    std::vector<int> cuts;
+    std::wstring book = MakeBook(4, cuts, 4);
+    std::string data;
+    BlockStore writer, reader;
+    const ol_block_t *blocks;
+    TCHAR *text = NULL;
+    int length = 0, i;
+
+    data = Save(writer, book, cuts);
+    blocks = (const ol_block_t *)(data.c_str() + sizeof(ol_text_t));
+    data[blocks[2].data_offset + blocks[2].data_size / 2] ^= 0x55;
+    CHECK(reader.Load(data.c_str(), (int)data.size(), &text, &length));
+    CHECK(!reader.Read(text, 0, length, TRUE));
+    CHECK(Same(text, book, 0, cuts[2]));
+    CHECK(Same(text, book, cuts[3], length - cuts[3]));
+    for (i = cuts[2]; i < cuts[3]; i++)
+        CHECK_EQ(text[i], L' ');
+    free(text);
+
+    // an index pointing out of the data is refused at once
+    data = Save(writer, book, cuts);
+    ((ol_block_t *)(&data[0] + sizeof(ol_text_t)))[1].data_size = (u32)data.size();
+    CHECK(!reader.Load(data.c_str(), (int)data.size(), &text, &length));
+}
+
+static void BenchRatioAndInflate(void)
+{
+    std::vector<int> cuts;
+    std::wstring book = MakeBook(1000, cuts, 5);
+    std::string data;
+    BlockStore writer, reader;
+    TCHAR *text = NULL;
+    int length = 0, i;
+    double begin, seconds;
+
+    begin = test_now();
+    data = Save(writer, book, cuts);
+    seconds = test_now() - begin;
+    bench_report("block store deflate", (double)book.size() * sizeof(TCHAR), seconds);
+    // against the raw text as the old .ol files held it, TCHAR is 4 bytes here
+    printf("BENCH block store: %d chars, %.2f MB raw, %.2f MB stored, ratio %.2f\n",
+        (int)book.size(), book.size() * sizeof(TCHAR) / (1024.0 * 1024.0), data.size() / (1024.0 * 1024.0),
+        (double)data.size() / (book.size() * sizeof(TCHAR)));
+
+    begin = test_now();
+    CHECK(reader.Load(data.c_str(), (int)data.size(), &text, &length));
+    seconds = test_now() - begin;
+    printf("BENCH block store: open %.3f ms\n", seconds * 1000);
+
+    begin = test_now();
+    for (i = 0; i < 1000; i++)
+        reader.Read(text, cuts[i], 1, TRUE);
+    seconds = test_now() - begin;
+    bench_report("block store inflate", (double)length * sizeof(TCHAR), seconds);
+    CHECK(reader.Read(text, 0, length, FALSE));
+    CHECK(Same(text, book, 0, length));
+    free(text);
+}
+
+int main()
+{
+    RUN_TEST(TestLoadInflatesNothing);
+    RUN_TEST(TestEvictsTheOldest);
+    RUN_TEST(TestSaveWithDeflatedBlocks);
+    RUN_TEST(TestSameCrcOtherText);
+    RUN_TEST(TestDamagedBlockReadsBlank);
+    RUN_TEST(BenchRatioAndInflate);
+    return test_result();
+}
@@ -0,0 +1,132 @@
+#include "test.h"
+#include "BookCache.h"
+#include <string>
+
+static book_cache_item_t* Book(const wchar_t *name, int length, u64 write_time = 1)
+{
+    book_cache_item_t *item = new book_cache_item_t;
+    int i;
+
+    item->file_name = name;
+    item->file_size = 1000;
+    item->write_time = write_time;
+    item->text = (wchar_t *)malloc(sizeof(wchar_t) * (length + 1));
+    for (i = 0; i < length; i++)
+        item->text[i] = (wchar_t)('a' + i % 26);
+    item->text[length] = 0;
+    item->length = length;
+    item->chapter_index.push_back(0);
+    item->chapter_title.push_back(name);
+    item->cover = "cover";
+    return item;
+}
+
+static BOOL Has(BookCache &cache, const wchar_t *name, u64 write_time = 1)
+{
+    book_cache_item_t copy;
+
+    if (!cache.Get(name, 1000, write_time, &copy))
+        return FALSE;
+    free(copy.text);
+    return TRUE;
+}
+
+static void TestGetCopies(void)
+{
+    BookCache cache(3, 1000);
+    book_cache_item_t copy;
+
+    cache.Put(Book(L"a.mobi", 10));
+    CHECK(cache.Get(L"a.mobi", 1000, 1, &copy));
+    CHECK(copy.text && std::wstring(copy.text, copy.length + 1) == std::wstring(L"abcdefghij", 11));
+    CHECK(copy.chapter_title.size() == 1 && copy.chapter_title[0] == L"a.mobi");
+    CHECK(copy.cover == "cover");
+    free(copy.text);
+
+    // the copy is the caller's, the cache still has its own
+    CHECK(Has(cache, L"a.mobi"));
+
+    // a file written or resized since is decoded again
+    CHECK(!Has(cache, L"a.mobi", 2));
+    CHECK(!cache.Get(L"a.mobi", 999, 1, &copy));
+    CHECK(!Has(cache, L"b.mobi"));
+
+    // put again under the same name, the old one goes
+    cache.Put(Book(L"a.mobi", 20, 2));
+    CHECK_EQ(cache.GetBooks(), 1);
+    CHECK_EQ(cache.GetChars(), 20);
+    CHECK(!Has(cache, L"a.mobi", 1));
+    CHECK(Has(cache, L"a.mobi", 2));
+}
+
+static void TestEvictsByBooks(void)
+{
+    BookCache cache(3, 1000);
+
+    cache.Put(Book(L"a", 10));
+    cache.Put(Book(L"b", 10));
+    cache.Put(Book(L"c", 10));
+
+    // a opened again, so b is the least recently opened
+    CHECK(Has(cache, L"a"));
+    cache.Put(Book(L"d", 10));
+    CHECK_EQ(cache.GetBooks(), 3);
+    CHECK_EQ(cache.GetChars(), 30);
+    CHECK(!Has(cache, L"b"));
+    CHECK(Has(cache, L"a"));
+    CHECK(Has(cache, L"c"));
+    CHECK(Has(cache, L"d"));
+}
+
+static void TestEvictsByChars(void)
+{
+    BookCache cache(3, 100);
+
+    cache.Put(Book(L"a", 40));
+    cache.Put(Book(L"b", 40));
+    CHECK_EQ(cache.GetChars(), 80);
+
+    // 120 characters is over, a goes
+    cache.Put(Book(L"c", 40));
+    CHECK_EQ(cache.GetBooks(), 2);
+    CHECK_EQ(cache.GetChars(), 80);
+    CHECK(!Has(cache, L"a"));
+
+    // one over the budget on its own is kept, the rest make room for it
+    cache.Put(Book(L"d", 150));
+    CHECK_EQ(cache.GetBooks(), 1);
+    CHECK_EQ(cache.GetChars(), 150);
+    CHECK(Has(cache, L"d"));
+
+    cache.Clear();
+    CHECK_EQ(cache.GetBooks(), 0);
+    CHECK_EQ(cache.GetChars(), 0);
+    CHECK(!Has(cache, L"d"));
+}
+
+// what opening a book again costs from the cache: a copy of its text
+static void BenchReopen(void)
+{
+    BookCache cache(3, 32 << 20);
+    double begin, seconds, bytes = 0;
+    int round, rounds = 20;
+
+    cache.Put(Book(L"big.azw3", 8 << 20));
+    begin = test_now();
+    for (round = 0; round < rounds; round++)
+    {
+        CHECK(Has(cache, L"big.azw3"));
+        bytes += (double)(8 << 20) * sizeof(wchar_t);
+    }
+    seconds = test_now() - begin;
+    bench_report("mobi reopen, 8M characters from the cache", bytes, seconds);
+}
+
+int main()
+{
+    RUN_TEST(TestGetCopies);
+    RUN_TEST(TestEvictsByBooks);
+    RUN_TEST(TestEvictsByChars);
+    RUN_TEST(BenchReopen);
+    return test_result();
+}
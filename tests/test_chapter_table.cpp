@@ -0,0 +1,179 @@
+#include "test.h"
+#include "ChapterTable.h"
+#include <string>
+#include <vector>
+
+static std::string Url(int i)
+{
+    // a new directory every 40 chapters, shorter prefixes at the turns
+    return "https://www.example.com/book/4711/" + std::to_string(i / 40) + "/" + std::to_string(100000 + i) + ".html";
+}
+
+static std::wstring Title(int i)
+{
+    return L"Chapter " + std::to_wstring(i) + L" \x7b2c" + std::to_wstring(i) + L"\x7ae0";
+}
+
+static void Fill(ChapterTable &table, int count)
+{
+    std::wstring title;
+    std::string url;
+    int i;
+
+    for (i = 0; i < count; i++)
+    {
+        title = Title(i);
+        url = Url(i);
+        table.push_back(i * 100, title.c_str(), (int)title.size(), i % 7 == 3 ? NULL : url.c_str(), i);
+    }
+}
+
+static BOOL Same(const ChapterTable &table, int count)
+{
+    int i;
+
+    for (i = 0; i < count; i++)
+    {
+        if (table[i].index != i * 100 || table[i].size != i || table.title(i) != Title(i)
+            || table[i].title_len != (int)Title(i).size())
+        {
+            fprintf(stderr, "chapter %d\n", i);
+            return FALSE;
+        }
+        if (table.url(i) != (i % 7 == 3 ? "" : Url(i)))
+        {
+            fprintf(stderr, "chapter %d: %s\n", i, table.url(i).c_str());
+            return FALSE;
+        }
+    }
+    return TRUE;
+}
+
+// a url is front coded against the one before, a full one every 16: decoding
+// walks back at most 16 nodes, and a chain longer than that would not decode
+static void TestRoundTrip(void)
+{
+    static const int counts[] = { 0, 1, 15, 16, 17, 31, 32, 33, 100, 1000 };
+    std::vector<char> buf;
+    std::vector<u32> offsets;
+    size_t k;
+    int i, count;
+
+    for (k = 0; k < sizeof(counts) / sizeof(counts[0]); k++)
+    {
+        ChapterTable table;
+
+        count = counts[k];
+        Fill(table, count);
+        CHECK_EQ(table.size(), count);
+        CHECK(Same(table, count));
+
+        // the .ol header takes them back whole
+        buf.assign(table.url_export_size() + 1, 'x');
+        offsets.assign(count + 1, 0);
+        table.export_urls(&buf[0], &offsets[0]);
+        for (i = 0; i < count; i++)
+            CHECK(std::string(&buf[offsets[i]]) == (i % 7 == 3 ? "" : Url(i)));
+        CHECK_EQ(buf.back(), 'x');
+    }
+}
+
+static void TestSetAndAppend(void)
+{
+    ChapterTable table, copy, moved;
+    std::string url = "http://other.example.org/x.html";
+    int i;
+
+    Fill(table, 100);
+
+    // a replaced url is a node of its own, the chain through the old one holds
+    table.set(20, L"new", 3, url.c_str());
+    table.set(47, L"", 0, NULL);
+    CHECK(table.url(20) == url && std::wstring(table.title(20)) == L"new");
+    CHECK(table.url(47).empty() && table[47].title_len == 0);
+    for (i = 21; i < 40; i++)
+        CHECK(table.url(i) == (i % 7 == 3 ? "" : Url(i)));
+
+    for (i = 0; i < 100; i++)
+        copy.append(table, i);
+    for (i = 0; i < 100; i++)
+        CHECK(copy.same(i, table, i));
+    CHECK(!copy.same(20, table, 21));
+
+    moved = std::move(copy);
+    CHECK(copy.empty());
+    CHECK_EQ(moved.size(), 100);
+    CHECK(moved.same(99, table, 99));
+}
+
+// titles taken from the table itself while the pool grows under them
+static void TestTitleFromItself(void)
+{
+    ChapterTable table;
+    int i;
+
+    table.push_back(0, L"first title", 11);
+    for (i = 1; i < 2000; i++)
+        table.push_back(i, table.title(i - 1), table[i - 1].title_len);
+    for (i = 0; i < 2000; i++)
+        CHECK(std::wstring(table.title(i)) == L"first title");
+    table.set(5, table.title(1999), table[1999].title_len, NULL);
+    CHECK(std::wstring(table.title(5)) == L"first title");
+}
+
+// what the pools save against a string per title and url, and what loading
+// a long book's list costs: one push_back per chapter, as ReadOlFile does
+static void BenchChapters(void)
+{
+    const int count = 20000;
+    std::vector<std::wstring> titles;
+    std::vector<std::string> urls;
+    std::vector<char> buf;
+    std::vector<u32> offsets;
+    double begin, build, decode, exported;
+    size_t naive = 0;
+    int i, round, rounds = 10;
+
+    for (i = 0; i < count; i++)
+    {
+        titles.push_back(Title(i));
+        urls.push_back(Url(i));
+        naive += sizeof(std::wstring) + (titles[i].size() + 1) * sizeof(wchar_t)
+            + sizeof(std::string) + urls[i].size() + 1 + sizeof(int) * 2;
+    }
+
+    ChapterTable table;
+    begin = test_now();
+    for (round = 0; round < rounds; round++)
+    {
+        table.clear();
+        for (i = 0; i < count; i++)
+            table.push_back(i, titles[i].c_str(), (int)titles[i].size(), urls[i].c_str(), 0);
+    }
+    build = (test_now() - begin) / rounds;
+
+    begin = test_now();
+    for (i = 0; i < count; i++)
+        CHECK(table.url(i).size() == urls[i].size());
+    decode = test_now() - begin;
+
+    buf.resize(table.url_export_size());
+    offsets.resize(count);
+    begin = test_now();
+    table.export_urls(&buf[0], &offsets[0]);
+    exported = test_now() - begin;
+
+    printf("BENCH chapter table: %d chapters, %.2f MB pooled, %.2f MB as strings\n",
+        count, table.memory_usage() / (1024.0 * 1024.0), naive / (1024.0 * 1024.0));
+    printf("BENCH chapter table: load %.2f ms, every url %.2f ms, export %.2f ms\n",
+        build * 1000, decode * 1000, exported * 1000);
+}
+
+int main()
+{
+    RUN_TEST(TestRoundTrip);
+    RUN_TEST(TestSetAndAppend);
+    RUN_TEST(TestTitleFromItself);
+    RUN_TEST(BenchChapters);
+    return test_result();
+}
@@ -0,0 +1,142 @@
+#include "test.h"
+#include "Composite.h"
+#include <vector>
+
+static u32 s_Seed = 12345;
+
+static u32 Rand(void)
+{
+    s_Seed = s_Seed * 1103515245 + 12345;
+    return s_Seed >> 8;
+}
+
+// white coverage on black like the text DIB, with some stray colored pixels
+static void FillPixels(BYTE *bits, int count, int blank)
+{
+    int i;
+    BYTE cov;
+
+    for (i = 0; i < count; i++, bits += 4)
+    {
+        cov = blank ? 0 : (BYTE)(Rand() % 4 == 0 ? 0 : Rand());
+        bits[0] = cov;
+        bits[1] = cov;
+        bits[2] = (Rand() % 16 == 0) ? (BYTE)Rand() : cov;
+        bits[3] = (BYTE)Rand();
+    }
+}
+
+static void CheckSame(composite_func_t func, const char *name)
+{
+    static const int counts[] = { 0, 1, 3, 7, 8, 9, 15, 16, 17, 31, 33, 64, 100, 257, 1000 };
+    static const COLORREF colors[] = { RGB(0, 0, 0), RGB(255, 255, 255), RGB(12, 200, 99), RGB(255, 0, 128) };
+    static const BYTE alphas[] = { 0, 1, 128, 254, 255 };
+    std::vector<BYTE> src, ref, out;
+    int c, k, a, offset, blank, n;
+    BOOL ref_found, found;
+    int mismatches = 0;
+
+    if (!func)
+    {
+        printf("SKIP %s, not supported by this cpu\n", name);
+        return;
+    }
+
+    for (c = 0; c < (int)(sizeof(counts) / sizeof(counts[0])); c++)
+    {
+        for (offset = 0; offset < 4; offset++)
+        {
+            for (blank = 0; blank < 2; blank++)
+            {
+                n = counts[c];
+                src.resize((n + offset) * 4 + 4);
+                FillPixels(&src[0], (int)src.size() / 4, blank);
+                for (k = 0; k < (int)(sizeof(colors) / sizeof(colors[0])); k++)
+                {
+                    for (a = 0; a < (int)sizeof(alphas); a++)
+                    {
+                        // unaligned starts, and the pixels around the range stay untouched
+                        ref = src;
+                        out = src;
+                        ref_found = alpha_composite_text_c(&ref[offset * 4], n, colors[k], alphas[a]);
+                        found = func(&out[offset * 4], n, colors[k], alphas[a]);
+                        if (ref != out || !ref_found != !found)
+                            mismatches++;
+                    }
+                }
+            }
+        }
+    }
+    if (mismatches)
+        fprintf(stderr, "%s: %d mismatches\n", name, mismatches);
+    CHECK_EQ(mismatches, 0);
+}
+
+static void TestScalarReference(void)
+{
+    BYTE px[8] = { 200, 200, 200, 9, 0, 0, 0, 77 };
+    BOOL found;
+
+    // fill * cov * alpha >> 16 and cov * alpha >> 8, premultiplied BGRA
+    found = alpha_composite_text_c(px, 2, RGB(10, 100, 250), 128);
+    CHECK(found);
+    CHECK_EQ(px[0], (250 * 200 * 128) >> 16);
+    CHECK_EQ(px[1], (100 * 200 * 128) >> 16);
+    CHECK_EQ(px[2], (10 * 200 * 128) >> 16);
+    CHECK_EQ(px[3], (200 * 128) >> 8);
+    CHECK_EQ(px[4], 0);
+    CHECK_EQ(px[7], 0);
+
+    // only alpha set, nothing was drawn
+    found = alpha_composite_text_c(px + 4, 1, RGB(255, 255, 255), 255);
+    CHECK(!found);
+}
+
+static void TestSse2MatchesScalar(void)
+{
+    CheckSame(get_composite_func(composite_sse2), "sse2");
+}
+
+static void TestAvx2MatchesScalar(void)
+{
+    CheckSame(get_composite_func(composite_avx2), "avx2");
+}
+
+static void TestDispatchMatchesScalar(void)
+{
+    CheckSame(alpha_composite_text, "dispatch");
+}
+
+static void Bench(composite_func_t func, const char *name)
+{
+    const int width = 1920, height = 1080, frames = 50;
+    std::vector<BYTE> frame(width * height * 4);
+    double begin, seconds;
+    int i;
+
+    if (!func)
+        return;
+    FillPixels(&frame[0], width * height, 0);
+    begin = test_now();
+    for (i = 0; i < frames; i++)
+        func(&frame[0], width * height, RGB(30, 30, 30), 255);
+    seconds = test_now() - begin;
+    bench_report(name, (double)frame.size() * frames, seconds);
+}
+
+static void BenchComposite(void)
+{
+    Bench(alpha_composite_text_c, "composite c");
+    Bench(get_composite_func(composite_sse2), "composite sse2");
+    Bench(get_composite_func(composite_avx2), "composite avx2");
+}
+
+int main()
+{
+    RUN_TEST(TestScalarReference);
+    RUN_TEST(TestSse2MatchesScalar);
+    RUN_TEST(TestAvx2MatchesScalar);
+    RUN_TEST(TestDispatchMatchesScalar);
+    RUN_TEST(BenchComposite);
+    return test_result();
+}
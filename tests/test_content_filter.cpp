@@ -0,0 +1,222 @@
+#include "test.h"
+#include "ContentFilter.h"
+#include <string>
+#include <vector>
+
+// the rules applied one at a time, the result the filter must give
+static std::wstring Reference(const std::vector<std::wstring> &rules, const std::wstring &text)
+{
+    std::wstring out = text, next;
+    size_t i, pos, hit;
+
+    for (i = 0; i < rules.size(); i++)
+    {
+        if (rules[i].compare(0, 3, FILTER_REGEX_PREFIX) == 0)
+        {
+            out = std::regex_replace(out, std::wregex(rules[i].substr(3)), L"");
+            continue;
+        }
+        next.clear();
+        for (pos = 0; (hit = out.find(rules[i], pos)) != std::wstring::npos; pos = hit + rules[i].size())
+            next.append(out, pos, hit - pos);
+        next.append(out, pos, std::wstring::npos);
+        out = next;
+    }
+    return out.empty() ? L"\n" : out;
+}
+
+static std::wstring Join(const std::vector<std::wstring> &rules)
+{
+    std::wstring keyword;
+    size_t i;
+
+    for (i = 0; i < rules.size(); i++)
+        keyword += rules[i] + L"\r\n";
+    return keyword;
+}
+
+static std::wstring Filter(const std::wstring &keyword, int type, const std::wstring &text)
+{
+    ContentFilter *filter = ContentFilter::Get(type, keyword.c_str());
+    std::vector<wchar_t> buf(text.begin(), text.end());
+    int len = (int)text.size();
+
+    buf.push_back(0);
+    if (!filter || !filter->Apply(&buf[0], &len))
+        return text;
+    CHECK_EQ(buf[len], 0);
+    return std::wstring(&buf[0], len);
+}
+
+static void TestRulesInOrder(void)
+{
+    std::vector<std::wstring> rules;
+
+    // a later literal inside an earlier one, then a regex over what is left
+    rules = { L"abc", L"b", L"re:x+" };
+    CHECK(Filter(Join(rules), 3, L"zabcxxqb") == L"zq");
+
+    // the earlier rule wins an overlap, whichever ends first
+    rules = { L"bcd", L"ab" };
+    CHECK(Filter(Join(rules), 3, L"abcde") == L"ae");
+    rules = { L"ab", L"bcd" };
+    CHECK(Filter(Join(rules), 3, L"abcde") == L"cde");
+
+    // a removal joins text that a later literal matches, not an earlier one
+    rules = { L"X", L"ab" };
+    CHECK(Filter(Join(rules), 3, L"aXbaXb") == L"\n");
+    rules = { L"ab", L"X" };
+    CHECK(Filter(Join(rules), 3, L"aXb") == L"ab");
+
+    // a literal removes its matches in one scan, not again where it joins text
+    rules = { L"abc" };
+    CHECK(Filter(Join(rules), 3, L"aabcbc") == L"abc");
+
+    // the same literal twice, a shorter one first
+    rules = { L"a", L"aa", L"a" };
+    CHECK(Filter(Join(rules), 3, L"baaab") == L"bb");
+
+    // nothing found leaves the text as it was
+    rules = { L"qq", L"re:z{3}" };
+    CHECK(Filter(Join(rules), 3, L"abc") == L"abc");
+}
+
+static void TestKeywordAndRegexTypes(void)
+{
+    CHECK(Filter(L"ad", 1, L"one ad two ad") == L"one  two ");
+    CHECK(Filter(L"line\r\nbreak", 1, L"aline\r\nbreakb") == L"ab");
+    CHECK(Filter(L"[0-9]+", 2, L"a12b3") == L"ab");
+    CHECK(Filter(L"ad", 1, L"adad") == L"\n");
+    CHECK(!ContentFilter::IsValid(3, L"ok\nre:(unclosed"));
+    CHECK(ContentFilter::IsValid(3, L"ok\nre:x+"));
+    CHECK(ContentFilter::Get(0, L"ad") == NULL);
+    CHECK(ContentFilter::Get(3, L"") == NULL);
+}
+
+// random rules over a small alphabet, where overlaps and joins are common
+static void TestRandomAgainstReference(void)
+{
+    static const wchar_t *regexes[] = { L"re:x+", L"re:a[bc]", L"re:y?c", L"re:(ab)+" };
+    static const wchar_t alphabet[] = L"abcxy";
+    std::vector<std::wstring> rules;
+    std::wstring text, rule, got, expect;
+    unsigned seed = 12345;
+    int round, i, j, n;
+
+    for (round = 0; round < 5000; round++)
+    {
+        rules.clear();
+        n = 1 + (seed >> 16) % 6;
+        for (i = 0; i < n; i++)
+        {
+            seed = seed * 1103515245 + 12345;
+            if ((seed >> 16) % 5 == 0)
+            {
+                rules.push_back(regexes[(seed >> 8) % 4]);
+                continue;
+            }
+            rule.clear();
+            for (j = 0; j < 1 + (int)((seed >> 20) % 4); j++)
+            {
+                seed = seed * 1103515245 + 12345;
+                rule += alphabet[(seed >> 16) % 5];
+            }
+            rules.push_back(rule);
+        }
+        text.clear();
+        for (i = 0; i < 1 + (int)((seed >> 12) % 60); i++)
+        {
+            seed = seed * 1103515245 + 12345;
+            text += alphabet[(seed >> 16) % 5];
+        }
+
+        got = Filter(Join(rules), 3, text);
+        expect = Reference(rules, text);
+        if (got != expect)
+        {
+            fprintf(stderr, "round %d: '%ls' with", round, text.c_str());
+            for (i = 0; i < (int)rules.size(); i++)
+                fprintf(stderr, " '%ls'", rules[i].c_str());
+            fprintf(stderr, ": '%ls' != '%ls'\n", got.c_str(), expect.c_str());
+            CHECK(FALSE);
+            break;
+        }
+    }
+}
+
+static void Bench(const char *name, const std::vector<std::wstring> &rules, const std::wstring &chapter, int rounds)
+{
+    std::wstring keyword = Join(rules);
+    std::vector<wchar_t> buf;
+    double begin, seconds, bytes = 0;
+    int round, len;
+
+    begin = test_now();
+    for (round = 0; round < rounds; round++)
+    {
+        buf.assign(chapter.begin(), chapter.end());
+        buf.push_back(0);
+        len = (int)chapter.size();
+        CHECK(ContentFilter::Get(3, keyword.c_str())->Apply(&buf[0], &len));
+        bytes += chapter.size() * 2;
+    }
+    seconds = test_now() - begin;
+    // as UTF-16, the size it has on Windows
+    bench_report(name, bytes, seconds);
+
+    begin = test_now();
+    for (round = 0; round < rounds / 10; round++)
+        Reference(rules, chapter);
+    seconds = test_now() - begin;
+    printf("BENCH %s, one by one: %.1f MB/s\n", name, bytes / 10 / seconds / (1024 * 1024));
+}
+
+static void BenchChapters(void)
+{
+    std::vector<std::wstring> rules = {
+        L"\x672c\x7ad9\x7f51\x5740\xff1a" L"www.example.com",
+        L"\x8bf7\x8bb0\x4f4f\x672c\x4e66\x9996\x53d1\x57df\x540d",
+        L"\x624b\x673a\x7248\x9605\x8bfb\x7f51\x5740",
+        L"\x6700\x65b0\x7ae0\x8282\x8bf7\x8bbf\x95ee",
+        L"\x7eaf\x6587\x5b57\x5728\x7ebf\x9605\x8bfb",
+        L"\x5929\x624d\x4e00\x79d2\x8bb0\x4f4f",
+        L"re:\\(\x672a\x5b8c\x5f85\x7eed.{0,8}\\)",
+        L"\x5fae\x4fe1\x516c\x4f17\x53f7",
+        L"\x767e\x5ea6\x641c\x7d22",
+        L"\x52a0\x5165\x4e66\x7b7e",
+        L"re:[a-z]{3}\\.[a-z0-9]{4,10}\\.(com|net)",
+        L"\x7ae0\x8282\x9519\x8bef\x70b9\x6b64\x4e3e\x62a5",
+    };
+    std::vector<std::wstring> literals;
+    std::wstring chapter;
+    unsigned seed = 99;
+    int i;
+
+    // a chapter of 6000 chars with an ad every 20 paragraphs
+    for (i = 0; i < 6000; i++)
+    {
+        seed = seed * 1103515245 + 12345;
+        chapter += (wchar_t)(0x4E00 + (seed >> 16) % 3000);
+        if (i % 60 == 59)
+            chapter += L"\x3002\n\x3000\x3000";
+        if (i % 1200 == 1199)
+            chapter += rules[(seed >> 8) % 6] + L"\n";
+    }
+
+    for (i = 0; i < (int)rules.size(); i++)
+    {
+        if (rules[i].compare(0, 3, FILTER_REGEX_PREFIX) != 0)
+            literals.push_back(rules[i]);
+    }
+    Bench("content filter, 10 literals", literals, chapter, 30000);
+    Bench("content filter, 12 rules", rules, chapter, 300);
+}
+
+int main()
+{
+    RUN_TEST(TestRulesInOrder);
+    RUN_TEST(TestKeywordAndRegexTypes);
+    RUN_TEST(TestRandomAgainstReference);
+    RUN_TEST(BenchChapters);
+    return test_result();
+}
@@ -0,0 +1,119 @@
+#include "test.h"
+#include "EventQueue.h"
+#include <thread>
+#include <vector>
+#include <atomic>
+
+#define PRODUCERS           6
+#define EVENTS_PER_PRODUCER 200000
+
+static void TestFifoAndFull(void)
+{
+    EventQueue queue;
+    void *data;
+    int type, i;
+
+    CHECK(!queue.Pop(&type, &data));
+    for (i = 0; i < EVENT_QUEUE_SIZE; i++)
+        CHECK(queue.Push(i, (void *)(uintptr_t)(i + 1)));
+    CHECK(!queue.Push(-1, NULL));
+
+    // around the ring a few times
+    for (i = 0; i < EVENT_QUEUE_SIZE * 5; i++)
+    {
+        CHECK(queue.Pop(&type, &data));
+        CHECK_EQ(type, i);
+        CHECK_EQ((uintptr_t)data, i + 1);
+        CHECK(queue.Push(i + EVENT_QUEUE_SIZE, (void *)(uintptr_t)(i + EVENT_QUEUE_SIZE + 1)));
+    }
+    for (i = 0; i < EVENT_QUEUE_SIZE; i++)
+        CHECK(queue.Pop(&type, &data));
+    CHECK(!queue.Pop(&type, &data));
+}
+
+// producers push numbered events, the owner pops them while they race
+static void TestProducersUnderContention(void)
+{
+    EventQueue queue;
+    std::vector<std::thread> producers;
+    std::atomic<int> ready(0);
+    int next[PRODUCERS] = { 0 };
+    int lost_order = 0, duplicated = 0, bad_type = 0;
+    int received = 0, full = 0;
+    int type, seq, i;
+    void *data;
+
+    for (i = 0; i < PRODUCERS; i++)
+    {
+        producers.push_back(std::thread([&queue, &ready, i] {
+            int n;
+            ready++;
+            while (ready < PRODUCERS)
+                std::this_thread::yield();
+            for (n = 0; n < EVENTS_PER_PRODUCER; n++)
+            {
+                // the owner drains a full queue soon, like the dispatch message
+                while (!queue.Push(i, (void *)(uintptr_t)n))
+                    std::this_thread::yield();
+            }
+        }));
+    }
+
+    while (received < PRODUCERS * EVENTS_PER_PRODUCER)
+    {
+        if (!queue.Pop(&type, &data))
+        {
+            full++;
+            std::this_thread::yield();
+            continue;
+        }
+        received++;
+        if (type < 0 || type >= PRODUCERS)
+        {
+            bad_type++;
+            continue;
+        }
+        seq = (int)(uintptr_t)data;
+        if (seq < next[type])
+            duplicated++;
+        else if (seq > next[type])
+            lost_order++;
+        next[type] = seq + 1;
+    }
+    for (i = 0; i < PRODUCERS; i++)
+        producers[i].join();
+
+    CHECK_EQ(bad_type, 0);
+    CHECK_EQ(duplicated, 0);
+    CHECK_EQ(lost_order, 0);
+    for (i = 0; i < PRODUCERS; i++)
+        CHECK_EQ(next[i], EVENTS_PER_PRODUCER);
+    CHECK(!queue.Pop(&type, &data));
+}
+
+static void BenchPushPop(void)
+{
+    EventQueue queue;
+    double begin, seconds;
+    void *data;
+    int type, i, j;
+
+    begin = test_now();
+    for (i = 0; i < 200000; i++)
+    {
+        for (j = 0; j < EVENT_QUEUE_SIZE / 2; j++)
+            queue.Push(j, NULL);
+        for (j = 0; j < EVENT_QUEUE_SIZE / 2; j++)
+            queue.Pop(&type, &data);
+    }
+    seconds = test_now() - begin;
+    printf("BENCH event queue: %.1f M events/s, one thread\n", 200000.0 * (EVENT_QUEUE_SIZE / 2) / seconds / 1e6);
+}
+
+int main()
+{
+    RUN_TEST(TestFifoAndFull);
+    RUN_TEST(TestProducersUnderContention);
+    RUN_TEST(BenchPushPop);
+    return test_result();
+}
@@ -0,0 +1,229 @@
+#include "test.h"
+#include "framework.h"
+#include "HtmlParser.h"
+#include <string>
+#include <vector>
+#include <thread>
+#include <future>
+
+// the paths of a book source in bs.json that pages its chapters
+#define NEXT_URL_XPATH      "//*[@id=\"container\"]/div/div/div[2]/div[1]/a[3]/@href"
+#define NEXT_KEYWORD_XPATH  "//*[@id=\"container\"]/div/div/div[2]/div[1]/a[3]"
+// the same for a site with the page links under the text
+#define LAST_URL_XPATH      "//*[@id=\"container\"]/div/div/div[2]/div[2]/a[3]/@href"
+#define LAST_KEYWORD_XPATH  "//*[@id=\"container\"]/div/div/div[2]/div[2]/a[3]"
+#define CONTENT_XPATH       "//*[@id=\"content\"]"
+
+#define PAGE_LATENCY_MS     40      // round trip of one page from a book site
+
+// one page of a chapter split over pages, the page links above the text or
+// under it, none on the last page
+static std::string MakePage(int page, int pages, int paras, BOOL nav_top)
+{
+    std::string nav, html;
+    int i, j;
+
+    if (page + 1 < pages)
+    {
+        nav = "<div class=\"page\"><a href=\"/b/1/\">\xe7\x9b\xae\xe5\xbd\x95</a><a href=\"/b/1/9_" + std::to_string(page) + ".html\">"
+            "\xe4\xb8\x8a\xe4\xb8\x80\xe9\xa1\xb5</a><a href=\"/b/1/9_" + std::to_string(page + 2) + ".html\">"
+            "\xe4\xb8\x8b\xe4\xb8\x80\xe9\xa1\xb5</a></div>";
+    }
+    else
+    {
+        nav = "<div class=\"page\"><a href=\"/b/1/\">\xe7\x9b\xae\xe5\xbd\x95</a></div>";
+    }
+    html = "<html><head><meta charset=\"utf-8\"><title>chapter</title>"
+        "<script>var a = '<div>';</script></head><body><div id=\"container\"><div><div>"
+        "<div class=\"title\"><h1>\xe7\xac\xac\xe4\xb9\x9d\xe7\xab\xa0</h1></div><div class=\"main\">";
+    if (nav_top)
+        html += nav;
+    html += "<div id=\"content\">";
+    for (i = 0; i < paras; i++)
+    {
+        html += "&nbsp;&nbsp;&nbsp;&nbsp;";
+        for (j = 0; j < 40; j++)
+            html += "\xe6\x96\x87\xe5\xad\x97";
+        html += "<br /><br />\n";
+    }
+    html += "</div>";
+    if (!nav_top)
+        html += nav;
+    html += "</div></div></div></div></body></html>";
+    return html;
+}
+
+// the first value the full parse gives, as the completer reads it after FormatHtml
+static BOOL DomFirst(const std::string &html, const char *xpath, std::string &value)
+{
+    std::vector<std::string> values;
+    LONG stop = FALSE;
+
+    if (HtmlParser::Instance()->HtmlParseByXpath(html.c_str(), (int)html.size(), xpath, values, &stop, TRUE) || values.empty())
+        return FALSE;
+    value = values[0];
+    return TRUE;
+}
+
+static void TestScanMatchesDom(void)
+{
+    std::string html, url, keyword, expect_url, expect_keyword;
+    const char *url_xpath, *keyword_xpath;
+    LONG stop = FALSE;
+    int top, paras;
+
+    for (top = 0; top < 2; top++)
+    {
+        url_xpath = top ? NEXT_URL_XPATH : LAST_URL_XPATH;
+        keyword_xpath = top ? NEXT_KEYWORD_XPATH : LAST_KEYWORD_XPATH;
+        // within one chunk, and spread over many
+        for (paras = 1; paras <= 400; paras *= 20)
+        {
+            html = MakePage(0, 3, paras, top);
+            url.clear();
+            keyword.clear();
+            CHECK_EQ(HtmlParser::Instance()->HtmlScanByXpath(html.c_str(), (int)html.size(), url_xpath, keyword_xpath, url, keyword, &stop), 0);
+            CHECK(DomFirst(html, url_xpath, expect_url));
+            CHECK(DomFirst(html, keyword_xpath, expect_keyword));
+            CHECK(url == expect_url);
+            CHECK(keyword == expect_keyword);
+            CHECK(url == "/b/1/9_2.html");
+        }
+    }
+}
+
+static void TestScanWithoutLink(void)
+{
+    std::string html = MakePage(2, 3, 100, TRUE);
+    std::string url, keyword;
+    LONG stop = FALSE;
+
+    // the last page of the chapter, the full parse goes on as before
+    CHECK_EQ(HtmlParser::Instance()->HtmlScanByXpath(html.c_str(), (int)html.size(), NEXT_URL_XPATH, NEXT_KEYWORD_XPATH, url, keyword, &stop), 1);
+    CHECK(url.empty());
+    CHECK(keyword.empty());
+
+    CHECK_EQ(HtmlParser::Instance()->HtmlScanByXpath("", 0, NEXT_URL_XPATH, NEXT_KEYWORD_XPATH, url, keyword, &stop), 1);
+    stop = TRUE;
+    html = MakePage(0, 3, 100, TRUE);
+    CHECK_EQ(HtmlParser::Instance()->HtmlScanByXpath(html.c_str(), (int)html.size(), NEXT_URL_XPATH, NEXT_KEYWORD_XPATH, url, keyword, &stop), 1);
+}
+
+// the link under the text, found only at the end: the scan time grows with the page, not its square
+static void TestScanLinear(void)
+{
+    std::string small = MakePage(0, 3, 200, FALSE), large = MakePage(0, 3, 3200, FALSE);
+    std::string url, keyword;
+    double begin, t_small, t_large;
+    LONG stop = FALSE;
+    int round;
+
+    begin = test_now();
+    for (round = 0; round < 16; round++)
+        CHECK_EQ(HtmlParser::Instance()->HtmlScanByXpath(small.c_str(), (int)small.size(), LAST_URL_XPATH, LAST_KEYWORD_XPATH, url, keyword, &stop), 0);
+    t_small = (test_now() - begin) / 16;
+    begin = test_now();
+    CHECK_EQ(HtmlParser::Instance()->HtmlScanByXpath(large.c_str(), (int)large.size(), LAST_URL_XPATH, LAST_KEYWORD_XPATH, url, keyword, &stop), 0);
+    t_large = test_now() - begin;
+    CHECK(url == "/b/1/9_2.html");
+    printf("BENCH scan to a link at the end: %d KB %.2f ms, %d KB %.2f ms\n",
+        (int)(small.size() / 1024), t_small * 1000, (int)(large.size() / 1024), t_large * 1000);
+    // 16 times the page, a quadratic scan takes some 256 times as long
+    CHECK(t_large < t_small * 64);
+}
+
+// what the completer does with a page once it has it
+static void ParsePage(const std::string &page, std::string &next)
+{
+    std::vector<std::string> content, url;
+    char *fmt = NULL;
+    int fmtlen = 0;
+    void *doc = NULL, *ctx = NULL;
+    LONG stop = FALSE;
+
+    HtmlParser::Instance()->FormatHtml((char *)page.c_str(), (int)page.size(), &fmt, &fmtlen);
+    HtmlParser::Instance()->HtmlParseBegin(fmt, fmtlen, &doc, &ctx, &stop);
+    HtmlParser::Instance()->HtmlParseByXpath(doc, ctx, CONTENT_XPATH, content, &stop);
+    HtmlParser::Instance()->HtmlParseByXpath(doc, ctx, NEXT_URL_XPATH, url, &stop, TRUE);
+    HtmlParser::Instance()->HtmlParseEnd(doc, ctx);
+    HtmlParser::Instance()->FreeFormat(fmt);
+    CHECK(!content.empty());
+    next = url.empty() ? "" : url[0];
+}
+
+static std::string Fetch(const std::vector<std::string> &pages, int page)
+{
+    std::this_thread::sleep_for(std::chrono::milliseconds(PAGE_LATENCY_MS));
+    return pages[page];
+}
+
+// wall clock of a chapter of five pages, fetched one after the other against
+// the next one requested as soon as the scan finds its link
+static void BenchMultiPageChapter(void)
+{
+    std::vector<std::string> pages;
+    std::future<std::string> ahead;
+    std::string page, next, url, keyword;
+    double begin, serial, overlapped, scan, parse;
+    LONG stop = FALSE;
+    int i, rounds = 5;
+    int round;
+
+    for (i = 0; i < 5; i++)
+        pages.push_back(MakePage(i, 5, 300, TRUE));
+
+    begin = test_now();
+    for (round = 0; round < rounds; round++)
+    {
+        for (i = 0; i < 5; i++)
+        {
+            page = Fetch(pages, i);
+            ParsePage(page, next);
+            CHECK_EQ(next.empty(), i == 4);
+        }
+    }
+    serial = (test_now() - begin) / rounds;
+
+    begin = test_now();
+    for (round = 0; round < rounds; round++)
+    {
+        page = Fetch(pages, 0);
+        for (i = 0; i < 5; i++)
+        {
+            url.clear();
+            keyword.clear();
+            if (0 == HtmlParser::Instance()->HtmlScanByXpath(page.c_str(), (int)page.size(), NEXT_URL_XPATH, NEXT_KEYWORD_XPATH, url, keyword, &stop))
+                ahead = std::async(std::launch::async, Fetch, std::cref(pages), i + 1);
+            ParsePage(page, next);
+            CHECK(next == url);
+            if (next.empty())
+                break;
+            page = ahead.get();
+        }
+        CHECK_EQ(i, 4);
+    }
+    overlapped = (test_now() - begin) / rounds;
+
+    begin = test_now();
+    for (round = 0; round < 100; round++)
+        HtmlParser::Instance()->HtmlScanByXpath(pages[0].c_str(), (int)pages[0].size(), NEXT_URL_XPATH, NEXT_KEYWORD_XPATH, url, keyword, &stop);
+    scan = (test_now() - begin) / 100;
+    begin = test_now();
+    for (round = 0; round < 100; round++)
+        ParsePage(pages[0], next);
+    parse = (test_now() - begin) / 100;
+
+    printf("BENCH multi-page chapter: %d KB pages, %d ms latency, serial %.1f ms, ahead %.1f ms\n",
+        (int)(pages[0].size() / 1024), PAGE_LATENCY_MS, serial * 1000, overlapped * 1000);
+    printf("BENCH multi-page chapter: scan to the link %.3f ms, full parse %.3f ms\n", scan * 1000, parse * 1000);
+}
+
+int main()
+{
+    RUN_TEST(TestScanMatchesDom);
+    RUN_TEST(TestScanWithoutLink);
+    RUN_TEST(TestScanLinear);
+    RUN_TEST(BenchMultiPageChapter);
+    HtmlParser::ReleaseInstance();
+    return test_result();
+}
@@ -0,0 +1,162 @@
+#include "test.h"
+#include "InlineImage.h"
+#include <string>
+
+static void Put16(std::string &s, size_t at, unsigned v, BOOL be)
+{
+    s[at] = (char)(be ? v >> 8 : v);
+    s[at + 1] = (char)(be ? v : v >> 8);
+}
+
+static void Put32(std::string &s, size_t at, unsigned v, BOOL be)
+{
+    int i;
+
+    for (i = 0; i < 4; i++)
+        s[at + i] = (char)(v >> (be ? 24 - 8 * i : 8 * i));
+}
+
+static BOOL Probe(const std::string &data, int width, int height)
+{
+    int w = 0, h = 0;
+
+    if (!image_probe_size(data.c_str(), data.size(), &w, &h))
+        return FALSE;
+    return w == width && h == height;
+}
+
+static BOOL Refused(const std::string &data)
+{
+    int w = 7, h = 7;
+
+    return !image_probe_size(data.c_str(), data.size(), &w, &h) && w == 7 && h == 7;
+}
+
+// SOI, an APP0 and an APP1 of the given size, a DQT, then the frame
+static std::string Jpeg(int width, int height, int exif, BYTE sof)
+{
+    std::string s("\xFF\xD8\xFF\xE0\x00\x10JFIF\x00\x01\x01\x00\x00\x01\x00\x01\x00\x00", 20);
+
+    s += std::string("\xFF\xE1", 2) + std::string(exif + 2, 'x');
+    Put16(s, s.size() - exif - 2, exif + 2, TRUE);
+    s += std::string("\xFF\xDB\x00\x05\x00\x01\x02", 7);
+    s += std::string("\xFF\xFF", 2);   // fill byte
+    s += std::string("\xFF\x00\x00\x11\x08\x00\x00\x00\x00\x03", 10);
+    s[s.size() - 9] = (char)sof;
+    Put16(s, s.size() - 5, height, TRUE);
+    Put16(s, s.size() - 3, width, TRUE);
+    return s + std::string(12, '\0') + "\xFF\xD9";
+}
+
+static void TestProbeFormats(void)
+{
+    std::string png("\x89PNG\r\n\x1a\n\x00\x00\x00\x0dIHDR", 16);
+    std::string gif("GIF89a\0\0\0\0\0\0", 12);
+    std::string bmp(54, '\0'), os2(26, '\0');
+    std::string webp("RIFF\0\0\0\0WEBPVP8 ", 16), lossless("RIFF\0\0\0\0WEBPVP8L", 16), ext("RIFF\0\0\0\0WEBPVP8X", 16);
+
+    CHECK(Probe(Jpeg(640, 480, 100, 0xC0), 640, 480));
+    CHECK(Probe(Jpeg(1, 65535, 3000, 0xC2), 1, 65535));
+    // DHT is no frame, the size is in the one after it
+    CHECK(!Probe(Jpeg(640, 480, 100, 0xC4), 640, 480));
+
+    png += std::string(13, '\0');
+    Put32(png, 16, 1200, TRUE);
+    Put32(png, 20, 1800, TRUE);
+    CHECK(Probe(png, 1200, 1800));
+
+    Put16(gif, 6, 320, FALSE);
+    Put16(gif, 8, 200, FALSE);
+    CHECK(Probe(gif, 320, 200));
+
+    bmp[0] = 'B';
+    bmp[1] = 'M';
+    Put32(bmp, 14, 40, FALSE);
+    Put32(bmp, 18, 800, FALSE);
+    Put32(bmp, 22, (unsigned)-600, FALSE);
+    CHECK(Probe(bmp, 800, 600));
+    os2[0] = 'B';
+    os2[1] = 'M';
+    Put32(os2, 14, 12, FALSE);
+    Put16(os2, 18, 64, FALSE);
+    Put16(os2, 20, 32, FALSE);
+    CHECK(Probe(os2, 64, 32));
+
+    webp += std::string(14, '\0');
+    Put16(webp, 26, 0xC000 | 1024, FALSE);
+    Put16(webp, 28, 768, FALSE);
+    CHECK(Probe(webp, 1024, 768));
+    lossless += std::string(14, '\0');
+    lossless[20] = 0x2F;
+    Put32(lossless, 21, (99 << 14) | 199, FALSE);
+    CHECK(Probe(lossless, 200, 100));
+    ext += std::string(14, '\0');
+    Put32(ext, 24, 4095, FALSE);
+    Put32(ext, 27, 2047, FALSE);
+    CHECK(Probe(ext, 4096, 2048));
+}
+
+static void TestProbeRefuses(void)
+{
+    std::string jpeg = Jpeg(640, 480, 100, 0xC0);
+
+    // cut before the frame, where the probe read ended
+    CHECK(Refused(jpeg.substr(0, jpeg.size() - 24)));
+    // scan data before any frame
+    CHECK(Refused(std::string("\xFF\xD8\xFF\xDA\x00\x08", 6) + std::string(20, 'x')));
+    CHECK(Refused(std::string("\xFF\xD8\x12\x34", 4) + std::string(20, 'x')));
+    CHECK(Refused(std::string("\xFF\xD8\xFF\xE0\x00\x01", 6) + std::string(20, 'x')));
+    CHECK(Refused(Jpeg(0, 480, 100, 0xC0)));
+
+    CHECK(Refused(std::string("\x89PNG\r\n\x1a\n\x00\x00\x00\x0dIHDR", 16) + std::string(8, '\0')));
+    CHECK(Refused(std::string("GIF8", 4)));
+    CHECK(Refused(std::string(64, '\0')));
+    CHECK(Refused(std::string("RIFF\0\0\0\0WEBPVP8L", 16) + std::string(14, '\0')));
+    CHECK(Refused(""));
+    CHECK(!image_probe_size(NULL, 100, NULL, NULL));
+}
+
+static void TestCacheEvicts(void)
+{
+    // room for four 100x100 images
+    ImageCache cache(4 * 100 * 100 * 4);
+    Gdiplus::Bitmap *big;
+    int i;
+
+    for (i = 0; i < 4; i++)
+        cache.Put(i, 100, 100, new Gdiplus::Bitmap(100, 100));
+    CHECK_EQ(Gdiplus::Bitmap::Live(), 4);
+
+    // a box of another size is another image
+    CHECK(cache.Get(0, 100, 100) != NULL);
+    CHECK(cache.Get(0, 100, 120) == NULL);
+
+    // the least recently drawn goes first, 0 was drawn again
+    cache.Put(4, 100, 100, new Gdiplus::Bitmap(100, 100));
+    CHECK_EQ(Gdiplus::Bitmap::Live(), 4);
+    CHECK(cache.Get(1, 100, 100) == NULL);
+    CHECK(cache.Get(0, 100, 100) != NULL);
+    CHECK(cache.Get(2, 100, 100) != NULL);
+
+    // one over the budget on its own is kept, the rest make room for it
+    big = new Gdiplus::Bitmap(1000, 1000);
+    cache.Put(5, 1000, 1000, big);
+    CHECK_EQ(Gdiplus::Bitmap::Live(), 1);
+    CHECK(cache.Get(5, 1000, 1000) == big);
+
+    cache.Put(6, 10, 10, new Gdiplus::Bitmap(10, 10));
+    CHECK_EQ(Gdiplus::Bitmap::Live(), 1);
+    CHECK(cache.Get(6, 10, 10) != NULL);
+
+    cache.Clear();
+    CHECK_EQ(Gdiplus::Bitmap::Live(), 0);
+    CHECK(cache.Get(6, 10, 10) == NULL);
+}
+
+int main()
+{
+    RUN_TEST(TestProbeFormats);
+    RUN_TEST(TestProbeRefuses);
+    RUN_TEST(TestCacheEvicts);
+    return test_result();
+}
@@ -0,0 +1,318 @@
+#include "test.h"
+#include "TaskScheduler.h"
+#include <atomic>
+#include <mutex>
+#include <condition_variable>
+#include <vector>
+
+// holds the workers until opened
+class Gate
+{
+public:
+    Gate() : m_Open(false) {}
+    void Open(void)
+    {
+        std::lock_guard<std::mutex> lock(m_Lock);
+        m_Open = true;
+        m_Cond.notify_all();
+    }
+    void Pass(void)
+    {
+        std::unique_lock<std::mutex> lock(m_Lock);
+        m_Cond.wait(lock, [this] { return m_Open; });
+    }
+
+private:
+    std::mutex m_Lock;
+    std::condition_variable m_Cond;
+    bool m_Open;
+};
+
+static std::atomic<int> s_Runs;
+static std::atomic<int> s_Started;
+static std::atomic<int> s_Order;
+
+static unsigned CountProc(void *arg, task_token_t *token)
+{
+    (void)token;
+    s_Runs++;
+    return (unsigned)(uintptr_t)arg;
+}
+
+static unsigned GateProc(void *arg, task_token_t *token)
+{
+    (void)token;
+    s_Started++;
+    ((Gate *)arg)->Pass();
+    return 0;
+}
+
+// blocks every worker, the tasks queued meanwhile are taken in lane order after
+static std::vector<task_t *> BlockWorkers(Gate *gate)
+{
+    TaskScheduler *ts = TaskScheduler::Instance();
+    std::vector<task_t *> tasks;
+    int i;
+
+    s_Started = 0;
+    for (i = 0; i < ts->GetWorkerCount(); i++)
+        tasks.push_back(ts->Submit(GateProc, gate, task_high, NULL, "gate"));
+    while (s_Started < ts->GetWorkerCount())
+        std::this_thread::yield();
+    return tasks;
+}
+
+static void ReleaseAll(std::vector<task_t *> &tasks)
+{
+    size_t i;
+
+    for (i = 0; i < tasks.size(); i++)
+    {
+        TaskScheduler::Instance()->Wait(tasks[i], INFINITE);
+        TaskScheduler::Instance()->Release(tasks[i]);
+    }
+    tasks.clear();
+}
+
+static void TestEveryTaskRunsOnce(void)
+{
+    TaskScheduler *ts = TaskScheduler::Instance();
+    std::vector<task_t *> tasks;
+    int i;
+
+    s_Runs = 0;
+    for (i = 0; i < 10000; i++)
+        tasks.push_back(ts->Submit(CountProc, (void *)(uintptr_t)i, (task_priority_t)(i % task_priority_count), NULL, "count"));
+    for (i = 0; i < (int)tasks.size(); i++)
+    {
+        CHECK(tasks[i] != NULL);
+        CHECK(ts->Wait(tasks[i], INFINITE));
+        CHECK(ts->IsDone(tasks[i]));
+        CHECK_EQ(ts->GetResult(tasks[i]), i);
+    }
+    CHECK_EQ(s_Runs, 10000);
+    ReleaseAll(tasks);
+}
+
+typedef struct order_arg_t
+{
+    task_priority_t priority;
+    int order;
+} order_arg_t;
+
+static unsigned OrderProc(void *arg, task_token_t *token)
+{
+    (void)token;
+    ((order_arg_t *)arg)->order = s_Order++;
+    return 0;
+}
+
+static void TestHigherLanesFirst(void)
+{
+    TaskScheduler *ts = TaskScheduler::Instance();
+    std::vector<task_t *> tasks, gates;
+    order_arg_t args[300];
+    Gate gate;
+    int first_low = 1 << 30, late_high = 0;
+    int i;
+
+    gates = BlockWorkers(&gate);
+    s_Order = 0;
+    // queued low first, so that only the lanes put the high ones ahead
+    for (i = 0; i < 300; i++)
+    {
+        args[i].priority = i < 150 ? task_low : task_high;
+        args[i].order = -1;
+        tasks.push_back(ts->Submit(OrderProc, &args[i], args[i].priority, NULL, "order"));
+    }
+    gate.Open();
+    ReleaseAll(gates);
+    ReleaseAll(tasks);
+
+    for (i = 0; i < 150; i++)
+    {
+        if (args[i].order < first_low)
+            first_low = args[i].order;
+    }
+    for (i = 150; i < 300; i++)
+    {
+        if (args[i].order > first_low)
+            late_high++;
+    }
+    // a worker may take a low task while another one takes the last high ones
+    CHECK(late_high < ts->GetWorkerCount());
+}
+
+static unsigned CancelProc(void *arg, task_token_t *token)
+{
+    // still called, to let go of arg
+    *(int *)arg = ReadAcquire(&token->cancel) ? 2 : 1;
+    return 0;
+}
+
+static void TestCancelledTaskFreesArg(void)
+{
+    TaskScheduler *ts = TaskScheduler::Instance();
+    std::vector<task_t *> gates;
+    task_stats_t before, after;
+    task_token_t token;
+    task_t *task;
+    Gate gate;
+    int seen = 0;
+
+    ts->GetStats(task_normal, &before);
+    gates = BlockWorkers(&gate);
+    InterlockedExchange(&token.cancel, FALSE);
+    task = ts->Submit(CancelProc, &seen, task_normal, &token, "cancel");
+    InterlockedExchange(&token.cancel, TRUE);
+    gate.Open();
+    ReleaseAll(gates);
+    CHECK(ts->Wait(task, INFINITE));
+    ts->Release(task);
+    ts->GetStats(task_normal, &after);
+
+    CHECK_EQ(seen, 2);
+    CHECK_EQ(after.submitted - before.submitted, 1);
+    CHECK_EQ(after.cancelled - before.cancelled, 1);
+    CHECK_EQ(after.completed - before.completed, 0);
+}
+
+static void TestWaitTimeout(void)
+{
+    TaskScheduler *ts = TaskScheduler::Instance();
+    Gate gate;
+    task_t *task;
+
+    s_Started = 0;
+    task = ts->Submit(GateProc, &gate, task_normal, NULL, "wait");
+    CHECK(!ts->Wait(task, 50));
+    CHECK(!ts->IsDone(task));
+    gate.Open();
+    CHECK(ts->Wait(task, 5000));
+    CHECK(ts->IsDone(task));
+    ts->Release(task);
+}
+
+static std::atomic<int> s_Detached;
+
+static unsigned DetachedProc(void *arg, task_token_t *token)
+{
+    (void)token;
+    ((Gate *)arg)->Pass();
+    s_Detached = 1;
+    return 0;
+}
+
+static void TestReleaseDoesNotWait(void)
+{
+    TaskScheduler *ts = TaskScheduler::Instance();
+    Gate gate;
+    task_t *task, *probe;
+
+    s_Detached = 0;
+    task = ts->Submit(DetachedProc, &gate, task_normal, NULL, "detached");
+    // released while it runs, the way a book detaches a task that ignores the cancel
+    ts->Release(task);
+    CHECK_EQ(s_Detached, 0);
+    gate.Open();
+    while (s_Detached == 0)
+        std::this_thread::yield();
+    // the worker is still fine afterwards
+    probe = ts->Submit(CountProc, (void *)7, task_normal, NULL, "probe");
+    CHECK(ts->Wait(probe, 5000));
+    CHECK_EQ(ts->GetResult(probe), 7);
+    ts->Release(probe);
+}
+
+static std::atomic<int> s_Children;
+
+static unsigned ChildProc(void *arg, task_token_t *token)
+{
+    (void)arg;
+    (void)token;
+    s_Children++;
+    return 0;
+}
+
+static unsigned ParentProc(void *arg, task_token_t *token)
+{
+    int i;
+
+    (void)arg;
+    (void)token;
+    for (i = 0; i < 100; i++)
+        TaskScheduler::Instance()->Release(TaskScheduler::Instance()->Submit(ChildProc, NULL, task_normal, NULL, "child"));
+    return 0;
+}
+
+static void TestSubmitFromTask(void)
+{
+    TaskScheduler *ts = TaskScheduler::Instance();
+    task_t *task;
+
+    s_Children = 0;
+    task = ts->Submit(ParentProc, NULL, task_normal, NULL, "parent");
+    CHECK(ts->Wait(task, 5000));
+    ts->Release(task);
+    while (s_Children < 100)
+        std::this_thread::yield();
+    CHECK_EQ(s_Children, 100);
+}
+
+static unsigned SlowProc(void *arg, task_token_t *token)
+{
+    (void)arg;
+    (void)token;
+    std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    s_Runs++;
+    return 0;
+}
+
+static void TestReleaseInstanceDrains(void)
+{
+    TaskScheduler *ts = TaskScheduler::Instance();
+    int i;
+
+    s_Runs = 0;
+    for (i = 0; i < 200; i++)
+        ts->Release(ts->Submit(SlowProc, NULL, task_low, NULL, "save"));
+    // queued saves are written before the scheduler goes away
+    TaskScheduler::ReleaseInstance();
+    CHECK_EQ(s_Runs, 200);
+
+    // and a new one comes up on demand
+    ts = TaskScheduler::Instance();
+    CHECK(ts->GetWorkerCount() >= 2);
+    TaskScheduler::ReleaseInstance();
+}
+
+static void BenchSubmitThroughput(void)
+{
+    TaskScheduler *ts = TaskScheduler::Instance();
+    std::vector<task_t *> tasks;
+    double begin, seconds;
+    int i;
+
+    s_Runs = 0;
+    begin = test_now();
+    for (i = 0; i < 100000; i++)
+        tasks.push_back(ts->Submit(CountProc, NULL, task_normal, NULL, "bench"));
+    ReleaseAll(tasks);
+    seconds = test_now() - begin;
+    CHECK_EQ(s_Runs, 100000);
+    printf("BENCH scheduler: %.0f tasks/s on %d workers\n", 100000 / seconds, ts->GetWorkerCount());
+    TaskScheduler::ReleaseInstance();
+}
+
+int main()
+{
+    RUN_TEST(TestEveryTaskRunsOnce);
+    RUN_TEST(TestHigherLanesFirst);
+    RUN_TEST(TestCancelledTaskFreesArg);
+    RUN_TEST(TestWaitTimeout);
+    RUN_TEST(TestReleaseDoesNotWait);
+    RUN_TEST(TestSubmitFromTask);
+    RUN_TEST(TestReleaseInstanceDrains);
+    RUN_TEST(BenchSubmitThroughput);
+    return test_result();
+}
@@ -0,0 +1,225 @@
+#include "test.h"
+#include "TextDecode.h"
+#include <string>
+#include <vector>
+#include <sys/mman.h>
+#include <unistd.h>
+
+#define CP_DBCS             CP_ACP  // a GBK like system code page: trail bytes may look like lead bytes
+
+static int s_Calls;
+static int s_LongestCall;
+
+BOOL IsDBCSLeadByteEx(UINT cp, BYTE c)
+{
+    return cp == CP_DBCS && c >= 0x81 && c <= 0xFE;
+}
+
+// a character cut by the slice comes out as U+FFFD, as Windows gives its default one
+int MultiByteToWideChar(UINT cp, DWORD flags, LPCSTR str, int size, LPWSTR out, int out_size)
+{
+    const BYTE *p = (const BYTE *)str;
+    int count = 0;
+    u32 c;
+    int i, k, n;
+
+    (void)flags;
+    if (cp != CP_UTF8 && cp != CP_DBCS)
+        return 0;
+    s_Calls++;
+    if (size > s_LongestCall)
+        s_LongestCall = size;
+// only counted without a buffer, a large file is not copied
+#define PUT(u)  do { if (out && count < out_size) out[count] = (wchar_t)(u); count++; } while (0)
+    for (i = 0; i < size; i += n)
+    {
+        n = 1;
+        if (p[i] < 0x80)
+        {
+            PUT(p[i]);
+        }
+        else if (cp == CP_DBCS)
+        {
+            if (i + 1 < size && p[i + 1] >= 0x40 && p[i + 1] <= 0xFE)
+            {
+                PUT(0x4E00 + ((p[i] - 0x81) * 191 + p[i + 1] - 0x40) % 0x5000);
+                n = 2;
+            }
+            else
+            {
+                PUT(0xFFFD);
+            }
+        }
+        else
+        {
+            n = p[i] >= 0xF0 ? 4 : p[i] >= 0xE0 ? 3 : p[i] >= 0xC0 ? 2 : 0;
+            c = p[i] & (0x7F >> n);
+            for (k = 1; k < n && i + k < size && (p[i + k] & 0xC0) == 0x80; k++)
+                c = (c << 6) | (p[i + k] & 0x3F);
+            if (n == 0 || k < n)
+            {
+                PUT(0xFFFD);
+                n = n == 0 ? 1 : k;
+            }
+            else if (c >= 0x10000)
+            {
+                PUT(0xD800 + ((c - 0x10000) >> 10));
+                PUT(0xDC00 + ((c - 0x10000) & 0x3FF));
+            }
+            else
+            {
+                PUT(c);
+            }
+        }
+    }
+#undef PUT
+    if (out && out_size < count)
+        return 0;
+    return count;
+}
+
+static std::wstring Decode(UINT cp, const std::string &text, size_t slice)
+{
+    std::wstring result;
+    wchar_t *buf;
+    int len = -1;
+
+    buf = mb_to_utf16(cp, text.c_str(), text.size(), slice, &len);
+    CHECK(buf != NULL);
+    if (!buf)
+        return result;
+    CHECK_EQ(buf[len], 0);
+    result.assign(buf, len);
+    free(buf);
+    return result;
+}
+
+// lines of ASCII and multibyte characters, runs of lead bytes are common
+static std::string RandomText(UINT cp, unsigned &seed, int size)
+{
+    static const char *utf8[] = { "\xc3\xa9", "\xe4\xb8\xad", "\xe3\x80\x80", "\xf0\x9f\x98\x80" };
+    std::string text;
+    int kind;
+
+    while ((int)text.size() < size)
+    {
+        seed = seed * 1103515245 + 12345;
+        kind = (seed >> 16) % 8;
+        if (kind < 2)
+            text += kind ? '\n' : (char)('a' + (seed >> 20) % 26);
+        else if (cp == CP_UTF8)
+            text += utf8[(seed >> 20) % 4];
+        else if (kind < 5)
+            text += std::string(1, (char)(0x81 + (seed >> 20) % 0x7E)) + (char)(0x81 + (seed >> 24) % 0x7E);
+        else
+            text += std::string(1, (char)(0x81 + (seed >> 20) % 0x7E)) + (char)(0x40 + (seed >> 24) % 0x40);
+    }
+    return text;
+}
+
+static void TestSlicesKeepCharacters(void)
+{
+    static const size_t slices[] = { 4, 5, 7, 16, 63, 1000 };
+    static const UINT cps[] = { CP_UTF8, CP_DBCS };
+    std::string text;
+    std::wstring whole;
+    unsigned seed = 7;
+    int round, i, j;
+
+    for (round = 0; round < 400; round++)
+    {
+        for (i = 0; i < 2; i++)
+        {
+            text = RandomText(cps[i], seed, round * 5);
+            whole = Decode(cps[i], text, text.size() + 1);
+            CHECK(whole.find(0xFFFD) == std::wstring::npos);
+            for (j = 0; j < (int)(sizeof(slices) / sizeof(slices[0])); j++)
+            {
+                s_LongestCall = 0;
+                if (Decode(cps[i], text, slices[j]) != whole)
+                {
+                    fprintf(stderr, "round %d, code page %u, slice %d\n", round, cps[i], (int)slices[j]);
+                    CHECK(FALSE);
+                    return;
+                }
+                CHECK(s_LongestCall <= (int)slices[j]);
+            }
+        }
+    }
+}
+
+static void TestLeadByteRuns(void)
+{
+    std::string text;
+    int i;
+
+    // only lead bytes: the cut falls after a whole number of pairs from the last byte that is no lead
+    for (i = 0; i < 40; i++)
+    {
+        text = std::string(i % 3, 'a') + std::string(2 * (i + 1), '\x81');
+        CHECK(Decode(CP_DBCS, text, 2) == Decode(CP_DBCS, text, text.size()));
+        CHECK(Decode(CP_DBCS, text, 3) == Decode(CP_DBCS, text, text.size()));
+    }
+    CHECK_EQ(mb_slice(CP_DBCS, "a\x81\x81\x81\x81", 5, 4), 3);
+    CHECK_EQ(mb_slice(CP_DBCS, "\x81\x81\x81\x81\x81", 5, 4), 4);
+    CHECK_EQ(mb_slice(CP_DBCS, "ab\x81\x81\x81", 5, 4), 4);
+    CHECK_EQ(mb_slice(CP_UTF8, "a\xe4\xb8\xad", 4, 2), 1);
+    CHECK_EQ(mb_slice(CP_UTF8, "abc", 3, 4), 3);
+}
+
+static void TestEmptyAndFailure(void)
+{
+    wchar_t *buf;
+    int len = -1;
+
+    buf = utf8_to_utf16_ex("", 0, &len);
+    CHECK(buf != NULL && len == 0 && buf[0] == 0);
+    free(buf);
+
+    s_Calls = 0;
+    buf = ansi_to_utf16_ex("abc", 3, &len);
+    CHECK(buf != NULL && std::wstring(buf, len) == L"abc");
+    CHECK_EQ(s_Calls, 2);
+    free(buf);
+
+    // a code page the system does not have
+    CHECK(mb_to_utf16(936, "abc", 3, MB_SLICE_SIZE, &len) == NULL);
+}
+
+// a sparse file of 5 GB mapped the way TextBook reads a book: past 4 GB the
+// sizes do not wrap, and a text over the model's length is refused, not cut
+static void TestLargeFile(void)
+{
+    size_t size = ((size_t)5 << 30) + 1;
+    FILE *fp = tmpfile();
+    void *data;
+    int len = -1;
+
+    CHECK(fp != NULL);
+    if (!fp)
+        return;
+    CHECK_EQ(ftruncate(fileno(fp), (off_t)size), 0);
+    data = mmap(NULL, size, PROT_READ, MAP_PRIVATE, fileno(fp), 0);
+    CHECK(data != MAP_FAILED);
+    if (data != MAP_FAILED)
+    {
+        s_Calls = 0;
+        s_LongestCall = 0;
+        CHECK(mb_to_utf16(CP_UTF8, (const char *)data, size, MB_SLICE_SIZE, &len) == NULL);
+        CHECK_EQ(len, -1);
+        // counted up to the first slice over the length, none of them over an int
+        CHECK_EQ(s_Calls, TEXT_MAX_LENGTH / MB_SLICE_SIZE + 1);
+        CHECK_EQ(s_LongestCall, MB_SLICE_SIZE);
+        munmap(data, size);
+    }
+    fclose(fp);
+}
+
+int main()
+{
+    RUN_TEST(TestSlicesKeepCharacters);
+    RUN_TEST(TestLeadByteRuns);
+    RUN_TEST(TestEmptyAndFailure);
+    RUN_TEST(TestLargeFile);
+    return test_result();
+}
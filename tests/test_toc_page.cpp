@@ -0,0 +1,323 @@
+#include "test.h"
+#include "TocPage.h"
+#include "HtmlParser.h"
+#include <string>
+#include <vector>
+
+#define TITLE_XPATH         "//div[@class='listmain']/dl/dd/a"
+#define URL_XPATH           "//div[@class='listmain']/dl/dd/a/@href"
+
+// a book site as an update check sees it: the chapter list page with an ad
+// that changes on its own, and validators it may or may not honour
+struct site_t
+{
+    int chapters;
+    int renamed;            // chapter whose title was fixed, -1 for none
+    int ad;
+    BOOL validators;        // answers a matching If-None-Match with 304
+    int version;            // bumped with every change of the list or the ad
+
+    std::string Page(void) const
+    {
+        std::string html;
+        int i;
+
+        html = "<html><body><div class=\"ad\">ad " + std::to_string(ad) + "</div><div class=\"listmain\"><dl>";
+        for (i = 0; i < chapters; i++)
+        {
+            html += "<dd><a href=\"/b/1/" + std::to_string(i + 1) + ".html\">\xe7\xac\xac" + std::to_string(i + 1)
+                + (i == renamed ? "\xe7\xab\xa0 fixed" : "\xe7\xab\xa0") + "</a></dd>";
+        }
+        return html + "</dl></div></body></html>";
+    }
+
+    std::string ETag(void) const
+    {
+        return "\"v" + std::to_string(version) + "\"";
+    }
+};
+
+// the response of the stand-in to a request with the given extra header
+struct response_t
+{
+    int status;
+    std::string body;
+    std::string etag;
+    http_header_t headers[2];
+};
+
+static void Serve(const site_t &site, const char *extraheader, response_t &res, request_result_t &result)
+{
+    std::string match = "If-None-Match: " + site.ETag() + "\r\n";
+
+    memset(&result, 0, sizeof(result));
+    res.etag = " " + site.ETag();
+    res.headers[0].name = (char *)"Content-Type";
+    res.headers[0].value = (char *)"text/html";
+    res.headers[0].next = &res.headers[1];
+    res.headers[1].name = (char *)"etag";
+    res.headers[1].value = (char *)res.etag.c_str();
+    res.headers[1].next = NULL;
+    if (site.validators && strstr(extraheader, match.c_str()))
+    {
+        res.status = 304;
+        res.body.clear();
+    }
+    else
+    {
+        res.status = 200;
+        res.body = site.Page();
+    }
+    result.header = res.headers;
+    result.status_code = res.status;
+    result.body = (char *)res.body.c_str();
+    result.bodylen = (int)res.body.size();
+}
+
+// what the book keeps between checks
+struct book_t
+{
+    std::vector<std::string> titles;
+    std::vector<std::string> urls;
+    ol_toc_t toc;
+};
+
+typedef enum check_t
+{
+    check_304,
+    check_same_page,
+    check_same_list,
+    check_tail,
+    check_full
+} check_t;
+
+// one update check the way GetChaptersCompleter takes it
+static check_t Check(book_t &book, const site_t &site)
+{
+    std::vector<std::string> titles, urls;
+    html_query_t queries[2];
+    request_result_t result;
+    response_t res;
+    char extraheader[256] = { 0 };
+    ol_toc_t toc;
+    LONG stop = FALSE;
+    int first;
+
+    if (book.toc.count > 0 && book.toc.count == book.urls.size())
+        toc_request_header(&book.toc, extraheader);
+    Serve(site, extraheader, res, result);
+    if (result.status_code == 304)
+        return check_304;
+    if (toc_read_page(&book.toc, &result, &toc))
+    {
+        memcpy(&book.toc, &toc, sizeof(toc));
+        return check_same_page;
+    }
+
+    queries[0].xpath = TITLE_XPATH;
+    queries[0].value = &titles;
+    queries[0].clear = FALSE;
+    queries[1].xpath = URL_XPATH;
+    queries[1].value = &urls;
+    queries[1].clear = FALSE;
+    HtmlParser::Instance()->HtmlParseByXpaths(result.body, result.bodylen, queries, 2, &stop);
+    CHECK(!urls.empty() && urls.size() == titles.size());
+
+    first = toc_new_entries(&book.toc, titles, urls, &toc);
+    if (book.toc.count > 0 && first == (int)urls.size())
+    {
+        memcpy(&book.toc, &toc, sizeof(toc));
+        return check_same_list;
+    }
+    memcpy(&book.toc, &toc, sizeof(toc));
+    if (first > 0)
+    {
+        // ApplyChapters takes a tail only where the book ends
+        CHECK_EQ(first, book.urls.size());
+        book.titles.insert(book.titles.end(), titles.begin() + first, titles.end());
+        book.urls.insert(book.urls.end(), urls.begin() + first, urls.end());
+        return check_tail;
+    }
+    book.titles = titles;
+    book.urls = urls;
+    return check_full;
+}
+
+static BOOL Matches(const book_t &book, const site_t &site)
+{
+    std::vector<std::string> titles, urls;
+    std::string page = site.Page();
+    LONG stop = FALSE;
+
+    HtmlParser::Instance()->HtmlParseByXpath(page.c_str(), (int)page.size(), TITLE_XPATH, titles, &stop);
+    HtmlParser::Instance()->HtmlParseByXpath(page.c_str(), (int)page.size(), URL_XPATH, urls, &stop);
+    return titles == book.titles && urls == book.urls;
+}
+
+static void TestUpdateChecks(void)
+{
+    site_t site = { 100, -1, 0, TRUE, 0 };
+    book_t book;
+    int validators;
+
+    for (validators = 1; validators >= 0; validators--)
+    {
+        site.chapters = 100;
+        site.renamed = -1;
+        site.validators = validators;
+        memset(&book.toc, 0, sizeof(book.toc));
+        book.titles.clear();
+        book.urls.clear();
+
+        CHECK_EQ(Check(book, site), check_full);
+        CHECK(Matches(book, site));
+        CHECK(0 == strcmp(book.toc.etag, site.ETag().c_str()));
+
+        // nothing changed, the server answers 304 or sends the same bytes
+        CHECK_EQ(Check(book, site), validators ? check_304 : check_same_page);
+
+        // the ad turned, the list is the same
+        site.ad++;
+        site.version++;
+        CHECK_EQ(Check(book, site), check_same_list);
+        CHECK_EQ(Check(book, site), validators ? check_304 : check_same_page);
+
+        // new chapters at the end, only they are taken
+        site.chapters += 3;
+        site.version++;
+        CHECK_EQ(Check(book, site), check_tail);
+        CHECK_EQ(book.urls.size(), 103);
+        CHECK(Matches(book, site));
+        CHECK_EQ(Check(book, site), validators ? check_304 : check_same_page);
+
+        // an old chapter renamed, the list is taken again
+        site.renamed = 10;
+        site.chapters++;
+        site.version++;
+        CHECK_EQ(Check(book, site), check_full);
+        CHECK(Matches(book, site));
+        CHECK_EQ(Check(book, site), validators ? check_304 : check_same_page);
+    }
+}
+
+static void TestRequestHeader(void)
+{
+    char header[256];
+    ol_toc_t toc;
+    http_header_t headers[2];
+    request_result_t result;
+    std::string body = "<html></html>";
+    std::string longtag(200, 'x');
+
+    memset(&toc, 0, sizeof(toc));
+    toc_request_header(&toc, header);
+    CHECK_EQ(header[0], 0);
+
+    // the longest validators the header keeps still fit
+    memset(toc.etag, 'e', sizeof(toc.etag) - 1);
+    memset(toc.last_modified, 'm', sizeof(toc.last_modified) - 1);
+    toc_request_header(&toc, header);
+    CHECK(strlen(header) < sizeof(header));
+    CHECK(strstr(header, "If-None-Match: eee") == header);
+    CHECK(strstr(header, "\r\nIf-Modified-Since: mmm") != NULL);
+
+    // a name in any case, a value too long to keep is dropped
+    headers[0].name = (char *)"LAST-MODIFIED";
+    headers[0].value = (char *)"\t Wed, 21 Oct 2026 07:28:00 GMT";
+    headers[0].next = &headers[1];
+    headers[1].name = (char *)"ETag";
+    headers[1].value = (char *)longtag.c_str();
+    headers[1].next = NULL;
+    memset(&result, 0, sizeof(result));
+    result.header = headers;
+    result.status_code = 200;
+    result.body = (char *)body.c_str();
+    result.bodylen = (int)body.size();
+    memset(&toc, 0, sizeof(toc));
+    CHECK(!toc_read_page(&toc, &result, &toc));
+    CHECK(0 == strcmp(toc.last_modified, "Wed, 21 Oct 2026 07:28:00 GMT"));
+    CHECK_EQ(toc.etag[0], 0);
+}
+
+static void TestPagePattern(void)
+{
+    // first url, second url, the url of the third page or NULL where refused
+    static const char *cases[][3] = {
+        { "http://a.com/b/1/list.html", "http://a.com/b/1/list_2.html", "http://a.com/b/1/list_3.html" },
+        { "http://a.com/b/1/list_1.html", "http://a.com/b/1/list_2.html", "http://a.com/b/1/list_3.html" },
+        { "/b/1/index_9.html", "/b/1/index_10.html", "/b/1/index_11.html" },
+        { "/b/1/?page=1", "/b/1/?page=2", "/b/1/?page=3" },
+        { "/b/2/list.html", "/b/3/list.html", "/b/4/list.html" },
+        { "/b/1/list.html", "/b/1/list-p2.html", "/b/1/list-p3.html" },
+        { "/b/1/list_1.html", "/b/1/list_3.html", NULL },
+        { "/b/1/list_01.html", "/b/1/list_02.html", NULL },
+        { "/b/1/list_1.html", "/b/1/list_p2.html", NULL },
+        { "/b/1/list.html", "/b/1/list_02.html", NULL },
+        { "/b/1/list.html", "/b/1/more.html", NULL },
+        { "/b/1/list.html", "/b/1/list.html", NULL },
+        { "/b/1/list.html", "/b/1/list_2a.html", NULL },
+        { "/b/1/list.html", "/b/1/list_of_the_whole_book_2.html", NULL },
+        { "/b/1/", "/b/1/2/", NULL },
+    };
+    toc_pattern_t pattern;
+    std::string prefix(1100, 'x');
+    char url[2048];
+    size_t i;
+
+    for (i = 0; i < sizeof(cases) / sizeof(cases[0]); i++)
+    {
+        if (!cases[i][2])
+        {
+            CHECK(!toc_parse_pattern(cases[i][0], cases[i][1], &pattern));
+            continue;
+        }
+        CHECK(toc_parse_pattern(cases[i][0], cases[i][1], &pattern));
+        toc_page_url(&pattern, 1, url);
+        CHECK(0 == strcmp(url, cases[i][1]));
+        toc_page_url(&pattern, 2, url);
+        if (strcmp(url, cases[i][2]))
+        {
+            fprintf(stderr, "%s, %s: %s\n", cases[i][0], cases[i][1], url);
+            CHECK(FALSE);
+        }
+    }
+
+    // a url that does not fit the pattern is refused
+    CHECK(!toc_parse_pattern((prefix + "/list.html").c_str(), (prefix + "/list_2.html").c_str(), &pattern));
+}
+
+static void BenchUnchangedCheck(void)
+{
+    site_t site = { 3000, -1, 0, FALSE, 0 };
+    book_t book;
+    double begin, page, list;
+    int round;
+
+    memset(&book.toc, 0, sizeof(book.toc));
+    CHECK_EQ(Check(book, site), check_full);
+
+    begin = test_now();
+    for (round = 0; round < 50; round++)
+        CHECK_EQ(Check(book, site), check_same_page);
+    page = (test_now() - begin) / 50;
+
+    begin = test_now();
+    for (round = 0; round < 50; round++)
+    {
+        site.ad++;
+        CHECK_EQ(Check(book, site), check_same_list);
+    }
+    list = (test_now() - begin) / 50;
+
+    printf("BENCH update check, %d chapters: same page %.3f ms, same list %.3f ms\n", site.chapters, page * 1000, list * 1000);
+}
+
+int main()
+{
+    RUN_TEST(TestUpdateChecks);
+    RUN_TEST(TestRequestHeader);
+    RUN_TEST(TestPagePattern);
+    RUN_TEST(BenchUnchangedCheck);
+    HtmlParser::ReleaseInstance();
+    return test_result();
+}
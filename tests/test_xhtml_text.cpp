@@ -0,0 +1,213 @@
+#include "test.h"
+#include "XhtmlText.h"
+#include "InlineImage.h"
+#include "libxml/HTMLparser.h"
+#include "libxml/xpath.h"
+#include <string>
+#include <vector>
+
+// the body text the book gets, as UTF-16 code units
+static std::wstring Body(const std::string &html, std::wstring *heading = NULL, std::wstring *title = NULL)
+{
+    XhtmlText xt;
+    std::wstring text;
+    wchar_t *buf;
+    int len = 0;
+    LONG stop = FALSE;
+
+    CHECK(xt.Parse(html.c_str(), (int)html.size(), &stop));
+    buf = xt.Detach(&len);
+    if (buf)
+    {
+        CHECK_EQ(buf[len], 0);
+        text.assign(buf, len);
+        free(buf);
+    }
+    if (heading)
+        *heading = xt.GetHeading();
+    if (title)
+        *title = xt.GetTitle();
+    return text;
+}
+
+static std::wstring Page(const std::string &body)
+{
+    return Body("<html><head><title>t</title></head><body>" + body + "</body></html>");
+}
+
+static void TestLines(void)
+{
+    // blocks end a line, inline elements do not
+    CHECK(Page("<p>one <b>two</b></p><p>three</p>") == L"one two\nthree\n");
+    CHECK(Page("<div><div>a</div>b</div>c") == L"a\nb\nc\n");
+
+    // whitespace collapsed, blanks around a line dropped
+    CHECK(Page("<p>  a \n\t b  </p>\n\n<p> c </p>") == L"a b\nc\n");
+
+    // a <br> breaks a line, more of them keep one blank line, never at the top
+    CHECK(Page("<br><br>a<br>b<br><br><br><br>c") == L"a\nb\n\nc\n");
+
+    // newlines kept in <pre>, one blank line at most
+    CHECK(Page("<pre>x  y\n\n\n\nz</pre>w") == L"x  y\n\nz\nw\n");
+
+    // cells of a row on one line
+    CHECK(Page("<table><tr><td>a</td><td>b</td></tr><tr><th>c</th><td>d</td></tr></table>") == L"a b\nc d\n");
+
+    // scripts and styles, and the head, are not text
+    CHECK(Page("<script>var a = '<p>x</p>';</script>a<style>p { }</style>b") == L"ab\n");
+
+    // an indent longer than FormatText keeps is cut the same way
+    CHECK(Page("<p>&nbsp;&nbsp;&nbsp;&nbsp;&nbsp;&nbsp;a</p>") == L"    a\n");
+    CHECK(Page("<p>\xe3\x80\x80\xe3\x80\x80\xe3\x80\x80\xe3\x80\x80" "b</p>") == L"\x3000\x3000" L"b\n");
+    CHECK(Page("<p>\xe3\x80\x80\xe3\x80\x80" "c</p>") == L"\x3000\x3000" L"c\n");
+
+    CHECK(Page("<p> </p><div>\n</div>").empty());
+}
+
+static void TestCharacters(void)
+{
+    // entities, a character outside the BMP as two units, the image characters replaced
+    CHECK(Page("a&amp;b&lt;&#x4e2d;") == L"a&b<\x4e2d\n");
+    CHECK(Page("\xf0\x9f\x98\x80") == std::wstring(L"\xd83d\xde00\n"));
+    CHECK(Page("\xee\x80\x81x") == L"\xfffdx\n");
+
+    // a page in another charset is decoded the way htmlReadMemory does it
+    CHECK(Body("<html><head><meta http-equiv=\"Content-Type\" content=\"text/html; charset=iso-8859-1\"></head>"
+        "<body>caf\xe9</body></html>") == L"caf\xe9\n");
+}
+
+static void TestHeadingAndTitle(void)
+{
+    std::wstring heading, title;
+
+    Body("<html><head><title>\n  Book \t title </title></head><body><h4>no</h4>"
+        "<h2>Chapter <i>one</i>\n\n  begins</h2><h1>second</h1>text</body></html>", &heading, &title);
+    CHECK(heading == L"Chapter one begins");
+    CHECK(title == L"Book title");
+
+    // a <title> in the body is text, not the title
+    CHECK(Body("<html><body><title>x</title></body></html>", &heading, &title) == L"x\n");
+    CHECK(heading.empty());
+}
+
+static int ImageId(void *arg, const char *src)
+{
+    std::vector<std::string> *images = (std::vector<std::string> *)arg;
+    size_t i;
+
+    for (i = 0; i < images->size(); i++)
+    {
+        if ((*images)[i] == src)
+            return (int)i;
+    }
+    return -1;
+}
+
+static void TestImages(void)
+{
+    std::vector<std::string> images = { "a.jpg", "b.png" };
+    std::string html = "<html><body><p>x<img src=\"a.jpg\">y</p><img src=\"missing.jpg\">"
+        "<svg><image xlink:href=\"b.png\"/></svg>z<img></body></html>";
+    XhtmlText xt;
+    wchar_t *text;
+    int len = 0;
+    LONG stop = FALSE;
+
+    // an image is a line of its own
+    xt.SetImageCallback(ImageId, &images);
+    CHECK(xt.Parse(html.c_str(), (int)html.size(), &stop));
+    text = xt.Detach(&len);
+    CHECK(text && std::wstring(text, len) == std::wstring(L"x\n") + (wchar_t)INLINE_IMAGE_BASE + L"\ny\n"
+        + (wchar_t)(INLINE_IMAGE_BASE + 1) + L"\nz\n");
+    free(text);
+
+    // without a callback they are left out
+    CHECK(Body(html) == L"xy\nz\n");
+}
+
+static void TestStopAndEmpty(void)
+{
+    std::string html = "<html><body><p>a</p><p>b</p></body></html>";
+    XhtmlText xt;
+    int len = 1;
+    LONG stop = TRUE;
+
+    CHECK(!xt.Parse(html.c_str(), (int)html.size(), &stop));
+    CHECK(!xt.Parse("", 0, NULL));
+    CHECK(xt.Detach(&len) == NULL);
+    CHECK_EQ(len, 0);
+    CHECK(Body("<html><head><title>only</title></head><body></body></html>").empty());
+}
+
+// what ParserOps did before: a tree, an xpath for the body and a copy of its content
+static size_t DomBody(const std::string &html)
+{
+    htmlDocPtr doc;
+    xmlXPathContextPtr ctx;
+    xmlXPathObjectPtr obj;
+    xmlChar *value;
+    size_t size = 0;
+
+    doc = htmlReadMemory(html.c_str(), (int)html.size(), NULL, NULL, HTML_PARSE_RECOVER | HTML_PARSE_NOERROR | HTML_PARSE_NOWARNING);
+    ctx = xmlXPathNewContext(doc);
+    obj = xmlXPathEvalExpression(BAD_CAST "//*[local-name()='body']", ctx);
+    if (obj && !xmlXPathNodeSetIsEmpty(obj->nodesetval))
+    {
+        value = xmlNodeGetContent(obj->nodesetval->nodeTab[0]);
+        size = strlen((const char *)value);
+        xmlFree(value);
+    }
+    xmlXPathFreeObject(obj);
+    xmlXPathFreeContext(ctx);
+    xmlFreeDoc(doc);
+    return size;
+}
+
+static void BenchChapter(void)
+{
+    std::string html = "<?xml version=\"1.0\" encoding=\"utf-8\"?><html xmlns=\"http://www.w3.org/1999/xhtml\">"
+        "<head><title>\xe7\xac\xac\xe4\xb8\x80\xe7\xab\xa0</title></head><body><h2>\xe7\xac\xac\xe4\xb8\x80\xe7\xab\xa0</h2>\n";
+    double begin, seconds, bytes;
+    int i, j, round, rounds = 20;
+
+    for (i = 0; i < 5000; i++)
+    {
+        html += "<p class=\"p\">\xe3\x80\x80\xe3\x80\x80";
+        for (j = 0; j < 30; j++)
+            html += "\xe6\x96\x87\xe5\xad\x97";
+        html += i % 10 ? "</p>\n" : "<span>\xe6\xb3\xa8</span>, <i>x</i></p>\n";
+    }
+    html += "</body></html>";
+
+    bytes = 0;
+    begin = test_now();
+    for (round = 0; round < rounds; round++)
+    {
+        CHECK(Body(html).size() > 5000 * 62);
+        bytes += html.size();
+    }
+    seconds = test_now() - begin;
+    bench_report("epub chapter, one sax walk", bytes, seconds);
+
+    bytes = 0;
+    begin = test_now();
+    for (round = 0; round < rounds; round++)
+    {
+        CHECK(DomBody(html) > 0);
+        bytes += html.size();
+    }
+    seconds = test_now() - begin;
+    // still without the utf-8 check, DecodeText and FormatText it went on to
+    bench_report("epub chapter, tree and xpath copy", bytes, seconds);
+}
+
+int main()
+{
+    RUN_TEST(TestLines);
+    RUN_TEST(TestCharacters);
+    RUN_TEST(TestHeadingAndTitle);
+    RUN_TEST(TestImages);
+    RUN_TEST(TestStopAndEmpty);
+    RUN_TEST(BenchChapter);
+    return test_result();
+}
@@ -0,0 +1,328 @@
+#include "test.h"
+#include "framework.h"
+#include "HtmlParser.h"
+#include "XpathStream.h"
+#include "libxml/xmlerror.h"
+#include <string>
+#include <vector>
+
+static std::vector<std::string> Dom(const std::string &html, const char *xpath)
+{
+    std::vector<std::string> values;
+    LONG stop = FALSE;
+
+    HtmlParser::Instance()->HtmlParseByXpath(html.c_str(), (int)html.size(), xpath, values, &stop);
+    return values;
+}
+
+static std::vector<std::string> Stream(const std::string &html, const char *xpath)
+{
+    std::vector<std::string> values;
+    XpathStream stream;
+    LONG stop = FALSE;
+
+    CHECK(stream.Add(xpath, &values));
+    CHECK_EQ(stream.Run(html.c_str(), (int)html.size(), &stop), 0);
+    return values;
+}
+
+static BOOL Same(const std::string &html, const char *xpath)
+{
+    std::vector<std::string> expect = Dom(html, xpath);
+    std::vector<std::string> got = Stream(html, xpath);
+    size_t i;
+
+    if (got == expect)
+        return TRUE;
+    fprintf(stderr, "%s: %d values, the tree gives %d\n", xpath, (int)got.size(), (int)expect.size());
+    for (i = 0; i < got.size() || i < expect.size(); i++)
+    {
+        fprintf(stderr, "  [%d] '%s' | '%s'\n", (int)i,
+            i < got.size() ? got[i].c_str() : "-", i < expect.size() ? expect[i].c_str() : "-");
+    }
+    fprintf(stderr, "  in: %s\n", html.c_str());
+    return FALSE;
+}
+
+// a chapter list as the book sites serve it: implied ends, entities, a script
+static std::string MakeChapterList(int chapters)
+{
+    std::string html;
+    int i;
+
+    html = "<!DOCTYPE html><html><head><meta charset=\"utf-8\"><title>\xe7\x9b\xae\xe5\xbd\x95</title>"
+        "<script>if (a < b && c > d) document.write('<div id=\"list\">');</script>"
+        "<style>dd > a { color: red }</style></head><body>"
+        "<div class=\"header\"><h1>\xe4\xb9\xa6\xe5\x90\x8d <small>\xe4\xbd\x9c\xe8\x80\x85</small> &amp; \xe6\xa0\x87\xe9\xa2\x98</h1></div>"
+        "<div class=\"listmain\" id=\"list\"><dl><dt>\xe6\x9c\x80\xe6\x96\xb0\xe7\xab\xa0\xe8\x8a\x82\n";
+    for (i = 0; i < chapters; i++)
+    {
+        html += "<dd><a href=\"/b/1/" + std::to_string(i + 1) + ".html\" title='c" + std::to_string(i) + "'>"
+            "\xe7\xac\xac" + std::to_string(i + 1) + "\xe7\xab\xa0 <b>x</b>&nbsp;y</a></dd>\n";
+        if (i % 100 == 99)
+            html += "<!-- ad --><dt>\xe5\x88\x86\xe5\x8d\xb7 " + std::to_string(i / 100) + "\n";
+    }
+    html += "</dl></div><div id=\"content\"><p>one<p>two<br>three</div>"
+        "<ul><li class=\"book-item\"><a href=\"/x\">x</a><li class=\"book-item other\"><a href=\"/y\">y</a></ul>"
+        "<input type=checkbox checked><div class=result_title><a href=/z>z</a></div></body></html>";
+    return html;
+}
+
+static void TestBookSourcePaths(void)
+{
+    // the paths of the sources in bs.json and the ones in the request
+    static const char *xpaths[] = {
+        "//div[@id='content']",
+        "//dd/a/@href",
+        "//h1/text()",
+        "//*[@id=\"list\"]/dl/dd/a",
+        "//*[@id=\"list\"]/dl/dd/a/@href",
+        "//div[@class='listmain']/dl/dd/a",
+        "//div[@class='listmain']/dl/dd/a/@title",
+        "//li[@class='book-item']/a",
+        "//li[@class='book-item']/a/@href",
+        "//div[@class='result_title']/a/@href",
+        "//*[@id=\"content\"]/p",
+        "//p/text()",
+        "/html/body/div/h1",
+        "//dt/text()",
+        "//input/@checked",
+        "//script",
+        "//*[@id='list'][@class='listmain']//a/@href",
+        "//dl//b/text()",
+        "//nothing/@href",
+    };
+    std::string html = MakeChapterList(250);
+    size_t i;
+
+    for (i = 0; i < sizeof(xpaths) / sizeof(xpaths[0]); i++)
+        CHECK(Same(html, xpaths[i]));
+}
+
+static void TestRefusesOthers(void)
+{
+    static const char *xpaths[] = {
+        "//dd/a[1]",
+        "//div[contains(@class,'x')]",
+        "count(//a)",
+        "//a/..",
+        "//dd//@href",
+        "dd/a",
+        "//a/@href/text()",
+        "//svg:path",
+        "//a | //b",
+        "//a[@href]",
+        "",
+    };
+    std::vector<std::string> values;
+    XpathStream stream;
+    size_t i;
+
+    for (i = 0; i < sizeof(xpaths) / sizeof(xpaths[0]); i++)
+        CHECK(!stream.Add(xpaths[i], &values));
+}
+
+// random markup over few names, where the tree and the events may part
+static std::string RandomHtml(unsigned &seed, int nodes)
+{
+    static const char *tags[] = { "div", "p", "a", "dd", "dl", "span", "h1", "li", "ul", "b" };
+    static const char *texts[] = { "t", " ", "&amp;", "&nbsp;x", "\xe4\xb8\xad", "a<b", "\n" };
+    static const char *ids[] = { "a", "b", "content" };
+    std::vector<int> open;
+    std::string html = "<html><body>";
+    int i, kind;
+
+    for (i = 0; i < nodes; i++)
+    {
+        seed = seed * 1103515245 + 12345;
+        kind = (seed >> 16) % 10;
+        if (kind < 4)
+        {
+            open.push_back((seed >> 8) % 10);
+            html += "<";
+            html += tags[open.back()];
+            if ((seed >> 20) % 3 == 0)
+                html += std::string(" id=\"") + ids[(seed >> 22) % 3] + "\"";
+            if ((seed >> 24) % 3 == 0)
+                html += std::string(" class='") + ids[(seed >> 26) % 3] + "'";
+            if ((seed >> 28) % 4 == 0)
+                html += " href=/h" + std::to_string(i);
+            html += ">";
+        }
+        else if (kind < 7)
+        {
+            html += texts[(seed >> 8) % 7];
+        }
+        else if (kind < 9)
+        {
+            // closes the last open one, or one that is not open at all
+            if (!open.empty() && (seed >> 8) % 5)
+            {
+                html += std::string("</") + tags[open.back()] + ">";
+                open.pop_back();
+            }
+            else
+            {
+                html += std::string("</") + tags[(seed >> 12) % 10] + ">";
+            }
+        }
+        else
+        {
+            html += (seed >> 8) % 2 ? "<br>" : "<!--c-->";
+        }
+    }
+    return html;
+}
+
+static std::string RandomXpath(unsigned &seed)
+{
+    static const char *names[] = { "div", "p", "a", "dd", "dl", "span", "*" };
+    static const char *ids[] = { "a", "b", "content" };
+    std::string xpath;
+    int i, steps;
+
+    seed = seed * 1103515245 + 12345;
+    steps = 1 + (seed >> 16) % 3;
+    for (i = 0; i < steps; i++)
+    {
+        seed = seed * 1103515245 + 12345;
+        xpath += (i == 0 || (seed >> 16) % 2) ? "//" : "/";
+        xpath += names[(seed >> 18) % 7];
+        if ((seed >> 22) % 4 == 0)
+            xpath += std::string("[@id='") + ids[(seed >> 24) % 3] + "']";
+        if ((seed >> 26) % 5 == 0)
+            xpath += std::string("[@class=\"") + ids[(seed >> 28) % 3] + "\"]";
+    }
+    seed = seed * 1103515245 + 12345;
+    switch ((seed >> 16) % 4)
+    {
+    case 0:
+        xpath += "/text()";
+        break;
+    case 1:
+        xpath += "/@href";
+        break;
+    }
+    return xpath;
+}
+
+static void TestRandomAgainstDom(void)
+{
+    std::string html, xpath;
+    unsigned seed = 4242;
+    int round;
+
+    for (round = 0; round < 3000; round++)
+    {
+        html = RandomHtml(seed, 5 + round % 60);
+        xpath = RandomXpath(seed);
+        if (!Same(html, xpath.c_str()))
+        {
+            fprintf(stderr, "round %d\n", round);
+            CHECK(FALSE);
+            break;
+        }
+    }
+}
+
+static void TestQueriesOverOneParse(void)
+{
+    std::string html = MakeChapterList(50);
+    std::vector<std::string> titles, urls, content, expect;
+    html_query_t queries[3];
+    LONG stop = FALSE;
+
+    queries[0].xpath = "//dd/a";
+    queries[0].value = &titles;
+    queries[0].clear = TRUE;
+    queries[1].xpath = "//dd/a/@href";
+    queries[1].value = &urls;
+    queries[1].clear = FALSE;
+    queries[2].xpath = "//*[@id='content']";
+    queries[2].value = &content;
+    queries[2].clear = FALSE;
+    CHECK_EQ(HtmlParser::Instance()->HtmlParseByXpaths(html.c_str(), (int)html.size(), queries, 3, &stop), 0);
+    HtmlParser::Instance()->HtmlParseByXpath(html.c_str(), (int)html.size(), "//dd/a", expect, &stop, TRUE);
+    CHECK(titles == expect);
+    CHECK(urls == Dom(html, "//dd/a/@href"));
+    CHECK(content == Dom(html, "//*[@id='content']"));
+
+    // one of them out of the subset, all of them go to the tree
+    titles.clear();
+    urls.clear();
+    content.clear();
+    queries[2].xpath = "//*[@id='content']/p[2]";
+    CHECK_EQ(HtmlParser::Instance()->HtmlParseByXpaths(html.c_str(), (int)html.size(), queries, 3, &stop), 0);
+    CHECK(titles == expect);
+    CHECK(urls == Dom(html, "//dd/a/@href"));
+    CHECK_EQ(content.size(), 1);
+
+    stop = TRUE;
+    queries[2].xpath = "//*[@id='content']";
+    CHECK_EQ(HtmlParser::Instance()->HtmlParseByXpaths(html.c_str(), (int)html.size(), queries, 3, &stop), 1);
+}
+
+static void BenchChapterList(void)
+{
+    std::string html = MakeChapterList(3000);
+    std::vector<std::string> titles, urls;
+    html_query_t queries[2];
+    void *doc, *ctx;
+    double begin, seconds, bytes = 0;
+    LONG stop = FALSE;
+    int round;
+
+    queries[0].xpath = "//div[@class='listmain']/dl/dd/a";
+    queries[0].value = &titles;
+    queries[0].clear = TRUE;
+    queries[1].xpath = "//div[@class='listmain']/dl/dd/a/@href";
+    queries[1].value = &urls;
+    queries[1].clear = FALSE;
+
+    begin = test_now();
+    for (round = 0; round < 50; round++)
+    {
+        titles.clear();
+        urls.clear();
+        HtmlParser::Instance()->HtmlParseByXpaths(html.c_str(), (int)html.size(), queries, 2, &stop);
+        bytes += html.size();
+    }
+    seconds = test_now() - begin;
+    CHECK_EQ(titles.size(), 3000);
+    bench_report("chapter list, streamed", bytes, seconds);
+
+    bytes = 0;
+    begin = test_now();
+    for (round = 0; round < 50; round++)
+    {
+        titles.clear();
+        urls.clear();
+        HtmlParser::Instance()->HtmlParseBegin(html.c_str(), (int)html.size(), &doc, &ctx, &stop);
+        HtmlParser::Instance()->HtmlParseByXpath(doc, ctx, queries[0].xpath, titles, &stop, TRUE);
+        HtmlParser::Instance()->HtmlParseByXpath(doc, ctx, queries[1].xpath, urls, &stop);
+        HtmlParser::Instance()->HtmlParseEnd(doc, ctx);
+        bytes += html.size();
+    }
+    seconds = test_now() - begin;
+    CHECK_EQ(titles.size(), 3000);
+    bench_report("chapter list, tree and xpath", bytes, seconds);
+}
+
+// the tree path reports every repaired tag, the random markup has plenty
+static void Quiet(void *ctx, const char *msg, ...)
+{
+    (void)ctx;
+    (void)msg;
+}
+
+int main()
+{
+    xmlSetGenericErrorFunc(NULL, Quiet);
+    RUN_TEST(TestBookSourcePaths);
+    RUN_TEST(TestRefusesOthers);
+    RUN_TEST(TestRandomAgainstDom);
+    RUN_TEST(TestQueriesOverOneParse);
+    RUN_TEST(BenchChapterList);
+    HtmlParser::ReleaseInstance();
+    return test_result();
+}